@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include "ntp_adev.h"
+
+/**
+ * ntp-adev - Allan deviation of a clock from its offset logs.
+ *
+ * Reads offsets from ntpd-style loopstats or peerstats files (as
+ * ntp-clock --statsdir writes them) or from ntp-replay --samples CSV, in
+ * any order and mixed, and prints the overlapping and modified Allan
+ * deviation at every octave of the sampling interval. Offsets are put on
+ * an even grid of that interval (the median spacing, unless given), and
+ * gaps in the log are filled in by linear interpolation.
+ *
+ * Usage: ntp-adev [--peer=ADDR] [--tau0=SEC] log...
+ */
+
+#define MAX_POINTS 64
+#define MJD_UNIX_EPOCH 40587
+
+typedef struct {
+    double time;                  /* Unix seconds */
+    int64_t offset_ns;
+} offset_sample_t;
+
+static offset_sample_t *samples;
+static size_t sample_count;
+static size_t sample_slots;
+
+static const char *peer_filter = NULL;
+static char first_peer[64] = "";
+static bool several_peers = false;
+
+static bool add_sample(double time, double offset_ns, const char *peer)
+{
+    if (peer != NULL)
+    {
+        if (peer_filter != NULL && strcmp(peer, peer_filter) != 0) return true;
+        if (first_peer[0] == '\0') snprintf(first_peer, sizeof(first_peer), "%s", peer);
+        else if (strcmp(peer, first_peer) != 0) several_peers = true;
+    }
+    if (sample_count == sample_slots)
+    {
+        size_t slots = sample_slots ? sample_slots * 2 : 65536;
+        offset_sample_t *grown = realloc(samples, slots * sizeof(*samples));
+        if (grown == NULL) return false;
+        samples = grown;
+        sample_slots = slots;
+    }
+    samples[sample_count].time = time;
+    samples[sample_count].offset_ns = (int64_t)llround(offset_ns);
+    sample_count++;
+    return true;
+}
+
+// One line of loopstats, peerstats or ntp-replay CSV; anything else is skipped
+static bool parse_line(const char *line)
+{
+    long mjd;
+    double seconds, offset, a, b, c, d;
+    char peer[64], status[16];
+
+    if (strchr(line, ',') != NULL)
+    {
+        // time,server,port,status,offset_ns,...
+        char server[64], result[16];
+        unsigned port;
+        if (sscanf(line, "%lf,%63[^,],%u,%15[^,],%lf", &seconds, server, &port, result, &offset) == 5 &&
+            strcmp(result, "ok") == 0)
+        {
+            return add_sample(seconds, offset, server);
+        }
+        return true;
+    }
+
+    int n = sscanf(line, "%ld %lf %63s %15s %lf %lf %lf %lf", &mjd, &seconds, peer, status, &offset, &a, &b, &c);
+    if (n == 8)
+    {
+        return add_sample((double)(mjd - MJD_UNIX_EPOCH) * 86400 + seconds, offset * 1e9, peer);
+    }
+    n = sscanf(line, "%ld %lf %lf %lf %lf %lf %lf", &mjd, &seconds, &offset, &a, &b, &c, &d);
+    if (n == 7)
+    {
+        return add_sample((double)(mjd - MJD_UNIX_EPOCH) * 86400 + seconds, offset * 1e9, NULL);
+    }
+    return true;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    double x = ((const offset_sample_t *)a)->time;
+    double y = ((const offset_sample_t *)b)->time;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Median spacing of the sorted samples
+static double median_interval(void)
+{
+    double *gaps = malloc((sample_count - 1) * sizeof(*gaps));
+    if (gaps == NULL) return 0;
+    size_t n = 0;
+    for (size_t i = 1; i < sample_count; i++)
+    {
+        if (samples[i].time > samples[i - 1].time) gaps[n++] = samples[i].time - samples[i - 1].time;
+    }
+    double median = 0;
+    if (n > 0)
+    {
+        qsort(gaps, n, sizeof(*gaps), compare_doubles);
+        median = gaps[n / 2];
+    }
+    free(gaps);
+    return median;
+}
+
+// The offsets on a grid tau0 apart, interpolated between the samples
+// either side of each point
+static int64_t *grid_offsets(double tau0, size_t *count, size_t *filled)
+{
+    double start = samples[0].time;
+    size_t n = (size_t)((samples[sample_count - 1].time - start) / tau0 + 0.5) + 1;
+    int64_t *phase = malloc(n * sizeof(*phase));
+    if (phase == NULL) return NULL;
+
+    size_t j = 0;
+    *filled = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        double t = start + i * tau0;
+        while (j + 1 < sample_count && samples[j + 1].time <= t) j++;
+        const offset_sample_t *a = &samples[j];
+        const offset_sample_t *b = j + 1 < sample_count ? &samples[j + 1] : a;
+        // A sample within half an interval of the point stands for it
+        if (fabs(a->time - t) <= tau0 / 2) phase[i] = a->offset_ns;
+        else if (fabs(b->time - t) <= tau0 / 2) phase[i] = b->offset_ns;
+        else
+        {
+            double f = b->time > a->time ? (t - a->time) / (b->time - a->time) : 0;
+            phase[i] = a->offset_ns + (int64_t)llround(f * (double)(b->offset_ns - a->offset_ns));
+            (*filled)++;
+        }
+    }
+    *count = n;
+    return phase;
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] log...\n\n", prog);
+    fprintf(stderr, "Allan deviation (overlapping ADEV and MDEV) of the offsets in loopstats or\n");
+    fprintf(stderr, "peerstats files or ntp-replay --samples output.\n\n");
+    fprintf(stderr, "      --peer=ADDR  Use the offsets from this server only\n");
+    fprintf(stderr, "      --tau0=SEC   Sampling interval (default: the median spacing of the offsets)\n");
+    fprintf(stderr, "  -h, --help       Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "peer", required_argument, NULL, 'p' },
+        { "tau0", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    double tau0 = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            peer_filter = optarg;
+            break;
+        case 't':
+            tau0 = atof(optarg);
+            if (tau0 <= 0)
+            {
+                fprintf(stderr, "Invalid interval: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    double start = monotonic_seconds();
+    char line[512];
+    for (int f = optind; f < argc; f++)
+    {
+        FILE *in = fopen(argv[f], "r");
+        if (in == NULL)
+        {
+            fprintf(stderr, "Cannot read %s: %s\n", argv[f], strerror(errno));
+            return 1;
+        }
+        while (fgets(line, sizeof(line), in) != NULL)
+        {
+            if (!parse_line(line))
+            {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+        fclose(in);
+    }
+    if (several_peers)
+    {
+        fprintf(stderr, "The logs hold offsets from several servers; pick one with --peer\n");
+        return 1;
+    }
+    if (sample_count < 3)
+    {
+        fprintf(stderr, "Too few offsets: %zu\n", sample_count);
+        return 1;
+    }
+
+    qsort(samples, sample_count, sizeof(*samples), compare_samples);
+    if (tau0 == 0) tau0 = median_interval();
+    if (tau0 <= 0)
+    {
+        fprintf(stderr, "The offsets all have the same time\n");
+        return 1;
+    }
+
+    size_t count, filled;
+    int64_t *phase = grid_offsets(tau0, &count, &filled);
+    if (phase == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    ntp_adev_point_t points[MAX_POINTS];
+    size_t n = ntp_adev_compute(phase, count, tau0, points, MAX_POINTS);
+    double elapsed = monotonic_seconds() - start;
+
+    printf("%14s %12s %14s %14s\n", "tau s", "terms", "adev", "mdev");
+    for (size_t i = 0; i < n; i++)
+    {
+        printf("%14.3f %12llu %14.6e ", points[i].tau, (unsigned long long)points[i].terms, points[i].adev);
+        if (isnan(points[i].mdev)) printf("%14s\n", "-");
+        else printf("%14.6e\n", points[i].mdev);
+    }
+    printf("\n%zu offsets, %zu points %.3f s apart (%zu interpolated), lowest ADEV at %.0f s; %.3f s\n",
+           sample_count, count, tau0, filled, ntp_adev_best_tau(points, n), elapsed);
+
+    free(phase);
+    free(samples);
+    return 0;
+}
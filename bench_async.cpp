@@ -0,0 +1,338 @@
+/**
+ * ntp_async.hpp benchmark - thousands of coroutines awaiting ntp::sync()
+ * and ntp::until() on one executor thread, against a mock NTP server on
+ * the loopback interface.
+ *
+ * Usage: ntp-bench-async
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "ntp_async.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);               \
+            fprintf(stderr, __VA_ARGS__);                                      \
+            fprintf(stderr, "\n");                                             \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static const int64_t MOCK_OFFSET_NS = 40000000;    // The mock server runs 40 ms ahead
+
+static int64_t system_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/**
+ * Stratum 2 server on 127.0.0.1 answering from its own thread, optionally
+ * ignoring every drop_every'th request. With drop_every = 1 it never answers.
+ * A spoofing server first answers each request from a second socket, an
+ * hour ahead, as an off-path attacker who guessed the origin would.
+ */
+class mock_server {
+public:
+    explicit mock_server(int drop_every = 0, bool spoof = false) : drop_every_(drop_every)
+    {
+        if (spoof) {
+            spoof_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+            sockaddr_in any = {};
+            any.sin_family = AF_INET;
+            any.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(spoof_fd_, (sockaddr *)&any, sizeof(any));
+        }
+
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        int size = 4 << 20;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        struct timeval tv = {0, 50000};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd_, (sockaddr *)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, (sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~mock_server()
+    {
+        stopping_ = true;
+        thread_.join();
+        close(fd_);
+        if (spoof_fd_ >= 0) close(spoof_fd_);
+    }
+
+    std::string name() const { return "127.0.0.1:" + std::to_string(port_); }
+    uint64_t answered() const { return answered_; }
+
+private:
+    static void put_timestamp(uint32_t *words, int64_t ns)
+    {
+        words[0] = htonl((uint32_t)(ns / 1000000000 + 2208988800LL));
+        words[1] = htonl((uint32_t)(((uint64_t)(ns % 1000000000) << 32) / 1000000000));
+    }
+
+    void serve()
+    {
+        uint32_t packet[12];
+        sockaddr_in from;
+        uint64_t seen = 0;
+
+        while (!stopping_) {
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fd_, packet, sizeof(packet), 0, (sockaddr *)&from, &len);
+            if (n != (ssize_t)sizeof(packet)) continue;
+            int64_t received = system_ns() + MOCK_OFFSET_NS;
+            if (drop_every_ > 0 && ++seen % drop_every_ == 0) continue;
+
+            uint32_t origin[2] = {packet[10], packet[11]};
+            memset(packet, 0, sizeof(packet));
+            packet[0] = htonl((4u << 27) | (4u << 24) | (2u << 16));  // LI 0, version 4, server, stratum 2
+            packet[2] = htonl(1 << 6);                                 // 1 ms root dispersion
+            packet[6] = origin[0];
+            packet[7] = origin[1];
+            put_timestamp(&packet[8], received);
+            if (spoof_fd_ >= 0) {
+                uint32_t spoofed[12];
+                memcpy(spoofed, packet, sizeof(spoofed));
+                put_timestamp(&spoofed[8], received + 3600000000000LL);
+                put_timestamp(&spoofed[10], system_ns() + MOCK_OFFSET_NS + 3600000000000LL);
+                sendto(spoof_fd_, spoofed, sizeof(spoofed), 0, (sockaddr *)&from, len);
+            }
+            put_timestamp(&packet[10], system_ns() + MOCK_OFFSET_NS);
+            sendto(fd_, packet, sizeof(packet), 0, (sockaddr *)&from, len);
+            answered_++;
+        }
+    }
+
+    int fd_;
+    int spoof_fd_ = -1;
+    uint16_t port_;
+    int drop_every_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> answered_{0};
+    std::thread thread_;
+};
+
+static double percentile(std::vector<int64_t> v, double p)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = (size_t)(p * (v.size() - 1));
+    return (double)v[i];
+}
+
+/* ---------------------------------------------------------------------- */
+
+struct sync_result {
+    ntp_status_t status = NTP_ERROR_NOT_INIT;
+    int64_t latency_ns = 0;
+};
+
+static ntp::task<void> sync_once(const ntp::server_set *servers, sync_result *result)
+{
+    int64_t start = system_ns();
+    result->status = co_await ntp::sync(*servers);
+    result->latency_ns = system_ns() - start;
+}
+
+static ntp::task<void> sleep_until(int64_t deadline_ns, int64_t *late_ns)
+{
+    co_await ntp::until(ntp::clock::time_point(std::chrono::nanoseconds(deadline_ns)));
+    *late_ns = ntp_getTimeNs() - deadline_ns;
+}
+
+// Stagger the start, then sync: a service's worth of coroutines sharing one executor
+static ntp::task<void> wait_then_sync(int64_t start_ns, const ntp::server_set *servers, sync_result *result)
+{
+    co_await ntp::until(ntp::clock::time_point(std::chrono::nanoseconds(start_ns)));
+    co_await sync_once(servers, result);
+}
+
+// One sync against the mock applies its offset to the client
+static void check_single_sync(const mock_server &mock)
+{
+    ntp::server_set servers{mock.name()};
+    sync_result result;
+    ntp::executor ex;
+    ex.spawn(sync_once(&servers, &result));
+    ex.run();
+
+    ntp_sync_info_t info;
+    ntp_getSyncInfo(&info);
+    printf("single sync       %8.1f us, offset %.3f ms\n", result.latency_ns / 1e3, info.offset_ns / 1e6);
+    CHECK(result.status == NTP_OK, "sync failed: %d", result.status);
+    CHECK(info.synced && info.offset_ns > MOCK_OFFSET_NS - 1000000 && info.offset_ns < MOCK_OFFSET_NS + 1000000,
+          "offset %.3f ms not applied", info.offset_ns / 1e6);
+}
+
+// An answer with the right origin from another address is not taken for
+// the server's, and the server's own answer still completes the sync
+static void check_spoofed_response()
+{
+    mock_server spoofing(0, true);
+    ntp::server_set servers{spoofing.name()};
+    sync_result result;
+    ntp::executor ex;
+    ex.spawn(sync_once(&servers, &result));
+    ex.run();
+
+    ntp_sync_info_t info;
+    ntp_getSyncInfo(&info);
+    printf("spoofed answer    %8.1f us, offset %.3f ms\n", result.latency_ns / 1e3, info.offset_ns / 1e6);
+    CHECK(result.status == NTP_OK, "sync failed: %d", result.status);
+    CHECK(info.offset_ns > MOCK_OFFSET_NS - 1000000 && info.offset_ns < MOCK_OFFSET_NS + 1000000,
+          "offset %.3f ms, the spoofed answer was taken", info.offset_ns / 1e6);
+}
+
+// Malformed ports are refused, not thrown or wrapped
+static void check_server_names()
+{
+    ntp::server_set servers;
+    bool refused = !servers.add("127.0.0.1:") && !servers.add("127.0.0.1:abc") && !servers.add("127.0.0.1:70000") &&
+                   !servers.add("127.0.0.1:0") && !servers.add("127.0.0.1:123x");
+    bool taken = servers.add("127.0.0.1:65535") && servers.add("127.0.0.1");
+    CHECK(refused, "a server with a malformed port was added");
+    CHECK(taken && servers.addresses().size() == 2 && ntohs(servers.addresses()[0].sin_port) == 65535,
+          "valid servers were not added");
+}
+
+// A server that never answers: every attempt times out
+static void check_timeout()
+{
+    mock_server silent(1);
+    ntp::server_set servers{silent.name()};
+    servers.timeout = std::chrono::milliseconds(30);
+    servers.attempts = 2;
+
+    sync_result result;
+    ntp::executor ex;
+    ex.spawn(sync_once(&servers, &result));
+    ex.run();
+
+    printf("silent server     %8.1f ms, %llu timeouts\n", result.latency_ns / 1e6,
+           (unsigned long long)ex.stats().timeouts);
+    CHECK(result.status == NTP_ERROR_TIMEOUT, "status %d, expected a timeout", result.status);
+    CHECK(result.latency_ns >= 60000000 && result.latency_ns < 200000000,
+          "two 30 ms attempts took %.1f ms", result.latency_ns / 1e6);
+    CHECK(ex.stats().timeouts == 2, "%llu timeouts", (unsigned long long)ex.stats().timeouts);
+}
+
+// Many coroutines sleeping to spread-out deadlines on one thread
+static void check_until(int count)
+{
+    std::vector<int64_t> late(count);
+    int64_t base = ntp_getTimeNs() + 20000000;
+    ntp::executor ex;
+    for (int i = 0; i < count; i++) {
+        ex.spawn(sleep_until(base + (int64_t)i * 200000000 / count, &late[i]));
+    }
+    double start = now_seconds();
+    ex.run();
+    double elapsed = now_seconds() - start;
+
+    int early = (int)std::count_if(late.begin(), late.end(), [](int64_t l) { return l < 0; });
+    printf("until x%-6d     p50 %7.1f us  p99 %7.1f us  max %7.1f us  early %d  %.0f ms, %llu polls\n",
+           count, percentile(late, 0.5) / 1e3, percentile(late, 0.99) / 1e3,
+           percentile(late, 1.0) / 1e3, early, elapsed * 1e3, (unsigned long long)ex.stats().polls);
+    CHECK(early == 0, "%d coroutines resumed before their deadline", early);
+    CHECK(percentile(late, 0.5) < 2000000, "median lateness %.1f us", percentile(late, 0.5) / 1e3);
+}
+
+// Thousands of concurrent syncs against two servers, one of them lossy
+static void check_concurrent_syncs(int count, const mock_server &a, const mock_server &lossy)
+{
+    ntp::server_set servers{a.name(), lossy.name()};
+    servers.timeout = std::chrono::milliseconds(50);
+    servers.attempts = 4;
+
+    std::vector<sync_result> results(count);
+    int64_t base = ntp_getTimeNs();
+    ntp::executor ex;
+    for (int i = 0; i < count; i++) {
+        // All start within 10 ms of each other
+        ex.spawn(wait_then_sync(base + (int64_t)i * 10000000 / count, &servers, &results[i]));
+    }
+    double start = now_seconds();
+    ex.run();
+    double elapsed = now_seconds() - start;
+
+    std::vector<int64_t> latency;
+    int failed = 0;
+    for (const sync_result &r : results) {
+        latency.push_back(r.latency_ns);
+        if (r.status != NTP_OK) failed++;
+    }
+    const ntp::executor::stats_t &st = ex.stats();
+    printf("sync x%-6d      %7.0f syncs/s  p50 %7.1f ms  p99 %7.1f ms  %llu requests, %llu retries, %d failed\n",
+           count, count / elapsed, percentile(latency, 0.5) / 1e6, percentile(latency, 0.99) / 1e6,
+           (unsigned long long)st.requests, (unsigned long long)st.retries, failed);
+    CHECK(failed == 0, "%d of %d syncs failed", failed, count);
+    CHECK(st.retries > 0, "the lossy server never caused a retry");
+    // An answer that arrives after its attempt timed out is dropped, and the
+    // retry may then be the one the lossy server ignores
+    CHECK(st.responses >= (uint64_t)count * 2 * 99 / 100, "%llu responses for %d syncs to two servers",
+          (unsigned long long)st.responses, count);
+}
+
+int main()
+{
+    ntp_config_t config;
+    memset(&config, 0, sizeof(config));
+    strcpy(config.server_name, "async.bench.invalid");
+    config.server_port = 123;
+    config.timeout_ms = 100;
+    config.retry_count = 1;
+    config.sync_interval = 3600;
+    if (ntp_init(&config) != NTP_OK) {
+        fprintf(stderr, "cannot initialize the NTP client\n");
+        return 1;
+    }
+
+    {
+        mock_server mock, lossy(7);
+        check_spoofed_response();
+        check_single_sync(mock);
+        check_server_names();
+        check_timeout();
+        check_until(10000);
+        check_concurrent_syncs(5000, mock, lossy);
+    }
+
+    ntp_cleanup();
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
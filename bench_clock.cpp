@@ -0,0 +1,285 @@
+/**
+ * ntp::clock benchmark - compares ntp::clock::now() with system_clock::now()
+ * and the C getters, and checks the clock follows a leader's offset.
+ *
+ * Benchmarks are registered and reported in the same way as Google
+ * Benchmark (BENCHMARK(fn)->Threads(n), a Time/CPU/Iterations table), but
+ * this harness is self-contained, so it builds without extra libraries.
+ *
+ * Usage: ntp-bench-clock [filter]   (runs benchmarks whose name contains filter)
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "ntp_clock.hpp"
+#include "ntp_shared.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);               \
+            fprintf(stderr, __VA_ARGS__);                                      \
+            fprintf(stderr, "\n");                                             \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Compile-time checks of the Cpp17TrivialClock shape and constexpr conversions
+static_assert(std::is_same<ntp::clock::duration, std::chrono::nanoseconds>::value, "nanosecond ticks");
+static_assert(std::is_same<ntp::clock::time_point::clock, ntp::clock>::value, "time_point of ntp::clock");
+static_assert(!ntp::clock::is_steady, "offset steps make it non-steady");
+static_assert(noexcept(ntp::clock::now()), "now() is noexcept");
+#if defined(__cpp_lib_chrono) && __cpp_lib_chrono >= 201907L
+static_assert(std::chrono::is_clock_v<ntp::clock>, "is_clock");
+#endif
+
+constexpr ntp::clock::time_point golden{std::chrono::seconds(1709987696) + std::chrono::nanoseconds(123456789)};
+static_assert(ntp::clock::to_sys(golden).time_since_epoch().count() == 1709987696123456789LL,
+              "to_sys keeps the epoch and every nanosecond");
+static_assert(ntp::clock::from_sys(ntp::clock::to_sys(golden)) == golden, "from_sys round trip");
+
+/* ---------------------------------------------------------------------- */
+
+// Google Benchmark's State, reduced to what these benchmarks use
+class State {
+public:
+    explicit State(uint64_t iterations) : remaining_(iterations) {}
+
+    struct iterator {
+        uint64_t left;
+        bool operator!=(const iterator &) const { return left != 0; }
+        void operator++() { left--; }
+        int operator*() const { return 0; }
+    };
+    iterator begin() { return iterator{remaining_}; }
+    iterator end() { return iterator{0}; }
+
+private:
+    uint64_t remaining_;
+};
+
+template <class T>
+static inline void DoNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State &)> fn;
+    int threads = 1;
+
+    Benchmark *Threads(int n)
+    {
+        threads = n;
+        return this;
+    }
+};
+
+static std::vector<Benchmark *> &registry()
+{
+    static std::vector<Benchmark *> benchmarks;
+    return benchmarks;
+}
+
+static Benchmark *register_benchmark(const char *name, void (*fn)(State &))
+{
+    Benchmark *b = new Benchmark;
+    b->name = name;
+    b->fn = fn;
+    registry().push_back(b);
+    return b;
+}
+
+#define BENCHMARK_CONCAT2(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+#define BENCHMARK(fn) \
+    static Benchmark *BENCHMARK_CONCAT(benchmark_, __LINE__) [[maybe_unused]] = register_benchmark(#fn, fn)
+
+static double elapsed(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run every thread for the same number of iterations; wall and CPU seconds
+static void run_once(const Benchmark &b, uint64_t iterations, double *wall, double *cpu)
+{
+    std::vector<std::thread> workers;
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 1; t < b.threads; t++) {
+        workers.emplace_back([&] {
+            State state(iterations);
+            b.fn(state);
+        });
+    }
+    State state(iterations);
+    b.fn(state);
+    for (auto &w : workers) w.join();
+    *wall = elapsed(start);
+    *cpu = cpu_seconds() - cpu_start;
+}
+
+// Grow the iteration count until a run takes min_time, as Google Benchmark does
+static void run_benchmark(const Benchmark &b)
+{
+    const double min_time = 0.5;
+    uint64_t iterations = 1;
+    double wall = 0, cpu = 0;
+    for (;;) {
+        run_once(b, iterations, &wall, &cpu);
+        if (wall >= min_time || iterations >= 1000000000ULL) break;
+        double scale = wall > 0 ? min_time * 1.4 / wall : 10;
+        if (scale > 10) scale = 10;
+        if (scale < 2) scale = 2;
+        iterations = (uint64_t)(iterations * scale);
+    }
+
+    std::string name = b.name;
+    if (b.threads > 1) name += "/threads:" + std::to_string(b.threads);
+    // Per-iteration times, as Google Benchmark reports for threaded runs
+    uint64_t total = iterations * b.threads;
+    printf("%-40s %10.1f ns %10.1f ns %12llu\n", name.c_str(), wall * 1e9 / iterations,
+           cpu * 1e9 / total, (unsigned long long)total);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void BM_SystemClockNow(State &state)
+{
+    for ([[maybe_unused]] auto _ : state) DoNotOptimize(std::chrono::system_clock::now());
+}
+BENCHMARK(BM_SystemClockNow);
+
+static void BM_NtpClockNow(State &state)
+{
+    for ([[maybe_unused]] auto _ : state) DoNotOptimize(ntp::clock::now());
+}
+BENCHMARK(BM_NtpClockNow);
+
+// The double getter C++ callers wrapped before, taking the client lock
+static void BM_NtpGetCurrentTimeWithMicros(State &state)
+{
+    for ([[maybe_unused]] auto _ : state) DoNotOptimize(ntp_getCurrentTimeWithMicros());
+}
+BENCHMARK(BM_NtpGetCurrentTimeWithMicros);
+
+BENCHMARK(BM_SystemClockNow)->Threads(4);
+BENCHMARK(BM_NtpClockNow)->Threads(4);
+BENCHMARK(BM_NtpGetCurrentTimeWithMicros)->Threads(4);
+
+/* ---------------------------------------------------------------------- */
+
+static void publish_offset(ntp_shared_t *leader, uint64_t n, int64_t offset_ns)
+{
+    ntp_shared_sync_t sync;
+    memset(&sync, 0, sizeof(sync));
+    sync.status = NTP_OK;
+    sync.attempts = n;
+    sync.sync_count = n;
+    sync.offset_ns = offset_ns;
+    sync.last_sync_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    sync.stratum = 2;
+    ntp_shared_publish(leader, &sync);
+}
+
+// ntp::clock minus system_clock in nanoseconds, once the reader has re-checked the page
+static int64_t measured_offset()
+{
+    usleep(20000);
+    ntp::clock::now();
+    auto sys = std::chrono::system_clock::now();
+    auto ntp = ntp::clock::to_sys(ntp::clock::now());
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(ntp - sys).count();
+}
+
+// The clock follows a leader's offsets with full nanosecond resolution
+static void check_offsets(ntp_shared_t *leader)
+{
+    int64_t before = measured_offset();
+    CHECK(before >= 0 && before < 1000000, "unsynced clock is %.3f ms off system time", before / 1e6);
+
+    publish_offset(leader, 1, 250000000);
+    int64_t ahead = measured_offset();
+    printf("offset +250 ms published, ntp::clock - system_clock = %.3f ms\n", ahead / 1e6);
+    CHECK(ahead >= 250000000 && ahead < 251000000, "offset not followed: %.3f ms", ahead / 1e6);
+
+    publish_offset(leader, 2, -50000000);
+    int64_t behind = measured_offset();
+    printf("offset -50 ms published,  ntp::clock - system_clock = %.3f ms\n", behind / 1e6);
+    CHECK(behind >= -50000000 && behind < -49000000, "offset not followed: %.3f ms", behind / 1e6);
+
+    // Sub-microsecond digits survive, unlike through a double
+    int submicro = 0;
+    for (int i = 0; i < 1000; i++) {
+        if (ntp::clock::now().time_since_epoch().count() % 1000 != 0) submicro++;
+    }
+    CHECK(submicro > 0, "no sub-microsecond resolution in 1000 reads");
+
+    std::time_t t = ntp::clock::to_time_t(ntp::clock::from_time_t(1709987696));
+    CHECK(t == 1709987696, "time_t round trip gave %lld", (long long)t);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : "";
+
+    ntp_config_t config;
+    memset(&config, 0, sizeof(config));
+    strcpy(config.server_name, "clock.bench.invalid");
+    config.server_port = 123;
+    config.timeout_ms = 100;
+    config.retry_count = 1;
+    config.sync_interval = 3600;
+
+    char dir[] = "/tmp/ntp-bench-clock-XXXXXX";
+    if (mkdtemp(dir) == NULL || ntp_init(&config) != NTP_OK || ntp_enableSharing(dir) != NTP_OK) {
+        fprintf(stderr, "cannot set up the NTP client\n");
+        return 1;
+    }
+
+    // Lead the shared page so the client under test follows our offsets
+    ntp_shared_t leader;
+    if (!ntp_shared_open(&leader, dir, "clock.bench.invalid:123") || !ntp_shared_try_lead(&leader)) {
+        fprintf(stderr, "cannot lead the shared page\n");
+        return 1;
+    }
+    check_offsets(&leader);
+
+    printf("%s\n", std::string(81, '-').c_str());
+    printf("%-40s %13s %13s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    printf("%s\n", std::string(81, '-').c_str());
+    for (const Benchmark *b : registry()) {
+        if (b->name.find(filter) != std::string::npos) run_benchmark(*b);
+    }
+
+    ntp_shared_close(&leader);
+    ntp_cleanup();
+    std::error_code ignored;
+    std::filesystem::remove_all(dir, ignored);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
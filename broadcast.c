@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "broadcast.h"
+#include "ntp_client.h"
+
+/* ---------------------------------------------------------------------- */
+/* Shared frames                                                          */
+/* ---------------------------------------------------------------------- */
+
+static shared_frame_t *frame_share(const render_buffer_t *out)
+{
+    shared_frame_t *f = malloc(sizeof(*f) + out->len);
+    if (f == NULL) return NULL;
+    f->refs = 0;
+    f->len = out->len;
+    memcpy(f->data, out->data, out->len);
+    return f;
+}
+
+static void frame_release(shared_frame_t *f)
+{
+    if (f != NULL && --f->refs == 0) free(f);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Groups and viewers                                                     */
+/* ---------------------------------------------------------------------- */
+
+void broadcast_init(broadcast_t *b, int listen_fd)
+{
+    memset(b, 0, sizeof(*b));
+    b->listen_fd = listen_fd;
+}
+
+static void group_release(broadcast_t *b, broadcast_group_t *g)
+{
+    if (g == NULL || --g->viewers > 0) return;
+
+    for (int i = 0; i < b->group_count; i++) {
+        if (b->groups[i] == g) {
+            b->groups[i] = b->groups[--b->group_count];
+            break;
+        }
+    }
+    render_free(&g->delta);
+    render_free(&g->full);
+    free(g);
+}
+
+/**
+ * Find the group for a geometry, creating it if this is the first viewer
+ * with that geometry
+ */
+static broadcast_group_t *group_join(broadcast_t *b, int width, int height, bool sync_output)
+{
+    for (int i = 0; i < b->group_count; i++) {
+        broadcast_group_t *g = b->groups[i];
+        if (g->width == width && g->height == height && g->sync_output == sync_output) {
+            g->viewers++;
+            return g;
+        }
+    }
+
+    if (b->group_count == b->group_cap) {
+        int cap = b->group_cap ? b->group_cap * 2 : 4;
+        broadcast_group_t **grown = realloc(b->groups, cap * sizeof(*grown));
+        if (grown == NULL) return NULL;
+        b->groups = grown;
+        b->group_cap = cap;
+    }
+
+    broadcast_group_t *g = calloc(1, sizeof(*g));
+    if (g == NULL) return NULL;
+    g->width = width;
+    g->height = height;
+    g->sync_output = sync_output;
+    g->viewers = 1;
+    render_init(&g->delta, width, height);
+    render_init(&g->full, width, height);
+    g->delta.sync_output = g->full.sync_output = sync_output;
+    b->groups[b->group_count++] = g;
+    return g;
+}
+
+bool broadcast_add_viewer(broadcast_t *b, int fd)
+{
+    if (b->viewer_count == b->viewer_cap) {
+        int cap = b->viewer_cap ? b->viewer_cap * 2 : 16;
+        broadcast_viewer_t **grown = realloc(b->viewers, cap * sizeof(*grown));
+        if (grown == NULL) return false;
+        b->viewers = grown;
+        b->viewer_cap = cap;
+    }
+
+    broadcast_viewer_t *v = calloc(1, sizeof(*v));
+    if (v == NULL) return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    v->fd = fd;
+    v->needs_full = true;
+    b->viewers[b->viewer_count++] = v;
+    return true;
+}
+
+static void remove_viewer(broadcast_t *b, int index)
+{
+    broadcast_viewer_t *v = b->viewers[index];
+
+    close(v->fd);
+    frame_release(v->frame);
+    group_release(b, v->group);
+    free(v);
+    b->viewers[index] = b->viewers[--b->viewer_count];
+}
+
+void broadcast_free(broadcast_t *b)
+{
+    while (b->viewer_count > 0) {
+        remove_viewer(b, b->viewer_count - 1);
+    }
+    free(b->viewers);
+    free(b->groups);
+    if (b->listen_fd >= 0) close(b->listen_fd);
+    memset(b, 0, sizeof(*b));
+    b->listen_fd = -1;
+}
+
+/**
+ * Read geometry updates from a viewer
+ *
+ * @return false if the viewer has gone away
+ */
+static bool read_viewer(broadcast_t *b, broadcast_viewer_t *v)
+{
+    for (;;) {
+        ssize_t n = read(v->fd, v->hello + v->hello_len, sizeof(v->hello) - v->hello_len);
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        v->hello_len += n;
+        if (v->hello_len < sizeof(v->hello)) continue;
+        v->hello_len = 0;
+
+        viewer_hello_t hello;
+        memcpy(&hello, v->hello, sizeof(hello));
+        if (memcmp(hello.magic, VIEWER_HELLO_MAGIC, sizeof(hello.magic)) != 0 ||
+            hello.width == 0 || hello.height == 0) {
+            return false;
+        }
+
+        // Move to the group for the new geometry and start from a clean screen
+        group_release(b, v->group);
+        v->group = group_join(b, hello.width, hello.height, hello.flags & VIEWER_SYNC_OUTPUT);
+        if (v->group == NULL) return false;
+        v->needs_full = true;
+    }
+}
+
+/**
+ * Send as much of a viewer's frame as its socket takes without blocking
+ *
+ * @return false if the viewer has gone away
+ */
+static bool send_viewer(broadcast_t *b, broadcast_viewer_t *v)
+{
+    while (v->frame != NULL) {
+        struct iovec iov = { v->frame->data + v->offset, v->frame->len - v->offset };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+        ssize_t n = sendmsg(v->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        v->offset += n;
+        b->bytes_sent += n;
+        if (v->offset == v->frame->len) {
+            frame_release(v->frame);
+            v->frame = NULL;
+            v->offset = 0;
+            v->frames_sent++;
+        }
+    }
+    return true;
+}
+
+static void queue_frame(broadcast_viewer_t *v, shared_frame_t *f)
+{
+    f->refs++;
+    v->frame = f;
+    v->offset = 0;
+}
+
+/**
+ * Render one frame per group and queue it for every viewer in the group
+ */
+void broadcast_frame(broadcast_t *b, const clock_frame_t *frame)
+{
+    for (int i = 0; i < b->group_count; i++) {
+        broadcast_group_t *g = b->groups[i];
+        shared_frame_t *delta = NULL, *full = NULL;
+
+        // Always keep the delta renderer current, so that what it renders
+        // next is relative to what a repainted viewer is now showing
+        render_frame(&g->delta, frame);
+        b->renders++;
+        bool changed = g->delta.out.len > 0;
+        if (changed) {
+            delta = frame_share(&g->delta.out);
+            rb_reset(&g->delta.out);
+        }
+        if (delta != NULL) delta->refs++; // Held until every viewer has its reference
+
+        for (int j = 0; j < b->viewer_count; j++) {
+            broadcast_viewer_t *v = b->viewers[j];
+            if (v->group != g) continue;
+
+            if (v->frame != NULL) {
+                // Still busy with an earlier frame; repaint once it catches up.
+                // If that was a repaint, the viewer can't take one per frame,
+                // so wait longer before the next rather than sending nothing else
+                v->frames_skipped++;
+                v->needs_full = true;
+                if (v->sending_full) {
+                    v->backoff = v->backoff ? v->backoff * 2 : 1;
+                    if (v->backoff > BROADCAST_MAX_BACKOFF) v->backoff = BROADCAST_MAX_BACKOFF;
+                }
+                continue;
+            }
+
+            if (changed && delta == NULL) {
+                // Out of memory - the viewer missed a change, so repaint it later
+                v->needs_full = true;
+                continue;
+            }
+
+            if (v->needs_full) {
+                if (v->hold > 0) {
+                    v->hold--;
+                    v->frames_skipped++;
+                    continue;
+                }
+                if (full == NULL) {
+                    render_invalidate(&g->full);
+                    render_frame(&g->full, frame);
+                    b->renders++;
+                    full = frame_share(&g->full.out);
+                    rb_reset(&g->full.out);
+                    if (full == NULL) continue;
+                    full->refs++;
+                }
+                queue_frame(v, full);
+                v->needs_full = false;
+                v->sending_full = true;
+                v->hold = v->backoff;
+            } else if (delta != NULL) {
+                queue_frame(v, delta);
+                v->sending_full = false;
+                v->backoff = 0;
+            }
+        }
+
+        if (delta != NULL) frame_release(delta);
+        if (full != NULL) frame_release(full);
+    }
+
+    // Start sending straight away
+    for (int j = 0; j < b->viewer_count; j++) {
+        if (!send_viewer(b, b->viewers[j])) remove_viewer(b, j--);
+    }
+}
+
+/**
+ * Service the sockets for up to timeout_ms: accept new viewers, read
+ * geometry updates and keep sending queued frames
+ */
+void broadcast_wait(broadcast_t *b, int timeout_ms)
+{
+    int count = b->viewer_count + 1;
+    struct pollfd stack_fds[64];
+    struct pollfd *fds = count <= 64 ? stack_fds : malloc(count * sizeof(*fds));
+    if (fds == NULL) return;
+
+    fds[0] = (struct pollfd){ b->listen_fd, POLLIN, 0 };
+    for (int i = 0; i < b->viewer_count; i++) {
+        broadcast_viewer_t *v = b->viewers[i];
+        fds[i + 1] = (struct pollfd){ v->fd, POLLIN | (v->frame ? POLLOUT : 0), 0 };
+    }
+
+    int viewers = b->viewer_count;
+    if (poll(fds, count, timeout_ms) > 0) {
+        // Walk backwards so removing a viewer doesn't disturb the ones left to check
+        for (int i = viewers - 1; i >= 0; i--) {
+            broadcast_viewer_t *v = b->viewers[i];
+            short re = fds[i + 1].revents;
+            bool ok = true;
+            if (re & (POLLIN | POLLHUP | POLLERR)) ok = read_viewer(b, v);
+            if (ok && (re & POLLOUT)) ok = send_viewer(b, v);
+            if (!ok) remove_viewer(b, i);
+        }
+
+        if (b->listen_fd >= 0 && (fds[0].revents & POLLIN)) {
+            int fd;
+            while ((fd = accept(b->listen_fd, NULL, NULL)) >= 0) {
+                if (!broadcast_add_viewer(b, fd)) close(fd);
+            }
+        }
+    }
+
+    if (fds != stack_fds) free(fds);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Sockets                                                                */
+/* ---------------------------------------------------------------------- */
+
+/**
+ * Default socket path: in $XDG_RUNTIME_DIR if set, otherwise /tmp
+ */
+void broadcast_default_path(char *buf, size_t size)
+{
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(buf, size, "%s/ntp-clock.sock", runtime);
+    } else {
+        snprintf(buf, size, "/tmp/ntp-clock-%u.sock", (unsigned)getuid());
+    }
+}
+
+static bool make_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return false;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+int broadcast_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!make_address(path, &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // Replace a socket left behind by a server that is no longer running
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (errno != EADDRINUSE) {
+            close(fd);
+            return -1;
+        }
+        int probe = broadcast_connect(path);
+        if (probe >= 0) {
+            // Another server is alive and well
+            close(probe);
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 64) < 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+int broadcast_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!make_address(path, &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+bool broadcast_send_hello(int fd, int width, int height, bool sync_output)
+{
+    viewer_hello_t hello;
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, VIEWER_HELLO_MAGIC, sizeof(hello.magic));
+    hello.width = width;
+    hello.height = height;
+    hello.flags = sync_output ? VIEWER_SYNC_OUTPUT : 0;
+    return send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) == (ssize_t)sizeof(hello);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Server                                                                 */
+/* ---------------------------------------------------------------------- */
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * Keep time and serve frames to attached viewers until interrupted
+ *
+ * @param path Socket to listen on
+ * @return Process exit status
+ */
+int broadcast_serve(const char *path)
+{
+    broadcast_t b;
+
+    int fd = broadcast_listen(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    broadcast_init(&b, fd);
+    ntp_startBackgroundSync();
+    fprintf(stderr, "Serving on %s\n", path);
+
+    while (!stop_requested) {
+        // System time, shown as unsynced, until the first sync
+        char server_name_buffer[256];
+        clock_frame_t frame;
+        ntp_sync_info_t info;
+        ntp_getSyncInfo(&info);
+        frame.now = (time_t)(info.time_ns / 1000000000LL);
+        int micros = (int)(info.time_ns % 1000000000LL / 1000);
+        frame.tenths = micros / 100000;
+        frame.hide_tenths = false;
+        frame.history = NULL;
+        frame.time_since_sync = info.synced ? info.sync_age_ns / 1000000000LL : -1;
+        frame.server_name = ntp_getServerName(server_name_buffer, sizeof(server_name_buffer))
+                            ? server_name_buffer : NULL;
+
+        if (b.group_count > 0) broadcast_frame(&b, &frame);
+
+        // Serve sockets until just after the next tenth
+        struct timespec start, now;
+        int sleep_ms = (render_next_change_us(&frame, micros) + 999) / 1000 + 1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int waited = 0;
+        while (waited < sleep_ms && !stop_requested) {
+            broadcast_wait(&b, sleep_ms - waited);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        }
+    }
+
+    ntp_stopBackgroundSync();
+    broadcast_free(&b);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "clock_render.h"
+
+/**
+ * Multi-viewer broadcast: one server process keeps time and renders, any
+ * number of thin viewers (`ntp-clock --attach`) copy its output to their
+ * terminals over a Unix socket.
+ *
+ * Viewers with the same geometry form a group that is rendered once per
+ * frame. The rendered frame is shared by reference between the group's
+ * viewers and sent to each straight from the shared buffer. A viewer that
+ * can't keep up skips frames and gets a full repaint (also rendered once and
+ * shared) when it catches up, exactly like a slow link in output_queue.c.
+ */
+
+#define VIEWER_HELLO_MAGIC "NTPV"
+#define VIEWER_SYNC_OUTPUT 0x01     // Viewer's terminal supports DEC mode 2026
+
+/**
+ * Sent by a viewer when it attaches and again whenever its terminal is
+ * resized
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];                  // VIEWER_HELLO_MAGIC
+    uint16_t width;                 // Terminal columns
+    uint16_t height;                // Terminal rows
+    uint8_t flags;                  // VIEWER_* flags
+    uint8_t reserved[3];
+} viewer_hello_t;
+
+/**
+ * A rendered frame shared by every viewer it is queued for
+ */
+typedef struct {
+    unsigned refs;
+    size_t len;
+    char data[];
+} shared_frame_t;
+
+/**
+ * Viewers that share a geometry and are served from one renderer
+ */
+typedef struct {
+    int width, height;
+    bool sync_output;
+    int viewers;                    // Viewers in this group
+    clock_renderer_t delta;         // Renders changes since the previous frame
+    clock_renderer_t full;          // Renders complete repaints on demand
+} broadcast_group_t;
+
+#define BROADCAST_MAX_BACKOFF 64    // Frames; a repaint at least every ~1s at 60 fps
+
+typedef struct {
+    int fd;
+    broadcast_group_t *group;       // NULL until the viewer says hello
+    bool needs_full;                // Next frame must be a complete repaint
+    bool sending_full;              // frame is a complete repaint
+    unsigned backoff;               // Frames to hold off a repaint after a slow one
+    unsigned hold;                  // Frames left before the next repaint
+    shared_frame_t *frame;          // Frame being sent, or NULL
+    size_t offset;                  // Bytes of it already sent
+    char hello[sizeof(viewer_hello_t)];
+    size_t hello_len;
+
+    uint64_t frames_sent;
+    uint64_t frames_skipped;        // Frames skipped because the viewer was busy
+} broadcast_viewer_t;
+
+typedef struct {
+    int listen_fd;                  // Listening socket, or -1
+    broadcast_viewer_t **viewers;
+    int viewer_count, viewer_cap;
+    broadcast_group_t **groups;
+    int group_count, group_cap;
+
+    // Statistics
+    uint64_t renders;               // Frames rendered (delta and full)
+    uint64_t bytes_sent;
+} broadcast_t;
+
+void broadcast_init(broadcast_t *b, int listen_fd);
+void broadcast_free(broadcast_t *b);
+bool broadcast_add_viewer(broadcast_t *b, int fd);
+void broadcast_frame(broadcast_t *b, const clock_frame_t *frame);
+void broadcast_wait(broadcast_t *b, int timeout_ms);
+
+int broadcast_listen(const char *path);
+int broadcast_connect(const char *path);
+bool broadcast_send_hello(int fd, int width, int height, bool sync_output);
+void broadcast_default_path(char *buf, size_t size);
+
+int broadcast_serve(const char *path);
+
+#endif /* BROADCAST_H */
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "budget_render.h"
+
+// ANSI escape codes
+#define CLEAR_SCREEN "\x1b[2J"
+#define SYNC_BEGIN "\x1b[?2026h"
+#define SYNC_END "\x1b[?2026l"
+
+#define NS_PER_SEC 1000000000ULL
+
+// Unchanged cells costing fewer bytes than this are reprinted rather than
+// skipped with a cursor movement
+#define REPRINT_MAX_BYTES 4
+
+/**
+ * Cursor and colour state of the terminal while an update is being built
+ */
+typedef struct {
+    int row, col;               // 0-based cursor position
+    int8_t fg, bg;              // Current SGR colours
+    bool pos_known;             // Position is known (not after a pending wrap)
+    bool sgr_known;             // Colours are known
+} pen_t;
+
+static int utf8_encode(uint32_t ch, char *buf)
+{
+    if (ch < 0x80) {
+        buf[0] = ch;
+        return 1;
+    }
+    if (ch < 0x800) {
+        buf[0] = 0xc0 | (ch >> 6);
+        buf[1] = 0x80 | (ch & 0x3f);
+        return 2;
+    }
+    if (ch < 0x10000) {
+        buf[0] = 0xe0 | (ch >> 12);
+        buf[1] = 0x80 | ((ch >> 6) & 0x3f);
+        buf[2] = 0x80 | (ch & 0x3f);
+        return 3;
+    }
+    buf[0] = 0xf0 | (ch >> 18);
+    buf[1] = 0x80 | ((ch >> 12) & 0x3f);
+    buf[2] = 0x80 | ((ch >> 6) & 0x3f);
+    buf[3] = 0x80 | (ch & 0x3f);
+    return 4;
+}
+
+/**
+ * Whether two cells look the same (the foreground of a blank doesn't show)
+ */
+static bool same_cell(const vt_cell_t *a, const vt_cell_t *b)
+{
+    return a->ch == b->ch && a->bg == b->bg && (a->ch == ' ' || a->fg == b->fg);
+}
+
+/**
+ * Whether a cell can be printed with the pen's colours as they are
+ */
+static bool pen_matches(const pen_t *pen, const vt_cell_t *c)
+{
+    return pen->sgr_known && pen->bg == c->bg && (c->ch == ' ' || pen->fg == c->fg);
+}
+
+/**
+ * Format a CSI sequence with one numeric parameter, leaving out the default
+ * of 1
+ */
+static int csi_n(char *buf, size_t size, int n, char final)
+{
+    return n == 1 ? snprintf(buf, size, "\x1b[%c", final)
+                  : snprintf(buf, size, "\x1b[%d%c", n, final);
+}
+
+/**
+ * Move the cursor with the shortest sequence that gets it there
+ */
+static void move_to(render_buffer_t *out, pen_t *pen, int row, int col)
+{
+    char best[32], vert[16] = "", horiz[16] = "";
+    int best_len;
+
+    if (pen->pos_known && pen->row == row && pen->col == col) return;
+
+    // Absolute position, leaving out a column of 1
+    best_len = col == 0 ? snprintf(best, sizeof(best), "\x1b[%dH", row + 1)
+                        : snprintf(best, sizeof(best), "\x1b[%d;%dH", row + 1, col + 1);
+
+    if (pen->pos_known) {
+        // Relative moves; CUU/CUD never scroll, unlike LF
+        if (row < pen->row) csi_n(vert, sizeof(vert), pen->row - row, 'A');
+        if (row > pen->row) csi_n(vert, sizeof(vert), row - pen->row, 'B');
+
+        if (col == 0 && pen->col != 0) {
+            strcpy(horiz, "\r");
+        } else if (col > pen->col) {
+            csi_n(horiz, sizeof(horiz), col - pen->col, 'C');
+        } else if (col < pen->col) {
+            csi_n(horiz, sizeof(horiz), pen->col - col, 'D');
+        }
+
+        int len = strlen(vert) + strlen(horiz);
+        if (len < best_len) {
+            best_len = snprintf(best, sizeof(best), "%s%s", vert, horiz);
+        }
+    }
+
+    rb_write(out, best, best_len);
+    pen->row = row;
+    pen->col = col;
+    pen->pos_known = true;
+}
+
+static int sgr_fg(int8_t c)
+{
+    return c == VT_COLOR_DEFAULT ? 39 : c < 8 ? 30 + c : 90 + c - 8;
+}
+
+static int sgr_bg(int8_t c)
+{
+    return c == VT_COLOR_DEFAULT ? 49 : c < 8 ? 40 + c : 100 + c - 8;
+}
+
+/**
+ * Change only the colours the next cell needs
+ */
+static void set_colors(render_buffer_t *out, pen_t *pen, const vt_cell_t *c)
+{
+    if (pen_matches(pen, c)) return;
+
+    // A blank keeps whatever foreground is current
+    int8_t fg = c->ch == ' ' && pen->sgr_known ? pen->fg : c->fg;
+
+    if (fg == VT_COLOR_DEFAULT && c->bg == VT_COLOR_DEFAULT) {
+        rb_puts(out, "\x1b[0m");
+    } else if (!pen->sgr_known) {
+        rb_printf(out, "\x1b[0;%d;%dm", sgr_fg(fg), sgr_bg(c->bg));
+    } else if (fg != pen->fg && c->bg != pen->bg) {
+        rb_printf(out, "\x1b[%d;%dm", sgr_fg(fg), sgr_bg(c->bg));
+    } else if (fg != pen->fg) {
+        rb_printf(out, "\x1b[%dm", sgr_fg(fg));
+    } else {
+        rb_printf(out, "\x1b[%dm", sgr_bg(c->bg));
+    }
+    pen->fg = fg;
+    pen->bg = c->bg;
+    pen->sgr_known = true;
+}
+
+/**
+ * Bytes needed to reprint a run of unchanged cells as they are
+ *
+ * @return Byte count, or -1 if the run needs colour changes
+ */
+static int reprint_cost(const vt_screen_t *shown, const pen_t *pen, int row, int from, int to)
+{
+    int bytes = 0;
+    char enc[4];
+
+    for (int col = from; col < to; col++) {
+        const vt_cell_t *c = vt_screen_cell(shown, row, col);
+        if (!pen_matches(pen, c)) return -1;
+        bytes += utf8_encode(c->ch, enc);
+    }
+    return bytes;
+}
+
+/**
+ * Emit the changes that turn the shown screen into the desired one
+ */
+static void emit_diff(budget_renderer_t *b)
+{
+    const vt_screen_t *want = &b->desired;
+    const vt_screen_t *have = &b->shown;
+    pen_t pen = {
+        .row = have->row, .col = have->col,
+        .fg = have->fg, .bg = have->bg,
+        .pos_known = b->state_known && !have->wrap_pending,
+        .sgr_known = b->state_known,
+    };
+    char enc[4];
+
+    for (int row = 0; row < want->height; row++) {
+        int col = 0;
+        while (col < want->width) {
+            if (same_cell(vt_screen_cell(want, row, col), vt_screen_cell(have, row, col))) {
+                col++;
+                continue;
+            }
+
+            move_to(&b->out, &pen, row, col);
+
+            // Print this changed run, bridging short gaps of unchanged cells
+            // when that's cheaper than moving the cursor over them
+            while (col < want->width) {
+                const vt_cell_t *c = vt_screen_cell(want, row, col);
+                set_colors(&b->out, &pen, c);
+                rb_write(&b->out, enc, utf8_encode(c->ch, enc));
+                col++;
+
+                int gap = col;
+                while (gap < want->width &&
+                       same_cell(vt_screen_cell(want, row, gap), vt_screen_cell(have, row, gap))) {
+                    gap++;
+                }
+                if (gap == want->width) break;
+
+                int cost = reprint_cost(have, &pen, row, col, gap);
+                if (cost < 0 || cost >= REPRINT_MAX_BYTES) break;
+                for (; col < gap; col++) {
+                    const vt_cell_t *same = vt_screen_cell(have, row, col);
+                    rb_write(&b->out, enc, utf8_encode(same->ch, enc));
+                }
+            }
+
+            if (col == want->width) {
+                // The cursor is now waiting to wrap; don't rely on where it is
+                pen.pos_known = false;
+            } else {
+                pen.col = col;
+            }
+        }
+    }
+}
+
+bool budget_init(budget_renderer_t *b, int bytes_per_sec, int width, int height)
+{
+    memset(b, 0, sizeof(*b));
+    b->bytes_per_sec = bytes_per_sec;
+    b->show_tenths = true;
+    return budget_resize(b, width, height);
+}
+
+void budget_free(budget_renderer_t *b)
+{
+    vt_screen_free(&b->desired);
+    vt_screen_free(&b->shown);
+    free(b->out.data);
+    memset(b, 0, sizeof(*b));
+}
+
+/**
+ * Match the models to a new terminal size; the next update repaints
+ * everything
+ */
+bool budget_resize(budget_renderer_t *b, int width, int height)
+{
+    if (b->desired.width == width && b->desired.height == height) return true;
+
+    vt_screen_free(&b->desired);
+    vt_screen_free(&b->shown);
+    if (!vt_screen_init(&b->desired, width, height) ||
+        !vt_screen_init(&b->shown, width, height)) {
+        return false;
+    }
+    budget_invalidate(b);
+    return true;
+}
+
+/**
+ * Forget what the terminal is showing, e.g. after something else wrote to it
+ */
+void budget_invalidate(budget_renderer_t *b)
+{
+    b->clear_pending = true;
+    b->state_known = false;
+}
+
+/**
+ * Close the current one-second meter window
+ */
+static void end_window(budget_renderer_t *b, uint64_t now_ns)
+{
+    uint64_t elapsed = now_ns - b->window_start_ns;
+
+    if (b->window_start_ns != 0 && elapsed > 0) {
+        b->bytes_per_sec_seen = b->window_bytes * 1e9 / elapsed;
+    }
+    b->window_start_ns = now_ns;
+    b->window_bytes = 0;
+}
+
+/**
+ * Render a frame and turn it into the smallest update the terminal needs
+ *
+ * Hides the frame's tenths when the budget only allows whole seconds, so
+ * the caller can sleep until the next second; tenths it hides already
+ * stay hidden.
+ *
+ * @return true if b->out holds an update to send; false if nothing changed
+ *         or the budget is used up for now
+ */
+bool budget_frame(budget_renderer_t *b, clock_renderer_t *r, clock_frame_t *frame, uint64_t now_ns)
+{
+    rb_reset(&b->out);
+
+    // Refill the token bucket, allowing bursts of up to one second's budget
+    if (b->last_ns != 0) {
+        b->tokens += (double)(now_ns - b->last_ns) * b->bytes_per_sec / NS_PER_SEC;
+        if (b->tokens > b->bytes_per_sec) b->tokens = b->bytes_per_sec;
+    }
+    b->last_ns = now_ns;
+
+    if (now_ns - b->window_start_ns >= NS_PER_SEC) end_window(b, now_ns);
+
+    if (b->tokens >= 0) b->repaying_redraw = false;
+
+    if (b->tokens < 0) {
+        b->frames_deferred++;
+        if (b->show_tenths && !b->repaying_redraw) {
+            // Ten updates a second don't fit; fall back to whole seconds
+            b->show_tenths = false;
+        }
+        frame->hide_tenths |= !b->show_tenths;
+        return false;
+    }
+
+    if (b->sync_output) rb_puts(&b->out, SYNC_BEGIN);
+    size_t body = b->out.len;
+
+    if (b->clear_pending) {
+        rb_puts(&b->out, CLEAR_SCREEN);
+        vt_screen_reset(&b->shown);
+        vt_screen_reset(&b->desired);
+        render_invalidate(r);
+        b->clear_pending = false;
+        b->repaying_redraw = true;
+    }
+
+    // Bring the desired screen up to date; tenths the caller hides stay hidden
+    frame->hide_tenths |= !b->show_tenths;
+    render_frame(r, frame);
+    vt_screen_feed(&b->desired, r->out.data, r->out.len);
+    rb_reset(&r->out);
+
+    emit_diff(b);
+    if (b->out.len == body) {
+        rb_reset(&b->out);
+        return false;
+    }
+    if (b->sync_output) rb_puts(&b->out, SYNC_END);
+
+    // The update is exactly what the terminal will see
+    vt_screen_feed(&b->shown, b->out.data, b->out.len);
+    b->state_known = true;
+
+    b->tokens -= b->out.len;
+    b->bytes_total += b->out.len;
+    b->window_bytes += b->out.len;
+    b->frames_sent++;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef BUDGET_RENDER_H
+#define BUDGET_RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clock_render.h"
+#include "vt_screen.h"
+
+/**
+ * Bandwidth-budgeted output for serial consoles and metered links.
+ *
+ * Frames are rendered as usual into a model of the desired screen, then
+ * diffed cell by cell against a model of what the terminal is showing.
+ * Only changed cells are sent, using whichever cursor movement is shortest
+ * and only the SGR changes actually needed. The tenths display is dropped
+ * if the budget can't afford ten updates a second, and a token bucket keeps
+ * the long-term rate within the budget.
+ */
+typedef struct {
+    int bytes_per_sec;          // Budget
+    bool sync_output;           // Wrap updates in DEC synchronized output
+    bool show_tenths;           // Current update granularity
+    vt_screen_t desired;        // What the next frame should look like
+    vt_screen_t shown;          // What the terminal is showing
+    render_buffer_t out;        // Update stream for the terminal
+    bool clear_pending;         // Terminal contents unknown - clear before the next update
+    bool state_known;           // Cursor and SGR state of the terminal match the model
+
+    double tokens;              // Bytes that may be sent right now (may go negative)
+    uint64_t last_ns;           // When tokens were last refilled
+    bool repaying_redraw;       // Tokens are short because of a full repaint
+    uint64_t window_start_ns;   // Start of the current one-second meter window
+    uint64_t window_bytes;      // Bytes sent in the current window
+
+    // Meter
+    double bytes_per_sec_seen;  // Bytes sent in the last complete second
+    uint64_t bytes_total;       // Bytes sent since start
+    uint64_t frames_sent;       // Updates sent
+    uint64_t frames_deferred;   // Updates held back by the token bucket
+} budget_renderer_t;
+
+bool budget_init(budget_renderer_t *b, int bytes_per_sec, int width, int height);
+void budget_free(budget_renderer_t *b);
+bool budget_resize(budget_renderer_t *b, int width, int height);
+void budget_invalidate(budget_renderer_t *b);
+bool budget_frame(budget_renderer_t *b, clock_renderer_t *r, clock_frame_t *frame, uint64_t now_ns);
+
+#endif /* BUDGET_RENDER_H */
@@ -7,8 +7,22 @@
 #include <stdarg.h>
 #include <signal.h>
 #include <termios.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
 #include <sys/ioctl.h>
 #include "ntp_client.h"
+#include "ntp_capture.h"
+#include "ntp_stats.h"
+#include "ntp_server.h"
+#include "ntp_auth.h"
+#include "clock_render.h"
+#include "output_queue.h"
+#include "budget_render.h"
+#include "headless.h"
+#include "broadcast.h"
+#include "tick_service.h"
+#include "term_caps.h"
 
 // Global variable declarations
 static volatile int keep_running = 1;
@@ -16,6 +30,72 @@ static int term_width = 80;
 static int term_height = 24;
 volatile sig_atomic_t terminal_resized = 0;
 
+// Renderer for the controlling terminal
+static clock_renderer_t renderer;
+
+// Non-blocking output queue for rendered frames
+static output_queue_t output = { .fd = -1 };
+
+// What the terminal supports; anything not known at startup is asked while
+// the clock is already running
+static term_caps_t caps;
+static bool sync_output_supported = false;
+
+// Bandwidth budget in bytes per second (0 = unlimited) and the renderer that
+// keeps output within it
+static int budget_bytes_per_sec = 0;
+static budget_renderer_t budget;
+
+// Whether tenths are wanted at all, and whether to drop to whole seconds
+// while the terminal window doesn't have focus
+static bool show_tenths = true;
+static bool focus_reporting = false;
+static bool terminal_focused = true;
+
+// Headless record streaming instead of the display
+static bool headless = false;
+static record_format_t headless_format = RECORD_JSON;
+static int headless_tick_ms = 1000;
+
+// Multi-viewer broadcast: serve frames to attached viewers, or be a viewer
+static bool serve = false;
+static bool attach = false;
+static char socket_path[108];
+
+// Second-boundary tick service for local subscribers
+static bool ticks = false;
+static char tick_socket_path[108];
+
+// Offset/RTT history graph above the status bar
+static bool show_graph = false;
+static sync_history_t history;
+static uint64_t history_syncs = 0;
+
+// Share one upstream poller with the other instances on this host
+static bool share_syncs = true;
+
+// Record our own NTP exchanges to a rotating pcapng file
+#define CAPTURE_MAX_BYTES (16 << 20)
+#define CAPTURE_FILES 4
+static char capture_path[256] = "";
+
+// Write ntpd-style peerstats and loopstats files to this directory
+static char stats_dir[256] = "";
+
+// Sync from a server's multicasts instead of polling it
+#define MULTICAST_CALIBRATE_SEC 86400
+static bool multicast = false;
+static char multicast_group[64] = NTP_MULTICAST_GROUP;
+
+// Serve our NTP time to other hosts on this port (0 = don't)
+static int ntp_server_port = 0;
+static ntp_server_t *ntp_server = NULL;
+
+// Symmetric keys for our syncs (key_id) and for the clients we serve
+static char keys_path[256] = "";
+static ntp_keyring_t *keys = NULL;
+static uint32_t key_id = 0;
+
 // Buffer constants - keep for reference during refactoring
 #define MAX_BUFFER_LINES 100
 #define MAX_LINE_LENGTH 512
@@ -25,46 +105,24 @@ volatile sig_atomic_t terminal_resized = 0;
 #define CURSOR_HOME "\x1b[H"
 #define HIDE_CURSOR "\x1b[?25l"
 #define SHOW_CURSOR "\x1b[?25h"
+#define FOCUS_REPORTING_ON "\x1b[?1004h"
+#define FOCUS_REPORTING_OFF "\x1b[?1004l"
 
 // Default NTP server
 #define DEFAULT_NTP_SERVER "pool.ntp.org"
 
-#define CLOCK_HEIGHT 5
-
-// Define a MIN macro for use in size calculations
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-// Track last drawn values to optimize partial updates
-static int last_second = -1;
-static int last_minute = -1;
-static int last_hour = -1;
-static int last_hundredths = -1;
-static bool buffer_initialized = false;
-
 // ANSI escape codes
-#define ANSI_CLEAR_SCREEN "\x1b[2J"
-#define ANSI_CURSOR_HOME "\x1b[H"
 #define ANSI_CURSOR_POSITION "\x1b[%d;%dH"
-#define ANSI_SAVE_CURSOR "\x1b[s"
-#define ANSI_RESTORE_CURSOR "\x1b[u"
 
 // Forward declarations
-// void clear_screen(void);
 void set_cursor_position(int row, int col);
-// void draw_clock(time_t now);
-void draw_full_clock(time_t now);
-// oid draw_status_bar(time_t current_time, int time_since_sync);
-void direct_draw_status_bar(time_t current_time, int time_since_sync);
 void direct_clear_screen(void);
 void direct_print(int row, int col, const char *format, ...);
-void update_hundredths(int row, int col, int hundredths);
-// void show_message(const char *format, ...);
-void draw_hundredths(int row, int col, int hundredths);
 void update_terminal_size(void);
 void handle_sigint(int sig);
 void handle_sigwinch(int sig);
 void init_terminal(void);
 void restore_terminal(void);
-int sync_with_ntp(void);
 
 /**
  * Direct print to terminal at specified position
@@ -91,47 +149,6 @@ void direct_print(int row, int col, const char *format, ...)
     va_end(args);
 }
 
-/**
- * Update the hundredths display without redrawing the entire clock
- */
-void update_hundredths(int row, int col, int hundredths)
-{
-    // Format the hundredths display text with colors
-    char hundredths_buffer[40]; // Buffer for the hundredths display
-    memset(hundredths_buffer, 0, sizeof(hundredths_buffer));
-    
-    // Dark gray dot
-    strcat(hundredths_buffer, "\x1b[90m");
-    strcat(hundredths_buffer, ".");
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // Bright red hundredths
-    strcat(hundredths_buffer, "\x1b[91m");
-    char temp[16];
-    snprintf(temp, sizeof(temp), "%01d", hundredths);
-    strcat(hundredths_buffer, temp);
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // White "UTC" text
-    strcat(hundredths_buffer, "\x1b[97m");
-    strcat(hundredths_buffer, " UTC");
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // Print directly to the screen at the specified position
-    direct_print(row, col, "%s", hundredths_buffer);
-}
-
-/**
- * Clear screen and position cursor at top
- */
-/*
-void clear_screen(void)
-{
-    printf("%s%s", CLEAR_SCREEN, CURSOR_HOME);
-    fflush(stdout);
-}
-*/
-
 /**
  * Directly clear screen without using buffer
  */
@@ -146,108 +163,6 @@ void set_cursor_position(int row, int col)
     printf(ANSI_CURSOR_POSITION, row, col);
 }
 
-/**
- * Show a temporary message directly on screen
- */
-/*
-void show_message(const char *format, ...) 
-{
-    va_list args;
-    va_start(args, format);
-    
-    char message[MAX_LINE_LENGTH];
-    vsnprintf(message, sizeof(message), format, args);
-    
-    // Display message at the top of the screen
-    direct_print(1, 1, "%s", message);
-    
-    va_end(args);
-}
-*/
-
-const char* DIGIT_ART[10][5] =
-{
-    {
-        " ████ ",
-        "██  ██",
-        "██  ██",
-        "██  ██",
-        " ████ "
-    },
-    {
-        "  ██  ",
-        " ███  ",
-        "  ██  ",
-        "  ██  ",
-        " ████ "
-    },
-    {
-        " ████ ",
-        "    ██",
-        " ████ ",
-        "██    ",
-        "██████"
-    },
-    {
-        " ████ ",
-        "    ██",
-        " ████ ",
-        "    ██",
-        " ████ "
-    },
-    {
-        "██  ██",
-        "██  ██",
-        "██████",
-        "    ██",
-        "    ██"
-    },
-    {
-        "██████",
-        "██    ",
-        "██████",
-        "    ██",
-        "██████"
-    },
-    {
-        " ████ ",
-        "██    ",
-        "██████",
-        "██  ██",
-        " ████ "
-    },
-    {
-        "██████",
-        "    ██",
-        "   ██ ",
-        "  ██  ",
-        " ██   "
-    },
-    {
-        " ████ ",
-        "██  ██",
-        " ████ ",
-        "██  ██",
-        " ████ "
-    },
-    {
-        " ████ ",
-        "██  ██",
-        " █████",
-        "    ██",
-        " ████ "
-    }
-};
-
-const char* COLON_ART[5] = 
-{
-    "  ",
-    "██",
-    "  ",
-    "██",
-    "  "
-};
-
 /**
  * Handle CTRL+C signal
  */
@@ -283,646 +198,8 @@ void update_terminal_size() {
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
     term_width = w.ws_col;
     term_height = w.ws_row;
-}
-
-/**
- * Draw a centered string at the specified row
- */
-/*
-void draw_centered_string(int row, const char* str) {
-    int len = strlen(str);
-    int pos_x = (term_width - len) / 2;
-    if (pos_x < 0) pos_x = 0;
-    
-    direct_print(row, pos_x + 1, "%s", str);
-}
-*/
-
-/**
- * Draw the hundredths of a second at the specified position
- * This should only be called for the bottom line (line 4)
- */
-void draw_hundredths(int row, int col, int hundredths) 
-{
-    // Check if row is valid
-    if (row < 0) return;
-    
-    // Make sure the column is valid
-    if (col < 1) col = 1;
-    
-    // Format the hundredths display text
-    char hundredths_buffer[40]; // Buffer for the hundredths display
-    memset(hundredths_buffer, 0, sizeof(hundredths_buffer));
-    
-    // Format the display with colors using separate strcat calls for each color segment
-    // Dark gray dot
-    strcat(hundredths_buffer, "\x1b[90m");
-    strcat(hundredths_buffer, ".");
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // Bright red hundredths
-    strcat(hundredths_buffer, "\x1b[91m");
-    char temp[16];
-    snprintf(temp, sizeof(temp), "%01d", hundredths);
-    strcat(hundredths_buffer, temp);
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // White "UTC" text
-    strcat(hundredths_buffer, "\x1b[97m");
-    strcat(hundredths_buffer, " UTC");
-    strcat(hundredths_buffer, "\x1b[0m");
-    
-    // Print directly to screen
-    direct_print(row, col, "%s", hundredths_buffer);
-}
-
-/**
- * Draw the clock digits at the center of the screen
- */
-void draw_full_clock(time_t current_time) 
-{
-    struct tm* time_info = localtime(&current_time);
-    
-    // Get the hundredths of a second
-    int hundredths = (ntp_getCurrentHundredths() / 10);
-    
-    char time_str[9];
-    sprintf(time_str, "%02d:%02d:%02d", time_info->tm_hour, time_info->tm_min, time_info->tm_sec);
-
-    // Adding 1 space between each element 
-    // Including space for ANSI color codes
-    int start_row = (term_height - 5) / 2 - 2; // 5 is the height of digits, -2 to add some margin
-    if (start_row < 1) start_row = 1;
-    
-    // Precalculate the full width of the clock display
-    // 6 digits (each 6 chars wide) + 2 colons (each 2 chars wide) + 7 separations (each 1 space) 
-    // Plus ANSI color codes which don't affect visible width
-    int clock_display_width = 6 * 6 + 2 * 2 + 7;
-    
-    // Width of the hundredths display: ".0 UTC" 6 chars plus ANSI codes
-    int hundredths_display_width = 6;
-    
-    // Full width including hundredths display and some spacing
-    int total_display_width = clock_display_width + 3 + hundredths_display_width;
-    // Calculate starting column for horizontal centering of the entire display (clock + hundredths)
-    int start_col = (term_width - total_display_width) / 2;
-    if (start_col < 1) start_col = 1;
-    
-    // Calculate the starting column for the hundredths display
-    int hundredths_col = start_col + clock_display_width + 1; // Adjusted for better alignment
-    
-    // Draw each line of the digits
-    char buffer[512]; // Larger buffer to accommodate color codes and spacing
-    for (int line = 0; line < 5; line++) 
-    {
-        memset(buffer, 0, sizeof(buffer));
-        
-        // Hours tens digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_hour / 10][line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Hours ones digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_hour % 10][line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Colon - light black (dark gray)
-        strcat(buffer, "\x1b[90m");
-        strcat(buffer, COLON_ART[line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Minutes tens digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_min / 10][line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Minutes ones digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_min % 10][line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Colon - light black (dark gray)
-        strcat(buffer, "\x1b[90m");
-        strcat(buffer, COLON_ART[line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Seconds tens digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_sec / 10][line]);
-        strcat(buffer, "\x1b[0m "); // Reset + space for separation
-        
-        // Seconds ones digit - bright red
-        strcat(buffer, "\x1b[91m");
-        strcat(buffer, DIGIT_ART[time_info->tm_sec % 10][line]);
-        strcat(buffer, "\x1b[0m"); // Reset
-        
-        // Print the line directly to the screen
-        direct_print(start_row + line, start_col, "%s", buffer);
-    }
-    
-    // Draw the hundredths part on the last line
-    draw_hundredths(start_row + 4, hundredths_col, hundredths);
-}
-
-/**
- * Draw the clock by calling draw_full_clock
- * This function maintains backward compatibility with existing code
- */
-/*
-void draw_clock(time_t current_time)
-{
-    draw_full_clock(current_time);
-}
-*/
-
-/**
- * Draw the status bar at the bottom of the screen
- * This function ensures the status bar is always positioned at the bottom
- * of the terminal regardless of resizing
- * Note: This is a legacy version that uses buffer_line
- */
-/*
-void draw_status_bar(time_t current_time, int time_since_sync)
-{
-    struct tm* time_info = localtime(&current_time);
-    
-    // Determine if the current position indicator should blink
-    // Since main loop sleeps for 900ms (just under 1 second), 
-    // we need to use a combination of seconds and the expected timing
-    // to determine the blink state
-    int current_second = time_info->tm_sec;
-    // Even seconds show the character, odd seconds hide it
-    // Since we update roughly every 10ms, use modulo to create blinking
-    int should_show_character = (current_second % 2 == 0);
-    
-    // Format date and time with hundredths
-    int hundredths = ntp_getCurrentHundredths();
-    char datetime_str[40];
-    snprintf(datetime_str, sizeof(datetime_str), "%04d-%02d-%02d %02d:%02d:%02d.%01d UTC", 
-            time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday,
-            time_info->tm_hour, time_info->tm_min, time_info->tm_sec, hundredths);
-    
-    // Get NTP server name
-    char server_name_buffer[256];
-    if (!ntp_getServerName(server_name_buffer, sizeof(server_name_buffer))) {
-        strcpy(server_name_buffer, "Not connected");
-    }
-    
-    // Limit server name to a safe size (128 chars) to prevent buffer overflow
-    server_name_buffer[128] = '\0';
-    // Calculate times since sync and until next sync in H:MM:SS format
-    char time_since_str[20] = "Never";
-    char time_until_str[20] = "Unknown";
-    int hours_since = 0, mins_since = 0, secs_since = 0;
-    int hours_until = 0, mins_until = 0, secs_until = 0;
-    
-    // Time since last sync
-    if (time_since_sync < 0) 
-    {
-        strcpy(time_since_str, "Never");
-    } 
-    else 
-    {
-        hours_since = time_since_sync / 3600;
-        mins_since = (time_since_sync % 3600) / 60;
-        secs_since = time_since_sync % 60;
-        snprintf(time_since_str, sizeof(time_since_str), "%d:%02d:%02d", hours_since, mins_since, secs_since);
-    }
-    
-    // Calculate next sync time
-    int seconds_to_next_sync = 7200 - (time_since_sync % 7200); // 7200 = 2 hours
-    if (time_since_sync < 0) 
-    {
-        seconds_to_next_sync = 7200;
-    }
-    
-    // Format time until next sync
-    hours_until = seconds_to_next_sync / 3600;
-    mins_until = (seconds_to_next_sync % 3600) / 60;
-    secs_until = seconds_to_next_sync % 60;
-    snprintf(time_until_str, sizeof(time_until_str), "%d:%02d:%02d", hours_until, mins_until, secs_until);
-    
-    // Use global terminal dimensions - don't recompute them here
-    // This avoids potential issues with inconsistent dimensions
-    // Format the server name
-    char server_name_buffer_formatted[64] = "";
-    if (strlen(server_name_buffer) > 0) 
-    {
-        snprintf(server_name_buffer_formatted, sizeof(server_name_buffer_formatted), "%.*s", (int)sizeof(server_name_buffer_formatted) - 1, server_name_buffer);
-    } 
-    else 
-    {
-        strcpy(server_name_buffer_formatted, "Not connected");
-    }
-    
-    // Format the left section with date/time and server name
-    char left_section[256];
-    snprintf(left_section, sizeof(left_section), " %s │ %s ", datetime_str, server_name_buffer_formatted);
-    
-    // Calculate progress as percentage of time elapsed in the sync cycle
-    float progress = 0.0;
-    if (time_since_sync >= 0) 
-    {
-        progress = (float)time_since_sync / (time_since_sync + seconds_to_next_sync);
-    }
-    
-    // Step 1: Position cursor at the bottom line
-    int status_line_y = term_height;
-    
-    // Create a buffer for the status bar line with all spaces
-    char status_line_buffer[MAX_LINE_LENGTH];
-    memset(status_line_buffer, 0, sizeof(status_line_buffer));
-    
-    // Fill with spaces for the background - always draw this regardless of content changes
-    // This ensures the background is properly drawn on every frame
-    strcpy(status_line_buffer, "\x1b[30;47m"); // Black text on grey background
-    for (int i = 0; i < term_width && i < MAX_LINE_LENGTH - 20; i++) 
-    {
-        strcat(status_line_buffer, " ");
-    }
-    strcat(status_line_buffer, "\x1b[0m");
-    
-    // Add to buffer
-    direct_print(status_line_y, 1, "%s", status_line_buffer);
-    // Step 4: Add left section to buffer with black text on gray background
-    char formatted_left_section[384];
-    snprintf(formatted_left_section, sizeof(formatted_left_section), "\x1b[30;47m%s\x1b[0m", left_section);
-    direct_print(status_line_y, 1, "%s", formatted_left_section);
-    // Build the progress bar section text WITHOUT formatting to calculate its true length
-    char plain_progress_section[512];
-    
-    // Create the divider, sync label and time
-    sprintf(plain_progress_section, "NTP %s [", time_since_str);
-    
-    // Calculate maximum size for progress section (max 50% of terminal width)
-    // Ensure a reasonable minimum for very small terminals
-    int min_term_width = 40; // Minimum reasonable terminal width
-    int effective_term_width = (term_width < min_term_width) ? min_term_width : term_width;
-    int max_progress_width = effective_term_width / 2;
-    
-    // Calculate size of fixed elements (dividers, times, labels)
-    int fixed_elements_width = strlen("NTP Sync: ") + strlen(time_since_str) +
-                            strlen(" │ ") + strlen(" │ ") + 
-                            strlen(time_until_str) + 1; // +1 for right padding space
-    
-    // Calculate width available for the actual progress bar
-    int bar_width = max_progress_width - fixed_elements_width;
-    if (bar_width < 10) bar_width = 10; // Ensure minimum bar width
-    
-    // Add placeholder characters for the bar
-    for (int i = 0; i < bar_width; i++) {
-        strcat(plain_progress_section, "X"); // Placeholder character
-    }
-    
-    // Add the divider and time until
-    strcat(plain_progress_section, " │ ");
-    strcat(plain_progress_section, time_until_str);
-    strcat(plain_progress_section, " "); // Right padding space
-    
-    // Calculate where to position the progress section to be right-justified
-    // Ensure progress_section_column is never less than the left section length + minimum spacing
-    int left_section_length = strlen(left_section);
-    int min_progress_section_column = left_section_length + 2; // +2 for minimum spacing
-    int progress_section_column = term_width - strlen(plain_progress_section) + 1;
-    
-    // If terminal is too small, ensure at least the left section is completely visible
-    if (progress_section_column < min_progress_section_column) {
-        progress_section_column = min_progress_section_column;
-    }
-    
-    // Build the progress section in a buffer
-    char progress_section_buffer[MAX_LINE_LENGTH];
-    memset(progress_section_buffer, 0, sizeof(progress_section_buffer));
-    
-    // Start with the right ANSI color code for the background
-    strcpy(progress_section_buffer, "\x1b[30;47m"); // Black text on grey background
-    
-    // Now add the progress section content
-    
-    // Add divider and sync label with time
-    strcat(progress_section_buffer, "NTP Sync: ");
-    strcat(progress_section_buffer, time_since_str);
-    strcat(progress_section_buffer, " [");
-    
-    // Calculate filled portion of the bar
-    // Calculate filled portion of the bar
-    int filled_width = (int)(progress * bar_width);
-    if (filled_width > bar_width) filled_width = bar_width;
-    
-    // Calculate the fractional part of the progress to determine if we should show a half block
-    float fractional_part = (progress * bar_width) - filled_width;
-    bool show_half_block = (fractional_part >= 0.1) && (filled_width < bar_width);
-    
-    // Determine the position of the blinking element:
-    // - If we have a partial fill (half block): the half block position blinks
-    // - If we have no half block: the boundary between filled and unfilled blinks
-    //   (either last filled block or first unfilled dot)
-    int blink_position = filled_width;
-    if (!show_half_block && filled_width > 0) {
-        // When no half block and we have filled blocks, blink the last filled block
-        blink_position = filled_width - 1;
-    }
-    
-    // Add the filled portion (bright yellow blocks on grey)
-    strcat(progress_section_buffer, "\x1b[93;47m"); // Bright yellow on grey
-    // Add full blocks for completed sections
-    for (int i = 0; i < filled_width; i++) {
-        if (i == blink_position && !show_half_block) {
-            // This is the blinking element (the last filled block)
-            if (should_show_character) {
-                strcat(progress_section_buffer, "█"); // Full block for complete fill
-            } else {
-                strcat(progress_section_buffer, " "); // Space for blinking effect
-            }
-        } else {
-            // Regular filled blocks never blink
-            strcat(progress_section_buffer, "█"); // Full block for complete fill
-        }
-    }
-    
-    // Handle half block if needed
-    if (show_half_block) {
-        if (blink_position == filled_width) {
-            // This half block is the blinking element
-            if (should_show_character) {
-                strcat(progress_section_buffer, "▌"); // Half block for partial fill
-            } else {
-                strcat(progress_section_buffer, " "); // Space for blinking effect
-            }
-        } else {
-            // This half block is not the blinking element
-            strcat(progress_section_buffer, "▌"); // Half block for partial fill
-        }
-        filled_width++; // Increment to account for the half block position
-    }
-    
-    // Add the empty portion (dark grey mid-dots on grey)
-    strcat(progress_section_buffer, "\x1b[90;47m"); // Dark grey on grey
-    for (int i = filled_width; i < bar_width; i++) {
-        if (i == blink_position) {
-            // This is the blinking element (the first unfilled dot)
-            if (should_show_character) {
-                strcat(progress_section_buffer, "·"); // Mid-dot for unfilled portion
-            } else {
-                strcat(progress_section_buffer, " "); // Space for blinking effect
-            }
-        } else {
-            // Regular unfilled dots never blink
-            strcat(progress_section_buffer, "·"); // Mid-dot for unfilled portion
-        }
-    }
-    strcat(progress_section_buffer, "] ");
-    strcat(progress_section_buffer, time_until_str);
-    strcat(progress_section_buffer, " ");
-    
-    // Reset terminal colors
-    strcat(progress_section_buffer, "\x1b[0m");
-    
-    // Add progress section to buffer only if there's enough room to display it
-    // For very small terminals, we might skip the progress section entirely
-    if (term_width >= min_term_width) {
-        // Check if we need to truncate the progress section
-        if (progress_section_column + strlen(plain_progress_section) > term_width) {
-            // Truncate the progress buffer to fit available width
-            int available_width = term_width - progress_section_column + 1;
-            if (available_width > 0) {
-                progress_section_buffer[available_width] = '\0';
-                strcat(progress_section_buffer, "\x1b[0m"); // Ensure color is reset
-            }
-        }
-        direct_print(status_line_y, progress_section_column, "%s", progress_section_buffer);
-    }
-}
-*/
-
-/**
- * Direct draw status bar - draws directly to the screen without buffering
- */
-void direct_draw_status_bar(time_t current_time, int time_since_sync) 
-{
-    struct tm* time_info = localtime(&current_time);
-    
-    // Determine if the current position indicator should blink
-    int current_second = time_info->tm_sec;
-    // Even seconds show the character, odd seconds hide it
-    int should_show_character = (current_second % 2 == 0);
-    
-    // Format date and time with hundredths
-    int hundredths = (ntp_getCurrentHundredths() / 10);
-    char datetime_str[40];
-    snprintf(datetime_str, sizeof(datetime_str), "%04d-%02d-%02d %02d:%02d:%02d.%01d UTC", 
-            time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday,
-            time_info->tm_hour, time_info->tm_min, time_info->tm_sec, hundredths);
-    
-    // Get NTP server name
-    char server_name_buffer[256];
-    if (!ntp_getServerName(server_name_buffer, sizeof(server_name_buffer))) 
-    {
-        strcpy(server_name_buffer, "Not connected");
-    }
-    
-    // Limit server name to a safe size (128 chars) to prevent buffer overflow
-    server_name_buffer[128] = '\0';
-    
-    // Calculate times since sync and until next sync in H:MM:SS format
-    char time_since_str[20] = "Never";
-    char time_until_str[20] = "Unknown";
-    int hours_since = 0, mins_since = 0, secs_since = 0;
-    int hours_until = 0, mins_until = 0, secs_until = 0;
-    
-    // Time since last sync
-    if (time_since_sync < 0) 
-    {
-        strcpy(time_since_str, "Never");
-    } 
-    else 
-    {
-        hours_since = time_since_sync / 3600;
-        mins_since = (time_since_sync % 3600) / 60;
-        secs_since = time_since_sync % 60;
-        snprintf(time_since_str, sizeof(time_since_str), "%d:%02d:%02d", hours_since, mins_since, secs_since);
-    }
-    
-    // Calculate next sync time
-    int seconds_to_next_sync = 7200 - (time_since_sync % 7200); // 7200 = 2 hours
-    if (time_since_sync < 0) 
-    {
-        seconds_to_next_sync = 7200;
-    }
-    
-    // Format time until next sync
-    hours_until = seconds_to_next_sync / 3600;
-    mins_until = (seconds_to_next_sync % 3600) / 60;
-    secs_until = seconds_to_next_sync % 60;
-    snprintf(time_until_str, sizeof(time_until_str), "%d:%02d:%02d", hours_until, mins_until, secs_until);
-    
-    // Format the server name
-    char server_name_buffer_formatted[64] = "";
-    if (strlen(server_name_buffer) > 0) 
-    {
-        snprintf(server_name_buffer_formatted, sizeof(server_name_buffer_formatted), "%.*s", (int)sizeof(server_name_buffer_formatted) - 1, server_name_buffer);
-    } 
-    else 
-    {
-        strcpy(server_name_buffer_formatted, "Not connected");
-    }
-    
-    // Format the left section with date/time and server name
-    char left_section[256];
-    snprintf(left_section, sizeof(left_section), " %s │ %s ", datetime_str, server_name_buffer_formatted);
-    
-    // Calculate progress as percentage of time elapsed in the sync cycle
-    float progress = 0.0;
-    if (time_since_sync >= 0) 
-    {
-        progress = (float)time_since_sync / (time_since_sync + seconds_to_next_sync);
-    }
-    
-    // Position cursor at the bottom line
-    int status_line_y = term_height;
-    
-    // First, draw the background line
-    set_cursor_position(status_line_y, 1);
-    printf("\x1b[30;47m"); // Black text on grey background
-    
-    // Print spaces for the full width of the terminal
-    for (int i = 0; i < term_width; i++) {
-        printf(" ");
-    }
-    printf("\x1b[0m"); // Reset colors
-    
-    // Draw the left section
-    set_cursor_position(status_line_y, 1);
-    printf("\x1b[30;47m%s\x1b[0m", left_section); // Black text on grey background
-    
-    // Build the progress bar section text WITHOUT formatting to calculate its true length
-    char plain_progress_section[512];
-    
-    // Create the divider, sync label and time
-    sprintf(plain_progress_section, "NTP Sync: %s [", time_since_str);
-    
-    // Calculate maximum size for progress section (max 50% of terminal width)
-    // Ensure a reasonable minimum for very small terminals
-    int min_term_width = 40; // Minimum reasonable terminal width
-    int effective_term_width = (term_width < min_term_width) ? min_term_width : term_width;
-    int max_progress_width = effective_term_width / 2;
-    
-    // Calculate size of fixed elements (dividers, times, labels)
-    int fixed_elements_width = strlen("NTP Sync: ") + strlen(time_since_str) +
-                            strlen(" [") + strlen(" [") + 
-                            strlen(time_until_str) + 1; // +1 for right padding space
-    
-    // Calculate width available for the actual progress bar
-    int bar_width = max_progress_width - fixed_elements_width;
-    if (bar_width < 10) bar_width = 10; // Ensure minimum bar width
-    
-    // Add placeholder characters for the bar
-    for (int i = 0; i < bar_width; i++) {
-        strcat(plain_progress_section, "X"); // Placeholder character
-    }
-    
-    // Add the divider and time until
-    strcat(plain_progress_section, "] ");
-    strcat(plain_progress_section, time_until_str);
-    strcat(plain_progress_section, " "); // Right padding space
-    
-    // Calculate where to position the progress section to be right-justified
-    // Ensure progress_section_column is never less than the left section length + minimum spacing
-    int left_section_length = strlen(left_section);
-    int min_progress_section_column = left_section_length + 2; // +2 for minimum spacing
-    int progress_section_column = term_width - strlen(plain_progress_section) + 1;
-    
-    // If terminal is too small, ensure at least the left section is completely visible
-    if (progress_section_column < min_progress_section_column) {
-        progress_section_column = min_progress_section_column;
-    }
-    
-    // Only proceed with drawing the progress section if there's enough room
-    if (term_width >= min_term_width) {
-        // Position cursor for the progress section
-        set_cursor_position(status_line_y, progress_section_column);
-        
-        // Start with black text on grey background
-        printf("\x1b[30;47m"); // Black text on grey background
-        
-        // Add divider and sync label with time
-        printf("NTP Sync: %s [", time_since_str);
-        
-        // Calculate filled portion of the bar
-        int filled_width = (int)(progress * bar_width);
-        if (filled_width > bar_width) filled_width = bar_width;
-        
-        // Calculate the fractional part of the progress to determine if we should show a half block
-        float fractional_part = (progress * bar_width) - filled_width;
-        bool show_half_block = (fractional_part >= 0.1) && (filled_width < bar_width);
-        
-        // Determine the position of the blinking element
-        int blink_position = filled_width;
-        if (!show_half_block && filled_width > 0) {
-            // When no half block and we have filled blocks, blink the last filled block
-            blink_position = filled_width - 1;
-        }
-        
-        // Add the filled portion (bright yellow blocks on grey)
-        printf("\x1b[93;47m"); // Bright yellow on grey
-        
-        // Add full blocks for completed sections
-        for (int i = 0; i < filled_width; i++) {
-            if (i == blink_position && !show_half_block) {
-                // This is the blinking element (the last filled block)
-                if (should_show_character) {
-                    printf("█"); // Full block for complete fill
-                } else {
-                    printf(" "); // Space for blinking effect
-                }
-            } else {
-                // Regular filled blocks never blink
-                printf("█"); // Full block for complete fill
-            }
-        }
-        
-        // Handle half block if needed
-        if (show_half_block) {
-            if (blink_position == filled_width) {
-                // This half block is the blinking element
-                if (should_show_character) {
-                    printf("▌"); // Half block for partial fill
-                } else {
-                    printf(" "); // Space for blinking effect
-                }
-            } else {
-                // This half block is not the blinking element
-                printf("▌"); // Half block for partial fill
-            }
-            filled_width++; // Increment to account for the half block position
-        }
-        
-        // Add the empty portion (dark grey mid-dots on grey)
-        printf("\x1b[90;47m"); // Dark grey on grey
-        for (int i = filled_width; i < bar_width; i++) {
-            if (i == blink_position) {
-                // This is the blinking element (the first unfilled dot)
-                if (should_show_character) {
-                    printf("·"); // Mid-dot for unfilled portion
-                } else {
-                    printf(" "); // Space for blinking effect
-                }
-            } else {
-                // Regular unfilled dots never blink
-                printf("·"); // Mid-dot for unfilled portion
-            }
-        }
-        
-        // Add the final part of the progress section
-        printf("] \x1b[30;47m%s ", time_until_str);
-        
-        // Reset terminal colors
-        printf("\x1b[0m");
-    }
-    
-    // Flush to ensure immediate display
-    fflush(stdout);
+    render_resize(&renderer, term_width, term_height);
+    if (budget_bytes_per_sec > 0) budget_resize(&budget, term_width, term_height);
 }
 
 void init_terminal() 
@@ -932,10 +209,20 @@ void init_terminal()
     tcgetattr(0, &old_termios);
     new_termios = old_termios;
     new_termios.c_lflag &= ~ECHO; // Turn off echo
+    if (focus_reporting || term_caps_pending(&caps))
+    {
+        // Deliver focus reports and query replies as they arrive rather than
+        // a line at a time
+        new_termios.c_lflag &= ~ICANON;
+        new_termios.c_cc[VMIN] = 1;
+        new_termios.c_cc[VTIME] = 0;
+    }
     tcsetattr(0, TCSANOW, &new_termios);
     
     // Hide cursor
     printf("%s", HIDE_CURSOR);
+    if (focus_reporting) printf("%s", FOCUS_REPORTING_ON);
+    if (term_caps_pending(&caps)) printf("%s", TERM_CAPS_QUERY);
     fflush(stdout);
 }
 
@@ -945,8 +232,12 @@ void init_terminal()
  */
 void restore_terminal() 
 {
+    // Put stdout back into blocking mode for the final messages
+    oq_close(&output);
+
     // Restore cursor
     printf("%s", SHOW_CURSOR);
+    if (focus_reporting) printf("%s", FOCUS_REPORTING_OFF);
     
     // Clear screen
     printf("%s%s", CLEAR_SCREEN, CURSOR_HOME);
@@ -956,72 +247,344 @@ void restore_terminal()
     struct termios old_termios;
     tcgetattr(0, &old_termios);
     old_termios.c_lflag |= ECHO; // Turn on echo
+    old_termios.c_lflag |= ICANON;
     tcsetattr(0, TCSANOW, &old_termios);
 }
 
 /**
- * Attempt to sync with NTP server
+ * Use synchronized output from now on, if the terminal turned out to support it
  */
-int sync_with_ntp() 
+static void apply_terminal_caps(void)
 {
-    char server_name_buffer[256];
-    if (!ntp_getServerName(server_name_buffer, sizeof(server_name_buffer))) 
+    sync_output_supported = (caps.sync_output == CAP_YES);
+    renderer.sync_output = sync_output_supported && budget_bytes_per_sec == 0;
+    if (budget_bytes_per_sec > 0) budget.sync_output = sync_output_supported;
+}
+
+/**
+ * Read whatever the terminal sent: focus reports (CSI I / CSI O) and the
+ * replies to the capability query
+ */
+static void handle_terminal_input(void)
+{
+    char buf[64];
+
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
     {
-        strcpy(server_name_buffer, "Not connected.");
+        // Nothing more will come from the terminal - stop watching it
+        output.wake_fd = -1;
+        return;
     }
-    
-    // Display sync message
-    printf("Syncing with NTP server: %s", server_name_buffer);
-    
-    int result = ntp_sync();
-    if (result == 0) 
-    {
-        printf("Sync successful.\n");
-        return 1;
-    } 
-    else 
+
+    for (ssize_t i = 0; i < n; i++)
     {
-        printf("Sync failed with error code: %d", result);
-        return 0;
+        switch (term_caps_input(&caps, buf[i]))
+        {
+          case TERM_EVENT_FOCUS_IN:
+            terminal_focused = true;
+            break;
+          case TERM_EVENT_FOCUS_OUT:
+            terminal_focused = false;
+            break;
+          case TERM_EVENT_CAPS_DONE:
+            // Remember the answer so the next start doesn't have to ask
+            apply_terminal_caps();
+            term_caps_save(&caps);
+            if (!focus_reporting) output.wake_fd = -1;
+            break;
+          default:
+            break;
+        }
     }
 }
 
-int supports_ansi() 
+/**
+ * Show the frames of a running `ntp-clock --serve` on this terminal
+ */
+static int attach_to_server(const char *path)
 {
-    if (!isatty(STDOUT_FILENO)) return 0;
+    int fd = broadcast_connect(path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot attach to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
 
-    struct termios t;
-    tcgetattr(STDIN_FILENO, &t);
-    t.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &t);
+    signal(SIGINT, handle_sigint);
+    signal(SIGWINCH, handle_sigwinch);
+    init_terminal();
+    update_terminal_size();
+    broadcast_send_hello(fd, term_width, term_height, sync_output_supported);
 
-    printf("\x1B[c");
-    fflush(stdout);
+    char buf[65536];
+    bool server_gone = false;
+    while (keep_running && !server_gone)
+    {
+      if (terminal_resized)
+      {
+        // The server answers a new geometry with a complete repaint
+        terminal_resized = 0;
+        update_terminal_size();
+        broadcast_send_hello(fd, term_width, term_height, sync_output_supported);
+      }
 
-    char buf[32] = {0};
-    alarm(1);
-    int r = read(STDIN_FILENO, buf, sizeof(buf) - 1);
-    alarm(0);
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (poll(&pfd, 1, -1) <= 0) continue; // Interrupted by a resize
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &t);
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0)
+      {
+        server_gone = (n == 0 || errno != EINTR);
+        continue;
+      }
 
-    return (r > 0 && strstr(buf, "\x1B[") != NULL);
+      // Copy to the terminal; if it can't keep up the server skips frames for us
+      for (ssize_t done = 0; done < n; )
+      {
+        ssize_t w = write(STDOUT_FILENO, buf + done, n - done);
+        if (w < 0)
+        {
+          if (errno == EINTR) continue;
+          server_gone = true;
+          break;
+        }
+        done += w;
+      }
+    }
+
+    close(fd);
+    restore_terminal();
+    if (server_gone) printf("Clock server went away.\n");
+    return 0;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stop_ntp_server(void)
+{
+    ntp_server_stop(ntp_server);
+    ntp_server = NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n\n", prog);
+    fprintf(stderr, "      --budget=BYTES  Limit output to BYTES per second (serial consoles)\n");
+    fprintf(stderr, "      --no-tenths     Show whole seconds only\n");
+    fprintf(stderr, "      --focus         Update once a second while the terminal is unfocused\n");
+    fprintf(stderr, "      --json          Stream JSON Lines records instead of drawing the clock\n");
+    fprintf(stderr, "      --binary        Stream fixed-size binary records instead of drawing the clock\n");
+    fprintf(stderr, "      --tick=MS       Milliseconds between records (0 = sync events only)\n");
+    fprintf(stderr, "      --serve[=PATH]  Keep time and render for attached viewers on a Unix socket\n");
+    fprintf(stderr, "      --attach[=PATH] Show the clock of a running --serve instance\n");
+    fprintf(stderr, "      --ticks[=PATH]  Wake local subscribers on every NTP second (Unix socket)\n");
+    fprintf(stderr, "      --graph         Plot the offset and round-trip time of each sync\n");
+    fprintf(stderr, "      --no-share      Sync on our own instead of sharing one leader's syncs\n");
+    fprintf(stderr, "      --capture=PATH  Record NTP exchanges to PATH (pcapng, rotated at 16 MB, 4 kept)\n");
+    fprintf(stderr, "      --statsdir=DIR  Log each sync to DIR/peerstats and DIR/loopstats, as ntpd does\n");
+    fprintf(stderr, "      --multicast[=GROUP]  Sync from NTP multicasts to GROUP (default %s)\n", NTP_MULTICAST_GROUP);
+    fprintf(stderr, "                      and broadcasts on port 123 instead of polling\n");
+    fprintf(stderr, "      --ntp-server[=PORT]  Serve our time to other hosts over NTP (default port 123)\n");
+    fprintf(stderr, "      --keys=FILE     Symmetric keys (ntpd keyfile) for --key and for --ntp-server clients\n");
+    fprintf(stderr, "      --key=ID        Authenticate our syncs with key ID from --keys\n");
+    fprintf(stderr, "  -h, --help          Show this help\n");
 }
 
 int main(int argc, char* argv[]) 
 {
-    if (!supports_ansi()) 
+    static const struct option long_options[] = {
+        { "budget", required_argument, NULL, 'B' },
+        { "no-tenths", no_argument, NULL, 'T' },
+        { "focus", no_argument, NULL, 'F' },
+        { "json", no_argument, NULL, 'J' },
+        { "binary", no_argument, NULL, 'R' },
+        { "tick", required_argument, NULL, 'K' },
+        { "serve", optional_argument, NULL, 'S' },
+        { "attach", optional_argument, NULL, 'A' },
+        { "ticks", optional_argument, NULL, 'P' },
+        { "no-share", no_argument, NULL, 'N' },
+        { "graph", no_argument, NULL, 'G' },
+        { "capture", required_argument, NULL, 'C' },
+        { "statsdir", required_argument, NULL, 'D' },
+        { "multicast", optional_argument, NULL, 'M' },
+        { "ntp-server", optional_argument, NULL, 'V' },
+        { "keys", required_argument, NULL, 'k' },
+        { "key", required_argument, NULL, 'I' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
     {
-        printf("No ANSI support.\n");
-        exit(1);
+        switch (opt)
+        {
+        case 'B':
+            budget_bytes_per_sec = atoi(optarg);
+            if (budget_bytes_per_sec <= 0)
+            {
+                fprintf(stderr, "Invalid budget: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            show_tenths = false;
+            break;
+        case 'F':
+            focus_reporting = true;
+            break;
+        case 'J':
+        case 'R':
+            headless = true;
+            headless_format = (opt == 'J') ? RECORD_JSON : RECORD_BINARY;
+            break;
+        case 'K':
+            headless_tick_ms = atoi(optarg);
+            if (headless_tick_ms < 0)
+            {
+                fprintf(stderr, "Invalid tick: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+        case 'A':
+            serve = (opt == 'S');
+            attach = (opt == 'A');
+            if (optarg != NULL)
+            {
+                snprintf(socket_path, sizeof(socket_path), "%s", optarg);
+            }
+            break;
+        case 'P':
+            ticks = true;
+            if (optarg != NULL)
+            {
+                snprintf(tick_socket_path, sizeof(tick_socket_path), "%s", optarg);
+            }
+            break;
+        case 'G':
+            show_graph = true;
+            break;
+        case 'N':
+            share_syncs = false;
+            break;
+        case 'C':
+            snprintf(capture_path, sizeof(capture_path), "%s", optarg);
+            break;
+        case 'D':
+            snprintf(stats_dir, sizeof(stats_dir), "%s", optarg);
+            break;
+        case 'M':
+            multicast = true;
+            if (optarg != NULL)
+            {
+                snprintf(multicast_group, sizeof(multicast_group), "%s", optarg);
+            }
+            break;
+        case 'V':
+            ntp_server_port = optarg != NULL ? atoi(optarg) : 123;
+            if (ntp_server_port <= 0 || ntp_server_port > 65535)
+            {
+                fprintf(stderr, "Invalid port: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k':
+            snprintf(keys_path, sizeof(keys_path), "%s", optarg);
+            break;
+        case 'I':
+            key_id = (uint32_t)strtoul(optarg, NULL, 10);
+            if (key_id == 0)
+            {
+                fprintf(stderr, "Invalid key ID: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
-    printf("ANSI supported.\n");
 
+    if (socket_path[0] == '\0')
+    {
+        broadcast_default_path(socket_path, sizeof(socket_path));
+    }
+    if (tick_socket_path[0] == '\0')
+    {
+        tick_default_path(tick_socket_path, sizeof(tick_socket_path));
+    }
+
+    // Headless output and the servers don't draw on a terminal
+    if (!headless && !serve && !ticks)
+    {
+        term_caps_detect(&caps);
+        if (!isatty(STDOUT_FILENO) || !caps.ansi)
+        {
+            printf("No ANSI support.\n");
+            exit(1);
+        }
+        sync_output_supported = (caps.sync_output == CAP_YES);
+    }
+
+    // A viewer only copies frames; the server does the timekeeping
+    if (attach)
+    {
+        // A viewer never reads the terminal, so it can't take replies to a
+        // query; without a cached answer it goes without synchronized output
+        if (term_caps_pending(&caps)) caps.sync_output = CAP_NO;
+        return attach_to_server(socket_path);
+    }
+
+    // Recording starts before the first sync and is written out at exit
+    if (capture_path[0] != '\0')
+    {
+        ntp_recorder_config_t capture = { .max_bytes = CAPTURE_MAX_BYTES, .files = CAPTURE_FILES };
+        snprintf(capture.path, sizeof(capture.path), "%s", capture_path);
+        if (!ntp_recorder_start(&capture))
+        {
+            fprintf(stderr, "Cannot record to %s: %s\n", capture_path, strerror(errno));
+            return 1;
+        }
+        atexit(ntp_recorder_stop);
+    }
+    if (stats_dir[0] != '\0')
+    {
+        ntp_stats_config_t stats = { .ring_records = 0 };
+        snprintf(stats.dir, sizeof(stats.dir), "%s", stats_dir);
+        if (!ntp_stats_start(&stats))
+        {
+            fprintf(stderr, "Cannot write statistics to %s: %s\n", stats_dir, strerror(errno));
+            return 1;
+        }
+        atexit(ntp_stats_stop);
+    }
+    if (keys_path[0] != '\0')
+    {
+        unsigned line;
+        keys = ntp_keyring_load(keys_path, &line);
+        if (keys == NULL)
+        {
+            if (line != 0) fprintf(stderr, "Invalid key at %s:%u\n", keys_path, line);
+            else fprintf(stderr, "Cannot read keys from %s: %s\n", keys_path, strerror(errno));
+            return 1;
+        }
+    }
+    if (key_id != 0 && !ntp_keyring_has(keys, key_id))
+    {
+        if (keys == NULL) fprintf(stderr, "--key needs a keyfile (--keys)\n");
+        else fprintf(stderr, "No key %u in %s\n", key_id, keys_path);
+        return 1;
+    }
 
-    // Register signal handler for CTRL+C
-    signal(SIGINT, handle_sigint);
-    signal(SIGWINCH, handle_sigwinch);
-    
     // Initialize NTP client with configuration
     ntp_config_t config;
     memset(&config, 0, sizeof(config));
@@ -1030,6 +593,7 @@ int main(int argc, char* argv[])
     config.timeout_ms = 5000;  // 5 second timeout
     config.retry_count = 3;    // Retry 3 times
     config.sync_interval = 7200; // Sync every 2 hours (7200 seconds)
+    config.key_id = key_id;
     
     // Initialize the NTP client with the configuration
     ntp_status_t init_status = ntp_init(&config);
@@ -1040,9 +604,76 @@ int main(int argc, char* argv[])
     
     // Set the NTP server (now that the client is properly initialized)
     ntp_setServer(DEFAULT_NTP_SERVER);
+    ntp_setKeys(keys);
+
+    // Let one instance on this host do the polling for everyone; on failure
+    // we simply sync on our own. A leader's syncs aren't authenticated.
+    if (share_syncs && key_id == 0)
+    {
+        ntp_enableSharing(NULL);
+    }
+
+    // Broadcasts keep us synced; the background sync only polls the
+    // server if they stop coming
+    if (multicast)
+    {
+        ntp_broadcast_config_t listen = { .port = 123, .calibrate_interval = MULTICAST_CALIBRATE_SEC };
+        snprintf(listen.group, sizeof(listen.group), "%s", multicast_group);
+        ntp_status_t status = ntp_startBroadcastClient(&listen);
+        if (status != NTP_OK)
+        {
+            fprintf(stderr, "Cannot listen for multicasts to %s: %s\n", multicast_group,
+                    status == NTP_ERROR_INVALID_PARAM ? "not a multicast group" : strerror(errno));
+            return 1;
+        }
+        atexit(ntp_stopBroadcastClient);
+    }
+
+    // Until the first sync, clients are told our clock is unsynchronized
+    if (ntp_server_port != 0)
+    {
+        ntp_server_config_t server_config = { .port = (uint16_t)ntp_server_port, .keys = keys };
+        ntp_server = ntp_server_start(&server_config);
+        if (ntp_server == NULL)
+        {
+            fprintf(stderr, "Cannot serve NTP on port %d: %s\n", ntp_server_port, strerror(errno));
+            return 1;
+        }
+        atexit(stop_ntp_server);
+    }
+
+    if (headless)
+    {
+        return headless_run(headless_format, headless_tick_ms);
+    }
+    if (serve)
+    {
+        return broadcast_serve(socket_path);
+    }
+    if (ticks)
+    {
+        return tick_serve(tick_socket_path);
+    }
+
+    // Register signal handler for CTRL+C
+    signal(SIGINT, handle_sigint);
+    signal(SIGWINCH, handle_sigwinch);
     
     // Initialize terminal and clear it
+    render_init(&renderer, term_width, term_height);
+    renderer.sync_output = sync_output_supported;
+    if (budget_bytes_per_sec > 0)
+    {
+        // The budget renderer does its own synchronized output around the
+        // minimal update; the frame itself only feeds the screen model
+        budget_init(&budget, budget_bytes_per_sec, term_width, term_height);
+        budget.sync_output = sync_output_supported;
+        renderer.sync_output = false;
+    }
     init_terminal();
+    oq_init(&output, STDOUT_FILENO);
+    if (focus_reporting || term_caps_pending(&caps)) output.wake_fd = STDIN_FILENO;
+    oq_set_blocking(&output, true);
     update_terminal_size();
     
     // Clear screen at startup
@@ -1053,14 +684,14 @@ int main(int argc, char* argv[])
     terminal_resized = 1;
     update_terminal_size();
     
-    // Perform initial sync
-    // int message_line = term_height - 3;
-    
-    // Perform initial NTP sync
-    sync_with_ntp();
+    // Sync in the background; until the first sync (ours or another
+    // instance's) the clock shows the system time, marked as unsynced
+    ntp_startBackgroundSync();
     
     // Do an initial full draw of the clock and status bar
-    direct_clear_screen();
+    render_invalidate(&renderer);
+    if (budget_bytes_per_sec > 0) budget_invalidate(&budget);
+    oq_set_blocking(&output, false);
 
     while (keep_running) 
     {
@@ -1069,39 +700,89 @@ int main(int argc, char* argv[])
       {
         update_terminal_size();
         terminal_resized = 0;
-        // Redraw the whole screen
-        direct_clear_screen();
+        // Redraw the whole screen as part of the next frame
+        render_invalidate(&renderer);
+        if (budget_bytes_per_sec > 0) budget_invalidate(&budget);
       }
     
-      // Get current time and time since last sync
-      time_t current_time = ntp_getCurrentTime();
-      int time_since_sync = ntp_getTimeSinceLastSync();
+      // Update terminal size to handle possible window resizing
+      update_terminal_size();
     
-      // Check if it's time to sync again (every 2 hours)
-      if (time_since_sync >= 7200 || time_since_sync < 0)  // 7200 seconds = 2 hours
+      // Get the most up-to-date time, read once so the seconds, the tenths,
+      // the sync status and the wakeup schedule all agree (system time until
+      // the first sync)
+      ntp_sync_info_t info;
+      ntp_getSyncInfo(&info);
+
+      // Record each new sync for the history graph
+      if (show_graph && info.synced && info.sync_count != history_syncs)
       {
-        direct_clear_screen(); 
-        sync_with_ntp();
-        direct_clear_screen();
+        history_syncs = info.sync_count;
+        history_add(&history, (time_t)((info.time_ns - info.sync_age_ns) / 1000000000LL),
+                    info.offset_ns, info.delay_ns);
       }
 
-
-      // Update terminal size to handle possible window resizing
-      update_terminal_size();
-    
-      // Get the most up-to-date time including hundredths for a smooth display
-      current_time = ntp_getCurrentTime();
-      time_since_sync = ntp_getTimeSinceLastSync();
-    
-      // Draw clock components directly to screen
-      draw_full_clock(current_time);
-      direct_draw_status_bar(current_time, time_since_sync);
+      char server_name_buffer[256];
+      clock_frame_t frame;
+      frame.now = (time_t)(info.time_ns / 1000000000LL);
+      int micros = (int)(info.time_ns % 1000000000LL / 1000);
+      frame.tenths = micros / 100000;
+      frame.hide_tenths = !show_tenths || !terminal_focused;
+      frame.history = show_graph ? &history : NULL;
+      frame.time_since_sync = info.synced ? info.sync_age_ns / 1000000000LL : -1;
+      frame.server_name = ntp_getServerName(server_name_buffer, sizeof(server_name_buffer))
+                          ? server_name_buffer : NULL;
+
+      // Skip this frame if the previous one is still draining over a slow link;
+      // the next frame will be built from the current time instead
+      if (oq_ready(&output))
+      {
+        // Draw the frame and queue it to be sent in one batch
+        if (budget_bytes_per_sec > 0)
+        {
+            // Send only the cells that changed, as far as the budget allows
+            if (budget_frame(&budget, &renderer, &frame, monotonic_ns()))
+            {
+                oq_submit(&output, &budget.out);
+            }
+        }
+        else
+        {
+            render_frame(&renderer, &frame);
+            oq_submit(&output, &renderer.out);
+        }
+      }
     
-      // Sleep for a shorter interval to provide smoother hundredths updates
-      usleep(100000); // 100ms for smoother tenth display
+      // Sleep until the display next changes visibly (the next tenth, or the
+      // next second when tenths are hidden), but no sooner than the link can
+      // take another frame; the extra millisecond makes sure we wake up after
+      // the change rather than just before it
+      int sleep_ms = (render_next_change_us(&frame, micros) + 999) / 1000 + 1;
+      int step_ms = frame.hide_tenths ? 1000 : 100;
+      while (sleep_ms < output.interval_ms)
+      {
+        sleep_ms += step_ms;
+      }
+
+      // Write out the frame meanwhile; a resize or a focus report ends the
+      // sleep early
+      int waited = 0;
+      while (waited < sleep_ms && !terminal_resized)
+      {
+        waited += oq_wait(&output, sleep_ms - waited);
+        if (output.woken)
+        {
+          output.woken = false;
+          handle_terminal_input();
+          break;
+        }
+      }
     }
 
     // Cleanup and restore terminal
+    ntp_stopBackgroundSync();
+    render_free(&renderer);
+    if (budget_bytes_per_sec > 0) budget_free(&budget);
     restore_terminal();
     direct_print(term_height / 2, (term_width - 26) / 2, "Clock display terminated.");
     
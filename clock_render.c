@@ -0,0 +1,1029 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "clock_render.h"
+
+// ANSI escape codes
+#define CLEAR_SCREEN "\x1b[2J"
+#define CURSOR_HOME "\x1b[H"
+#define ANSI_CURSOR_POSITION "\x1b[%d;%dH"
+#define SYNC_BEGIN "\x1b[?2026h"
+#define SYNC_END "\x1b[?2026l"
+#define SET_SCROLL_REGION "\x1b[%d;%dr"
+#define RESET_SCROLL_REGION "\x1b[r"
+#define SCROLL_UP "\x1b[%dS"
+#define CURSOR_FORWARD "\x1b[%dC"
+#define ERASE_TO_EOL "\x1b[K"
+
+// Buffer constants
+#define MAX_LINE_LENGTH 512
+#define RENDER_BUFFER_INITIAL 4096
+
+const char* DIGIT_ART[10][5] =
+{
+    {
+        " ████ ",
+        "██  ██",
+        "██  ██",
+        "██  ██",
+        " ████ "
+    },
+    {
+        "  ██  ",
+        " ███  ",
+        "  ██  ",
+        "  ██  ",
+        " ████ "
+    },
+    {
+        " ████ ",
+        "    ██",
+        " ████ ",
+        "██    ",
+        "██████"
+    },
+    {
+        " ████ ",
+        "    ██",
+        " ████ ",
+        "    ██",
+        " ████ "
+    },
+    {
+        "██  ██",
+        "██  ██",
+        "██████",
+        "    ██",
+        "    ██"
+    },
+    {
+        "██████",
+        "██    ",
+        "██████",
+        "    ██",
+        "██████"
+    },
+    {
+        " ████ ",
+        "██    ",
+        "██████",
+        "██  ██",
+        " ████ "
+    },
+    {
+        "██████",
+        "    ██",
+        "   ██ ",
+        "  ██  ",
+        " ██   "
+    },
+    {
+        " ████ ",
+        "██  ██",
+        " ████ ",
+        "██  ██",
+        " ████ "
+    },
+    {
+        " ████ ",
+        "██  ██",
+        " █████",
+        "    ██",
+        " ████ "
+    }
+};
+
+const char* COLON_ART[5] =
+{
+    "  ",
+    "██",
+    "  ",
+    "██",
+    "  "
+};
+
+/**
+ * Append raw bytes to a render buffer, growing it as needed
+ */
+void rb_write(render_buffer_t *b, const char *data, size_t len)
+{
+    if (b->len + len > b->cap) {
+        size_t new_cap = b->cap ? b->cap : RENDER_BUFFER_INITIAL;
+        while (new_cap < b->len + len) {
+            new_cap *= 2;
+        }
+        char *grown = realloc(b->data, new_cap);
+        if (grown == NULL) {
+            // Out of memory - drop the output rather than crash the clock
+            return;
+        }
+        b->data = grown;
+        b->cap = new_cap;
+        b->allocations++;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+void rb_puts(render_buffer_t *b, const char *s)
+{
+    rb_write(b, s, strlen(s));
+}
+
+void rb_printf(render_buffer_t *b, const char *format, ...)
+{
+    char temp_buffer[MAX_LINE_LENGTH];
+    va_list args;
+
+    va_start(args, format);
+    int ret = vsnprintf(temp_buffer, sizeof(temp_buffer), format, args);
+    va_end(args);
+
+    if (ret < 0) return;
+    if (ret >= (int)sizeof(temp_buffer)) {
+        // Truncation occurred
+        ret = sizeof(temp_buffer) - 1;
+    }
+    rb_write(b, temp_buffer, ret);
+}
+
+void rb_reset(render_buffer_t *b)
+{
+    b->len = 0;
+}
+
+void render_init(clock_renderer_t *r, int width, int height)
+{
+    memset(r, 0, sizeof(*r));
+    render_resize(r, width, height);
+    r->full_redraw = true;
+}
+
+void render_free(clock_renderer_t *r)
+{
+    free(r->out.data);
+    free(r->line.data);
+    for (int i = 0; i < RENDER_MAX_SEGMENTS; i++) {
+        free(r->segments[i].text.data);
+    }
+    memset(r, 0, sizeof(*r));
+}
+
+void render_resize(clock_renderer_t *r, int width, int height)
+{
+    if (r->width == width && r->height == height) return;
+    r->width = width;
+    r->height = height;
+    render_invalidate(r);
+}
+
+/**
+ * Forget what is on screen so the next frame repaints everything
+ */
+void render_invalidate(clock_renderer_t *r)
+{
+    r->full_redraw = true;
+    r->segment_count = 0;
+    r->history_valid = false;
+}
+
+/**
+ * Number of terminal columns taken by a UTF-8 string (one per code point)
+ */
+static int display_width(const char *s)
+{
+    int width = 0;
+    for (; *s; s++) {
+        if (((unsigned char)*s & 0xc0) != 0x80) width++;
+    }
+    return width;
+}
+
+/**
+ * Copy a UTF-8 string into a buffer, stopping after max_cols columns
+ *
+ * @return Number of columns copied
+ */
+static int append_clipped(render_buffer_t *b, const char *text, int max_cols)
+{
+    int cols = 0;
+    const char *p = text;
+
+    while (*p) {
+        if (((unsigned char)*p & 0xc0) != 0x80) {
+            if (cols == max_cols) break;
+            cols++;
+        }
+        p++;
+    }
+    rb_write(b, text, p - text);
+    return cols;
+}
+
+/**
+ * Emit a run of text at the specified position, unless the exact same text
+ * was already drawn there since the screen was last cleared
+ */
+static void render_segment(clock_renderer_t *r, int row, int col, const char *text, size_t len)
+{
+    render_segment_t *seg = NULL;
+
+    for (int i = 0; i < r->segment_count; i++) {
+        if (r->segments[i].row == row && r->segments[i].col == col) {
+            seg = &r->segments[i];
+            break;
+        }
+    }
+
+    if (seg != NULL && seg->text.len == len && memcmp(seg->text.data, text, len) == 0) {
+        return; // Already on screen
+    }
+
+    if (seg == NULL && r->segment_count < RENDER_MAX_SEGMENTS) {
+        seg = &r->segments[r->segment_count++];
+        seg->row = row;
+        seg->col = col;
+    }
+    if (seg != NULL) {
+        rb_reset(&seg->text);
+        rb_write(&seg->text, text, len);
+    }
+
+    rb_printf(&r->out, ANSI_CURSOR_POSITION, row, col);
+    rb_write(&r->out, text, len);
+}
+
+/**
+ * Print at the specified position
+ */
+static void render_print(clock_renderer_t *r, int row, int col, const char *text)
+{
+    render_segment(r, row, col, text, strlen(text));
+}
+
+/**
+ * Clear screen and position cursor at top
+ */
+void render_clear_screen(clock_renderer_t *r)
+{
+    rb_puts(&r->out, CLEAR_SCREEN CURSOR_HOME);
+    r->segment_count = 0;
+}
+
+/**
+ * Render a complete frame into the output buffer as a single batch
+ *
+ * Only segments that changed since the previous frame are emitted, top to
+ * bottom, each in one piece. When the terminal supports synchronized output
+ * the batch is bracketed with DEC mode 2026 so it is presented atomically.
+ */
+void render_frame(clock_renderer_t *r, const clock_frame_t *frame)
+{
+    size_t start = r->out.len;
+
+    if (r->sync_output) rb_puts(&r->out, SYNC_BEGIN);
+    size_t body = r->out.len;
+
+    if (r->full_redraw) {
+        render_clear_screen(r);
+        r->full_redraw = false;
+    }
+    draw_full_clock(r, frame);
+    if (frame->history != NULL) draw_history(r, frame->history);
+    draw_status_bar(r, frame);
+
+    if (r->out.len == body) {
+        // Nothing changed - don't send an empty synchronized update
+        r->out.len = start;
+        return;
+    }
+    if (r->sync_output) rb_puts(&r->out, SYNC_END);
+}
+
+/**
+ * Work out how long the screen stays the same after a frame
+ *
+ * Everything on screen apart from the tenths - the clock digits, the status
+ * bar time, the sync age and countdown, the progress bar cells and the blink
+ * toggle - only ever changes on a whole second, so the next visible change is
+ * the next tenth when tenths are shown and the next second otherwise.
+ *
+ * @param frame  Frame currently on screen
+ * @param micros Microseconds elapsed since frame->now
+ * @return Microseconds until the display next changes
+ */
+int render_next_change_us(const clock_frame_t *frame, int micros)
+{
+    if (micros < 0) micros = 0;
+    if (micros >= 1000000) return 0;
+    if (frame->hide_tenths) return 1000000 - micros;
+    return (micros / 100000 + 1) * 100000 - micros;
+}
+
+/**
+ * Draw the tenths of a second at the specified position
+ * This should only be called for the bottom line (line 4)
+ */
+static void draw_hundredths(clock_renderer_t *r, int row, int col, int hundredths, bool hidden,
+                            const char *digit_color)
+{
+    // Check if row is valid
+    if (row < 0) return;
+
+    // Make sure the column is valid
+    if (col < 1) col = 1;
+
+    // Format the hundredths display text
+    char hundredths_buffer[40]; // Buffer for the hundredths display
+    memset(hundredths_buffer, 0, sizeof(hundredths_buffer));
+
+    if (hidden) {
+        // Whole seconds only - keep "UTC" next to the digits and blank the rest
+        render_print(r, row, col, "\x1b[97m UTC\x1b[0m  ");
+        return;
+    }
+
+    // Format the display with colors using separate strcat calls for each color segment
+    // Dark gray dot
+    strcat(hundredths_buffer, "\x1b[90m");
+    strcat(hundredths_buffer, ".");
+    strcat(hundredths_buffer, "\x1b[0m");
+
+    // Hundredths in the digit colour
+    strcat(hundredths_buffer, digit_color);
+    char temp[16];
+    snprintf(temp, sizeof(temp), "%01d", hundredths);
+    strcat(hundredths_buffer, temp);
+    strcat(hundredths_buffer, "\x1b[0m");
+
+    // White "UTC" text
+    strcat(hundredths_buffer, "\x1b[97m");
+    strcat(hundredths_buffer, " UTC");
+    strcat(hundredths_buffer, "\x1b[0m");
+
+    render_print(r, row, col, hundredths_buffer);
+}
+
+/**
+ * First screen row of the clock digits
+ */
+static int clock_top_row(const clock_renderer_t *r)
+{
+    int start_row = (r->height - 5) / 2 - 2; // 5 is the height of digits, -2 to add some margin
+    if (start_row < 1) start_row = 1;
+    return start_row;
+}
+
+/**
+ * Draw the clock digits at the center of the screen
+ */
+void draw_full_clock(clock_renderer_t *r, const clock_frame_t *frame)
+{
+    struct tm time_buf;
+    struct tm* time_info = localtime_r(&frame->now, &time_buf);
+
+    // Adding 1 space between each element
+    // Including space for ANSI color codes
+    int start_row = clock_top_row(r);
+
+    // Bright red digits once synced; yellow while showing the unsynced system clock
+    const char *digit_color = frame->time_since_sync < 0 ? "\x1b[33m" : "\x1b[91m";
+
+    // Precalculate the full width of the clock display
+    // 6 digits (each 6 chars wide) + 2 colons (each 2 chars wide) + 7 separations (each 1 space)
+    // Plus ANSI color codes which don't affect visible width
+    int clock_display_width = 6 * 6 + 2 * 2 + 7;
+
+    // Width of the hundredths display: ".0 UTC" 6 chars plus ANSI codes
+    int hundredths_display_width = 6;
+
+    // Full width including hundredths display and some spacing
+    int total_display_width = clock_display_width + 3 + hundredths_display_width;
+    // Calculate starting column for horizontal centering of the entire display (clock + hundredths)
+    int start_col = (r->width - total_display_width) / 2;
+    if (start_col < 1) start_col = 1;
+
+    // Calculate the starting column for the hundredths display
+    int hundredths_col = start_col + clock_display_width + 1; // Adjusted for better alignment
+
+    // Draw each line of the digits
+    char buffer[512]; // Larger buffer to accommodate color codes and spacing
+    for (int line = 0; line < 5; line++)
+    {
+        memset(buffer, 0, sizeof(buffer));
+
+        // Hours tens digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_hour / 10][line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Hours ones digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_hour % 10][line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Colon - light black (dark gray)
+        strcat(buffer, "\x1b[90m");
+        strcat(buffer, COLON_ART[line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Minutes tens digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_min / 10][line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Minutes ones digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_min % 10][line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Colon - light black (dark gray)
+        strcat(buffer, "\x1b[90m");
+        strcat(buffer, COLON_ART[line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Seconds tens digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_sec / 10][line]);
+        strcat(buffer, "\x1b[0m "); // Reset + space for separation
+
+        // Seconds ones digit
+        strcat(buffer, digit_color);
+        strcat(buffer, DIGIT_ART[time_info->tm_sec % 10][line]);
+        strcat(buffer, "\x1b[0m"); // Reset
+
+        render_print(r, start_row + line, start_col, buffer);
+    }
+
+    // Draw the tenths part on the last line
+    draw_hundredths(r, start_row + 4, hundredths_col, frame->tenths, frame->hide_tenths,
+                    digit_color);
+}
+
+/**
+ * Draw the status bar at the bottom of the screen
+ * This function ensures the status bar is always positioned at the bottom
+ * of the terminal regardless of resizing
+ */
+void draw_status_bar(clock_renderer_t *r, const clock_frame_t *frame)
+{
+    int term_width = r->width;
+    int time_since_sync = (int)frame->time_since_sync;
+    struct tm time_buf;
+    struct tm* time_info = localtime_r(&frame->now, &time_buf);
+
+    // Determine if the current position indicator should blink
+    int current_second = time_info->tm_sec;
+    // Even seconds show the character, odd seconds hide it
+    int should_show_character = (current_second % 2 == 0);
+
+    // Format date and time with tenths
+    char datetime_str[64];
+    if (frame->hide_tenths) {
+        snprintf(datetime_str, sizeof(datetime_str), "%04d-%02d-%02d %02d:%02d:%02d UTC",
+                time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday,
+                time_info->tm_hour, time_info->tm_min, time_info->tm_sec);
+    } else {
+        snprintf(datetime_str, sizeof(datetime_str), "%04d-%02d-%02d %02d:%02d:%02d.%01d UTC",
+                time_info->tm_year + 1900, time_info->tm_mon + 1, time_info->tm_mday,
+                time_info->tm_hour, time_info->tm_min, time_info->tm_sec, frame->tenths);
+    }
+
+    // Get NTP server name; until the first sync the time shown is the
+    // system clock's, so say so instead
+    char server_name_buffer[256];
+    if (time_since_sync < 0)
+    {
+        strcpy(server_name_buffer, "Unsynced: system clock");
+    }
+    else if (frame->server_name == NULL)
+    {
+        strcpy(server_name_buffer, "Not connected");
+    }
+    else
+    {
+        snprintf(server_name_buffer, sizeof(server_name_buffer), "%s", frame->server_name);
+    }
+
+    // Limit server name to a safe size (128 chars) to prevent buffer overflow
+    server_name_buffer[128] = '\0';
+
+    // Calculate times since sync and until next sync in H:MM:SS format
+    char time_since_str[20] = "Never";
+    char time_until_str[20] = "Unknown";
+    int hours_since = 0, mins_since = 0, secs_since = 0;
+    int hours_until = 0, mins_until = 0, secs_until = 0;
+
+    // Time since last sync
+    if (time_since_sync < 0)
+    {
+        strcpy(time_since_str, "Never");
+    }
+    else
+    {
+        hours_since = time_since_sync / 3600;
+        mins_since = (time_since_sync % 3600) / 60;
+        secs_since = time_since_sync % 60;
+        snprintf(time_since_str, sizeof(time_since_str), "%d:%02d:%02d", hours_since, mins_since, secs_since);
+    }
+
+    // Calculate next sync time
+    int seconds_to_next_sync = 7200 - (time_since_sync % 7200); // 7200 = 2 hours
+    if (time_since_sync < 0)
+    {
+        seconds_to_next_sync = 7200;
+    }
+
+    // Format time until next sync
+    hours_until = seconds_to_next_sync / 3600;
+    mins_until = (seconds_to_next_sync % 3600) / 60;
+    secs_until = seconds_to_next_sync % 60;
+    snprintf(time_until_str, sizeof(time_until_str), "%d:%02d:%02d", hours_until, mins_until, secs_until);
+
+    // Format the server name
+    char server_name_buffer_formatted[64] = "";
+    if (strlen(server_name_buffer) > 0)
+    {
+        snprintf(server_name_buffer_formatted, sizeof(server_name_buffer_formatted), "%.*s", (int)sizeof(server_name_buffer_formatted) - 1, server_name_buffer);
+    }
+    else
+    {
+        strcpy(server_name_buffer_formatted, "Not connected");
+    }
+
+    // Format the left section with date/time and server name
+    char left_section[256];
+    snprintf(left_section, sizeof(left_section), " %s │ %s ", datetime_str, server_name_buffer_formatted);
+
+    // Calculate progress as percentage of time elapsed in the sync cycle
+    float progress = 0.0;
+    if (time_since_sync >= 0)
+    {
+        progress = (float)time_since_sync / (time_since_sync + seconds_to_next_sync);
+    }
+
+    // Position cursor at the bottom line
+    int status_line_y = r->height;
+
+    // Build the progress bar section text WITHOUT formatting to calculate its true length
+    char plain_progress_section[512];
+
+    // Create the divider, sync label and time
+    sprintf(plain_progress_section, "NTP Sync: %s [", time_since_str);
+
+    // Calculate maximum size for progress section (max 50% of terminal width)
+    // Ensure a reasonable minimum for very small terminals
+    int min_term_width = 40; // Minimum reasonable terminal width
+    int effective_term_width = (term_width < min_term_width) ? min_term_width : term_width;
+    int max_progress_width = effective_term_width / 2;
+
+    // Calculate size of fixed elements (dividers, times, labels)
+    int fixed_elements_width = strlen("NTP Sync: ") + strlen(time_since_str) +
+                            strlen(" [") + strlen(" [") +
+                            strlen(time_until_str) + 1; // +1 for right padding space
+
+    // Calculate width available for the actual progress bar
+    int bar_width = max_progress_width - fixed_elements_width;
+    if (bar_width < 10) bar_width = 10; // Ensure minimum bar width
+
+    // Add placeholder characters for the bar
+    for (int i = 0; i < bar_width; i++) {
+        strcat(plain_progress_section, "X"); // Placeholder character
+    }
+
+    // Add the divider and time until
+    strcat(plain_progress_section, "] ");
+    strcat(plain_progress_section, time_until_str);
+    strcat(plain_progress_section, " "); // Right padding space
+
+    // Calculate where to position the progress section to be right-justified
+    // Ensure progress_section_column is never less than the left section length + minimum spacing
+    int left_section_length = display_width(left_section);
+    int min_progress_section_column = left_section_length + 2; // +2 for minimum spacing
+    int progress_section_column = term_width - display_width(plain_progress_section) + 1;
+
+    // If terminal is too small, ensure at least the left section is completely visible
+    // and shrink the bar so the section never runs past the last column (which
+    // would wrap and scroll the whole screen)
+    if (progress_section_column < min_progress_section_column) {
+        bar_width -= min_progress_section_column - progress_section_column;
+        progress_section_column = min_progress_section_column;
+    }
+
+    // Only draw the progress section if there's enough room
+    bool draw_progress = (term_width >= min_term_width && bar_width > 0);
+
+    // Compose the whole line in one pass so every cell is painted exactly once:
+    // left section, padding, then the right-justified progress section
+    render_buffer_t *out = &r->line;
+    rb_reset(out);
+    rb_puts(out, "\x1b[30;47m"); // Black text on grey background
+    int column = append_clipped(out, left_section, term_width);
+
+    int pad_until = draw_progress ? progress_section_column - 1 : term_width;
+    for (; column < pad_until; column++) {
+        rb_puts(out, " ");
+    }
+
+    if (draw_progress) {
+        // Add divider and sync label with time
+        rb_printf(out, "NTP Sync: %s [", time_since_str);
+
+        // Calculate filled portion of the bar
+        int filled_width = (int)(progress * bar_width);
+        if (filled_width > bar_width) filled_width = bar_width;
+
+        // Calculate the fractional part of the progress to determine if we should show a half block
+        float fractional_part = (progress * bar_width) - filled_width;
+        bool show_half_block = (fractional_part >= 0.1) && (filled_width < bar_width);
+
+        // Determine the position of the blinking element
+        int blink_position = filled_width;
+        if (!show_half_block && filled_width > 0) {
+            // When no half block and we have filled blocks, blink the last filled block
+            blink_position = filled_width - 1;
+        }
+
+        // Add the filled portion (bright yellow blocks on grey)
+        rb_puts(out, "\x1b[93;47m"); // Bright yellow on grey
+
+        // Add full blocks for completed sections
+        for (int i = 0; i < filled_width; i++) {
+            if (i == blink_position && !show_half_block) {
+                // This is the blinking element (the last filled block)
+                if (should_show_character) {
+                    rb_puts(out, "█"); // Full block for complete fill
+                } else {
+                    rb_puts(out, " "); // Space for blinking effect
+                }
+            } else {
+                // Regular filled blocks never blink
+                rb_puts(out, "█"); // Full block for complete fill
+            }
+        }
+
+        // Handle half block if needed
+        if (show_half_block) {
+            if (blink_position == filled_width) {
+                // This half block is the blinking element
+                if (should_show_character) {
+                    rb_puts(out, "▌"); // Half block for partial fill
+                } else {
+                    rb_puts(out, " "); // Space for blinking effect
+                }
+            } else {
+                // This half block is not the blinking element
+                rb_puts(out, "▌"); // Half block for partial fill
+            }
+            filled_width++; // Increment to account for the half block position
+        }
+
+        // Add the empty portion (dark grey mid-dots on grey)
+        rb_puts(out, "\x1b[90;47m"); // Dark grey on grey
+        for (int i = filled_width; i < bar_width; i++) {
+            if (i == blink_position) {
+                // This is the blinking element (the first unfilled dot)
+                if (should_show_character) {
+                    rb_puts(out, "·"); // Mid-dot for unfilled portion
+                } else {
+                    rb_puts(out, " "); // Space for blinking effect
+                }
+            } else {
+                // Regular unfilled dots never blink
+                rb_puts(out, "·"); // Mid-dot for unfilled portion
+            }
+        }
+
+        // Add the final part of the progress section
+        rb_printf(out, "] \x1b[30;47m%s ", time_until_str);
+    }
+
+    // Reset terminal colors
+    rb_puts(out, "\x1b[0m");
+
+    render_segment(r, status_line_y, 1, out->data, out->len);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Offset/RTT history graph                                               */
+/* ---------------------------------------------------------------------- */
+
+// Columns besides the two lanes: sync time, offset value, separator, RTT value
+#define HISTORY_FIXED_COLS 28
+#define HISTORY_MIN_LANES 30
+#define HISTORY_MAX_WIDTH 120
+#define HISTORY_VALUE_COLS 7
+#define HISTORY_MAX_RTT_LANE 16
+
+// Smallest full-scale values, so that jitter doesn't fill the lanes
+#define HISTORY_MIN_OFFSET_SCALE 100000LL   // 100us
+#define HISTORY_MIN_RTT_SCALE 1000000LL     // 1ms
+
+typedef struct {
+    int top;                    // Header row; samples go in the rows below
+    int rows;                   // Number of sample rows
+    int col;                    // First column
+    int offset_lane;            // Offset lane width in cells (odd, so zero has a center cell)
+    int rtt_lane;               // RTT lane width in cells
+} history_layout_t;
+
+void history_add(sync_history_t *h, time_t when, int64_t offset_ns, int64_t delay_ns)
+{
+    history_sample_t *s = &h->samples[h->total % HISTORY_MAX];
+    s->when = when;
+    s->offset_ns = offset_ns;
+    s->delay_ns = delay_ns;
+    h->total++;
+    if (h->count < HISTORY_MAX) h->count++;
+}
+
+/**
+ * Get a sample by age (0 is the newest), or NULL if there is none that old
+ */
+const history_sample_t *history_get(const sync_history_t *h, int age)
+{
+    if (age < 0 || age >= h->count) return NULL;
+    return &h->samples[(h->total - 1 - age) % HISTORY_MAX];
+}
+
+/**
+ * Place the panel between the clock digits and the status bar
+ *
+ * @return false if the terminal is too small to fit it
+ */
+static bool history_layout(const clock_renderer_t *r, history_layout_t *l)
+{
+    l->top = clock_top_row(r) + 6; // One blank row below the digits
+    l->rows = r->height - 1 - l->top;
+    if (l->rows < 2) return false;
+
+    int width = r->width - 2;
+    if (width > HISTORY_MAX_WIDTH) width = HISTORY_MAX_WIDTH;
+    int lanes = width - HISTORY_FIXED_COLS;
+    if (lanes < HISTORY_MIN_LANES) return false;
+
+    l->rtt_lane = lanes / 3;
+    if (l->rtt_lane > HISTORY_MAX_RTT_LANE) l->rtt_lane = HISTORY_MAX_RTT_LANE;
+    l->offset_lane = (lanes - l->rtt_lane - 1) | 1;
+    l->col = (r->width - HISTORY_FIXED_COLS - l->offset_lane - l->rtt_lane) / 2 + 1;
+    return true;
+}
+
+/**
+ * Round up to the next 1-2-5 step, so the scale changes rarely
+ */
+static int64_t nice_scale(int64_t value, int64_t minimum)
+{
+    int64_t scale = minimum;
+    for (int step = 0; scale < value; step++) {
+        scale = step % 3 == 1 ? scale * 5 / 2 : scale * 2;
+    }
+    return scale;
+}
+
+/**
+ * Format a duration in at most HISTORY_VALUE_COLS columns
+ */
+static void format_duration(char *buf, size_t size, int64_t ns, bool sign)
+{
+    int64_t mag = ns < 0 ? -ns : ns;
+    const char *format;
+    double value;
+
+    if (mag < 1000000) {
+        format = sign ? "%+.0fµs" : "%.0fµs";
+        value = ns / 1e3;
+    } else if (mag < 1000000000) {
+        value = ns / 1e6;
+        if (mag < 10000000) format = sign ? "%+.2fms" : "%.2fms";
+        else if (mag < 100000000) format = sign ? "%+.1fms" : "%.1fms";
+        else format = sign ? "%+.0fms" : "%.0fms";
+    } else {
+        value = ns / 1e9;
+        format = sign ? "%+.2fs" : "%.2fs";
+    }
+    snprintf(buf, size, format, value);
+}
+
+/**
+ * Move forward to a column of a blank row, skipping over the gap rather
+ * than painting it
+ */
+static void skip_to(render_buffer_t *b, int *at, int col)
+{
+    int gap = col - *at;
+    if (gap > 3) {
+        rb_printf(b, CURSOR_FORWARD, gap);
+    } else {
+        for (; gap > 0; gap--) rb_puts(b, " ");
+    }
+    if (col > *at) *at = col;
+}
+
+/**
+ * Switch foreground colour unless it is already the current one
+ */
+static void set_color(render_buffer_t *b, int *current, int color)
+{
+    if (*current != color) rb_printf(b, "\x1b[%dm", color);
+    *current = color;
+}
+
+/**
+ * Write text right-aligned in a field, advancing the column
+ */
+static void put_right(render_buffer_t *b, int *at, int col, int width, const char *text)
+{
+    int cols = display_width(text);
+    skip_to(b, at, col + width - cols);
+    *at += append_clipped(b, text, width);
+}
+
+/**
+ * Draw one sample row: time of the sync, then offset and RTT each as a
+ * Braille line (two positions per cell) with its value. A plotted point is
+ * a single glyph, so a row costs the same however long the round trip
+ *
+ * @param blank The row is known to be empty already
+ */
+static void draw_history_row(clock_renderer_t *r, const history_layout_t *l, int row,
+                             const history_sample_t *s, bool blank)
+{
+    render_buffer_t *out = &r->out;
+    char text[32];
+    int at = 0;
+    int color = 0;
+
+    if (s == NULL && blank) return;
+    rb_printf(out, ANSI_CURSOR_POSITION, row, l->col);
+    if (!blank) rb_puts(out, ERASE_TO_EOL);
+    if (s == NULL) return;
+
+    struct tm time_buf;
+    struct tm *t = localtime_r(&s->when, &time_buf);
+    set_color(out, &color, 90);
+    rb_printf(out, "%02d:%02d:%02d", t->tm_hour, t->tm_min, t->tm_sec);
+    at = 8;
+
+    format_duration(text, sizeof(text), s->offset_ns, true);
+    set_color(out, &color, 96);
+    put_right(out, &at, 9, HISTORY_VALUE_COLS, text);
+
+    // Offset lane: zero sits in the middle cell, the edges are -/+ scale
+    int lane = 17;
+    int center = l->offset_lane / 2;
+    int64_t scale = r->history_offset_scale;
+    int64_t offset = s->offset_ns;
+    if (offset > 2 * scale) offset = 2 * scale;
+    if (offset < -2 * scale) offset = -2 * scale;
+    int64_t dot = offset * l->offset_lane / scale + l->offset_lane;
+    if (dot == 2 * l->offset_lane && offset == scale) dot--; // Exactly full scale
+    int cell;
+    const char *marker;
+    if (dot < 0) {
+        cell = 0;
+        marker = "◀";
+    } else if (dot >= 2 * l->offset_lane) {
+        cell = l->offset_lane - 1;
+        marker = "▶";
+    } else {
+        cell = dot / 2;
+        marker = dot % 2 == 0 ? "⡇" : "⢸";
+    }
+    if (cell > center) {
+        skip_to(out, &at, lane + center);
+        set_color(out, &color, 90);
+        rb_puts(out, "┊");
+        at++;
+    }
+    skip_to(out, &at, lane + cell);
+    set_color(out, &color, 96);
+    rb_puts(out, marker);
+    at++;
+    if (cell < center) {
+        skip_to(out, &at, lane + center);
+        set_color(out, &color, 90);
+        rb_puts(out, "┊");
+        at++;
+    }
+
+    int separator = lane + l->offset_lane + 1;
+    skip_to(out, &at, separator);
+    set_color(out, &color, 90);
+    rb_puts(out, "│");
+    at++;
+
+    // RTT lane: a Braille line like the offset, from zero at the left edge
+    int rtt_lane = separator + 2;
+    int64_t rtt_dot = s->delay_ns * l->rtt_lane * 2 / r->history_rtt_scale;
+    if (rtt_dot > 2 * l->rtt_lane - 1) rtt_dot = 2 * l->rtt_lane - 1;
+    if (rtt_dot < 0) rtt_dot = 0;
+    skip_to(out, &at, rtt_lane + (int)rtt_dot / 2);
+    set_color(out, &color, 92);
+    rb_puts(out, rtt_dot % 2 == 0 ? "⡇" : "⢸");
+    at++;
+
+    format_duration(text, sizeof(text), s->delay_ns, false);
+    put_right(out, &at, rtt_lane + l->rtt_lane + 1, HISTORY_VALUE_COLS, text);
+    rb_puts(out, "\x1b[0m");
+}
+
+/**
+ * Header row with the lane scales, padded to the full panel width so a new
+ * scale overwrites the old one completely
+ */
+static void draw_history_header(clock_renderer_t *r, const history_layout_t *l)
+{
+    render_buffer_t *line = &r->line;
+    char low[16], high[16];
+    int at = 0;
+    int lane = 17;
+    int separator = lane + l->offset_lane + 1;
+    int rtt_lane = separator + 2;
+    int width = HISTORY_FIXED_COLS + l->offset_lane + l->rtt_lane;
+
+    rb_reset(line);
+    rb_puts(line, "\x1b[90m  synced  offset ");
+    at = lane;
+
+    format_duration(low, sizeof(low), -r->history_offset_scale, true);
+    format_duration(high, sizeof(high), r->history_offset_scale, true);
+    at += append_clipped(line, low, l->offset_lane);
+    for (; at < lane + l->offset_lane / 2; at++) rb_puts(line, " ");
+    rb_puts(line, "0");
+    at++;
+    for (; at < lane + l->offset_lane - display_width(high); at++) rb_puts(line, " ");
+    at += append_clipped(line, high, HISTORY_VALUE_COLS);
+    rb_puts(line, " │ 0");
+    at += 4;
+
+    format_duration(high, sizeof(high), r->history_rtt_scale, false);
+    for (; at < rtt_lane + l->rtt_lane - display_width(high); at++) rb_puts(line, " ");
+    at += append_clipped(line, high, HISTORY_VALUE_COLS);
+    for (; at < width - 3; at++) rb_puts(line, " ");
+    rb_puts(line, "RTT\x1b[0m");
+
+    render_segment(r, l->top, l->col, line->data, line->len);
+}
+
+/**
+ * Draw the offset/RTT history panel between the clock and the status bar,
+ * newest sample at the bottom
+ *
+ * When samples arrive the rows already on screen are scrolled up inside a
+ * DECSTBM scroll region and only the new rows are drawn, so a sample costs
+ * the same however wide the terminal is: the scroll, one cursor move and a
+ * row of two values and three glyphs. The whole panel is redrawn
+ * only after a resize or when a lane's scale has to change.
+ */
+void draw_history(clock_renderer_t *r, const sync_history_t *history)
+{
+    history_layout_t l;
+    if (!history_layout(r, &l)) {
+        r->history_valid = false;
+        return;
+    }
+
+    // Scale the lanes to the samples that fit on screen
+    int64_t max_offset = 0, max_rtt = 0;
+    for (int age = 0; age < l.rows && age < history->count; age++) {
+        const history_sample_t *s = history_get(history, age);
+        int64_t offset = s->offset_ns < 0 ? -s->offset_ns : s->offset_ns;
+        if (offset > max_offset) max_offset = offset;
+        if (s->delay_ns > max_rtt) max_rtt = s->delay_ns;
+    }
+    int64_t offset_scale = nice_scale(max_offset, HISTORY_MIN_OFFSET_SCALE);
+    int64_t rtt_scale = nice_scale(max_rtt, HISTORY_MIN_RTT_SCALE);
+
+    bool blank = !r->history_valid; // Only invalid right after the screen was cleared
+    bool repaint = blank || r->history_top != l.top || r->history_rows != l.rows ||
+                   r->history_offset_scale != offset_scale || r->history_rtt_scale != rtt_scale;
+    uint64_t added = history->total - r->history_drawn;
+
+    r->history_offset_scale = offset_scale;
+    r->history_rtt_scale = rtt_scale;
+    draw_history_header(r, &l);
+
+    int first = l.top + 1;
+    int last = l.top + l.rows;
+    if (!repaint && added == 0) return;
+
+    if (!repaint && added < (uint64_t)l.rows) {
+        // Move the older samples up and draw just the new ones
+        rb_printf(&r->out, SET_SCROLL_REGION SCROLL_UP RESET_SCROLL_REGION,
+                  first, last, (int)added);
+        for (int age = (int)added - 1; age >= 0; age--) {
+            draw_history_row(r, &l, last - age, history_get(history, age), true);
+        }
+    } else {
+        for (int row = first; row <= last; row++) {
+            draw_history_row(r, &l, row, history_get(history, last - row), blank);
+        }
+    }
+
+    r->history_valid = true;
+    r->history_top = l.top;
+    r->history_rows = l.rows;
+    r->history_drawn = history->total;
+}
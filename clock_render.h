@@ -0,0 +1,107 @@
+#ifndef CLOCK_RENDER_H
+#define CLOCK_RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * Growable byte buffer that the renderer writes escape sequences into.
+ * Nothing is sent to the terminal until the owner flushes it.
+ */
+typedef struct {
+    char *data;                 // Rendered bytes
+    size_t len;                 // Number of bytes in use
+    size_t cap;                 // Allocated size
+    unsigned long allocations;  // Number of times the buffer had to grow
+} render_buffer_t;
+
+#define HISTORY_MAX 256
+
+/**
+ * Result of one sync, as plotted in the history graph
+ */
+typedef struct {
+    time_t when;                // NTP-adjusted time of the sync
+    int64_t offset_ns;          // NTP time minus system time
+    int64_t delay_ns;           // Round-trip delay
+} history_sample_t;
+
+/**
+ * The most recent syncs, oldest overwritten first
+ */
+typedef struct {
+    history_sample_t samples[HISTORY_MAX];
+    int count;                  // Samples stored (at most HISTORY_MAX)
+    uint64_t total;             // Samples ever added
+} sync_history_t;
+
+/**
+ * Everything a frame needs to know about the time being displayed
+ */
+typedef struct {
+    time_t now;                 // NTP-adjusted time in seconds
+    int tenths;                 // Tenths of a second (0-9)
+    bool hide_tenths;           // Show whole seconds only
+    int64_t time_since_sync;    // Seconds since last sync, or -1 if never synced
+    const char *server_name;    // NTP server name, or NULL if not connected
+    const sync_history_t *history; // Offset/RTT history to graph, or NULL for no graph
+} clock_frame_t;
+
+/**
+ * A run of text the renderer has put on screen, used to skip redrawing
+ * anything that hasn't changed since the previous frame
+ */
+typedef struct {
+    int row;                    // Screen row (1-based)
+    int col;                    // Screen column (1-based)
+    render_buffer_t text;       // Bytes last emitted at this position
+} render_segment_t;
+
+#define RENDER_MAX_SEGMENTS 16
+
+/**
+ * Renderer state for one terminal geometry
+ */
+typedef struct {
+    int width;                  // Terminal width in columns
+    int height;                 // Terminal height in rows
+    bool sync_output;           // Wrap frames in DEC synchronized output (mode 2026)
+    bool full_redraw;           // Clear and repaint everything on the next frame
+    render_buffer_t out;        // Pending output for the terminal
+    render_buffer_t line;       // Scratch space for composing one screen line
+    render_segment_t segments[RENDER_MAX_SEGMENTS];
+    int segment_count;
+
+    // What the history graph panel currently shows
+    bool history_valid;         // Rows below reflect the screen
+    int history_top;            // First sample row
+    int history_rows;           // Number of sample rows
+    uint64_t history_drawn;     // history->total when last drawn
+    int64_t history_offset_scale; // Offset lane spans +/- this many ns
+    int64_t history_rtt_scale;  // RTT lane spans 0 to this many ns
+} clock_renderer_t;
+
+void render_init(clock_renderer_t *r, int width, int height);
+void render_free(clock_renderer_t *r);
+void render_resize(clock_renderer_t *r, int width, int height);
+void render_invalidate(clock_renderer_t *r);
+
+void rb_write(render_buffer_t *b, const char *data, size_t len);
+void rb_puts(render_buffer_t *b, const char *s);
+void rb_printf(render_buffer_t *b, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void rb_reset(render_buffer_t *b);
+
+void history_add(sync_history_t *h, time_t when, int64_t offset_ns, int64_t delay_ns);
+const history_sample_t *history_get(const sync_history_t *h, int age);
+
+void render_clear_screen(clock_renderer_t *r);
+void render_frame(clock_renderer_t *r, const clock_frame_t *frame);
+int render_next_change_us(const clock_frame_t *frame, int micros);
+void draw_full_clock(clock_renderer_t *r, const clock_frame_t *frame);
+void draw_status_bar(clock_renderer_t *r, const clock_frame_t *frame);
+void draw_history(clock_renderer_t *r, const sync_history_t *history);
+
+#endif /* CLOCK_RENDER_H */
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include "headless.h"
+
+#define NS_PER_SEC 1000000000LL
+
+// Room needed for the largest JSON record (a server name of 255 characters,
+// every one of them escaped as \u00XX)
+#define RECORD_JSON_MAX (255 * 6 + 256)
+
+// Longest single wait, so a stop request is noticed promptly
+#define MAX_WAIT_NS (250 * 1000000LL)
+
+/* ---------------------------------------------------------------------- */
+/* Record formatting                                                      */
+/* ---------------------------------------------------------------------- */
+
+void record_writer_init(record_writer_t *w, int fd, record_format_t format)
+{
+    w->fd = fd;
+    w->format = format;
+    w->len = 0;
+    w->failed = false;
+    w->records = 0;
+}
+
+/**
+ * Write out everything buffered
+ *
+ * @return false if the destination stopped accepting data
+ */
+bool record_flush(record_writer_t *w)
+{
+    size_t offset = 0;
+
+    while (offset < w->len && !w->failed) {
+        ssize_t n = write(w->fd, w->buf + offset, w->len - offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->failed = true;
+            break;
+        }
+        offset += n;
+    }
+    w->len = 0;
+    return !w->failed;
+}
+
+static void put_str(record_writer_t *w, const char *s)
+{
+    size_t len = strlen(s);
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+}
+
+static void put_u64(record_writer_t *w, uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        w->buf[w->len++] = digits[--n];
+    }
+}
+
+/**
+ * Nanoseconds as decimal seconds with all nine digits, without going
+ * through floating point
+ */
+static void put_seconds(record_writer_t *w, int64_t ns)
+{
+    uint64_t v = ns < 0 ? -(uint64_t)ns : (uint64_t)ns;
+    if (ns < 0) w->buf[w->len++] = '-';
+
+    put_u64(w, v / NS_PER_SEC);
+    w->buf[w->len++] = '.';
+
+    uint64_t frac = v % NS_PER_SEC;
+    for (int i = 8; i >= 0; i--) {
+        w->buf[w->len + i] = '0' + frac % 10;
+        frac /= 10;
+    }
+    w->len += 9;
+}
+
+static void put_json_string(record_writer_t *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    w->buf[w->len++] = '"';
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            w->buf[w->len++] = '\\';
+            w->buf[w->len++] = c;
+        } else if (c < 0x20) {
+            put_str(w, "\\u00");
+            w->buf[w->len++] = hex[c >> 4];
+            w->buf[w->len++] = hex[c & 0xf];
+        } else {
+            w->buf[w->len++] = c;
+        }
+    }
+    w->buf[w->len++] = '"';
+}
+
+static void format_json(record_writer_t *w, const ntp_sync_info_t *info, record_event_t event)
+{
+    put_str(w, event == RECORD_SYNC ? "{\"event\":\"sync\",\"time\":" : "{\"event\":\"tick\",\"time\":");
+    put_seconds(w, info->time_ns);
+
+    if (info->synced) {
+        put_str(w, ",\"offset\":");
+        put_seconds(w, info->offset_ns);
+        put_str(w, ",\"delay\":");
+        put_seconds(w, info->delay_ns);
+        put_str(w, ",\"error\":");
+        put_seconds(w, info->error_bound_ns);
+        put_str(w, ",\"sync_age\":");
+        put_seconds(w, info->sync_age_ns);
+        put_str(w, ",\"stratum\":");
+        put_u64(w, info->stratum);
+    } else {
+        put_str(w, ",\"offset\":null,\"delay\":null,\"error\":null,\"sync_age\":null,\"stratum\":null");
+    }
+
+    put_str(w, ",\"server\":");
+    put_json_string(w, info->server_name);
+    put_str(w, "}\n");
+}
+
+static void format_binary(record_writer_t *w, const ntp_sync_info_t *info, record_event_t event)
+{
+    ntp_record_t rec;
+
+    memcpy(rec.magic, NTP_RECORD_MAGIC, sizeof(rec.magic));
+    rec.version = htole16(NTP_RECORD_VERSION);
+    rec.event = event;
+    rec.stratum = info->synced ? info->stratum : 0;
+    rec.time_ns = htole64(info->time_ns);
+    rec.offset_ns = htole64(info->synced ? info->offset_ns : 0);
+    rec.delay_ns = htole64(info->synced ? info->delay_ns : 0);
+    rec.error_bound_ns = htole64(info->synced ? info->error_bound_ns : -1);
+    rec.sync_age_ns = htole64(info->synced ? info->sync_age_ns : -1);
+    memset(rec.server, 0, sizeof(rec.server));
+    memcpy(rec.server, info->server_name, strnlen(info->server_name, sizeof(rec.server)));
+
+    memcpy(w->buf + w->len, &rec, sizeof(rec));
+    w->len += sizeof(rec);
+}
+
+/**
+ * Append one record, writing the buffer out first if it is nearly full
+ */
+void record_write(record_writer_t *w, const ntp_sync_info_t *info, record_event_t event)
+{
+    if (w->len + RECORD_JSON_MAX > sizeof(w->buf)) {
+        record_flush(w);
+    }
+
+    if (w->format == RECORD_BINARY) {
+        format_binary(w, info, event);
+    } else {
+        format_json(w, info, event);
+    }
+    w->records++;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Headless main loop                                                     */
+/* ---------------------------------------------------------------------- */
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * Stream records to stdout until interrupted or the reader goes away
+ *
+ * @param format        JSON Lines or binary records
+ * @param tick_ms       Interval between periodic records, aligned to the
+ *                      corrected time; 0 for sync events only
+ * @return Process exit status
+ */
+int headless_run(record_format_t format, int tick_ms)
+{
+    static record_writer_t writer;
+    ntp_sync_info_t info;
+    uint64_t seen_attempts = 0, seen_syncs = 0;
+    int64_t tick_ns = (int64_t)tick_ms * 1000000;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // A reader that goes away shows up as a failed write instead
+    signal(SIGPIPE, SIG_IGN);
+
+    record_writer_init(&writer, STDOUT_FILENO, format);
+
+    // Sync in the background so network round trips never hold up the
+    // record stream
+    if (ntp_startBackgroundSync() != NTP_OK) {
+        fprintf(stderr, "Failed to start background sync\n");
+        return 1;
+    }
+
+    while (!stop_requested && !writer.failed) {
+        ntp_getSyncInfo(&info);
+
+        if (info.sync_count != seen_syncs) {
+            seen_syncs = info.sync_count;
+            record_write(&writer, &info, RECORD_SYNC);
+        }
+
+        // Time until the next tick boundary of the corrected clock
+        int64_t wait_ns = MAX_WAIT_NS;
+        if (tick_ns > 0) {
+            wait_ns = tick_ns - info.time_ns % tick_ns;
+            if (wait_ns > MAX_WAIT_NS) wait_ns = MAX_WAIT_NS;
+        }
+
+        // Everything so far goes out before we sleep
+        record_flush(&writer);
+
+        seen_attempts = ntp_waitForSyncAttempt(seen_attempts, wait_ns);
+
+        if (tick_ns > 0) {
+            // Emit a tick if a boundary was crossed while waiting
+            int64_t before = info.time_ns;
+            ntp_getSyncInfo(&info);
+            if (info.time_ns / tick_ns != before / tick_ns) {
+                record_write(&writer, &info, RECORD_TICK);
+            }
+        }
+    }
+
+    record_flush(&writer);
+    ntp_stopBackgroundSync();
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ntp_client.h"
+
+/**
+ * Headless output: NTP-corrected time and sync health as a stream of
+ * machine-readable records instead of a terminal display.
+ *
+ * Records are formatted straight into a fixed buffer without allocating and
+ * written out in batches, either as JSON Lines or as fixed-size binary
+ * records (ntp_record_t).
+ */
+
+typedef enum {
+    RECORD_JSON,                // One JSON object per line
+    RECORD_BINARY               // ntp_record_t, back to back
+} record_format_t;
+
+typedef enum {
+    RECORD_TICK = 0,            // Periodic record
+    RECORD_SYNC = 1             // A sync just completed
+} record_event_t;
+
+#define NTP_RECORD_MAGIC "NTPR"
+#define NTP_RECORD_VERSION 1
+
+/**
+ * Binary record layout; all integers are little-endian. A negative
+ * sync_age_ns means the client has never synced, in which case offset,
+ * delay and error bound are meaningless.
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];              // NTP_RECORD_MAGIC
+    uint16_t version;           // NTP_RECORD_VERSION
+    uint8_t event;              // record_event_t
+    uint8_t stratum;            // Server stratum
+    int64_t time_ns;            // NTP-corrected Unix time
+    int64_t offset_ns;          // NTP time minus system time
+    int64_t delay_ns;           // Round-trip delay
+    int64_t error_bound_ns;     // Maximum error of time_ns
+    int64_t sync_age_ns;        // Time since the last sync, or -1
+    char server[32];            // Server name, NUL-padded and truncated
+} ntp_record_t;
+
+#define RECORD_BUFFER_SIZE 65536
+
+typedef struct {
+    int fd;                     // Destination
+    record_format_t format;
+    size_t len;                 // Bytes buffered
+    bool failed;                // A write failed (e.g. the reader went away)
+    uint64_t records;           // Records formatted
+    char buf[RECORD_BUFFER_SIZE];
+} record_writer_t;
+
+void record_writer_init(record_writer_t *w, int fd, record_format_t format);
+void record_write(record_writer_t *w, const ntp_sync_info_t *info, record_event_t event);
+bool record_flush(record_writer_t *w);
+
+int headless_run(record_format_t format, int tick_ms);
+
+#endif /* HEADLESS_H */
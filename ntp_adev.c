@@ -0,0 +1,248 @@
+#include "ntp_adev.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define NS_PER_SEC 1e9
+
+/* Both kernels sum squares of differences at stride m. Offsets are whole
+   nanoseconds, and so are their prefix sums as long as they stay under
+   2^53, so every difference is exact and only the squares and the sum
+   round. */
+
+/**
+ * @brief Sum over i < terms of (x[i + 2m] - 2 x[i + m] + x[i])^2
+ */
+static double second_differences_scalar(const double *x, size_t terms, size_t m) {
+    double sum = 0;
+
+    for (size_t i = 0; i < terms; i++) {
+        double d = (x[i + 2 * m] - x[i + m]) - (x[i + m] - x[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+/**
+ * @brief Sum over j < terms of (s[j + 3m] - 3 s[j + 2m] + 3 s[j + m] - s[j])^2
+ *
+ * With s the prefix sums of x, each term is the sum of m consecutive
+ * second differences of x, as MDEV wants.
+ */
+static double third_differences_scalar(const double *s, size_t terms, size_t m) {
+    double sum = 0;
+
+    for (size_t j = 0; j < terms; j++) {
+        double d = (s[j + 3 * m] - s[j]) - 3 * (s[j + 2 * m] - s[j + m]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * @brief second_differences_scalar eight terms at a time
+ */
+__attribute__((target("avx2")))
+static double second_differences_avx2(const double *x, size_t terms, size_t m) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+
+    /* Two accumulators hide the add latency */
+    for (; i + 8 <= terms; i += 8) {
+        __m256d a0 = _mm256_loadu_pd(x + i), a1 = _mm256_loadu_pd(x + i + 4);
+        __m256d b0 = _mm256_loadu_pd(x + i + m), b1 = _mm256_loadu_pd(x + i + m + 4);
+        __m256d c0 = _mm256_loadu_pd(x + i + 2 * m), c1 = _mm256_loadu_pd(x + i + 2 * m + 4);
+        __m256d d0 = _mm256_sub_pd(_mm256_sub_pd(c0, b0), _mm256_sub_pd(b0, a0));
+        __m256d d1 = _mm256_sub_pd(_mm256_sub_pd(c1, b1), _mm256_sub_pd(b1, a1));
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(d0, d0));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(d1, d1));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + second_differences_scalar(x + i, terms - i, m);
+}
+
+/**
+ * @brief third_differences_scalar eight terms at a time
+ */
+__attribute__((target("avx2")))
+static double third_differences_avx2(const double *s, size_t terms, size_t m) {
+    const __m256d three = _mm256_set1_pd(3);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t j = 0;
+
+    for (; j + 8 <= terms; j += 8) {
+        __m256d a0 = _mm256_loadu_pd(s + j), a1 = _mm256_loadu_pd(s + j + 4);
+        __m256d b0 = _mm256_loadu_pd(s + j + m), b1 = _mm256_loadu_pd(s + j + m + 4);
+        __m256d c0 = _mm256_loadu_pd(s + j + 2 * m), c1 = _mm256_loadu_pd(s + j + 2 * m + 4);
+        __m256d e0 = _mm256_loadu_pd(s + j + 3 * m), e1 = _mm256_loadu_pd(s + j + 3 * m + 4);
+        __m256d d0 = _mm256_sub_pd(_mm256_sub_pd(e0, a0), _mm256_mul_pd(three, _mm256_sub_pd(c0, b0)));
+        __m256d d1 = _mm256_sub_pd(_mm256_sub_pd(e1, a1), _mm256_mul_pd(three, _mm256_sub_pd(c1, b1)));
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(d0, d0));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(d1, d1));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + third_differences_scalar(s + j, terms - j, m);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+ntp_adev_isa_t ntp_adev_best_isa(void) {
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return NTP_ADEV_AVX2;
+    }
+#endif
+    return NTP_ADEV_SCALAR;
+}
+
+/**
+ * @brief Deviations from the sums of squared differences, at tau = m tau0
+ */
+static void fill_point(ntp_adev_point_t *p, size_t m, double tau0, double adev_sum, uint64_t adev_terms,
+                       double mdev_sum, uint64_t mdev_terms) {
+    double tau = m * tau0;
+
+    p->tau = tau;
+    p->terms = adev_terms;
+    p->adev = sqrt(adev_sum / (2.0 * m * m * adev_terms)) / tau0 / NS_PER_SEC;
+    p->mdev = mdev_terms > 0 ? sqrt(mdev_sum / (2.0 * m * m * m * m * mdev_terms)) / tau0 / NS_PER_SEC : NAN;
+}
+
+size_t ntp_adev_compute_isa(ntp_adev_isa_t isa, const int64_t *phase_ns, size_t count, double tau0,
+                            ntp_adev_point_t *points, size_t max) {
+    if (phase_ns == NULL || count < 3 || tau0 <= 0) {
+        return 0;
+    }
+    if (isa > ntp_adev_best_isa()) {
+        isa = ntp_adev_best_isa();
+    }
+
+    /* Offsets relative to the first, and their prefix sums */
+    double *x = malloc(count * sizeof(*x));
+    double *s = malloc((count + 1) * sizeof(*s));
+    if (x == NULL || s == NULL) {
+        free(x);
+        free(s);
+        return 0;
+    }
+    s[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        x[i] = (double)(phase_ns[i] - phase_ns[0]);
+        s[i + 1] = s[i] + x[i];
+    }
+
+    size_t n = 0;
+    for (size_t m = 1; 2 * m < count && n < max; m *= 2) {
+        uint64_t adev_terms = count - 2 * m;
+        uint64_t mdev_terms = count + 1 > 3 * m ? count + 1 - 3 * m : 0;
+        double adev_sum, mdev_sum = 0;
+
+#ifdef HAVE_X86_KERNELS
+        if (isa == NTP_ADEV_AVX2) {
+            adev_sum = second_differences_avx2(x, adev_terms, m);
+            if (mdev_terms > 0) {
+                mdev_sum = third_differences_avx2(s, mdev_terms, m);
+            }
+        } else
+#endif
+        {
+            adev_sum = second_differences_scalar(x, adev_terms, m);
+            if (mdev_terms > 0) {
+                mdev_sum = third_differences_scalar(s, mdev_terms, m);
+            }
+        }
+        fill_point(&points[n++], m, tau0, adev_sum, adev_terms, mdev_sum, mdev_terms);
+    }
+
+    free(x);
+    free(s);
+    return n;
+}
+
+size_t ntp_adev_compute(const int64_t *phase_ns, size_t count, double tau0, ntp_adev_point_t *points, size_t max) {
+    return ntp_adev_compute_isa(NTP_ADEV_AVX2, phase_ns, count, tau0, points, max);
+}
+
+double ntp_adev_best_tau(const ntp_adev_point_t *points, size_t count) {
+    double best_tau = 0, best = INFINITY;
+
+    for (size_t i = 0; i < count; i++) {
+        if (points[i].adev < best) {
+            best = points[i].adev;
+            best_tau = points[i].tau;
+        }
+    }
+    return best_tau;
+}
+
+void ntp_adev_online_reset(ntp_adev_online_t *a) {
+    memset(a, 0, sizeof(*a));
+}
+
+void ntp_adev_online_add(ntp_adev_online_t *a, int64_t time_ns, int64_t phase_ns) {
+    const uint64_t mask = NTP_ADEV_ONLINE_HISTORY - 1;
+
+    if (a->count == 0) {
+        a->first_phase_ns = phase_ns;
+        a->first_time_ns = time_ns;
+        a->prefix[0] = 0;
+    }
+    a->last_time_ns = time_ns;
+
+    /* prefix[k] holds s[k], the sum of the first k offsets; wrapping
+       arithmetic keeps the differences exact however large s grows */
+    uint64_t n = a->count++;
+    const uint64_t *s = a->prefix;
+    a->prefix[(n + 1) & mask] = s[n & mask] + (uint64_t)(phase_ns - a->first_phase_ns);
+
+    for (int k = 0; k < NTP_ADEV_ONLINE_TAUS; k++) {
+        uint64_t m = (uint64_t)1 << k;
+
+        /* The second difference that ends at offset n: x[n] - 2 x[n - m] + x[n - 2m] */
+        if (n >= 2 * m) {
+            int64_t x0 = (int64_t)(s[(n - 2 * m + 1) & mask] - s[(n - 2 * m) & mask]);
+            int64_t x1 = (int64_t)(s[(n - m + 1) & mask] - s[(n - m) & mask]);
+            int64_t x2 = (int64_t)(s[(n + 1) & mask] - s[n & mask]);
+            double d = (double)((x2 - x1) - (x1 - x0));
+            a->adev_sum[k] += d * d;
+        }
+
+        /* The sum of the m second differences that ends there */
+        if (n + 1 >= 3 * m) {
+            uint64_t j = n + 1 - 3 * m;
+            int64_t outer = (int64_t)(s[(j + 3 * m) & mask] - s[j & mask]);
+            int64_t inner = (int64_t)(s[(j + 2 * m) & mask] - s[(j + m) & mask]);
+            double d = (double)(outer - 3 * inner);
+            a->mdev_sum[k] += d * d;
+        }
+    }
+}
+
+size_t ntp_adev_online_get(const ntp_adev_online_t *a, ntp_adev_point_t *points, size_t max) {
+    if (a->count < 3 || a->last_time_ns <= a->first_time_ns) {
+        return 0;
+    }
+    double tau0 = (double)(a->last_time_ns - a->first_time_ns) / (a->count - 1) / NS_PER_SEC;
+
+    size_t n = 0;
+    for (int k = 0; k < NTP_ADEV_ONLINE_TAUS && n < max; k++) {
+        uint64_t m = (uint64_t)1 << k;
+        if (a->count <= 2 * m) {
+            break;
+        }
+        uint64_t mdev_terms = a->count + 1 > 3 * m ? a->count + 1 - 3 * m : 0;
+        fill_point(&points[n++], m, tau0, a->adev_sum[k], a->count - 2 * m, a->mdev_sum[k], mdev_terms);
+    }
+    return n;
+}
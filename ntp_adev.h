@@ -0,0 +1,111 @@
+#ifndef NTP_ADEV_H
+#define NTP_ADEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allan deviation of a clock's offsets, for judging its oscillator and
+ * choosing how often to poll.
+ *
+ * Both estimators take phase data: offsets measured tau0 apart. They give
+ * the overlapping Allan deviation (ADEV) and the modified Allan deviation
+ * (MDEV) at octave-spaced averaging times tau0, 2 tau0, 4 tau0, ... Each
+ * point is one pass over the data, using prefix sums for MDEV's averages,
+ * so a series of n offsets takes O(n log n) in all.
+ *
+ * ntp_adev_compute() works on a whole series at once, vectorised with AVX2
+ * where the CPU has it. ntp_adev_online_t keeps running sums instead, one
+ * update per sample, for the client to track its own clock as it syncs
+ * (ntp_client_getAllanDeviation()). Where ADEV bottoms out is where
+ * averaging stops helping, which makes it the natural poll interval
+ * (ntp_adev_best_tau()).
+ */
+
+#define NTP_ADEV_ONLINE_TAUS 8           /* tau0 up to 128 tau0 */
+#define NTP_ADEV_ONLINE_HISTORY 512      /* Prefix sums kept; at least 3 * 128 + 1 */
+
+/**
+ * @brief The deviations at one averaging time
+ */
+typedef struct {
+    double tau;                   /* Averaging time in seconds */
+    double adev;                  /* Overlapping Allan deviation */
+    double mdev;                  /* Modified Allan deviation; NaN if the series is too short */
+    uint64_t terms;               /* Second differences averaged for adev */
+} ntp_adev_point_t;
+
+typedef enum {
+    NTP_ADEV_SCALAR,
+    NTP_ADEV_AVX2
+} ntp_adev_isa_t;
+
+/**
+ * @brief Compute ADEV and MDEV at every octave of tau0 the series allows
+ *
+ * @param phase_ns count offsets, tau0 seconds apart, in nanoseconds
+ * @param points Filled in with up to max points, shortest tau first
+ * @return size_t How many points; 0 if there are fewer than 3 offsets or
+ *         memory can't be had
+ */
+size_t ntp_adev_compute(const int64_t *phase_ns, size_t count, double tau0, ntp_adev_point_t *points, size_t max);
+
+/**
+ * @brief ntp_adev_compute with a given instruction set, for comparing them
+ *
+ * Uses isa, or scalar code if this CPU doesn't have it.
+ */
+size_t ntp_adev_compute_isa(ntp_adev_isa_t isa, const int64_t *phase_ns, size_t count, double tau0,
+                            ntp_adev_point_t *points, size_t max);
+
+/**
+ * @brief The best instruction set this CPU has for ntp_adev_compute
+ */
+ntp_adev_isa_t ntp_adev_best_isa(void);
+
+/**
+ * @brief Averaging time with the lowest ADEV, or 0 with no points
+ */
+double ntp_adev_best_tau(const ntp_adev_point_t *points, size_t count);
+
+/**
+ * @brief Running sums for ADEV and MDEV, updated one offset at a time
+ *
+ * Offsets are taken as evenly spaced at their mean interval. Zero it, or
+ * call ntp_adev_online_reset(), to start.
+ */
+typedef struct {
+    uint64_t prefix[NTP_ADEV_ONLINE_HISTORY];  /* Recent prefix sums of the offsets, mod 2^64 */
+    uint64_t count;               /* Offsets added */
+    int64_t first_phase_ns;       /* Offsets are summed relative to the first */
+    int64_t first_time_ns;
+    int64_t last_time_ns;
+    double adev_sum[NTP_ADEV_ONLINE_TAUS];  /* Squared second differences, in ns^2 */
+    double mdev_sum[NTP_ADEV_ONLINE_TAUS];  /* Squared sums of m second differences */
+} ntp_adev_online_t;
+
+void ntp_adev_online_reset(ntp_adev_online_t *a);
+
+/**
+ * @brief Add the next offset
+ *
+ * @param time_ns When it was measured
+ */
+void ntp_adev_online_add(ntp_adev_online_t *a, int64_t time_ns, int64_t phase_ns);
+
+/**
+ * @brief The deviations so far, at the averaging times with at least one term
+ *
+ * @return size_t How many points, up to max and NTP_ADEV_ONLINE_TAUS
+ */
+size_t ntp_adev_online_get(const ntp_adev_online_t *a, ntp_adev_point_t *points, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_ADEV_H */
@@ -0,0 +1,519 @@
+#ifndef NTP_ASYNC_HPP
+#define NTP_ASYNC_HPP
+
+#include <charconv>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include "ntp_clock.hpp"
+#include "ntp_client.h"
+#include "ntp_sched.h"
+
+/**
+ * C++20 coroutines over the NTP client (needs -std=c++20).
+ *
+ *     ntp::task<void> keep_time(ntp::server_set servers) {
+ *         ntp_status_t status = co_await ntp::sync(servers);
+ *         co_await ntp::until(ntp::clock::now() + std::chrono::seconds(1));
+ *     }
+ *
+ *     ntp::executor ex;
+ *     ex.spawn(keep_time({"pool.ntp.org", "time.example.com:123"}));
+ *     ex.run();
+ *
+ * An executor is a single-threaded event loop. It owns one non-blocking
+ * UDP socket that carries every request. Responses are matched to requests
+ * by the key the server echoes back. Deadlines sit in a timing wheel
+ * (ntp_wheel_t from ntp_sched.h) keyed by NTP time: until() deadlines and
+ * request timeouts. Between events the loop waits in ppoll() for the socket
+ * or the next deadline. Awaiting coroutines hold no thread; they resume on
+ * the thread running the executor they were awaited on.
+ *
+ * sync() asks every server in the set and retries each one on timeout. It
+ * then applies the sample with the smallest root distance through
+ * ntp_applySample(), so the C getters, ntp::clock and sharing see it like
+ * any other sync. Names are resolved once, when the server_set is built.
+ */
+
+namespace ntp {
+
+class executor;
+template <class T = void> class task;
+
+namespace detail {
+
+inline thread_local executor *current_executor = nullptr;
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached = false;              // Started by executor::spawn; frees itself
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template <class T>
+struct promise_result {
+    std::optional<T> value;
+
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T take() { return std::move(*value); }
+};
+
+template <>
+struct promise_result<void> {
+    void return_void() noexcept {}
+    void take() noexcept {}
+};
+
+// Resume whoever awaited the task; a detached task has nobody and frees itself
+template <class Promise>
+struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+    {
+        promise_base &p = h.promise();
+        if (p.detached) {
+            // Nobody to rethrow to, as with an exception escaping a std::thread
+            if (p.exception) std::terminate();
+            h.destroy();
+            return std::noop_coroutine();
+        }
+        return p.continuation;
+    }
+
+    void await_resume() noexcept {}
+};
+
+class sync_awaiter;
+
+// One server's part of a sync(): sent, and re-sent on timeout, by the executor
+struct request {
+    sync_awaiter *owner;
+    const sockaddr_in *addr;
+    int attempts = 0;                   // Sent so far
+    int max_attempts;
+    int64_t timeout_ns;
+    uint64_t key = 0;                   // Key of the attempt in flight
+    bool sent = false;                  // The attempt in flight reached the socket
+    ntp_timer_t timer{};                // Its timeout
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine returning T. co_await it from another task,
+ * or hand a task<void> to executor::spawn.
+ */
+template <class T>
+class [[nodiscard]] task {
+public:
+    struct promise_type : detail::promise_base, detail::promise_result<T> {
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        detail::final_awaiter<promise_type> final_suspend() noexcept { return {}; }
+    };
+
+    task(task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    task &operator=(task &&) = delete;
+
+    ~task()
+    {
+        if (h_) h_.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept
+            {
+                h.promise().continuation = waiting;
+                return h;
+            }
+
+            T await_resume()
+            {
+                if (h.promise().exception) std::rethrow_exception(h.promise().exception);
+                return h.promise().take();
+            }
+        };
+        return awaiter{h_};
+    }
+
+private:
+    friend class executor;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    std::coroutine_handle<promise_type> release() noexcept { return std::exchange(h_, {}); }
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+/**
+ * The servers one sync() asks, resolved up front so awaiting never blocks
+ * on DNS.
+ */
+class server_set {
+public:
+    server_set() = default;
+
+    // Each server is "host" or "host:port"
+    server_set(std::initializer_list<std::string> servers)
+    {
+        for (const std::string &server : servers) add(server);
+    }
+
+    /**
+     * Add a server, "host" or "host:port"; false if the port isn't a
+     * number from 1 to 65535 or the host doesn't resolve
+     */
+    bool add(const std::string &server)
+    {
+        std::string host = server;
+        uint16_t port = 123;
+        size_t colon = server.rfind(':');
+        if (colon != std::string::npos) {
+            host = server.substr(0, colon);
+            const char *first = server.data() + colon + 1;
+            const char *last = server.data() + server.size();
+            unsigned value = 0;
+            auto [end, ec] = std::from_chars(first, last, value);
+            if (ec != std::errc() || end != last || value == 0 || value > 65535) return false;
+            port = (uint16_t)value;
+        }
+
+        sockaddr_in addr;
+        if (ntp_resolveServer(host.c_str(), port, &addr) != NTP_OK) return false;
+        addresses_.push_back(addr);
+        return true;
+    }
+
+    const std::vector<sockaddr_in> &addresses() const noexcept { return addresses_; }
+
+    std::chrono::milliseconds timeout{1000};  // Per attempt
+    int attempts = 3;                         // Per server, including the first
+
+private:
+    std::vector<sockaddr_in> addresses_;
+};
+
+/**
+ * Single-threaded event loop that runs tasks and completes their awaits.
+ */
+class executor {
+public:
+    static constexpr size_t max_in_flight = 128;  // Requests outstanding on the socket at once
+
+    struct stats_t {
+        uint64_t requests = 0;          // Datagrams sent
+        uint64_t responses = 0;         // Responses matched to a request
+        uint64_t retries = 0;           // Requests re-sent after a timeout
+        uint64_t timeouts = 0;          // Attempts that timed out
+        uint64_t polls = 0;             // Times the loop waited in ppoll
+    };
+
+    executor() : fd_(ntp_openRequestSocket())
+    {
+        ntp_wheel_init(&wheel_, ntp_getTimeNs());
+    }
+
+    ~executor()
+    {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    /**
+     * The executor running on this thread, or nullptr outside run()
+     */
+    static executor *current() noexcept { return detail::current_executor; }
+
+    /**
+     * Start a task on the next turn of the loop; it frees itself when done
+     */
+    void spawn(task<void> t)
+    {
+        auto h = t.release();
+        h.promise().detached = true;
+        ready_.push_back(h);
+    }
+
+    /**
+     * Run until every task has finished and nothing is pending
+     */
+    void run()
+    {
+        executor *outer = std::exchange(detail::current_executor, this);
+        for (;;) {
+            while (!ready_.empty()) {
+                std::coroutine_handle<> h = ready_.front();
+                ready_.pop_front();
+                h.resume();
+            }
+
+            int64_t now_ns = ntp_getTimeNs();
+            ntp_wheel_advance(&wheel_, now_ns);
+            while (ntp_timer_t *t = ntp_wheel_pop(&wheel_)) t->fn(t, t->arg);
+            if (!ready_.empty()) continue;
+            if (wheel_.count == 0 && pending_.empty() && queued_.empty()) break;
+
+            wait(now_ns);
+        }
+        detail::current_executor = outer;
+    }
+
+    const stats_t &stats() const noexcept { return stats_; }
+
+    // For the awaitables
+
+    void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+    void add_timer(ntp_timer_t *t, int64_t deadline_ns, ntp_timer_fn fn, void *arg)
+    {
+        t->deadline_ns = deadline_ns;
+        t->fn = fn;
+        t->arg = arg;
+        ntp_wheel_add(&wheel_, t);
+    }
+
+    void submit(detail::request *r)
+    {
+        if (in_flight_ < max_in_flight) {
+            send(r);
+        } else {
+            queued_.push_back(r);
+        }
+    }
+
+private:
+    void send(detail::request *r)
+    {
+        r->attempts++;
+        stats_.requests++;
+        if (r->attempts > 1) stats_.retries++;
+        in_flight_++;
+
+        // A send that fails is retried like a lost response
+        r->sent = fd_ >= 0 && ntp_sendRequest(fd_, r->addr, &r->key) == NTP_OK;
+        if (r->sent) pending_[r->key] = r;
+        r->timer = ntp_timer_t{};
+        add_timer(&r->timer, ntp_getTimeNs() + r->timeout_ns, &executor::on_timeout, r);
+    }
+
+    // Send queued requests as the window opens
+    void pump()
+    {
+        while (in_flight_ < max_in_flight && !queued_.empty()) {
+            detail::request *r = queued_.front();
+            queued_.pop_front();
+            send(r);
+        }
+    }
+
+    void receive();
+    static void on_timeout(ntp_timer_t *timer, void *arg);
+
+    // Sleep until the socket is readable or the next deadline, never so
+    // long that an offset change goes unnoticed
+    void wait(int64_t now_ns)
+    {
+        int64_t timeout_ns = NTP_SCHED_RECHECK_NS;
+        int64_t next = ntp_wheel_next(&wheel_);
+        if (next != INT64_MAX && next - now_ns < timeout_ns) {
+            timeout_ns = next - now_ns > 0 ? next - now_ns : 0;
+        }
+        struct timespec ts = {(time_t)(timeout_ns / 1000000000), (long)(timeout_ns % 1000000000)};
+        struct pollfd pfd = {fd_, POLLIN, 0};
+
+        stats_.polls++;
+        if (ppoll(&pfd, pending_.empty() ? 0 : 1, &ts, nullptr) > 0 && (pfd.revents & POLLIN)) {
+            receive();
+        }
+    }
+
+    int fd_;
+    ntp_wheel_t wheel_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::unordered_map<uint64_t, detail::request *> pending_;  // By key, awaiting a response
+    std::deque<detail::request *> queued_;                     // Waiting for the window
+    size_t in_flight_ = 0;                                     // Sent and neither answered nor timed out
+    stats_t stats_;
+};
+
+namespace detail {
+
+class sync_awaiter {
+public:
+    explicit sync_awaiter(const server_set &servers)
+        : addresses_(servers.addresses()),
+          timeout_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(servers.timeout).count()),
+          attempts_(servers.attempts > 0 ? servers.attempts : 1)
+    {
+    }
+
+    bool await_ready() const noexcept { return addresses_.empty(); }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        executor *ex = executor::current();
+        if (ex == nullptr) throw std::logic_error("ntp::sync awaited outside an executor");
+
+        waiter_ = h;
+        ex_ = ex;
+        requests_.reserve(addresses_.size());
+        outstanding_ = addresses_.size();
+        for (const sockaddr_in &addr : addresses_) {
+            requests_.push_back(request{this, &addr, 0, attempts_, timeout_ns_});
+        }
+        for (request &r : requests_) ex->submit(&r);
+    }
+
+    ntp_status_t await_resume() const
+    {
+        if (addresses_.empty()) return NTP_ERROR_NETWORK;
+        if (!best_) return error_;
+        return ntp_applySample(&*best_);
+    }
+
+    // One server answered, failed or ran out of attempts
+    void complete(ntp_status_t status, const ntp_sample_t *sample)
+    {
+        if (status == NTP_OK) {
+            if (!best_ || sample->root_distance_ns < best_->root_distance_ns) best_ = *sample;
+        } else {
+            error_ = status;
+        }
+        if (--outstanding_ == 0) ex_->post(waiter_);
+    }
+
+private:
+    std::vector<sockaddr_in> addresses_;
+    int64_t timeout_ns_;
+    int attempts_;
+    std::vector<request> requests_;
+    size_t outstanding_ = 0;
+    std::optional<ntp_sample_t> best_;
+    ntp_status_t error_ = NTP_ERROR_TIMEOUT;
+    std::coroutine_handle<> waiter_;
+    executor *ex_ = nullptr;
+};
+
+class until_awaiter {
+public:
+    explicit until_awaiter(int64_t deadline_ns) noexcept : deadline_ns_(deadline_ns) {}
+
+    bool await_ready() const noexcept { return ntp_getTimeNs() >= deadline_ns_; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        ex_ = executor::current();
+        if (ex_ == nullptr) throw std::logic_error("ntp::until awaited outside an executor");
+        h_ = h;
+        ex_->add_timer(&timer_, deadline_ns_, &until_awaiter::fire, this);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    static void fire(ntp_timer_t *, void *arg)
+    {
+        until_awaiter *a = static_cast<until_awaiter *>(arg);
+        a->ex_->post(a->h_);
+    }
+
+    int64_t deadline_ns_;
+    ntp_timer_t timer_{};
+    std::coroutine_handle<> h_;
+    executor *ex_ = nullptr;
+};
+
+} // namespace detail
+
+inline void executor::receive()
+{
+    uint64_t key;
+    sockaddr_in from;
+    ntp_sample_t sample;
+    ntp_status_t status;
+
+    while (ntp_receiveResponse(fd_, &key, &from, &sample, &status)) {
+        // Strays and answers to attempts that already timed out
+        auto it = pending_.find(key);
+        if (it == pending_.end()) continue;
+
+        // The key is only our transmit time; an answer from anyone but the
+        // server asked is ignored, so a guessed one can't complete the sync
+        detail::request *r = it->second;
+        if (from.sin_addr.s_addr != r->addr->sin_addr.s_addr || from.sin_port != r->addr->sin_port) continue;
+
+        pending_.erase(it);
+        ntp_wheel_cancel(&wheel_, &r->timer);
+        in_flight_--;
+        stats_.responses++;
+        r->owner->complete(status, &sample);
+    }
+    pump();
+}
+
+inline void executor::on_timeout(ntp_timer_t *timer, void *arg)
+{
+    (void)timer;
+    detail::request *r = static_cast<detail::request *>(arg);
+    executor *ex = detail::current_executor;
+
+    if (r->sent) ex->pending_.erase(r->key);
+    ex->in_flight_--;
+    ex->stats_.timeouts++;
+    if (r->attempts < r->max_attempts) {
+        ex->submit(r);
+    } else {
+        r->owner->complete(NTP_ERROR_TIMEOUT, nullptr);
+    }
+    ex->pump();
+}
+
+/**
+ * Sync with every server in the set; resumes with the status, and the
+ * best sample applied to the client on NTP_OK
+ */
+inline detail::sync_awaiter sync(const server_set &servers)
+{
+    return detail::sync_awaiter(servers);
+}
+
+/**
+ * Resume at an NTP time, never before it
+ */
+template <class Duration>
+inline detail::until_awaiter until(const std::chrono::time_point<clock, Duration> &t)
+{
+    return detail::until_awaiter(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+}
+
+} // namespace ntp
+
+#endif /* NTP_ASYNC_HPP */
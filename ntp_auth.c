@@ -0,0 +1,354 @@
+#include "ntp_auth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include <openssl/params.h>
+#include <openssl/core_names.h>
+
+#define NTP_HEADER_SIZE 48
+#define AES128_KEY_SIZE 16
+#define CMAC_SIZE 16
+#define MD5_SIZE 16
+#define SHA1_SIZE 20
+#define ASCII_KEY_MAX 20              /* ntpd takes longer keys without a prefix to be hex */
+#define KEYFILE_LINE_MAX 512
+
+/**
+ * @brief One key and its precomputed MAC contexts
+ */
+typedef struct {
+    uint32_t id;
+    ntp_auth_type_t type;
+    size_t digest_length;
+    pthread_mutex_t lock;         /* Serializes use of cmac and work */
+    EVP_MAC_CTX *cmac;            /* AES-128-CMAC with the key schedule and subkeys done */
+    EVP_MD_CTX *prefix;           /* MD5 or SHA1 state with the key absorbed; never changed */
+    EVP_MD_CTX *work;             /* prefix copied in for each packet */
+} auth_key_t;
+
+struct ntp_keyring {
+    auth_key_t **keys;            /* Sorted by ID */
+    size_t count;
+    size_t slots;
+};
+
+static void free_key(auth_key_t *key) {
+    if (key == NULL) {
+        return;
+    }
+    EVP_MAC_CTX_free(key->cmac);
+    EVP_MD_CTX_free(key->prefix);
+    EVP_MD_CTX_free(key->work);
+    pthread_mutex_destroy(&key->lock);
+    free(key);
+}
+
+/**
+ * @brief Set up a key's contexts, so signing with it never touches the key again
+ */
+static auth_key_t *create_key(uint32_t id, ntp_auth_type_t type, const uint8_t *secret, size_t length) {
+    auth_key_t *key = calloc(1, sizeof(*key));
+    if (key == NULL) {
+        return NULL;
+    }
+    key->id = id;
+    key->type = type;
+    pthread_mutex_init(&key->lock, NULL);
+
+    if (type == NTP_AUTH_AES128_CMAC) {
+        EVP_MAC *mac = EVP_MAC_fetch(NULL, "CMAC", NULL);
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_CIPHER, "AES-128-CBC", 0),
+            OSSL_PARAM_construct_end()
+        };
+        key->digest_length = CMAC_SIZE;
+        key->cmac = mac != NULL ? EVP_MAC_CTX_new(mac) : NULL;
+        EVP_MAC_free(mac);
+        if (key->cmac == NULL || !EVP_MAC_init(key->cmac, secret, length, params)) {
+            free_key(key);
+            return NULL;
+        }
+        return key;
+    }
+
+    const EVP_MD *md = type == NTP_AUTH_SHA1 ? EVP_sha1() : EVP_md5();
+    key->digest_length = type == NTP_AUTH_SHA1 ? SHA1_SIZE : MD5_SIZE;
+    key->prefix = EVP_MD_CTX_new();
+    key->work = EVP_MD_CTX_new();
+    if (key->prefix == NULL || key->work == NULL || !EVP_DigestInit_ex(key->prefix, md, NULL) ||
+        !EVP_DigestUpdate(key->prefix, secret, length)) {
+        free_key(key);
+        return NULL;
+    }
+    return key;
+}
+
+/**
+ * @brief Digest of a packet under a key; digest_length bytes
+ */
+static bool compute_digest(auth_key_t *key, const void *packet, size_t length, uint8_t *digest) {
+    bool ok;
+
+    pthread_mutex_lock(&key->lock);
+    if (key->cmac != NULL) {
+        /* Without a key, init restarts with the one already scheduled */
+        size_t out;
+        ok = EVP_MAC_init(key->cmac, NULL, 0, NULL) && EVP_MAC_update(key->cmac, packet, length) &&
+             EVP_MAC_final(key->cmac, digest, &out, CMAC_SIZE);
+    } else {
+        unsigned int out;
+        ok = EVP_MD_CTX_copy_ex(key->work, key->prefix) && EVP_DigestUpdate(key->work, packet, length) &&
+             EVP_DigestFinal_ex(key->work, digest, &out);
+    }
+    pthread_mutex_unlock(&key->lock);
+
+    return ok;
+}
+
+/**
+ * @brief Index of the first key with an ID not below id
+ */
+static size_t lower_bound(const ntp_keyring_t *keys, uint32_t id) {
+    size_t lo = 0, hi = keys->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys->keys[mid]->id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static auth_key_t *find_key(const ntp_keyring_t *keys, uint32_t id) {
+    if (keys == NULL) {
+        return NULL;
+    }
+    size_t i = lower_bound(keys, id);
+    return i < keys->count && keys->keys[i]->id == id ? keys->keys[i] : NULL;
+}
+
+ntp_keyring_t *ntp_keyring_create(void) {
+    return calloc(1, sizeof(ntp_keyring_t));
+}
+
+bool ntp_keyring_add(ntp_keyring_t *keys, uint32_t id, ntp_auth_type_t type, const uint8_t *key, size_t length) {
+    if (keys == NULL || key == NULL || id == 0 || length == 0 || length > NTP_AUTH_MAX_KEY ||
+        (type == NTP_AUTH_AES128_CMAC && length != AES128_KEY_SIZE) ||
+        (type != NTP_AUTH_AES128_CMAC && type != NTP_AUTH_SHA1 && type != NTP_AUTH_MD5)) {
+        return false;
+    }
+
+    auth_key_t *created = create_key(id, type, key, length);
+    if (created == NULL) {
+        return false;
+    }
+
+    size_t i = lower_bound(keys, id);
+    if (i < keys->count && keys->keys[i]->id == id) {
+        free_key(keys->keys[i]);
+        keys->keys[i] = created;
+        return true;
+    }
+    if (keys->count == keys->slots) {
+        size_t slots = keys->slots ? keys->slots * 2 : 8;
+        auth_key_t **grown = realloc(keys->keys, slots * sizeof(*grown));
+        if (grown == NULL) {
+            free_key(created);
+            return false;
+        }
+        keys->keys = grown;
+        keys->slots = slots;
+    }
+    memmove(&keys->keys[i + 1], &keys->keys[i], (keys->count - i) * sizeof(*keys->keys));
+    keys->keys[i] = created;
+    keys->count++;
+    return true;
+}
+
+static bool parse_type(const char *name, ntp_auth_type_t *type) {
+    if (strcasecmp(name, "AES128CMAC") == 0 || strcasecmp(name, "AES128") == 0) {
+        *type = NTP_AUTH_AES128_CMAC;
+    } else if (strcasecmp(name, "SHA1") == 0) {
+        *type = NTP_AUTH_SHA1;
+    } else if (strcasecmp(name, "MD5") == 0 || strcasecmp(name, "M") == 0) {
+        *type = NTP_AUTH_MD5;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Decode a keyfile key, hex or ASCII as ntpd and chrony tell them apart
+ *
+ * @return size_t Its length in bytes, or 0 if it isn't valid
+ */
+static size_t parse_key(const char *text, uint8_t *key) {
+    bool hex = strlen(text) > ASCII_KEY_MAX;
+
+    if (strncasecmp(text, "HEX:", 4) == 0) {
+        text += 4;
+        hex = true;
+    } else if (strncasecmp(text, "ASCII:", 6) == 0) {
+        text += 6;
+        hex = false;
+    }
+
+    size_t length = strlen(text);
+    if (!hex) {
+        if (length > NTP_AUTH_MAX_KEY) {
+            return 0;
+        }
+        memcpy(key, text, length);
+        return length;
+    }
+
+    if (length % 2 != 0 || length / 2 > NTP_AUTH_MAX_KEY) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i += 2) {
+        unsigned byte;
+        if (!isxdigit((unsigned char)text[i]) || !isxdigit((unsigned char)text[i + 1]) ||
+            sscanf(text + i, "%2x", &byte) != 1) {
+            return 0;
+        }
+        key[i / 2] = (uint8_t)byte;
+    }
+    return length / 2;
+}
+
+ntp_keyring_t *ntp_keyring_load(const char *path, unsigned *error_line) {
+    char line[KEYFILE_LINE_MAX];
+    unsigned number = 0;
+
+    if (error_line != NULL) {
+        *error_line = 0;
+    }
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+    ntp_keyring_t *keys = ntp_keyring_create();
+    if (keys == NULL) {
+        fclose(in);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        /* ntpd allows a list of addresses after the key; it is ignored */
+        char type_name[32], text[2 * NTP_AUTH_MAX_KEY + 8];
+        unsigned long id;
+        int fields = sscanf(line, "%lu %31s %135s", &id, type_name, text);
+        if (fields <= 0) {
+            continue;                 /* Blank or comment */
+        }
+
+        ntp_auth_type_t type;
+        uint8_t key[NTP_AUTH_MAX_KEY];
+        size_t length;
+        if (fields != 3 || id == 0 || id > UINT32_MAX || !parse_type(type_name, &type) ||
+            (length = parse_key(text, key)) == 0 || !ntp_keyring_add(keys, (uint32_t)id, type, key, length)) {
+            OPENSSL_cleanse(key, sizeof(key));
+            if (error_line != NULL) {
+                *error_line = number;
+            }
+            ntp_keyring_free(keys);
+            fclose(in);
+            errno = EINVAL;
+            return NULL;
+        }
+        OPENSSL_cleanse(key, sizeof(key));
+    }
+
+    OPENSSL_cleanse(line, sizeof(line));
+    fclose(in);
+    return keys;
+}
+
+size_t ntp_keyring_count(const ntp_keyring_t *keys) {
+    return keys != NULL ? keys->count : 0;
+}
+
+bool ntp_keyring_has(const ntp_keyring_t *keys, uint32_t id) {
+    return find_key(keys, id) != NULL;
+}
+
+void ntp_keyring_free(ntp_keyring_t *keys) {
+    if (keys == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < keys->count; i++) {
+        free_key(keys->keys[i]);
+    }
+    free(keys->keys);
+    free(keys);
+}
+
+size_t ntp_auth_sign(const ntp_keyring_t *keys, uint32_t id, const void *packet, size_t length, uint8_t *mac) {
+    auth_key_t *key = find_key(keys, id);
+    if (key == NULL) {
+        return 0;
+    }
+
+    uint32_t wire_id = htonl(id);
+    memcpy(mac, &wire_id, sizeof(wire_id));
+    if (!compute_digest(key, packet, length, mac + sizeof(wire_id))) {
+        return 0;
+    }
+    return sizeof(wire_id) + key->digest_length;
+}
+
+bool ntp_auth_verify(const ntp_keyring_t *keys, const void *packet, size_t length, uint32_t *id,
+                     size_t *data_length) {
+    static const size_t digest_lengths[] = { CMAC_SIZE, SHA1_SIZE };
+    const uint8_t *bytes = packet;
+
+    if (keys == NULL || packet == NULL) {
+        return false;
+    }
+
+    /* The MAC's length depends on the key it names, so try each */
+    for (size_t i = 0; i < sizeof(digest_lengths) / sizeof(digest_lengths[0]); i++) {
+        size_t digest_length = digest_lengths[i];
+        if (length < NTP_HEADER_SIZE + sizeof(uint32_t) + digest_length) {
+            continue;
+        }
+        size_t data = length - sizeof(uint32_t) - digest_length;
+
+        uint32_t wire_id;
+        memcpy(&wire_id, bytes + data, sizeof(wire_id));
+        auth_key_t *key = find_key(keys, ntohl(wire_id));
+        if (key == NULL || key->digest_length != digest_length) {
+            continue;
+        }
+
+        uint8_t digest[SHA1_SIZE];
+        if (compute_digest(key, bytes, data, digest) &&
+            CRYPTO_memcmp(digest, bytes + data + sizeof(wire_id), digest_length) == 0) {
+            if (id != NULL) {
+                *id = key->id;
+            }
+            if (data_length != NULL) {
+                *data_length = data;
+            }
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,102 @@
+#ifndef NTP_AUTH_H
+#define NTP_AUTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NTP symmetric-key authentication (RFC 5905, RFC 8573).
+ *
+ * An authenticated packet ends in a MAC: a four-byte key ID followed by a
+ * digest of the packet before it. The digest is AES-128-CMAC of the packet
+ * (RFC 8573) or, for ntpd and chrony setups that predate it, MD5 or SHA1
+ * of the key followed by the packet.
+ *
+ * Keys live in a keyring, usually loaded from an ntpd-style keyfile:
+ *
+ *     # id  type        key
+ *     1     AES128CMAC  000102030405060708090a0b0c0d0e0f
+ *     2     SHA1        HEX:4e6f74206120676f6f6420736563726574
+ *     3     MD5         secret
+ *
+ * Types are AES128CMAC (or chrony's AES128), SHA1 and MD5 (or M). A key is
+ * hex with a HEX: prefix or if longer than 20 characters, else ASCII
+ * (ASCII: forces it); an AES-128 key is 16 bytes.
+ *
+ * Everything a key needs is set up when it is added, so a packet costs
+ * only its own blocks: CMAC keys keep their expanded AES key schedule and
+ * subkeys, and MD5 and SHA1 keys a digest state that has already absorbed
+ * the key, copied for each packet. Signing and verifying are thread-safe;
+ * threads using the same key take turns on its contexts.
+ */
+
+#define NTP_AUTH_MAX_MAC 24           /* Key ID and the longest digest (SHA1) */
+#define NTP_AUTH_MAX_KEY 64           /* Longest key, in bytes */
+
+typedef enum {
+    NTP_AUTH_AES128_CMAC,         /* RFC 8573 */
+    NTP_AUTH_SHA1,                /* Legacy: SHA1(key || packet) */
+    NTP_AUTH_MD5                  /* Legacy: MD5(key || packet) */
+} ntp_auth_type_t;
+
+typedef struct ntp_keyring ntp_keyring_t;
+
+ntp_keyring_t *ntp_keyring_create(void);
+
+/**
+ * @brief Add a key, replacing any with the same ID
+ *
+ * Not safe while other threads use the keyring.
+ *
+ * @return bool false if the ID is 0, an AES-128 key isn't 16 bytes, a key
+ *         is empty or longer than NTP_AUTH_MAX_KEY, or memory runs out
+ */
+bool ntp_keyring_add(ntp_keyring_t *keys, uint32_t id, ntp_auth_type_t type, const uint8_t *key, size_t length);
+
+/**
+ * @brief Load a keyfile
+ *
+ * @param error_line Set to the line that couldn't be parsed, if any; may be NULL
+ * @return ntp_keyring_t* The keys, or NULL with errno set (EINVAL when a
+ *         line isn't a valid key)
+ */
+ntp_keyring_t *ntp_keyring_load(const char *path, unsigned *error_line);
+
+size_t ntp_keyring_count(const ntp_keyring_t *keys);
+
+/**
+ * @brief Whether the keyring holds a key with this ID
+ */
+bool ntp_keyring_has(const ntp_keyring_t *keys, uint32_t id);
+
+void ntp_keyring_free(ntp_keyring_t *keys);
+
+/**
+ * @brief Compute the MAC that authenticates a packet
+ *
+ * @param packet Header and any extension fields
+ * @param mac Set to the key ID and digest to append; NTP_AUTH_MAX_MAC bytes
+ * @return size_t Bytes written to mac, or 0 if there is no such key
+ */
+size_t ntp_auth_sign(const ntp_keyring_t *keys, uint32_t id, const void *packet, size_t length, uint8_t *mac);
+
+/**
+ * @brief Check the MAC at the end of a packet against the keyring
+ *
+ * @param id Set to the ID of the key that signed it
+ * @param data_length Set to the length of the packet before the MAC
+ * @return bool true if the packet ends in a valid MAC from one of the keys
+ */
+bool ntp_auth_verify(const ntp_keyring_t *keys, const void *packet, size_t length, uint32_t *id,
+                     size_t *data_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_AUTH_H */
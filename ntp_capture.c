@@ -0,0 +1,922 @@
+#include "ntp_capture.h"
+#include "ntp_packet.h"
+#include "ntp_logring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NS_PER_SEC 1000000000LL
+#define NTP_UDP_PORT 123
+
+/* Capture file formats */
+#define PCAP_MAGIC_US 0xa1b2c3d4      /* Classic pcap, microsecond timestamps */
+#define PCAP_MAGIC_NS 0xa1b23c4d      /* Classic pcap, nanosecond timestamps */
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_SIZE 16
+#define PCAPNG_SHB 0x0a0d0d0a         /* Section header block; the same either way round */
+#define PCAPNG_IDB 1                  /* Interface description block */
+#define PCAPNG_EPB 6                  /* Enhanced packet block */
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+#define PCAPNG_OPT_TSRESOL 9
+#define PCAPNG_OPT_TSOFFSET 14
+#define PCAPNG_FILE_HEADER 60         /* Section header and interface description blocks we write */
+#define PCAPNG_MAX_INTERFACES 64      /* Packets on interfaces past these are skipped */
+
+/* Link types */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_DLT_RAW1 12
+#define LINKTYPE_DLT_RAW2 14
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+#define IPPROTO_UDP_NUMBER 17
+
+/* NTP modes the matcher pairs */
+#define MODE_SYMMETRIC_ACTIVE 1
+#define MODE_SYMMETRIC_PASSIVE 2
+#define MODE_CLIENT 3
+#define MODE_SERVER 4
+#define ORIGIN_OFFSET 24              /* Origin timestamp in a packet */
+#define TRANSMIT_OFFSET 40            /* Transmit timestamp in a packet */
+
+/* Recording */
+#define RECORD_HEADERS 28             /* IPv4 and UDP headers put in front of each packet */
+#define RECORD_BLOCK_MAX (32 + RECORD_HEADERS + NTP_RECORDER_MAX_PAYLOAD)  /* Largest block written */
+#define RECORD_BUFFER_SIZE 65536      /* Blocks gathered into one write */
+
+/**
+ * @brief A pcapng interface: its link type and how to read its timestamps
+ */
+typedef struct {
+    uint16_t linktype;
+    bool binary;                  /* Units of 2^-exponent s, not 10^-exponent s */
+    uint8_t exponent;
+    int64_t offset_ns;            /* if_tsoffset */
+} capture_interface_t;
+
+/**
+ * @brief One captured frame
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t caplen;                /* Bytes in the file */
+    size_t origlen;               /* Bytes on the wire */
+    int64_t time_ns;
+    uint32_t linktype;
+} capture_frame_t;
+
+struct ntp_capture {
+    const uint8_t *data;          /* The mapped file */
+    size_t size;
+    size_t pos;                   /* Next record or block */
+    bool pcapng;
+    bool swapped;                 /* The file's byte order isn't ours */
+    uint32_t linktype;            /* Classic pcap */
+    bool nanosecond;              /* Classic pcap */
+    capture_interface_t interfaces[PCAPNG_MAX_INTERFACES];  /* Of the current pcapng section */
+    uint32_t interface_count;
+    uint16_t port;                /* UDP port NTP is on */
+    ntp_capture_stats_t stats;
+};
+
+/* ---------------------------------------------------------------------- */
+/* Reading                                                                */
+/* ---------------------------------------------------------------------- */
+
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint16_t file16(const ntp_capture_t *cap, const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return cap->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t file32(const ntp_capture_t *cap, const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return cap->swapped ? __builtin_bswap32(v) : v;
+}
+
+static int64_t interface_time_ns(const capture_interface_t *ifc, uint64_t ts) {
+    int64_t ns;
+
+    if (ifc->binary) {
+        ns = (int64_t)(((unsigned __int128)ts * NS_PER_SEC) >> ifc->exponent);
+    } else if (ifc->exponent <= 9) {
+        static const int64_t scale[] = { 1000000000, 100000000, 10000000, 1000000, 100000,
+                                         10000, 1000, 100, 10, 1 };
+        ns = (int64_t)ts * scale[ifc->exponent];
+    } else {
+        uint64_t divisor = 1;
+        for (int i = 9; i < ifc->exponent && i < 28; i++) {
+            divisor *= 10;
+        }
+        ns = (int64_t)(ts / divisor);
+    }
+
+    return ns + ifc->offset_ns;
+}
+
+/**
+ * @brief Start a pcapng section at cap->pos; false if it isn't one we can read
+ */
+static bool begin_section(ntp_capture_t *cap) {
+    uint32_t magic;
+
+    if (cap->size - cap->pos < 12) {
+        return false;
+    }
+    memcpy(&magic, cap->data + cap->pos + 8, sizeof(magic));
+    if (magic == PCAPNG_BYTE_ORDER) {
+        cap->swapped = false;
+    } else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER)) {
+        cap->swapped = true;
+    } else {
+        return false;
+    }
+
+    cap->interface_count = 0;
+    return true;
+}
+
+static void add_interface(ntp_capture_t *cap, const uint8_t *body, size_t length) {
+    if (length < 8 || cap->interface_count >= PCAPNG_MAX_INTERFACES) {
+        cap->interface_count++;       /* Keep later interface ids right */
+        return;
+    }
+
+    capture_interface_t *ifc = &cap->interfaces[cap->interface_count++];
+    ifc->linktype = file16(cap, body);
+    ifc->binary = false;
+    ifc->exponent = 6;                /* Microseconds unless the options say otherwise */
+    ifc->offset_ns = 0;
+
+    for (size_t pos = 8; pos + 4 <= length;) {
+        uint16_t code = file16(cap, body + pos);
+        uint16_t size = file16(cap, body + pos + 2);
+        const uint8_t *value = body + pos + 4;
+        if (code == 0 || pos + 4 + size > length) {
+            break;
+        }
+        if (code == PCAPNG_OPT_TSRESOL && size >= 1) {
+            ifc->binary = (value[0] & 0x80) != 0;
+            ifc->exponent = value[0] & 0x7f;
+            if (ifc->binary && ifc->exponent > 63) {
+                ifc->exponent = 63;
+            }
+        } else if (code == PCAPNG_OPT_TSOFFSET && size >= 8) {
+            uint64_t seconds;
+            memcpy(&seconds, value, sizeof(seconds));
+            if (cap->swapped) {
+                seconds = __builtin_bswap64(seconds);
+            }
+            ifc->offset_ns = (int64_t)seconds * NS_PER_SEC;
+        }
+        pos += 4 + ((size + 3u) & ~3u);
+    }
+}
+
+/**
+ * @brief Read the next record or block
+ *
+ * @return int 1 for a frame, 0 for a block without one, -1 at the end
+ */
+static int next_frame(ntp_capture_t *cap, capture_frame_t *frame) {
+    size_t left = cap->size - cap->pos;
+    const uint8_t *p = cap->data + cap->pos;
+
+    if (left == 0) {
+        return -1;
+    }
+
+    if (!cap->pcapng) {
+        if (left < PCAP_RECORD_SIZE) {
+            cap->stats.truncated = true;
+            return -1;
+        }
+        uint32_t seconds = file32(cap, p);
+        uint32_t fraction = file32(cap, p + 4);
+        frame->caplen = file32(cap, p + 8);
+        frame->origlen = file32(cap, p + 12);
+        if (frame->caplen > left - PCAP_RECORD_SIZE) {
+            cap->stats.truncated = true;
+            return -1;
+        }
+        cap->stats.frames++;
+        frame->data = p + PCAP_RECORD_SIZE;
+        frame->time_ns = (int64_t)seconds * NS_PER_SEC + (int64_t)fraction * (cap->nanosecond ? 1 : 1000);
+        frame->linktype = cap->linktype;
+        cap->pos += PCAP_RECORD_SIZE + frame->caplen;
+        return 1;
+    }
+
+    if (left < 12) {
+        cap->stats.truncated = true;
+        return -1;
+    }
+
+    uint32_t type;
+    memcpy(&type, p, sizeof(type));
+    if (type == PCAPNG_SHB && !begin_section(cap)) {
+        cap->stats.truncated = true;
+        return -1;
+    }
+
+    type = file32(cap, p);
+    uint32_t total = file32(cap, p + 4);
+    if (total < 12 || total % 4 != 0 || total > left) {
+        cap->stats.truncated = true;
+        return -1;
+    }
+    cap->pos += total;
+
+    const uint8_t *body = p + 8;
+    size_t length = total - 12;
+    if (type == PCAPNG_IDB) {
+        add_interface(cap, body, length);
+        return 0;
+    }
+    if (type != PCAPNG_EPB) {
+        return 0;                     /* Nothing we read: statistics, name resolution, ... */
+    }
+
+    cap->stats.frames++;
+    if (length < 20) {
+        cap->stats.skipped++;
+        return 0;
+    }
+    uint32_t id = file32(cap, body);
+    uint64_t ts = (uint64_t)file32(cap, body + 4) << 32 | file32(cap, body + 8);
+    frame->caplen = file32(cap, body + 12);
+    frame->origlen = file32(cap, body + 16);
+    if (id >= cap->interface_count || id >= PCAPNG_MAX_INTERFACES || frame->caplen > length - 20) {
+        cap->stats.skipped++;
+        return 0;
+    }
+    frame->data = body + 20;
+    frame->time_ns = interface_time_ns(&cap->interfaces[id], ts);
+    frame->linktype = cap->interfaces[id].linktype;
+    return 1;
+}
+
+/**
+ * @brief Find the IP header in a frame
+ *
+ * @param known Set to false for a link type we can't read
+ * @return const uint8_t* The IP header, or NULL if there is none
+ */
+static const uint8_t *frame_to_ip(const capture_frame_t *frame, size_t *length, bool *known) {
+    const uint8_t *p = frame->data;
+    size_t n = frame->caplen;
+    size_t header;
+
+    *known = true;
+    switch (frame->linktype) {
+        case LINKTYPE_ETHERNET: {
+            if (n < 14) {
+                return NULL;
+            }
+            uint16_t ethertype = be16(p + 12);
+            header = 14;
+            while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) && n >= header + 4) {
+                ethertype = be16(p + header + 2);
+                header += 4;
+            }
+            if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) {
+                return NULL;
+            }
+            break;
+        }
+        case LINKTYPE_LINUX_SLL:
+            if (n < 16 || (be16(p + 14) != ETHERTYPE_IPV4 && be16(p + 14) != ETHERTYPE_IPV6)) {
+                return NULL;
+            }
+            header = 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if (n < 20 || (be16(p) != ETHERTYPE_IPV4 && be16(p) != ETHERTYPE_IPV6)) {
+                return NULL;
+            }
+            header = 20;
+            break;
+        case LINKTYPE_NULL:
+        case LINKTYPE_LOOP:
+            header = 4;               /* Address family; the IP version tells us as much */
+            break;
+        case LINKTYPE_RAW:
+        case LINKTYPE_DLT_RAW1:
+        case LINKTYPE_DLT_RAW2:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            header = 0;
+            break;
+        default:
+            *known = false;
+            return NULL;
+    }
+
+    if (n <= header) {
+        return NULL;
+    }
+    *length = n - header;
+    return p + header;
+}
+
+/**
+ * @brief Fill in an NTP packet from a frame
+ *
+ * @return int 1 for NTP, 0 for anything else, -1 for a frame to count as skipped
+ */
+static int frame_to_ntp(const capture_frame_t *frame, uint16_t port, ntp_capture_packet_t *packet) {
+    size_t n;
+    bool known;
+    const uint8_t *ip = frame_to_ip(frame, &n, &known);
+    const uint8_t *udp;
+    size_t udp_length;
+
+    if (ip == NULL) {
+        return known ? 0 : -1;
+    }
+
+    if (ip[0] >> 4 == 4) {
+        size_t header = (size_t)(ip[0] & 0x0f) * 4;
+        if (n < 20 || header < 20 || header > n || ip[9] != IPPROTO_UDP_NUMBER) {
+            return 0;
+        }
+        if ((be16(ip + 6) & 0x3fff) != 0) {
+            return -1;                /* A fragment: more fragments, or not the first */
+        }
+        size_t total = be16(ip + 2);
+        if (total < header) {
+            return 0;
+        }
+        packet->family = 4;
+        memset(packet->src, 0, sizeof(packet->src));
+        memset(packet->dst, 0, sizeof(packet->dst));
+        memcpy(packet->src, ip + 12, 4);
+        memcpy(packet->dst, ip + 16, 4);
+        udp = ip + header;
+        udp_length = (total < n ? total : n) - header;
+    } else if (ip[0] >> 4 == 6) {
+        if (n < 40 || ip[6] != IPPROTO_UDP_NUMBER) {
+            return 0;                 /* Not UDP, or behind extension headers */
+        }
+        packet->family = 6;
+        memcpy(packet->src, ip + 8, 16);
+        memcpy(packet->dst, ip + 24, 16);
+        udp = ip + 40;
+        udp_length = n - 40;
+    } else {
+        return -1;
+    }
+
+    if (udp_length < 8) {
+        return frame->caplen < frame->origlen ? -1 : 0;
+    }
+    packet->src_port = be16(udp);
+    packet->dst_port = be16(udp + 2);
+    if (packet->src_port != port && packet->dst_port != port) {
+        return 0;
+    }
+
+    size_t length = be16(udp + 4);
+    if (length < 8 + NTP_PACKET_SIZE) {
+        return 0;
+    }
+    if (length > udp_length) {
+        return -1;                    /* Cut short by the snap length */
+    }
+    packet->payload = udp + 8;
+    packet->length = length - 8;
+    packet->time_ns = frame->time_ns;
+    return 1;
+}
+
+ntp_capture_t *ntp_capture_open(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < 12) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    ntp_capture_t *cap = calloc(1, sizeof(*cap));
+    if (cap == NULL) {
+        munmap(data, (size_t)st.st_size);
+        return NULL;
+    }
+    cap->data = data;
+    cap->size = (size_t)st.st_size;
+    cap->port = NTP_UDP_PORT;
+
+    uint32_t magic;
+    memcpy(&magic, cap->data, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        cap->pcapng = true;
+        if (!begin_section(cap)) {
+            ntp_capture_close(cap);
+            errno = EINVAL;
+            return NULL;
+        }
+    } else if (cap->size >= PCAP_HEADER_SIZE &&
+               (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+                magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS))) {
+        cap->swapped = magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+        cap->nanosecond = magic == PCAP_MAGIC_NS || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+        cap->linktype = file32(cap, cap->data + 20) & 0xffff;  /* The upper bits describe the FCS */
+        cap->pos = PCAP_HEADER_SIZE;
+    } else {
+        ntp_capture_close(cap);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return cap;
+}
+
+size_t ntp_capture_read(ntp_capture_t *cap, ntp_capture_packet_t *packets, size_t max) {
+    size_t count = 0;
+    capture_frame_t frame;
+
+    while (count < max) {
+        int r = next_frame(cap, &frame);
+        if (r < 0) {
+            break;
+        }
+        if (r == 0) {
+            continue;
+        }
+
+        r = frame_to_ntp(&frame, cap->port, &packets[count]);
+        if (r > 0) {
+            count++;
+        } else if (r < 0) {
+            cap->stats.skipped++;
+        }
+    }
+
+    cap->stats.ntp_packets += count;
+    return count;
+}
+
+void ntp_capture_set_port(ntp_capture_t *cap, uint16_t port) {
+    cap->port = port;
+}
+
+const ntp_capture_stats_t *ntp_capture_stats(const ntp_capture_t *cap) {
+    return &cap->stats;
+}
+
+void ntp_capture_close(ntp_capture_t *cap) {
+    if (cap == NULL) {
+        return;
+    }
+    munmap((void *)cap->data, cap->size);
+    free(cap);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Matching requests and responses                                        */
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    bool used;
+    uint64_t transmit;            /* The request's transmit timestamp, as on the wire */
+    ntp_capture_packet_t request;
+} pending_request_t;
+
+struct ntp_matcher {
+    size_t mask;
+    pending_request_t *slots;
+};
+
+/**
+ * @brief Slot for a request from client to server carrying transmit
+ */
+static size_t pending_slot(const ntp_matcher_t *m, const uint8_t *client, uint16_t client_port,
+                           uint64_t transmit) {
+    uint64_t a, b;
+    memcpy(&a, client, sizeof(a));
+    memcpy(&b, client + 8, sizeof(b));
+    uint64_t h = (transmit ^ a ^ (b << 1) ^ ((uint64_t)client_port << 48)) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h ^ (h >> 29)) & m->mask;
+}
+
+ntp_matcher_t *ntp_matcher_create(size_t pending) {
+    ntp_matcher_t *m = malloc(sizeof(*m));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    /* Twice as many slots, to keep collisions rare */
+    size_t slots = 64;
+    while (slots < pending * 2) {
+        slots *= 2;
+    }
+    m->mask = slots - 1;
+    m->slots = calloc(slots, sizeof(*m->slots));
+    if (m->slots == NULL) {
+        free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+bool ntp_matcher_add(ntp_matcher_t *m, const ntp_capture_packet_t *packet, ntp_exchange_t *exchange) {
+    uint8_t mode = packet->payload[0] & 0x07;
+    uint64_t stamp;
+
+    if (mode == MODE_CLIENT || mode == MODE_SYMMETRIC_ACTIVE) {
+        memcpy(&stamp, packet->payload + TRANSMIT_OFFSET, sizeof(stamp));
+        pending_request_t *slot = &m->slots[pending_slot(m, packet->src, packet->src_port, stamp)];
+        slot->used = true;
+        slot->transmit = stamp;
+        slot->request = *packet;
+        return false;
+    }
+
+    if (mode != MODE_SERVER && mode != MODE_SYMMETRIC_PASSIVE) {
+        return false;
+    }
+
+    /* The origin timestamp echoes the request's transmit timestamp */
+    memcpy(&stamp, packet->payload + ORIGIN_OFFSET, sizeof(stamp));
+    pending_request_t *slot = &m->slots[pending_slot(m, packet->dst, packet->dst_port, stamp)];
+    const ntp_capture_packet_t *request = &slot->request;
+    if (!slot->used || slot->transmit != stamp || request->family != packet->family ||
+        request->src_port != packet->dst_port || request->dst_port != packet->src_port ||
+        memcmp(request->src, packet->dst, sizeof(request->src)) != 0 ||
+        memcmp(request->dst, packet->src, sizeof(request->dst)) != 0) {
+        return false;
+    }
+
+    exchange->request = *request;
+    exchange->response = *packet;
+    slot->used = false;               /* A duplicated response is not a second exchange */
+    return true;
+}
+
+void ntp_matcher_destroy(ntp_matcher_t *m) {
+    if (m == NULL) {
+        return;
+    }
+    free(m->slots);
+    free(m);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Recording                                                              */
+/* ---------------------------------------------------------------------- */
+
+/**
+ * @brief One packet in the ring
+ */
+typedef struct {
+    int64_t time_ns;
+    struct sockaddr_in src;
+    struct sockaddr_in dst;
+    uint16_t length;
+    uint8_t payload[NTP_RECORDER_MAX_PAYLOAD];
+} record_t;
+
+/**
+ * @brief The writer's side of a recording
+ */
+typedef struct {
+    ntp_recorder_config_t config;
+    int fd;                       /* Current file */
+    uint64_t file_bytes;          /* Written to the current file */
+    uint8_t *buffer;              /* RECORD_BUFFER_SIZE bytes of blocks to write */
+} recorder_t;
+
+static ntp_logring_site_t recorder = NTP_LOGRING_SITE_INIT;
+
+static struct {
+    _Atomic uint64_t written;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t rotations;
+    _Atomic uint64_t write_errors;
+} recorder_stats;
+
+static void put16(uint8_t *p, uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+/**
+ * @brief Section and interface headers that start every file: raw IPv4, nanoseconds
+ *
+ * In host byte order, which the byte-order magic announces; the 16-bit
+ * fields are written as such so they land right on either kind of host.
+ */
+static size_t put_file_header(uint8_t *p) {
+    memset(p, 0, PCAPNG_FILE_HEADER);
+
+    put32(p, PCAPNG_SHB);
+    put32(p + 4, 28);
+    put32(p + 8, PCAPNG_BYTE_ORDER);
+    put16(p + 12, 1);                 /* Version 1.0 */
+    put16(p + 14, 0);
+    put32(p + 16, 0xffffffff);        /* Section length not given */
+    put32(p + 20, 0xffffffff);
+    put32(p + 24, 28);
+
+    uint8_t *idb = p + 28;
+    put32(idb, PCAPNG_IDB);
+    put32(idb + 4, 32);
+    put16(idb + 8, LINKTYPE_RAW);
+    put16(idb + 10, 0);               /* Reserved */
+    put32(idb + 12, 0);               /* No snapshot length */
+    put16(idb + 16, PCAPNG_OPT_TSRESOL);
+    put16(idb + 18, 1);
+    idb[20] = 9;                      /* 10^-9 s, padded to 4 bytes */
+    put32(idb + 24, 0);               /* End of options */
+    put32(idb + 28, 32);
+
+    return PCAPNG_FILE_HEADER;
+}
+
+static uint16_t ipv4_checksum(const uint8_t *header) {
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2) {
+        sum += (uint32_t)be16(header + i);
+    }
+    while (sum > 0xffff) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief An enhanced packet block for a slot, with IPv4 and UDP headers made up around it
+ */
+static size_t put_packet_block(uint8_t *p, const record_t *slot) {
+    size_t caplen = RECORD_HEADERS + slot->length;
+    size_t padded = (caplen + 3) & ~(size_t)3;
+    uint32_t total = (uint32_t)(32 + padded);
+    uint64_t ts = (uint64_t)slot->time_ns;
+
+    put32(p, PCAPNG_EPB);
+    put32(p + 4, total);
+    put32(p + 8, 0);
+    put32(p + 12, (uint32_t)(ts >> 32));
+    put32(p + 16, (uint32_t)ts);
+    put32(p + 20, (uint32_t)caplen);
+    put32(p + 24, (uint32_t)caplen);
+
+    uint8_t *ip = p + 28;
+    uint16_t ip_length = (uint16_t)caplen;
+    uint16_t udp_length = (uint16_t)(8 + slot->length);
+    memset(ip, 0, RECORD_HEADERS);
+    ip[0] = 0x45;
+    ip[2] = ip_length >> 8;
+    ip[3] = ip_length & 0xff;
+    ip[6] = 0x40;                     /* Don't fragment */
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP_NUMBER;
+    memcpy(ip + 12, &slot->src.sin_addr, 4);
+    memcpy(ip + 16, &slot->dst.sin_addr, 4);
+    uint16_t checksum = ipv4_checksum(ip);
+    ip[10] = checksum >> 8;
+    ip[11] = checksum & 0xff;
+
+    uint8_t *udp = ip + 20;
+    memcpy(udp, &slot->src.sin_port, 2);
+    memcpy(udp + 2, &slot->dst.sin_port, 2);
+    udp[4] = udp_length >> 8;
+    udp[5] = udp_length & 0xff;   /* Checksum 0: none, which IPv4 allows */
+    memcpy(udp + 8, slot->payload, slot->length);
+
+    memset(p + 28 + caplen, 0, padded - caplen);
+    put32(p + 28 + padded, total);
+    return total;
+}
+
+static bool write_all(int fd, const uint8_t *p, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Shift path to path.1, path.1 to path.2, ..., dropping the oldest
+ */
+static void rotate_files(const ntp_recorder_config_t *config) {
+    char from[sizeof(config->path) + 16], to[sizeof(config->path) + 16];
+
+    if (config->files == 0) {
+        return;                       /* Nothing kept; the file is just started over */
+    }
+    for (uint32_t i = config->files - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%u", config->path, i);
+        snprintf(to, sizeof(to), "%s.%u", config->path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", config->path);
+    rename(config->path, to);
+}
+
+/**
+ * @brief Start a new current file, with its headers
+ */
+static bool open_record_file(recorder_t *r) {
+    uint8_t header[PCAPNG_FILE_HEADER];
+    size_t length = put_file_header(header);
+
+    r->fd = open(r->config.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->fd < 0) {
+        return false;
+    }
+    if (!write_all(r->fd, header, length)) {
+        close(r->fd);
+        r->fd = -1;
+        return false;
+    }
+    r->file_bytes = length;
+    atomic_fetch_add(&recorder_stats.bytes, length);
+    return true;
+}
+
+/**
+ * @brief Write out everything in the ring; writer thread only
+ */
+static void flush_ring(ntp_logring_t *ring, void *context) {
+    recorder_t *r = context;
+
+    for (;;) {
+        size_t used = 0;
+        uint64_t count = 0;
+        const record_t *record;
+
+        while (used + RECORD_BLOCK_MAX <= RECORD_BUFFER_SIZE && (record = ntp_logring_peek(ring)) != NULL) {
+            used += put_packet_block(r->buffer + used, record);
+            ntp_logring_pop(ring);
+            count++;
+        }
+        if (used == 0) {
+            return;
+        }
+
+        if (r->fd < 0) {
+            /* The last rotation couldn't open a new file; try again rather
+               than rotate once more */
+            open_record_file(r);
+        }
+        if (r->fd < 0 || !write_all(r->fd, r->buffer, used)) {
+            atomic_fetch_add(&recorder_stats.write_errors, 1);
+        } else {
+            r->file_bytes += used;
+            atomic_fetch_add(&recorder_stats.written, count);
+            atomic_fetch_add(&recorder_stats.bytes, used);
+        }
+
+        if (r->fd >= 0 && r->config.max_bytes > 0 && r->file_bytes >= r->config.max_bytes) {
+            close(r->fd);
+            rotate_files(&r->config);
+            open_record_file(r);
+            atomic_fetch_add(&recorder_stats.rotations, 1);
+        }
+    }
+}
+
+/**
+ * @brief Start the first file; runs once no other recording does
+ */
+static bool open_recorder(void *context) {
+    recorder_t *r = context;
+
+    atomic_store(&recorder_stats.written, 0);
+    atomic_store(&recorder_stats.bytes, 0);
+    atomic_store(&recorder_stats.rotations, 0);
+    atomic_store(&recorder_stats.write_errors, 0);
+
+    /* A file left by an earlier run is kept as the newest rotated one */
+    if (access(r->config.path, F_OK) == 0) {
+        rotate_files(&r->config);
+    }
+    return open_record_file(r);
+}
+
+static void free_recorder(void *context) {
+    recorder_t *r = context;
+
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r->buffer);
+    free(r);
+}
+
+bool ntp_recorder_start(const ntp_recorder_config_t *config) {
+    if (config == NULL || config->path[0] == '\0') {
+        return false;
+    }
+
+    recorder_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return false;
+    }
+    r->config = *config;
+    r->config.path[sizeof(r->config.path) - 1] = '\0';
+    r->fd = -1;
+    r->buffer = malloc(RECORD_BUFFER_SIZE);
+    if (r->buffer == NULL) {
+        free_recorder(r);
+        return false;
+    }
+
+    ntp_logring_config_t ring = {
+        .record_size = sizeof(record_t),
+        .records = config->ring_records ? config->ring_records : NTP_RECORDER_RING_RECORDS,
+        .flush_ms = NTP_RECORDER_FLUSH_MS,
+        .context = r,
+        .open = open_recorder,
+        .flush = flush_ring,
+        .close = free_recorder
+    };
+    return ntp_logring_start(&recorder, &ring);
+}
+
+void ntp_recorder_stop(void) {
+    ntp_logring_stop(&recorder);
+}
+
+bool ntp_recorder_active(void) {
+    return ntp_logring_active(&recorder);
+}
+
+void ntp_recorder_record(int64_t time_ns, const struct sockaddr_in *src, const struct sockaddr_in *dst,
+                         const void *payload, size_t length) {
+    record_t *record = ntp_logring_claim(&recorder);
+    if (record == NULL) {
+        return;
+    }
+
+    if (length > NTP_RECORDER_MAX_PAYLOAD) {
+        length = NTP_RECORDER_MAX_PAYLOAD;
+    }
+    record->time_ns = time_ns;
+    record->src = *src;
+    record->dst = *dst;
+    record->length = (uint16_t)length;
+    memcpy(record->payload, payload, length);
+    ntp_logring_commit(&recorder, record);
+}
+
+void ntp_recorder_getStats(ntp_recorder_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->recorded = atomic_load(&recorder.logged);
+    stats->dropped = atomic_load(&recorder.dropped);
+    stats->written = atomic_load(&recorder_stats.written);
+    stats->bytes = atomic_load(&recorder_stats.bytes);
+    stats->rotations = atomic_load(&recorder_stats.rotations);
+    stats->write_errors = atomic_load(&recorder_stats.write_errors);
+}
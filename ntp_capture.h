@@ -0,0 +1,189 @@
+#ifndef NTP_CAPTURE_H
+#define NTP_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NTP traffic from packet captures.
+ *
+ * ntp_capture_open() maps a pcap or pcapng file, and ntp_capture_read()
+ * walks it in place and returns the NTP packets in it: UDP to or from port
+ * 123 (or another set with ntp_capture_set_port()) over IPv4 or IPv6, on Ethernet (with VLAN tags), Linux cooked
+ * capture, raw IP or BSD loopback links. Payloads point into the mapping,
+ * so nothing is copied. IP fragments and records cut short by the snap
+ * length are skipped.
+ *
+ * ntp_matcher_add() pairs client requests with the server responses that
+ * answer them. It uses the addresses, ports and the origin timestamp that
+ * echoes the request's transmit timestamp, as the client does with its
+ * own responses.
+ *
+ * The recorder goes the other way. Once started, every request the client
+ * sends and every response it receives is written to a pcapng file that
+ * ntp-replay can read. The sync path copies each packet into a lock-free
+ * ring and returns. A background thread drains the ring to the file every
+ * NTP_RECORDER_FLUSH_MS and rotates it by size. If the ring is full, the
+ * packet is dropped and counted rather than waited for. Responses carry
+ * the kernel's receive timestamp (SO_TIMESTAMPNS); requests carry the
+ * time the client put in them.
+ */
+
+/**
+ * @brief One NTP packet in a capture
+ */
+typedef struct {
+    int64_t time_ns;              /* Capture time, Unix nanoseconds */
+    uint8_t family;               /* 4 or 6 */
+    uint8_t src[16];              /* Source address; IPv4 in the first 4 bytes */
+    uint8_t dst[16];              /* Destination address */
+    uint16_t src_port;
+    uint16_t dst_port;
+    const uint8_t *payload;       /* UDP payload, inside the mapped capture */
+    size_t length;                /* At least NTP_PACKET_SIZE */
+} ntp_capture_packet_t;
+
+/**
+ * @brief What a capture held, so far
+ */
+typedef struct {
+    uint64_t frames;              /* Captured frames read */
+    uint64_t ntp_packets;         /* NTP packets returned */
+    uint64_t skipped;             /* Frames of unknown link types, fragments and cut-short records */
+    bool truncated;               /* The file ends inside a record or block */
+} ntp_capture_stats_t;
+
+typedef struct ntp_capture ntp_capture_t;
+
+/**
+ * @brief Map a capture file
+ *
+ * @return ntp_capture_t* The capture, or NULL with errno set (EINVAL when
+ *         the file is neither pcap nor pcapng)
+ */
+ntp_capture_t *ntp_capture_open(const char *path);
+
+/**
+ * @brief Look for NTP on another UDP port than 123, before reading
+ *
+ * For servers configured with a port of their own (server_port).
+ */
+void ntp_capture_set_port(ntp_capture_t *cap, uint16_t port);
+
+/**
+ * @brief Read the next NTP packets
+ *
+ * @param packets Filled in with up to max packets, in capture order
+ * @return size_t How many; 0 at the end of the capture
+ */
+size_t ntp_capture_read(ntp_capture_t *cap, ntp_capture_packet_t *packets, size_t max);
+
+/**
+ * @brief Counts of what has been read so far
+ */
+const ntp_capture_stats_t *ntp_capture_stats(const ntp_capture_t *cap);
+
+/**
+ * @brief Unmap the capture; payloads read from it are no longer valid
+ */
+void ntp_capture_close(ntp_capture_t *cap);
+
+/**
+ * @brief A request and the response that answers it
+ */
+typedef struct {
+    ntp_capture_packet_t request;
+    ntp_capture_packet_t response;
+} ntp_exchange_t;
+
+typedef struct ntp_matcher ntp_matcher_t;
+
+/**
+ * @brief Create a matcher holding up to about pending unanswered requests
+ *
+ * Requests wait in a hash table without chaining. A request whose slot is
+ * taken by a newer one is forgotten, as is one its response never comes
+ * for once it is overwritten.
+ *
+ * @return ntp_matcher_t* The matcher, or NULL on failure
+ */
+ntp_matcher_t *ntp_matcher_create(size_t pending);
+
+/**
+ * @brief Offer the next packet of a capture
+ *
+ * @param exchange Set to the exchange the packet completes
+ * @return bool true if the packet is a response to a request seen before
+ */
+bool ntp_matcher_add(ntp_matcher_t *m, const ntp_capture_packet_t *packet, ntp_exchange_t *exchange);
+
+void ntp_matcher_destroy(ntp_matcher_t *m);
+
+#define NTP_RECORDER_FLUSH_MS 100         /* How often the writer drains the ring */
+#define NTP_RECORDER_RING_RECORDS 4096    /* Default ring size */
+#define NTP_RECORDER_MAX_PAYLOAD 128      /* Longer packets are cut to this much */
+
+/**
+ * @brief Where and how to record
+ */
+typedef struct {
+    char path[256];               /* Current file; rotated ones get .1, .2, ... */
+    uint64_t max_bytes;           /* Rotate once the file reaches this size, 0 for never */
+    uint32_t files;               /* Rotated files to keep besides the current one */
+    uint32_t ring_records;        /* Ring capacity, rounded up to a power of two; 0 for the default */
+} ntp_recorder_config_t;
+
+/**
+ * @brief What the recorder has done since it started
+ */
+typedef struct {
+    uint64_t recorded;            /* Packets put in the ring */
+    uint64_t dropped;             /* Packets not recorded because the ring was full */
+    uint64_t written;             /* Packets written out */
+    uint64_t bytes;               /* Bytes written, over all files */
+    uint64_t rotations;           /* Files rotated */
+    uint64_t write_errors;        /* Failed writes; their packets are lost */
+} ntp_recorder_stats_t;
+
+/**
+ * @brief Start recording the client's exchanges, process-wide
+ *
+ * @return bool false if the file can't be created, memory or the thread
+ *         can't be had, or a recorder is already running
+ */
+bool ntp_recorder_start(const ntp_recorder_config_t *config);
+
+/**
+ * @brief Stop recording; everything recorded so far is written out first
+ */
+void ntp_recorder_stop(void);
+
+/**
+ * @brief Whether a recorder is running; one relaxed atomic load
+ */
+bool ntp_recorder_active(void);
+
+/**
+ * @brief Record one packet, if a recorder is running; never blocks
+ *
+ * @param time_ns When it was sent or received, Unix nanoseconds
+ */
+void ntp_recorder_record(int64_t time_ns, const struct sockaddr_in *src, const struct sockaddr_in *dst,
+                         const void *payload, size_t length);
+
+/**
+ * @brief Counts for the running or last recorder
+ */
+void ntp_recorder_getStats(ntp_recorder_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_CAPTURE_H */
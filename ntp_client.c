@@ -1,4 +1,9 @@
 #include "ntp_client.h"
+#include "ntp_capture.h"
+#include "ntp_packet.h"
+#include "ntp_shared.h"
+#include "ntp_sched.h"
+#include "ntp_stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,53 +17,148 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <time.h>
+#include <math.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 /* NTP protocol definitions */
 #define NTP_PORT 123                  /* Default NTP port */
-#define NTP_TIMESTAMP_DELTA 2208988800UL  /* Seconds between 1900 (NTP epoch) and 1970 (Unix epoch) */
 #define NTP_VERSION 4                 /* NTP version 4 */
 #define NTP_MODE_CLIENT 3             /* NTP client mode */
+#define NTP_MODE_BROADCAST 5          /* NTP broadcast server mode */
 #define NTP_STRATUM_MAX 16            /* Maximum stratum value */
 #define NTP_TIMEOUT_SEC 5             /* Default timeout in seconds */
+#define NTP_MAX_DISPERSION_RATE 15    /* Frequency tolerance (PHI) in parts per million */
+
+#define NS_PER_SEC 1000000000LL
+
+/* Sharing syncs with other instances */
+#define NTP_LEADER_POLL_US 50000      /* How often a follower checks for the leader's result */
+#define NTP_SHARED_MAX_OFFSET_SEC 2147483647LL  /* Half an NTP era; no exchange measures more */
+#define NTP_SHARED_MAX_DELAY_SEC 16   /* Longest delay or root distance taken from a leader (MAXDISP) */
+#define NTP_SHARED_FUTURE_NS 1000000000LL  /* How far ahead of our clock a leader's sync may be stamped */
+
+/* Interleaved mode */
+#define NTP_INTERLEAVE_MAX_AGE_SEC 64 /* Longest since the last exchange for asking for interleaved mode */
+
+/* Background sync thread */
+#define NTP_SYNC_RETRY_SEC 10         /* How soon to retry after a failed background sync */
+
+/* Broadcast client */
+#define NTP_BROADCAST_POLL_MS 200     /* Longest the listener goes without checking whether to stop */
+#define NTP_BROADCAST_BURST 4         /* Unicast exchanges per delay calibration, as ntpd's burst */
+
+/* Statistics files */
+#define NTP_STATS_AVG 4               /* Averaging constant for jitter and wander (RFC 5905) */
+#define NTP_STATS_PEER_STATUS 0x9614  /* Configured, reachable, system peer; event "reachable" */
+
+/* ntp_client_getTimeNs */
+#define NTP_SNAPSHOT_RECHECK_NS 10000000  /* How often readers look for a leader's newer result */
+
+#define NTP_CACHE_LINE 64
 
-/* NTP packet structure */
 typedef struct {
-    uint8_t li_vn_mode;           /* Leap indicator, version and mode */
-    uint8_t stratum;              /* Stratum level */
-    uint8_t poll;                 /* Poll interval */
-    uint8_t precision;            /* Precision */
-    uint32_t root_delay;          /* Root delay */
-    uint32_t root_dispersion;     /* Root dispersion */
-    uint32_t ref_id;              /* Reference ID */
-    uint32_t ref_timestamp_sec;   /* Reference timestamp seconds */
-    uint32_t ref_timestamp_frac;  /* Reference timestamp fraction */
-    uint32_t orig_timestamp_sec;  /* Origin timestamp seconds */
-    uint32_t orig_timestamp_frac; /* Origin timestamp fraction */
-    uint32_t recv_timestamp_sec;  /* Receive timestamp seconds */
-    uint32_t recv_timestamp_frac; /* Receive timestamp fraction */
-    uint32_t tx_timestamp_sec;    /* Transmit timestamp seconds */
-    uint32_t tx_timestamp_frac;   /* Transmit timestamp fraction */
-} ntp_packet_t;
-
-/* NTP client state */
+    bool running;                 /* The thread has been started */
+    bool stopping;                /* The thread should exit */
+    bool joinable;                /* A thread was started and not joined yet */
+    bool cond_ready;              /* cond has been initialized */
+    uint64_t attempts;            /* Sync attempts completed */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          /* Signalled after each attempt and on stop (CLOCK_MONOTONIC) */
+} ntp_background_t;
+
+/**
+ * @brief The last exchange with the server, for interleaved mode
+ */
+typedef struct {
+    char server[INET_ADDRSTRLEN]; /* Address it was with, "" for none */
+    uint16_t port;
+    uint32_t remote_rx_sec;       /* Receive timestamp of the response, host byte order, */
+    uint32_t remote_rx_frac;      /* sent back as the next request's origin */
+    uint32_t local_rx_sec;        /* When the response arrived, as the next request's */
+    uint32_t local_rx_frac;       /* receive timestamp; an interleaved response echoes it */
+    int64_t t1_ns;                /* Request sent, system time */
+    int64_t t2_ns;                /* Request received, server time */
+    int64_t t4_ns;                /* Response received, system time */
+} ntp_interleave_t;
+
 typedef struct {
+    bool running;                 /* The thread has been started and not joined; background.lock held */
+    _Atomic bool stopping;        /* The thread should exit */
+    int fd;                       /* Socket bound to the broadcast port */
+    pthread_t thread;
+    ntp_broadcast_config_t config;
+    /* The rest is the listener thread's own, except stats */
+    struct sockaddr_in source;    /* Configured server; sin_family is 0 until resolved */
+    uint64_t source_version;      /* Configuration it was resolved from, 0 for none */
+    char server[INET_ADDRSTRLEN]; /* Its address */
+    int64_t one_way_ns;           /* Calibrated delay from it, -1 before the first calibration */
+    int64_t round_trip_ns;        /* Delay of the calibrating exchange */
+    int64_t calibrated_ns;        /* System time of the last calibration, 0 for none */
+    int64_t last_t3_ns;           /* Transmit time of the last broadcast taken, server time; 0 for none */
+    int64_t last_applied_ns;      /* System time of the last broadcast applied; written with lock held */
+    ntp_broadcast_stats_t stats;  /* lock held */
+} ntp_listener_t;
+
+/**
+ * @brief One configuration; never modified once published, only replaced
+ */
+typedef struct ntp_config_version {
+    ntp_config_t config;
+    uint64_t version;             /* 1 for the first, one more for each replacement */
+    struct ntp_config_version *retired_next;  /* Next on the retired list */
+} ntp_config_version_t;
+
+/* NTP client state. Instances start on a cache line of their own and fill
+   whole lines, so neighbouring instances never share one. */
+struct ntp_client {
+    /* Lock-free copy of the offset for ntp_client_getTimeNs: offset_ns once
+       synced, 0 before. Written with the lock held; kept off the lock's
+       line so readers don't contend with lock holders. */
+    _Alignas(NTP_CACHE_LINE) _Atomic int64_t snapshot_offset_ns;
+    _Atomic int64_t snapshot_checked_ns;  /* System time readers last looked for a leader's result */
+    
+    /* Current configuration, NULL when not initialized. Readers go through
+       config_read_begin/end and never lock; a replaced version is retired
+       and freed once no reader is left. */
+    _Alignas(NTP_CACHE_LINE) _Atomic(ntp_config_version_t *) config;
+    _Atomic uint32_t config_readers;  /* Readers between config_read_begin and _end */
+    _Atomic bool config_retired;  /* The retired list is not empty */
+    pthread_mutex_t config_lock;  /* Serializes replacements and reclamation */
+    ntp_config_version_t *retired;  /* Replaced versions not freed yet; config_lock held */
+    
+    _Alignas(NTP_CACHE_LINE) pthread_mutex_t lock;  /* Mutex for thread safety */
     bool initialized;             /* Whether the client is initialized */
     bool ever_synced;             /* Whether the client has ever synced */
-    ntp_config_t config;          /* Client configuration */
     time_t last_sync_time;        /* Last successful sync time (Unix timestamp) */
     time_t ntp_time;              /* Last retrieved NTP time (Unix timestamp) */
-    int64_t time_offset;          /* Offset between system time and NTP time in seconds */
-    pthread_mutex_t lock;         /* Mutex for thread safety */
-} ntp_client_state_t;
-
-/* Global client state */
-static ntp_client_state_t client_state = {
-    .initialized = false,
-    .ever_synced = false,
-    .last_sync_time = 0,
-    .ntp_time = 0,
-    .time_offset = 0
+    int64_t offset_ns;            /* Offset between system time and NTP time in nanoseconds */
+    int64_t delay_ns;             /* Round-trip delay of the last exchange */
+    int64_t root_distance_ns;     /* Error bound at the moment of the last sync */
+    int64_t last_sync_ns;         /* System time of the last sync in nanoseconds */
+    uint8_t stratum;              /* Stratum of the server at the last sync */
+    uint64_t sync_count;          /* Number of successful syncs */
+    int64_t jitter_ns;            /* RMS of the differences between successive offsets */
+    double frequency_ppm;         /* Rate the offset changes at, averaged */
+    double wander_ppm;            /* RMS of the changes in frequency */
+    ntp_adev_online_t adev;       /* Allan deviation of the offsets */
+    ntp_interleave_t interleave;  /* Last exchange with the server */
+    bool interleaved;             /* The last sync was in interleaved mode */
+    const ntp_keyring_t *keys;    /* Keys to authenticate with, NULL for none */
+    bool sharing;                 /* Share syncs with other instances on this host */
+    char shared_dir[256];         /* Directory of the shared state files ("" for the default) */
+    ntp_shared_t shared;          /* Shared state page for the configured server */
+    ntp_background_t background;  /* Background sync thread */
+    ntp_listener_t listener;      /* Broadcast listener thread */
+};
+
+/* Default instance, behind the functions without a handle */
+static ntp_client_t default_client = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .config_lock = PTHREAD_MUTEX_INITIALIZER,
+    .background.lock = PTHREAD_MUTEX_INITIALIZER
 };
 
 /**
@@ -76,21 +176,44 @@ static uint32_t unix_time_to_ntp_time(time_t unix_seconds) {
 }
 
 /**
- * @brief Get current time as NTP timestamp fraction (0..2^32-1)
+ * @brief Get the system time in nanoseconds since the Unix epoch
+ */
+static int64_t system_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Convert an NTP timestamp (seconds and 2^-32 fraction) to Unix nanoseconds
+ */
+static int64_t ntp_timestamp_to_ns(uint32_t seconds, uint32_t fraction) {
+    return (int64_t)ntp_time_to_unix_time(seconds) * NS_PER_SEC +
+           (int64_t)(((uint64_t)fraction * NS_PER_SEC) >> 32);
+}
+
+/**
+ * @brief Convert an NTP short format value (16.16 fixed point seconds) to nanoseconds
+ */
+static int64_t ntp_short_to_ns(uint32_t value) {
+    return (int64_t)(((uint64_t)value * NS_PER_SEC) >> 16);
+}
+
+/**
+ * @brief Convert Unix nanoseconds to an NTP timestamp, host byte order
  */
-static uint32_t get_fraction_time(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    /* Convert microseconds to a fraction of a second (2^32 units) */
-    return (uint32_t)((double)tv.tv_usec * 4294.967296);
+static void ns_to_ntp_timestamp(int64_t ns, uint32_t *seconds, uint32_t *fraction) {
+    *seconds = unix_time_to_ntp_time(ns / NS_PER_SEC);
+    *fraction = (uint32_t)(((uint64_t)(ns % NS_PER_SEC) << 32) / NS_PER_SEC);
 }
 
 /**
  * @brief Create and initialize an NTP packet for sending to the server
+ *
+ * @param packet Packet to fill in
+ * @param now_ns System time to put in the transmit timestamp
  */
-static void create_ntp_packet(ntp_packet_t *packet) {
-    struct timeval tv;
-    
+static void create_ntp_packet(ntp_packet_t *packet, int64_t now_ns) {
     /* Initialize the packet with zeros */
     memset(packet, 0, sizeof(ntp_packet_t));
     
@@ -98,9 +221,107 @@ static void create_ntp_packet(ntp_packet_t *packet) {
     packet->li_vn_mode = (0 << 6) | (NTP_VERSION << 3) | NTP_MODE_CLIENT;
     
     /* Set transmit timestamp */
-    gettimeofday(&tv, NULL);
-    packet->tx_timestamp_sec = htonl(unix_time_to_ntp_time(tv.tv_sec));
-    packet->tx_timestamp_frac = htonl(get_fraction_time());
+    uint32_t seconds, fraction;
+    ns_to_ntp_timestamp(now_ns, &seconds, &fraction);
+    packet->tx_timestamp_sec = htonl(seconds);
+    packet->tx_timestamp_frac = htonl(fraction);
+}
+
+/**
+ * @brief Convert the fields of a response we use from network byte order
+ */
+static void response_to_host(ntp_packet_t *response) {
+    response->root_delay = ntohl(response->root_delay);
+    response->root_dispersion = ntohl(response->root_dispersion);
+    response->orig_timestamp_sec = ntohl(response->orig_timestamp_sec);
+    response->orig_timestamp_frac = ntohl(response->orig_timestamp_frac);
+    response->recv_timestamp_sec = ntohl(response->recv_timestamp_sec);
+    response->recv_timestamp_frac = ntohl(response->recv_timestamp_frac);
+    response->tx_timestamp_sec = ntohl(response->tx_timestamp_sec);
+    response->tx_timestamp_frac = ntohl(response->tx_timestamp_frac);
+}
+
+/**
+ * @brief Whether a response (host byte order) is one to take time from
+ */
+static bool response_usable(const ntp_packet_t *response) {
+    if ((response->li_vn_mode & 0x07) != 4 /* Server mode */ &&
+        (response->li_vn_mode & 0x07) != 2 /* Symmetric passive mode */) {
+        return false;
+    }
+    
+    return response->stratum != 0 && response->stratum < NTP_STRATUM_MAX;
+}
+
+/**
+ * @brief Compute the sample of one exchange from its four timestamps
+ */
+static void exchange_sample(const ntp_packet_t *response, int64_t t1, int64_t t2, int64_t t3, int64_t t4,
+                            ntp_sample_t *sample) {
+    /* On-wire offset and round-trip delay (RFC 5905) */
+    sample->offset_ns = ((t2 - t1) + (t3 - t4)) / 2;
+    sample->delay_ns = (t4 - t1) - (t3 - t2);
+    if (sample->delay_ns < 0) sample->delay_ns = 0;
+    
+    /* Worst-case error: half the round trip plus the server's own distance to its reference */
+    sample->root_distance_ns = sample->delay_ns / 2 +
+                               ntp_short_to_ns(response->root_delay) / 2 +
+                               ntp_short_to_ns(response->root_dispersion);
+    sample->sent_ns = t1;
+    sample->received_ns = t4;
+    sample->server_time_ns = t3;
+    sample->stratum = response->stratum;
+}
+
+/**
+ * @brief Validate a response (host byte order) and compute the sample it gives
+ *
+ * @param response Server's response
+ * @param t1 System time the request was sent
+ * @param t4 System time the response arrived
+ * @param sample Filled in on success
+ * @return ntp_status_t NTP_ERROR_SERVER if the server's response is unusable
+ */
+static ntp_status_t parse_response(const ntp_packet_t *response, int64_t t1, int64_t t4,
+                                   ntp_sample_t *sample) {
+    if (!response_usable(response)) {
+        return NTP_ERROR_SERVER;
+    }
+    
+    /* Server receive and transmit timestamps */
+    int64_t t2 = ntp_timestamp_to_ns(response->recv_timestamp_sec, response->recv_timestamp_frac);
+    int64_t t3 = ntp_timestamp_to_ns(response->tx_timestamp_sec, response->tx_timestamp_frac);
+    exchange_sample(response, t1, t2, t3, t4, sample);
+    
+    return NTP_OK;
+}
+
+/**
+ * @brief Validate an interleaved response (host byte order) and compute the
+ *        sample of the previous exchange, which it completes
+ *
+ * The response's transmit timestamp is when the server's previous response
+ * really left. The offset is measured as of that exchange, so the sample
+ * counts the clock's worst-case drift since then in its root distance.
+ *
+ * @param previous The exchange before this one
+ * @param t1 System time this request was sent
+ * @param t4 System time this response arrived
+ */
+static ntp_status_t parse_interleaved_response(const ntp_packet_t *response, const ntp_interleave_t *previous,
+                                               int64_t t1, int64_t t4, ntp_sample_t *sample) {
+    if (!response_usable(response)) {
+        return NTP_ERROR_SERVER;
+    }
+    
+    int64_t t3 = ntp_timestamp_to_ns(response->tx_timestamp_sec, response->tx_timestamp_frac);
+    exchange_sample(response, previous->t1_ns, previous->t2_ns, t3, previous->t4_ns, sample);
+    sample->root_distance_ns += (t4 - previous->t4_ns) / 1000000 * NTP_MAX_DISPERSION_RATE;
+    sample->sent_ns = t1;
+    sample->received_ns = t4;
+    sample->server_time_ns = ntp_timestamp_to_ns(response->recv_timestamp_sec, response->recv_timestamp_frac);
+    
+    return NTP_OK;
 }
 
 /**
@@ -137,6 +358,109 @@ static bool resolve_hostname(const char *hostname, char *ip_str, size_t ip_len)
     return true;
 }
 
+/**
+ * @brief Ask the kernel for receive timestamps on a socket, so a response's
+ *        arrival isn't timed late when the thread is slow to wake
+ */
+static void enable_receive_timestamps(int fd) {
+    int on = 1;
+    
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+}
+
+/**
+ * @brief A socket's local address for the recorder, looked up the first
+ *        time it is needed
+ *
+ * @param cache Holds it from then on; zero it for each new socket
+ */
+static const struct sockaddr_in *socket_local(int fd, struct sockaddr_in *cache) {
+    socklen_t length = sizeof(*cache);
+    
+    if (cache->sin_family == 0 && getsockname(fd, (struct sockaddr *)cache, &length) != 0) {
+        memset(cache, 0, sizeof(*cache));
+    }
+    return cache;
+}
+
+/**
+ * @brief Hand a request that was just sent to the recorder, if one is running
+ *
+ * @param local The socket's local address, as for socket_local
+ */
+static void record_sent(int fd, struct sockaddr_in *local, const struct sockaddr_in *server,
+                        const void *packet, size_t length, int64_t sent_ns) {
+    if (!ntp_recorder_active()) {
+        return;
+    }
+    ntp_recorder_record(sent_ns, socket_local(fd, local), server, packet, length);
+}
+
+/**
+ * @brief Receive a packet, and hand it to the recorder with the kernel's
+ *        receive timestamp if one is running
+ *
+ * @param from Set to the sender
+ * @param received_ns Set to the system time it was received: the kernel's
+ *        timestamp if the socket has them on, else when recvmsg returned
+ * @param local The socket's local address, as for socket_local
+ * @return ssize_t As recvfrom
+ */
+static ssize_t receive_packet(int fd, void *buffer, size_t size, struct sockaddr_in *from,
+                              int64_t *received_ns, struct sockaddr_in *local) {
+    struct iovec iov = { buffer, size };
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_name = from,
+        .msg_namelen = sizeof(*from),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    
+    ssize_t n = recvmsg(fd, &msg, 0);
+    *received_ns = system_time_ns();
+    if (n < 0) {
+        return n;
+    }
+    
+    int64_t kernel_ns = *received_ns;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            kernel_ns = (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+        }
+    }
+    *received_ns = kernel_ns;
+    if (ntp_recorder_active()) {
+        ntp_recorder_record(kernel_ns, from, socket_local(fd, local), buffer, (size_t)n);
+    }
+    
+    return n;
+}
+
+/**
+ * @brief Whether a packet answers a request: its origin timestamp is the
+ *        request's transmit timestamp or, for an interleaved request, the
+ *        receive timestamp it carried
+ */
+static bool answers_request(const uint8_t *buffer, const ntp_packet_t *request, bool interleaved) {
+    ntp_packet_t response;
+    
+    memcpy(&response, buffer, sizeof(response));
+    if (response.orig_timestamp_sec == request->tx_timestamp_sec &&
+        response.orig_timestamp_frac == request->tx_timestamp_frac) {
+        return true;
+    }
+    return interleaved && response.orig_timestamp_sec == request->recv_timestamp_sec &&
+           response.orig_timestamp_frac == request->recv_timestamp_frac;
+}
+
 /**
  * @brief Send an NTP request to a server and wait for a response
  * 
@@ -144,15 +468,27 @@ static bool resolve_hostname(const char *hostname, char *ip_str, size_t ip_len)
  * @param server_port NTP server port
  * @param timeout_ms Timeout in milliseconds
  * @param response Pointer to store the NTP response
+ * @param sent_ns Set to the system time the request was sent
+ * @param received_ns Set to the system time the response arrived
+ * @param ip_str Set to the server's address; INET_ADDRSTRLEN bytes
+ * @param previous Last exchange, to ask for interleaved mode if it was with
+ *        this server; NULL for basic mode
+ * @param keys Keyring holding key_id
+ * @param key_id Key to authenticate the exchange with, 0 for none
  * @return ntp_status_t Status code
  */
 static ntp_status_t send_ntp_request(const char *server_name, uint16_t server_port, 
-                                    uint32_t timeout_ms, ntp_packet_t *response) {
+                                    uint32_t timeout_ms, ntp_packet_t *response,
+                                    int64_t *sent_ns, int64_t *received_ns, char *ip_str,
+                                    const ntp_interleave_t *previous,
+                                    const ntp_keyring_t *keys, uint32_t key_id) {
     int sockfd;
     struct sockaddr_in server_addr;
-    socklen_t addr_len = sizeof(server_addr);
+    struct sockaddr_in from;
+    struct sockaddr_in local = { 0 };
     ntp_packet_t packet;
-    char ip_str[INET_ADDRSTRLEN];
+    uint8_t buffer[sizeof(ntp_packet_t) + NTP_AUTH_MAX_MAC];
+    size_t length = sizeof(packet);
     fd_set readfds;
     struct timeval timeout;
     int select_result;
@@ -162,6 +498,7 @@ static ntp_status_t send_ntp_request(const char *server_name, uint16_t server_po
     if (sockfd < 0) {
         return NTP_ERROR_NETWORK;
     }
+    enable_receive_timestamps(sockfd);
     
     /* Set socket timeout */
     timeout.tv_sec = timeout_ms / 1000;
@@ -173,7 +510,7 @@ static ntp_status_t send_ntp_request(const char *server_name, uint16_t server_po
     }
     
     /* Resolve hostname to IP address */
-    if (!resolve_hostname(server_name, ip_str, sizeof(ip_str))) {
+    if (!resolve_hostname(server_name, ip_str, INET_ADDRSTRLEN)) {
         close(sockfd);
         return NTP_ERROR_NETWORK;
     }
@@ -189,183 +526,682 @@ static ntp_status_t send_ntp_request(const char *server_name, uint16_t server_po
     }
     
     /* Create and send the NTP packet */
-    create_ntp_packet(&packet);
-    
-    if (sendto(sockfd, &packet, sizeof(packet), 0, 
-              (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        close(sockfd);
-        return NTP_ERROR_NETWORK;
+    *sent_ns = system_time_ns();
+    create_ntp_packet(&packet, *sent_ns);
+    
+    /* Interleaved mode: origin and receive timestamps from the last
+       response, so the server can send when that response really left */
+    bool interleaved = previous != NULL && previous->port == server_port && strcmp(previous->server, ip_str) == 0;
+    if (interleaved) {
+        packet.orig_timestamp_sec = htonl(previous->remote_rx_sec);
+        packet.orig_timestamp_frac = htonl(previous->remote_rx_frac);
+        packet.recv_timestamp_sec = htonl(previous->local_rx_sec);
+        packet.recv_timestamp_frac = htonl(previous->local_rx_frac);
     }
     
-    /* Wait for response with timeout */
-    FD_ZERO(&readfds);
-    FD_SET(sockfd, &readfds);
-    
-    select_result = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
+    /* The MAC follows the header */
+    memcpy(buffer, &packet, sizeof(packet));
+    if (key_id != 0) {
+        size_t mac_length = ntp_auth_sign(keys, key_id, buffer, sizeof(packet), buffer + sizeof(packet));
+        if (mac_length == 0) {
+            close(sockfd);
+            return NTP_ERROR_AUTH;
+        }
+        length += mac_length;
+    }
     
-    if (select_result < 0) {
+    if (sendto(sockfd, buffer, length, 0, 
+              (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         close(sockfd);
         return NTP_ERROR_NETWORK;
-    } else if (select_result == 0) {
-        close(sockfd);
-        return NTP_ERROR_TIMEOUT;
+    }
+    record_sent(sockfd, &local, &server_addr, buffer, length, *sent_ns);
+    
+    /* Wait for the response to this request. A packet from elsewhere, or
+       with an origin timestamp that isn't ours, is dropped and the wait
+       goes on; select leaves the time remaining in timeout. */
+    ssize_t received;
+    for (;;) {
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        
+        select_result = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
+        
+        if (select_result < 0) {
+            close(sockfd);
+            return NTP_ERROR_NETWORK;
+        } else if (select_result == 0) {
+            close(sockfd);
+            return NTP_ERROR_TIMEOUT;
+        }
+        
+        received = receive_packet(sockfd, buffer, sizeof(buffer), &from, received_ns, &local);
+        if (received < 0) {
+            close(sockfd);
+            return NTP_ERROR_NETWORK;
+        }
+        if (from.sin_addr.s_addr != server_addr.sin_addr.s_addr || from.sin_port != server_addr.sin_port) {
+            continue;
+        }
+        if ((size_t)received < sizeof(ntp_packet_t)) {
+            close(sockfd);
+            return NTP_ERROR_SERVER;
+        }
+        if (answers_request(buffer, &packet, interleaved)) {
+            break;
+        }
     }
     
-    /* Receive the response */
-    if (recvfrom(sockfd, response, sizeof(ntp_packet_t), 0,
-                (struct sockaddr*)&server_addr, &addr_len) < 0) {
+    /* Signed with the key we asked with, or not at all */
+    uint32_t signed_by;
+    if (key_id != 0 && (!ntp_auth_verify(keys, buffer, (size_t)received, &signed_by, NULL) ||
+                        signed_by != key_id)) {
         close(sockfd);
-        return NTP_ERROR_NETWORK;
+        return NTP_ERROR_AUTH;
     }
     
-    /* Convert network byte order to host byte order */
-    response->recv_timestamp_sec = ntohl(response->recv_timestamp_sec);
-    response->recv_timestamp_frac = ntohl(response->recv_timestamp_frac);
-    response->tx_timestamp_sec = ntohl(response->tx_timestamp_sec);
-    response->tx_timestamp_frac = ntohl(response->tx_timestamp_frac);
+    memcpy(response, buffer, sizeof(*response));
+    response_to_host(response);
     
     close(sockfd);
     return NTP_OK;
 }
 
-ntp_status_t ntp_init(const ntp_config_t *config) {
+/**
+ * @brief Start reading the configuration; never blocks
+ *
+ * @return const ntp_config_version_t* Current version, NULL if not
+ *         initialized; valid until config_read_end
+ */
+static const ntp_config_version_t *config_read_begin(ntp_client_t *c) {
+    atomic_fetch_add(&c->config_readers, 1);
+    return atomic_load(&c->config);
+}
+
+/**
+ * @brief Free the retired versions if no reader can still hold one; config_lock held
+ *
+ * A reader counts itself before it loads the pointer, so if none is
+ * counted now, none holds a version that was replaced before this point.
+ */
+static void reclaim_config_locked(ntp_client_t *c) {
+    if (c->retired == NULL || atomic_load(&c->config_readers) != 0) {
+        return;
+    }
+    while (c->retired != NULL) {
+        ntp_config_version_t *next = c->retired->retired_next;
+        free(c->retired);
+        c->retired = next;
+    }
+    atomic_store(&c->config_retired, false);
+}
+
+/**
+ * @brief Done with the version from config_read_begin
+ *
+ * The last reader out frees retired versions, unless a writer is busy and
+ * will do it.
+ */
+static void config_read_end(ntp_client_t *c) {
+    if (atomic_fetch_sub(&c->config_readers, 1) == 1 &&
+        atomic_load_explicit(&c->config_retired, memory_order_relaxed) &&
+        pthread_mutex_trylock(&c->config_lock) == 0) {
+        reclaim_config_locked(c);
+        pthread_mutex_unlock(&c->config_lock);
+    }
+}
+
+/**
+ * @brief Publish a new version, retiring the current one; config_lock held
+ */
+static void replace_config_locked(ntp_client_t *c, ntp_config_version_t *v) {
+    ntp_config_version_t *old = atomic_load(&c->config);
+    
+    v->version = old != NULL ? old->version + 1 : 1;
+    v->retired_next = NULL;
+    atomic_store(&c->config, v);
+    if (old != NULL) {
+        old->retired_next = c->retired;
+        c->retired = old;
+        atomic_store(&c->config_retired, true);
+    }
+    reclaim_config_locked(c);
+}
+
+/**
+ * @brief Set up an instance with the given configuration
+ */
+static ntp_status_t client_init(ntp_client_t *c, const ntp_config_t *config) {
     if (config == NULL) {
         return NTP_ERROR_INVALID_PARAM;
     }
     
     /* Initialize mutex */
-    if (pthread_mutex_init(&client_state.lock, NULL) != 0) {
+    if (pthread_mutex_init(&c->lock, NULL) != 0) {
         return NTP_ERROR_NETWORK;
     }
     
-    pthread_mutex_lock(&client_state.lock);
+    ntp_config_version_t *v = malloc(sizeof(*v));
+    if (v == NULL) {
+        return NTP_ERROR_NETWORK;
+    }
+    memcpy(&v->config, config, sizeof(ntp_config_t));
+    pthread_mutex_lock(&c->config_lock);
+    replace_config_locked(c, v);
+    pthread_mutex_unlock(&c->config_lock);
     
-    /* Copy configuration */
-    memcpy(&client_state.config, config, sizeof(ntp_config_t));
+    pthread_mutex_lock(&c->lock);
     
     /* Initialize state */
-    client_state.initialized = true;
-    client_state.ever_synced = false;
-    client_state.last_sync_time = 0;
-    client_state.ntp_time = 0;
-    client_state.time_offset = 0;
-    
-    pthread_mutex_unlock(&client_state.lock);
+    c->initialized = true;
+    c->ever_synced = false;
+    c->last_sync_time = 0;
+    c->ntp_time = 0;
+    c->offset_ns = 0;
+    c->delay_ns = 0;
+    c->root_distance_ns = 0;
+    c->last_sync_ns = 0;
+    c->stratum = 0;
+    c->sync_count = 0;
+    c->jitter_ns = 0;
+    c->frequency_ppm = 0;
+    c->wander_ppm = 0;
+    ntp_adev_online_reset(&c->adev);
+    memset(&c->interleave, 0, sizeof(c->interleave));
+    c->interleaved = false;
+    c->keys = NULL;
+    c->sharing = false;
+    atomic_store(&c->snapshot_offset_ns, 0);
+    
+    pthread_mutex_unlock(&c->lock);
     
     return NTP_OK;
 }
 
+/**
+ * @brief Release an instance's resources
+ */
+static void client_cleanup(ntp_client_t *c) {
+    /* The listener applies broadcasts until it is joined */
+    ntp_client_stopBroadcastClient(c);
+    
+    pthread_mutex_lock(&c->lock);
+    
+    c->initialized = false;
+    atomic_store(&c->snapshot_offset_ns, 0);
+    if (c->sharing) {
+        ntp_shared_close(&c->shared);
+        c->sharing = false;
+    }
+    
+    pthread_mutex_unlock(&c->lock);
+    pthread_mutex_destroy(&c->lock);
+    
+    /* Nothing may use the client any more, so no reader is left either */
+    pthread_mutex_lock(&c->config_lock);
+    ntp_config_version_t *v = atomic_exchange(&c->config, NULL);
+    if (v != NULL) {
+        v->retired_next = c->retired;
+        c->retired = v;
+    }
+    while (c->retired != NULL) {
+        ntp_config_version_t *next = c->retired->retired_next;
+        free(c->retired);
+        c->retired = next;
+    }
+    atomic_store(&c->config_retired, false);
+    pthread_mutex_unlock(&c->config_lock);
+}
+
+ntp_status_t ntp_init(const ntp_config_t *config) {
+    return client_init(&default_client, config);
+}
+
 void ntp_cleanup(void) {
-    pthread_mutex_lock(&client_state.lock);
+    client_cleanup(&default_client);
+}
+
+ntp_client_t *ntp_client_create(const ntp_config_t *config) {
+    ntp_client_t *c;
+    
+    if (config == NULL) {
+        return NULL;
+    }
+    
+    /* sizeof is a multiple of the alignment, as aligned_alloc requires */
+    c = aligned_alloc(_Alignof(ntp_client_t), sizeof(ntp_client_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    memset(c, 0, sizeof(*c));
+    
+    if (pthread_mutex_init(&c->background.lock, NULL) != 0) {
+        free(c);
+        return NULL;
+    }
+    if (pthread_mutex_init(&c->config_lock, NULL) != 0) {
+        pthread_mutex_destroy(&c->background.lock);
+        free(c);
+        return NULL;
+    }
+    if (client_init(c, config) != NTP_OK) {
+        pthread_mutex_destroy(&c->config_lock);
+        pthread_mutex_destroy(&c->background.lock);
+        free(c);
+        return NULL;
+    }
+    
+    return c;
+}
+
+void ntp_client_destroy(ntp_client_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    
+    /* Wait out the background thread, including a sync in progress; the
+       broadcast listener is stopped by client_cleanup */
+    ntp_client_stopBackgroundSync(c);
+    if (c->background.joinable) {
+        pthread_join(c->background.thread, NULL);
+    }
     
-    client_state.initialized = false;
+    client_cleanup(c);
+    if (c->background.cond_ready) {
+        pthread_cond_destroy(&c->background.cond);
+    }
+    pthread_mutex_destroy(&c->config_lock);
+    pthread_mutex_destroy(&c->background.lock);
+    free(c);
+}
+
+/**
+ * @brief (Re)open the shared state page for the configured server; lock held
+ */
+static void open_shared_locked(ntp_client_t *c) {
+    char key[sizeof(c->shared.key)];
     
-    pthread_mutex_unlock(&client_state.lock);
-    pthread_mutex_destroy(&client_state.lock);
+    if (c->sharing) {
+        ntp_shared_close(&c->shared);
+    }
+    const ntp_config_version_t *v = config_read_begin(c);
+    snprintf(key, sizeof(key), "%s:%u", v->config.server_name,
+             (unsigned)v->config.server_port);
+    config_read_end(c);
+    c->sharing = ntp_shared_open(&c->shared,
+                                           c->shared_dir[0] ? c->shared_dir : NULL,
+                                           key);
 }
 
-ntp_status_t ntp_sync(void) {
+/**
+ * @brief Take on the leader's latest result if it published a newer one; lock held
+ */
+static void adopt_shared_locked(ntp_client_t *c) {
+    ntp_shared_sync_t sync;
+    
+    if (!c->sharing || c->shared.leader ||
+        !ntp_shared_changed(&c->shared) ||
+        !ntp_shared_read(&c->shared, &sync) ||
+        sync.sync_count == 0 || sync.last_sync_ns <= c->last_sync_ns) {
+        return;
+    }
+    
+    /* Only our own user's instances can write the page, but a result no
+       exchange could have produced is still ignored */
+    if (sync.offset_ns < -NTP_SHARED_MAX_OFFSET_SEC * NS_PER_SEC ||
+        sync.offset_ns > NTP_SHARED_MAX_OFFSET_SEC * NS_PER_SEC ||
+        sync.delay_ns < 0 || sync.delay_ns > NTP_SHARED_MAX_DELAY_SEC * NS_PER_SEC ||
+        sync.root_distance_ns < 0 || sync.root_distance_ns > NTP_SHARED_MAX_DELAY_SEC * NS_PER_SEC ||
+        sync.last_sync_ns <= 0 || sync.last_sync_ns > system_time_ns() + NTP_SHARED_FUTURE_NS ||
+        sync.stratum == 0 || sync.stratum >= NTP_STRATUM_MAX) {
+        return;
+    }
+    
+    c->offset_ns = sync.offset_ns;
+    c->delay_ns = sync.delay_ns;
+    c->root_distance_ns = sync.root_distance_ns;
+    c->last_sync_ns = sync.last_sync_ns;
+    c->last_sync_time = sync.last_sync_ns / NS_PER_SEC;
+    c->ntp_time = (sync.last_sync_ns + sync.offset_ns) / NS_PER_SEC;
+    c->stratum = sync.stratum;
+    c->sync_count = sync.sync_count;
+    c->ever_synced = true;
+    atomic_store(&c->snapshot_offset_ns, c->offset_ns);
+}
+
+/**
+ * @brief Publish the outcome of a sync for the followers; lock held
+ */
+static void publish_shared_locked(ntp_client_t *c, ntp_status_t status) {
+    ntp_shared_sync_t sync;
+    
+    /* Carry on from whatever an earlier leader published */
+    if (!ntp_shared_read(&c->shared, &sync)) {
+        memset(&sync, 0, sizeof(sync));
+    }
+    
+    sync.status = status;
+    sync.leader_pid = getpid();
+    sync.attempts++;
+    if (status == NTP_OK) {
+        sync.sync_count = c->sync_count;
+        sync.offset_ns = c->offset_ns;
+        sync.delay_ns = c->delay_ns;
+        sync.root_distance_ns = c->root_distance_ns;
+        sync.last_sync_ns = c->last_sync_ns;
+        sync.stratum = c->stratum;
+    }
+    
+    ntp_shared_publish(&c->shared, &sync);
+}
+
+/**
+ * @brief Get the result of a sync from the leader instead of the network
+ *
+ * Waits as long as a sync of our own could take for the leader to publish
+ * a result that is recent enough, or to report a failed attempt.
+ *
+ * @param config Configuration to sync with
+ * @param status Set to the outcome when the leader provided one
+ * @return bool false if there is no live leader and this process took over
+ */
+static bool sync_from_leader(ntp_client_t *c, const ntp_config_t *config, ntp_status_t *status) {
+    ntp_shared_sync_t sync;
+    uint64_t first_attempts = 0;
+    int64_t patience_ns = (int64_t)config->retry_count * (config->timeout_ms + 500) * 1000000;
+    int64_t fresh_ns = (int64_t)config->sync_interval * NS_PER_SEC;
+    struct timespec start, now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    for (int polls = 0; ; polls++) {
+        pthread_mutex_lock(&c->lock);
+        if (!c->sharing || ntp_shared_try_lead(&c->shared)) {
+            pthread_mutex_unlock(&c->lock);
+            return false;
+        }
+        adopt_shared_locked(c);
+        bool published = ntp_shared_read(&c->shared, &sync);
+        pthread_mutex_unlock(&c->lock);
+        
+        if (published) {
+            if (polls == 0) {
+                first_attempts = sync.attempts;
+            }
+            if (sync.sync_count > 0 && system_time_ns() - sync.last_sync_ns < fresh_ns) {
+                *status = NTP_OK;
+                return true;
+            }
+            if (sync.attempts != first_attempts && sync.status != NTP_OK) {
+                *status = (ntp_status_t)sync.status;
+                return true;
+            }
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * NS_PER_SEC + (now.tv_nsec - start.tv_nsec) >= patience_ns) {
+            *status = NTP_ERROR_TIMEOUT;
+            return true;
+        }
+        usleep(NTP_LEADER_POLL_US);
+    }
+}
+
+/**
+ * @brief Make a sample the client's current sync state; lock held
+ */
+static void apply_sample_locked(ntp_client_t *c, const ntp_sample_t *sample) {
+    /* Jitter and frequency from the change since the last sync, averaged
+       as RFC 5905's clock discipline does */
+    if (c->ever_synced && sample->received_ns > c->last_sync_ns) {
+        double diff_ns = (double)(sample->offset_ns - c->offset_ns);
+        double jitter_ns = (double)c->jitter_ns;
+        c->jitter_ns = (int64_t)sqrt(jitter_ns * jitter_ns + (diff_ns * diff_ns - jitter_ns * jitter_ns) / NTP_STATS_AVG);
+        
+        double rate_ppm = diff_ns / (double)(sample->received_ns - c->last_sync_ns) * 1e6;
+        double change_ppm = (rate_ppm - c->frequency_ppm) / NTP_STATS_AVG;
+        c->frequency_ppm += change_ppm;
+        c->wander_ppm = sqrt(c->wander_ppm * c->wander_ppm +
+                             (change_ppm * change_ppm - c->wander_ppm * c->wander_ppm) / NTP_STATS_AVG);
+    }
+    
+    ntp_adev_online_add(&c->adev, sample->received_ns, sample->offset_ns);
+    
+    c->offset_ns = sample->offset_ns;
+    c->delay_ns = sample->delay_ns;
+    c->root_distance_ns = sample->root_distance_ns;
+    
+    /* Update state */
+    c->last_sync_time = sample->received_ns / NS_PER_SEC;
+    c->last_sync_ns = sample->received_ns;
+    c->ntp_time = sample->server_time_ns / NS_PER_SEC;
+    c->stratum = sample->stratum;
+    c->sync_count++;
+    c->ever_synced = true;
+    c->interleaved = false;
+    atomic_store(&c->snapshot_offset_ns, c->offset_ns);
+}
+
+/**
+ * @brief Log the sync just applied to the statistics files, if they are kept; lock held
+ */
+static void log_sync_locked(const ntp_client_t *c, const ntp_sample_t *sample, const char *peer,
+                            uint32_t sync_interval) {
+    ntp_stats_record_t record;
+    
+    if (!ntp_stats_active()) {
+        return;
+    }
+    record.time_ns = sample->received_ns + sample->offset_ns;
+    snprintf(record.peer, sizeof(record.peer), "%s", peer);
+    record.status = NTP_STATS_PEER_STATUS;
+    record.offset_ns = sample->offset_ns;
+    record.delay_ns = sample->delay_ns;
+    record.dispersion_ns = sample->root_distance_ns - sample->delay_ns / 2;
+    record.jitter_ns = c->jitter_ns;
+    record.frequency_ppm = c->frequency_ppm;
+    record.wander_ppm = c->wander_ppm;
+    record.poll = (int8_t)(sync_interval > 0 ? 31 - __builtin_clz(sync_interval) : 0);
+    ntp_stats_log(&record);
+}
+
+/**
+ * @brief Sync with the configured server over the network
+ */
+static ntp_status_t sync_from_network(ntp_client_t *c, const ntp_config_t *config) {
     ntp_packet_t response;
+    ntp_sample_t sample;
     ntp_status_t status;
-    time_t server_time, current_time;
-    struct timeval local_time;
+    int64_t t1, t4;
+    char ip_str[INET_ADDRSTRLEN];
     uint32_t attempts = 0;
     
-    pthread_mutex_lock(&client_state.lock);
-    
-    if (!client_state.initialized) {
-        pthread_mutex_unlock(&client_state.lock);
-        return NTP_ERROR_NOT_INIT;
+    /* Ask for interleaved mode if the last exchange is recent enough that
+       the clock can't have drifted much since */
+    pthread_mutex_lock(&c->lock);
+    ntp_interleave_t previous = c->interleave;
+    const ntp_keyring_t *keys = c->keys;
+    pthread_mutex_unlock(&c->lock);
+    bool recent = previous.server[0] != '\0' &&
+                  system_time_ns() - previous.t4_ns < NTP_INTERLEAVE_MAX_AGE_SEC * NS_PER_SEC;
+    
+    if (config->key_id != 0 && !ntp_keyring_has(keys, config->key_id)) {
+        return NTP_ERROR_AUTH;
     }
     
     /* Try to sync with server, with retries */
     do {
         status = send_ntp_request(
-            client_state.config.server_name,
-            client_state.config.server_port,
-            client_state.config.timeout_ms,
-            &response
+            config->server_name,
+            config->server_port,
+            config->timeout_ms,
+            &response,
+            &t1,
+            &t4,
+            ip_str,
+            recent ? &previous : NULL,
+            keys,
+            config->key_id
         );
         
         attempts++;
         
         /* If failed and we have retries left, sleep a bit and try again */
-        if (status != NTP_OK && attempts < client_state.config.retry_count) {
-            pthread_mutex_unlock(&client_state.lock);
+        if (status != NTP_OK && attempts < config->retry_count) {
             usleep(500000); /* 500ms */
-            pthread_mutex_lock(&client_state.lock);
         }
-    } while (status != NTP_OK && attempts < client_state.config.retry_count);
+    } while (status != NTP_OK && attempts < config->retry_count);
     
     if (status != NTP_OK) {
-        pthread_mutex_unlock(&client_state.lock);
         return status;
     }
     
-    /* Validate the server's response */
-    if ((response.li_vn_mode & 0x07) != 4 /* Server mode */ &&
-        (response.li_vn_mode & 0x07) != 2 /* Symmetric passive mode */) {
-        pthread_mutex_unlock(&client_state.lock);
-        return NTP_ERROR_SERVER;
+    /* An interleaved response echoes our receive timestamp instead of our
+       transmit timestamp */
+    bool interleaved = recent && strcmp(previous.server, ip_str) == 0 &&
+                       (previous.local_rx_sec | previous.local_rx_frac) != 0 &&
+                       response.orig_timestamp_sec == previous.local_rx_sec &&
+                       response.orig_timestamp_frac == previous.local_rx_frac;
+    if (interleaved) {
+        status = parse_interleaved_response(&response, &previous, t1, t4, &sample);
+    } else {
+        status = parse_response(&response, t1, t4, &sample);
     }
-    
-    if (response.stratum == 0 || response.stratum >= NTP_STRATUM_MAX) {
-        pthread_mutex_unlock(&client_state.lock);
-        return NTP_ERROR_SERVER;
+    if (status != NTP_OK) {
+        return status;
     }
     
-    /* Get server time from response */
-    server_time = ntp_time_to_unix_time(response.tx_timestamp_sec);
-    
-    /* Get current system time */
-    gettimeofday(&local_time, NULL);
-    current_time = local_time.tv_sec;
-    
-    /* Calculate time offset */
-    client_state.time_offset = server_time - current_time;
-    
-    /* Update state */
-    client_state.last_sync_time = current_time;
-    client_state.ntp_time = server_time;
-    client_state.ever_synced = true;
-    
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    apply_sample_locked(c, &sample);
+    c->interleaved = interleaved;
+    log_sync_locked(c, &sample, ip_str, config->sync_interval);
+    
+    /* This exchange is the one the next request refers back to */
+    ntp_interleave_t *next = &c->interleave;
+    memcpy(next->server, ip_str, sizeof(next->server));
+    next->port = config->server_port;
+    next->remote_rx_sec = response.recv_timestamp_sec;
+    next->remote_rx_frac = response.recv_timestamp_frac;
+    ns_to_ntp_timestamp(t4, &next->local_rx_sec, &next->local_rx_frac);
+    next->t1_ns = t1;
+    next->t2_ns = ntp_timestamp_to_ns(response.recv_timestamp_sec, response.recv_timestamp_frac);
+    next->t4_ns = t4;
+    pthread_mutex_unlock(&c->lock);
     
     return NTP_OK;
 }
 
-time_t ntp_getCurrentTime(void) 
-{
-    struct timeval current_time;
-    time_t adjusted_time;
+ntp_status_t ntp_client_sync(ntp_client_t *c) {
+    ntp_status_t status;
+    ntp_config_t config;
+    bool sharing;
     
-    pthread_mutex_lock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
     
-    if (!client_state.initialized || !client_state.ever_synced) {
-        pthread_mutex_unlock(&client_state.lock);
-        return 0;
+    if (!c->initialized) {
+        pthread_mutex_unlock(&c->lock);
+        return NTP_ERROR_NOT_INIT;
     }
     
-    /* Get current system time */
-    gettimeofday(&current_time, NULL);
+    sharing = c->sharing;
+    
+    pthread_mutex_unlock(&c->lock);
+    
+    /* The whole sync uses the configuration as it was now, whatever
+       replaces it in the meantime */
+    const ntp_config_version_t *v = config_read_begin(c);
+    if (v == NULL) {
+        config_read_end(c);
+        return NTP_ERROR_NOT_INIT;
+    }
+    memcpy(&config, &v->config, sizeof(config));
+    config_read_end(c);
+    
+    /* Only the leader talks to the server */
+    if (sharing && sync_from_leader(c, &config, &status)) {
+        return status;
+    }
+    
+    status = sync_from_network(c, &config);
+    
+    pthread_mutex_lock(&c->lock);
+    if (c->sharing && c->shared.leader) {
+        publish_shared_locked(c, status);
+    }
+    pthread_mutex_unlock(&c->lock);
+    
+    return status;
+}
+
+ntp_status_t ntp_client_setKeys(ntp_client_t *c, const ntp_keyring_t *keys) {
+    pthread_mutex_lock(&c->lock);
     
-    /* Apply the offset to get NTP-adjusted time */
-    adjusted_time = current_time.tv_sec + client_state.time_offset;
+    if (!c->initialized) {
+        pthread_mutex_unlock(&c->lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    c->keys = keys;
     
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_unlock(&c->lock);
+    
+    return NTP_OK;
+}
+
+ntp_status_t ntp_client_enableSharing(ntp_client_t *c, const char *dir) {
+    ntp_status_t status = NTP_OK;
+    
+    if (dir != NULL && strlen(dir) >= sizeof(c->shared_dir)) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    pthread_mutex_lock(&c->lock);
+    
+    if (!c->initialized) {
+        pthread_mutex_unlock(&c->lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    
+    strcpy(c->shared_dir, dir != NULL ? dir : "");
+    open_shared_locked(c);
+    if (!c->sharing) {
+        status = NTP_ERROR_INVALID_PARAM;
+    }
+    
+    pthread_mutex_unlock(&c->lock);
+    
+    return status;
+}
+
+time_t ntp_client_getCurrentTime(ntp_client_t *c) 
+{
+    time_t adjusted_time;
+    
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
+    
+    if (!c->initialized || !c->ever_synced) {
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    
+    /* Apply the offset to the current system time to get NTP-adjusted time */
+    adjusted_time = (system_time_ns() + c->offset_ns) / NS_PER_SEC;
+    
+    pthread_mutex_unlock(&c->lock);
     
     return adjusted_time;
 }
 
-int64_t ntp_getTimeSinceLastSync(void) 
+int64_t ntp_client_getTimeSinceLastSync(ntp_client_t *c) 
 {
     struct timeval current_time;
     int64_t time_since_sync;
     
-    pthread_mutex_lock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
     
-    if (!client_state.initialized || !client_state.ever_synced) {
-        pthread_mutex_unlock(&client_state.lock);
+    if (!c->initialized || !c->ever_synced) {
+        pthread_mutex_unlock(&c->lock);
         return -1;
     }
     
@@ -373,97 +1209,227 @@ int64_t ntp_getTimeSinceLastSync(void)
     gettimeofday(&current_time, NULL);
     
     /* Calculate time since last sync */
-    time_since_sync = current_time.tv_sec - client_state.last_sync_time;
+    time_since_sync = current_time.tv_sec - c->last_sync_time;
     
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_unlock(&c->lock);
     
     return time_since_sync;
 }
 
-bool ntp_getServerName(char *buffer, size_t buffer_size) 
+bool ntp_client_getServerName(ntp_client_t *c, char *buffer, size_t buffer_size) 
 {
     if (buffer == NULL || buffer_size == 0) {
         return false;
     }
     
-    pthread_mutex_lock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
     
-    if (!client_state.initialized || !client_state.ever_synced) {
-        pthread_mutex_unlock(&client_state.lock);
+    if (!c->initialized || !c->ever_synced) {
+        pthread_mutex_unlock(&c->lock);
         return false;
     }
     
+    pthread_mutex_unlock(&c->lock);
+    
     /* Copy server name to the provided buffer */
-    strncpy(buffer, client_state.config.server_name, buffer_size - 1);
-    buffer[buffer_size - 1] = '\0';  /* Ensure null termination */
+    const ntp_config_version_t *v = config_read_begin(c);
+    bool found = v != NULL;
+    if (found) {
+        strncpy(buffer, v->config.server_name, buffer_size - 1);
+        buffer[buffer_size - 1] = '\0';  /* Ensure null termination */
+    }
+    config_read_end(c);
+    
+    return found;
+}
+
+ntp_status_t ntp_client_getSyncInfo(ntp_client_t *c, ntp_sync_info_t *info) {
+    if (info == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
     
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
     
-    return true;
+    if (!c->initialized) {
+        pthread_mutex_unlock(&c->lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    
+    int64_t now_ns = system_time_ns();
+    
+    info->synced = c->ever_synced;
+    info->sync_count = c->sync_count;
+    info->interleaved = c->interleaved;
+    info->stratum = c->stratum;
+    const ntp_config_version_t *v = config_read_begin(c);
+    strncpy(info->server_name, v->config.server_name, sizeof(info->server_name) - 1);
+    info->server_name[sizeof(info->server_name) - 1] = '\0';
+    config_read_end(c);
+    
+    if (c->ever_synced) {
+        info->sync_age_ns = now_ns - c->last_sync_ns;
+        info->time_ns = now_ns + c->offset_ns;
+        info->offset_ns = c->offset_ns;
+        info->delay_ns = c->delay_ns;
+        /* The local clock may have drifted by up to PHI since the sync */
+        info->error_bound_ns = c->root_distance_ns +
+                               info->sync_age_ns / 1000000 * NTP_MAX_DISPERSION_RATE;
+    } else {
+        info->sync_age_ns = -1;
+        info->time_ns = now_ns;
+        info->offset_ns = 0;
+        info->delay_ns = 0;
+        info->error_bound_ns = -1;
+    }
+    
+    pthread_mutex_unlock(&c->lock);
+    
+    return NTP_OK;
 }
 
-bool ntp_hasEverSynced(void) {
+size_t ntp_client_getAllanDeviation(ntp_client_t *c, ntp_adev_point_t *points, size_t max) {
+    size_t n = 0;
+    
+    if (points == NULL) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&c->lock);
+    if (c->initialized) {
+        n = ntp_adev_online_get(&c->adev, points, max);
+    }
+    pthread_mutex_unlock(&c->lock);
+    
+    return n;
+}
+
+bool ntp_client_hasEverSynced(ntp_client_t *c) {
     bool synced;
     
-    pthread_mutex_lock(&client_state.lock);
-    synced = client_state.initialized && client_state.ever_synced;
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
+    synced = c->initialized && c->ever_synced;
+    pthread_mutex_unlock(&c->lock);
     
     return synced;
 }
 
-ntp_status_t ntp_setServer(const char *server_name) {
-    if (server_name == NULL) {
-        return NTP_ERROR_INVALID_PARAM;
+/**
+ * @brief Publish a new configuration version
+ *
+ * @param config Whole new configuration, or NULL to keep the current one
+ * @param server_name New server name, or NULL to keep the one in config
+ */
+static ntp_status_t update_config(ntp_client_t *c, const ntp_config_t *config, const char *server_name) {
+    ntp_config_version_t *v = malloc(sizeof(*v));
+    if (v == NULL) {
+        return NTP_ERROR_NETWORK;
     }
     
-    pthread_mutex_lock(&client_state.lock);
+    pthread_mutex_lock(&c->config_lock);
     
-    if (!client_state.initialized) {
-        pthread_mutex_unlock(&client_state.lock);
+    const ntp_config_version_t *current = atomic_load(&c->config);
+    if (current == NULL) {
+        pthread_mutex_unlock(&c->config_lock);
+        free(v);
         return NTP_ERROR_NOT_INIT;
     }
     
-    /* Update server name in configuration */
-    strncpy(client_state.config.server_name, server_name, 
-            sizeof(client_state.config.server_name) - 1);
-    client_state.config.server_name[sizeof(client_state.config.server_name) - 1] = '\0';
+    memcpy(&v->config, config != NULL ? config : &current->config, sizeof(v->config));
+    if (server_name != NULL) {
+        strncpy(v->config.server_name, server_name, sizeof(v->config.server_name) - 1);
+        v->config.server_name[sizeof(v->config.server_name) - 1] = '\0';
+    }
+    replace_config_locked(c, v);
+    
+    pthread_mutex_unlock(&c->config_lock);
     
-    pthread_mutex_unlock(&client_state.lock);
+    /* Each server has its own leader */
+    pthread_mutex_lock(&c->lock);
+    if (c->sharing) {
+        open_shared_locked(c);
+    }
+    pthread_mutex_unlock(&c->lock);
     
     return NTP_OK;
 }
 
-double ntp_getCurrentTimeWithMicros(void) {
-    struct timeval current_time;
+ntp_status_t ntp_client_setServer(ntp_client_t *c, const char *server_name) {
+    if (server_name == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    return update_config(c, NULL, server_name);
+}
+
+ntp_status_t ntp_client_setConfig(ntp_client_t *c, const ntp_config_t *config) {
+    if (config == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    return update_config(c, config, NULL);
+}
+
+uint64_t ntp_client_getConfig(ntp_client_t *c, ntp_config_t *config) {
+    uint64_t version = 0;
+    
+    const ntp_config_version_t *v = config_read_begin(c);
+    if (v != NULL) {
+        if (config != NULL) {
+            memcpy(config, &v->config, sizeof(*config));
+        }
+        version = v->version;
+    }
+    config_read_end(c);
+    
+    return version;
+}
+
+double ntp_client_getCurrentTimeWithMicros(ntp_client_t *c) {
     double adjusted_time;
     
-    pthread_mutex_lock(&client_state.lock);
+    pthread_mutex_lock(&c->lock);
+    adopt_shared_locked(c);
     
-    if (!client_state.initialized || !client_state.ever_synced) {
-        pthread_mutex_unlock(&client_state.lock);
+    if (!c->initialized || !c->ever_synced) {
+        pthread_mutex_unlock(&c->lock);
         return 0.0;
     }
     
-    /* Get current system time with microsecond precision */
-    gettimeofday(&current_time, NULL);
-    
     /* Apply the offset to get NTP-adjusted time with microsecond precision */
-    adjusted_time = (double)current_time.tv_sec + (double)current_time.tv_usec / 1000000.0;
-    adjusted_time += (double)client_state.time_offset;
+    adjusted_time = (double)((system_time_ns() + c->offset_ns) / 1000) / 1000000.0;
     
-    pthread_mutex_unlock(&client_state.lock);
+    pthread_mutex_unlock(&c->lock);
     
     return adjusted_time;
 }
 
-int ntp_getCurrentHundredths(void) {
+int64_t ntp_client_getTimeNs(ntp_client_t *c) {
+    int64_t now_ns = system_time_ns();
+    int64_t checked_ns = atomic_load_explicit(&c->snapshot_checked_ns, memory_order_relaxed);
+    
+    /* A follower only learns of the leader's results under the lock. One
+       reader every NTP_SNAPSHOT_RECHECK_NS takes it, if it is free, and
+       the rest never wait. */
+    if (now_ns - checked_ns >= NTP_SNAPSHOT_RECHECK_NS &&
+        atomic_compare_exchange_strong(&c->snapshot_checked_ns, &checked_ns, now_ns) &&
+        pthread_mutex_trylock(&c->lock) == 0) {
+        adopt_shared_locked(c);
+        pthread_mutex_unlock(&c->lock);
+    }
+    
+    return now_ns + atomic_load_explicit(&c->snapshot_offset_ns, memory_order_relaxed);
+}
+
+int ntp_client_getCurrentHundredths(ntp_client_t *c) {
     double time_with_micros;
     double fractional_part;
     int hundredths;
     
     /* Get the current time with microsecond precision */
-    time_with_micros = ntp_getCurrentTimeWithMicros();
+    time_with_micros = ntp_client_getCurrentTimeWithMicros(c);
     
     if (time_with_micros == 0.0) {
         return 0;
@@ -477,3 +1443,881 @@ int ntp_getCurrentHundredths(void) {
     
     return hundredths;
 }
+
+/**
+ * @brief Absolute CLOCK_MONOTONIC deadline the given number of nanoseconds from now
+ */
+static struct timespec monotonic_deadline(int64_t timeout_ns) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t ns = (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec + timeout_ns;
+    ts.tv_sec = ns / NS_PER_SEC;
+    ts.tv_nsec = ns % NS_PER_SEC;
+    return ts;
+}
+
+/**
+ * @brief Whether a broadcast was applied within the sync interval, so a
+ *        background sync needn't ask the server
+ */
+static bool broadcasts_fresh(ntp_client_t *c) {
+    const ntp_config_version_t *v = config_read_begin(c);
+    int64_t interval = v != NULL ? v->config.sync_interval : 0;
+    config_read_end(c);
+    
+    pthread_mutex_lock(&c->lock);
+    bool fresh = c->listener.last_applied_ns > 0 &&
+                 system_time_ns() - c->listener.last_applied_ns < interval * NS_PER_SEC;
+    pthread_mutex_unlock(&c->lock);
+    
+    return fresh;
+}
+
+/**
+ * @brief Body of the background sync thread
+ */
+static void *background_sync(void *arg) {
+    ntp_client_t *c = arg;
+    
+    pthread_mutex_lock(&c->background.lock);
+    while (!c->background.stopping) {
+        pthread_mutex_unlock(&c->background.lock);
+        ntp_status_t status = broadcasts_fresh(c) ? NTP_OK : ntp_client_sync(c);
+        
+        /* Next sync is due sync_interval after the last one, which a
+           leader may have made a while ago */
+        pthread_mutex_lock(&c->lock);
+        int64_t wait_sec = NTP_SYNC_RETRY_SEC;
+        if (status == NTP_OK) {
+            const ntp_config_version_t *v = config_read_begin(c);
+            int64_t interval = v != NULL ? v->config.sync_interval : 0;
+            config_read_end(c);
+            wait_sec = interval - (system_time_ns() - c->last_sync_ns) / NS_PER_SEC;
+            if (wait_sec < 1) wait_sec = 1;
+        }
+        pthread_mutex_unlock(&c->lock);
+        
+        pthread_mutex_lock(&c->background.lock);
+        c->background.attempts++;
+        pthread_cond_broadcast(&c->background.cond);
+        
+        struct timespec deadline = monotonic_deadline(wait_sec * NS_PER_SEC);
+        while (!c->background.stopping &&
+               pthread_cond_timedwait(&c->background.cond, &c->background.lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    c->background.running = false;
+    pthread_cond_broadcast(&c->background.cond);
+    pthread_mutex_unlock(&c->background.lock);
+    
+    return NULL;
+}
+
+ntp_status_t ntp_client_startBackgroundSync(ntp_client_t *c) {
+    pthread_mutex_lock(&c->background.lock);
+    
+    /* Initialized once, as the threads waiting on it may outlive a
+       stop and start */
+    if (!c->background.cond_ready) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&c->background.cond, &attr);
+        pthread_condattr_destroy(&attr);
+        c->background.cond_ready = true;
+    }
+    
+    /* A stopped thread may still be finishing a sync, and would exit
+       right after it; it must be gone before a new one is started */
+    for (;;) {
+        if (c->background.running && !c->background.stopping) {
+            pthread_mutex_unlock(&c->background.lock);
+            return NTP_OK;
+        }
+        if (c->background.joinable) {
+            pthread_t thread = c->background.thread;
+            c->background.joinable = false;
+            pthread_mutex_unlock(&c->background.lock);
+            pthread_join(thread, NULL);
+            pthread_mutex_lock(&c->background.lock);
+        } else if (c->background.running) {
+            /* Another start is joining it */
+            pthread_cond_wait(&c->background.cond, &c->background.lock);
+        } else {
+            break;
+        }
+    }
+    
+    c->background.stopping = false;
+    if (pthread_create(&c->background.thread, NULL, background_sync, c) != 0) {
+        pthread_mutex_unlock(&c->background.lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    /* Stopping never waits for a sync in progress; starting again or
+       destroying the instance joins the thread */
+    c->background.joinable = true;
+    c->background.running = true;
+    
+    pthread_mutex_unlock(&c->background.lock);
+    
+    return NTP_OK;
+}
+
+void ntp_client_stopBackgroundSync(ntp_client_t *c) {
+    pthread_mutex_lock(&c->background.lock);
+    c->background.stopping = true;
+    if (c->background.running) {
+        pthread_cond_broadcast(&c->background.cond);
+    }
+    pthread_mutex_unlock(&c->background.lock);
+}
+
+uint64_t ntp_client_waitForSyncAttempt(ntp_client_t *c, uint64_t seen, int64_t timeout_ns) {
+    uint64_t attempts;
+    
+    pthread_mutex_lock(&c->background.lock);
+    
+    if (c->background.running) {
+        struct timespec deadline = monotonic_deadline(timeout_ns);
+        while (c->background.attempts == seen && !c->background.stopping &&
+               pthread_cond_timedwait(&c->background.cond, &c->background.lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    attempts = c->background.attempts;
+    
+    pthread_mutex_unlock(&c->background.lock);
+    
+    return attempts;
+}
+
+ntp_status_t ntp_client_sleep_until(ntp_client_t *c, int64_t deadline_ns) {
+    struct timespec ts;
+    
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        adopt_shared_locked(c);
+        if (!c->initialized) {
+            pthread_mutex_unlock(&c->lock);
+            return NTP_ERROR_NOT_INIT;
+        }
+        int64_t offset_ns = c->offset_ns;
+        pthread_mutex_unlock(&c->lock);
+        
+        /* Map the deadline to CLOCK_MONOTONIC with the current offset */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t mono_ns = (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+        int64_t remaining_ns = deadline_ns - (system_time_ns() + offset_ns);
+        if (remaining_ns <= 0) {
+            return NTP_OK;
+        }
+        
+        /* Far off: come back to re-map before the final approach, and now
+           and then in case a leader published a new offset */
+        bool final;
+        int64_t until_ns = ntp_sched_next_wake(mono_ns, mono_ns + remaining_ns, &final);
+        if (!final) {
+            /* Our own background syncs wake us as soon as they finish */
+            pthread_mutex_lock(&c->background.lock);
+            if (c->background.running && !c->background.stopping) {
+                uint64_t seen = c->background.attempts;
+                struct timespec deadline = monotonic_deadline(until_ns - mono_ns);
+                while (c->background.attempts == seen && !c->background.stopping &&
+                       pthread_cond_timedwait(&c->background.cond, &c->background.lock, &deadline) != ETIMEDOUT) {
+                }
+                pthread_mutex_unlock(&c->background.lock);
+                continue;
+            }
+            pthread_mutex_unlock(&c->background.lock);
+        }
+        
+        ts.tv_sec = until_ns / NS_PER_SEC;
+        ts.tv_nsec = until_ns % NS_PER_SEC;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+ntp_status_t ntp_resolveServer(const char *server_name, uint16_t server_port, struct sockaddr_in *addr) {
+    char ip_str[INET_ADDRSTRLEN];
+    
+    if (server_name == NULL || addr == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    if (!resolve_hostname(server_name, ip_str, sizeof(ip_str))) {
+        return NTP_ERROR_NETWORK;
+    }
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(server_port);
+    if (inet_pton(AF_INET, ip_str, &addr->sin_addr) <= 0) {
+        return NTP_ERROR_NETWORK;
+    }
+    
+    return NTP_OK;
+}
+
+/**
+ * @brief Local addresses of the sockets ntp_openRequestSocket handed out,
+ *        so recording their packets doesn't look one up each time
+ *
+ * Keyed by descriptor; a closed socket's entry is replaced when its
+ * descriptor comes back from ntp_openRequestSocket. Sockets that don't fit
+ * fall back to a lookup per packet.
+ */
+#define NTP_REQUEST_SOCKETS 16
+static struct {
+    int fd;
+    struct sockaddr_in local;
+} request_sockets[NTP_REQUEST_SOCKETS];
+static size_t request_socket_count;
+static size_t request_socket_next;
+static pthread_mutex_t request_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void remember_request_socket(int fd, const struct sockaddr_in *local) {
+    pthread_mutex_lock(&request_sockets_lock);
+    size_t i = 0;
+    while (i < request_socket_count && request_sockets[i].fd != fd) {
+        i++;
+    }
+    if (i == request_socket_count) {
+        if (request_socket_count < NTP_REQUEST_SOCKETS) {
+            request_socket_count++;
+        } else {
+            i = request_socket_next;
+            request_socket_next = (request_socket_next + 1) % NTP_REQUEST_SOCKETS;
+        }
+    }
+    request_sockets[i].fd = fd;
+    request_sockets[i].local = *local;
+    pthread_mutex_unlock(&request_sockets_lock);
+}
+
+/**
+ * @brief A request socket's local address, or zeroes for socket_local to
+ *        look up if it isn't remembered
+ */
+static struct sockaddr_in request_socket_local(int fd) {
+    struct sockaddr_in local = { 0 };
+    
+    pthread_mutex_lock(&request_sockets_lock);
+    for (size_t i = 0; i < request_socket_count; i++) {
+        if (request_sockets[i].fd == fd) {
+            local = request_sockets[i].local;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&request_sockets_lock);
+    return local;
+}
+
+int ntp_openRequestSocket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    
+    if (fd >= 0) {
+        enable_receive_timestamps(fd);
+        
+        /* Binding now, as the first send would, fixes the local address */
+        struct sockaddr_in local = { .sin_family = AF_INET };
+        if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(fd);
+            return -1;
+        }
+        memset(&local, 0, sizeof(local));
+        remember_request_socket(fd, socket_local(fd, &local));
+    }
+    return fd;
+}
+
+ntp_status_t ntp_sendRequest(int fd, const struct sockaddr_in *addr, uint64_t *key) {
+    static _Atomic uint64_t last_key;
+    ntp_packet_t packet;
+    
+    if (addr == NULL || key == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    /* The transmit timestamp comes back as the response's origin timestamp
+       and tells the responses on a shared socket apart, so no two requests
+       may carry the same one; bumping the last 2^-32 s keeps them unique */
+    int64_t now_ns = system_time_ns();
+    create_ntp_packet(&packet, now_ns);
+    uint64_t stamp = ((uint64_t)ntohl(packet.tx_timestamp_sec) << 32) | ntohl(packet.tx_timestamp_frac);
+    uint64_t last = atomic_load(&last_key);
+    do {
+        *key = stamp > last ? stamp : last + 1;
+    } while (!atomic_compare_exchange_weak(&last_key, &last, *key));
+    packet.tx_timestamp_sec = htonl((uint32_t)(*key >> 32));
+    packet.tx_timestamp_frac = htonl((uint32_t)*key);
+    
+    if (sendto(fd, &packet, sizeof(packet), 0, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        return NTP_ERROR_NETWORK;
+    }
+    if (ntp_recorder_active()) {
+        struct sockaddr_in local = request_socket_local(fd);
+        record_sent(fd, &local, addr, &packet, sizeof(packet), now_ns);
+    }
+    
+    return NTP_OK;
+}
+
+bool ntp_receiveResponse(int fd, uint64_t *key, struct sockaddr_in *from, ntp_sample_t *sample,
+                         ntp_status_t *status) {
+    ntp_packet_t response;
+    struct sockaddr_in local = { 0 };
+    int64_t t4;
+    
+    if (ntp_recorder_active()) {
+        local = request_socket_local(fd);
+    }
+    for (;;) {
+        ssize_t n = receive_packet(fd, &response, sizeof(response), from, &t4, &local);
+        if (n < 0) {
+            return false;
+        }
+        if ((size_t)n < sizeof(response)) {
+            continue;                 /* Not an NTP packet */
+        }
+        
+        response_to_host(&response);
+        *key = ((uint64_t)response.orig_timestamp_sec << 32) | response.orig_timestamp_frac;
+        
+        /* The origin timestamp is our transmit time */
+        int64_t t1 = ntp_timestamp_to_ns(response.orig_timestamp_sec, response.orig_timestamp_frac);
+        *status = parse_response(&response, t1, t4, sample);
+        return true;
+    }
+}
+
+ntp_status_t ntp_parseResponse(const void *packet, size_t length, int64_t sent_ns, int64_t received_ns,
+                               ntp_sample_t *sample) {
+    ntp_packet_t response;
+    
+    if (packet == NULL || sample == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    if (length < sizeof(response)) {
+        return NTP_ERROR_SERVER;
+    }
+    
+    memcpy(&response, packet, sizeof(response));
+    response_to_host(&response);
+    
+    return parse_response(&response, sent_ns, received_ns, sample);
+}
+
+/**
+ * @brief Make a sample from outside ntp_client_sync the sync state
+ *
+ * @param peer Address the statistics files log it under
+ * @param sync_interval Seconds between samples, for the statistics files
+ */
+static ntp_status_t apply_sample(ntp_client_t *c, const ntp_sample_t *sample, const char *peer,
+                                 uint32_t sync_interval) {
+    pthread_mutex_lock(&c->lock);
+    
+    if (!c->initialized) {
+        pthread_mutex_unlock(&c->lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    
+    /* Concurrent syncs may finish out of order; keep the newest */
+    adopt_shared_locked(c);
+    if (sample->received_ns > c->last_sync_ns) {
+        apply_sample_locked(c, sample);
+        log_sync_locked(c, sample, peer, sync_interval);
+        if (c->sharing && c->shared.leader) {
+            publish_shared_locked(c, NTP_OK);
+        }
+    }
+    
+    pthread_mutex_unlock(&c->lock);
+    
+    return NTP_OK;
+}
+
+ntp_status_t ntp_client_applySample(ntp_client_t *c, const ntp_sample_t *sample) {
+    char peer[sizeof(((ntp_stats_record_t *)0)->peer)] = "";
+    uint32_t sync_interval = 0;
+    
+    if (sample == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    /* The statistics files name the configured server */
+    if (ntp_stats_active()) {
+        const ntp_config_version_t *v = config_read_begin(c);
+        if (v != NULL) {
+            memcpy(peer, v->config.server_name, sizeof(peer) - 1);  /* Long names are cut */
+            sync_interval = v->config.sync_interval;
+        }
+        config_read_end(c);
+    }
+    
+    return apply_sample(c, sample, peer, sync_interval);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Broadcast client                                                       */
+/* ---------------------------------------------------------------------- */
+
+/**
+ * @brief Open a socket on the broadcast port, joined to the group if there is one
+ *
+ * @return int The socket, or -1 on failure
+ */
+static int open_broadcast_socket(const ntp_broadcast_config_t *config, const struct in_addr *group,
+                                 const struct in_addr *interface_addr) {
+    struct sockaddr_in addr;
+    int on = 1;
+    
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    /* Every listener on the host, in this process or another, gets its own
+       copy of each broadcast */
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    if (config->group[0] != '\0') {
+        struct ip_mreq mreq = { .imr_multiaddr = *group, .imr_interface = *interface_addr };
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    /* A broadcast's arrival is all there is to go on, and the listener may
+       get to it late, so always take the kernel's timestamp */
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    
+    return fd;
+}
+
+/**
+ * @brief Calibrate the delay from the server with a burst of unicast
+ *        exchanges, and sync from the best of them
+ *
+ * @param broadcast_ns Server's transmit time in the broadcast that made it due
+ * @param received_ns System time that broadcast arrived
+ * @return bool Whether any exchange succeeded
+ */
+static bool calibrate_broadcast(ntp_client_t *c, int64_t broadcast_ns, int64_t received_ns) {
+    ntp_listener_t *l = &c->listener;
+    ntp_packet_t response;
+    ntp_sample_t sample;
+    int64_t t1, t4;
+    char ip_str[INET_ADDRSTRLEN];
+    uint32_t timeout_ms = NTP_TIMEOUT_SEC * 1000;
+    uint32_t sync_interval = 0;
+    uint32_t key_id = 0;
+    
+    const ntp_config_version_t *v = config_read_begin(c);
+    if (v != NULL) {
+        timeout_ms = v->config.timeout_ms;
+        sync_interval = v->config.sync_interval;
+        key_id = v->config.key_id;
+    }
+    config_read_end(c);
+    pthread_mutex_lock(&c->lock);
+    const ntp_keyring_t *keys = c->keys;
+    pthread_mutex_unlock(&c->lock);
+    
+    /* The exchange that took least time is least skewed by queueing */
+    ntp_status_t status = NTP_ERROR_TIMEOUT;
+    for (int i = 0; i < NTP_BROADCAST_BURST; i++) {
+        ntp_sample_t exchange;
+        ntp_status_t result = send_ntp_request(l->server, ntohs(l->source.sin_port), timeout_ms,
+                                               &response, &t1, &t4, ip_str, NULL, keys, key_id);
+        if (result == NTP_OK) {
+            result = parse_response(&response, t1, t4, &exchange);
+        }
+        if (result == NTP_OK && (status != NTP_OK || exchange.delay_ns < sample.delay_ns)) {
+            sample = exchange;
+        }
+        if (status != NTP_OK) {
+            status = result;
+        }
+    }
+    if (status == NTP_OK) {
+        /* The broadcast left at broadcast_ns by the server's clock and
+           arrived at received_ns + offset by it */
+        l->one_way_ns = received_ns + sample.offset_ns - broadcast_ns;
+        if (l->one_way_ns < 0) l->one_way_ns = 0;
+        l->round_trip_ns = sample.delay_ns;
+        l->calibrated_ns = received_ns;
+        apply_sample(c, &sample, l->server, sync_interval);
+    }
+    
+    /* Broadcasts that queued up meanwhile were received at times unknown */
+    uint64_t stale = 0;
+    while (recv(l->fd, &response, sizeof(response), MSG_DONTWAIT) >= 0) {
+        stale++;
+    }
+    
+    pthread_mutex_lock(&c->lock);
+    if (status == NTP_OK) {
+        l->stats.calibrations++;
+        l->stats.one_way_delay_ns = l->one_way_ns;
+    } else {
+        l->stats.calibration_errors++;
+    }
+    l->stats.received += stale;
+    l->stats.rejected += stale;
+    pthread_mutex_unlock(&c->lock);
+    
+    return status == NTP_OK;
+}
+
+/**
+ * @brief Point the listener at the configured server, resolving it again
+ *        whenever the configuration changes; listener thread only
+ */
+static void update_broadcast_source(ntp_client_t *c, uint64_t version, const char *server_name,
+                                    uint16_t server_port) {
+    ntp_listener_t *l = &c->listener;
+    struct sockaddr_in addr;
+    
+    if (version == l->source_version) {
+        return;
+    }
+    if (ntp_resolveServer(server_name, server_port, &addr) != NTP_OK) {
+        memset(&l->source, 0, sizeof(l->source));
+        return;                       /* Tried again with the next packet */
+    }
+    l->source_version = version;
+    if (addr.sin_addr.s_addr == l->source.sin_addr.s_addr && addr.sin_port == l->source.sin_port) {
+        return;
+    }
+    
+    /* Another server: its delay is yet to be calibrated */
+    l->source = addr;
+    inet_ntop(AF_INET, &addr.sin_addr, l->server, sizeof(l->server));
+    l->one_way_ns = -1;
+    l->calibrated_ns = 0;
+    l->last_t3_ns = 0;
+    pthread_mutex_lock(&c->lock);
+    memcpy(l->stats.server, l->server, sizeof(l->server));
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * @brief Sync from one packet received on the broadcast port
+ *
+ * @param length Bytes received, MAC included
+ */
+static void handle_broadcast(ntp_client_t *c, ntp_packet_t *packet, size_t length,
+                             const struct sockaddr_in *from, int64_t received_ns) {
+    ntp_listener_t *l = &c->listener;
+    uint8_t mode = packet->li_vn_mode & 0x07;
+    uint8_t version = (packet->li_vn_mode >> 3) & 0x07;
+    char server_name[sizeof(((ntp_config_t *)0)->server_name)] = "";
+    uint16_t server_port = 0;
+    uint64_t config_version = 0;
+    uint32_t key_id = 0;
+    
+    const ntp_config_version_t *v = config_read_begin(c);
+    if (v != NULL) {
+        config_version = v->version;
+        key_id = v->config.key_id;
+        if (v->version != l->source_version) {
+            memcpy(server_name, v->config.server_name, sizeof(server_name));
+            server_port = v->config.server_port;
+        }
+    }
+    config_read_end(c);
+    if (config_version != 0) {
+        update_broadcast_source(c, config_version, server_name, server_port);
+    }
+    
+    bool usable = length >= sizeof(*packet) && mode == NTP_MODE_BROADCAST &&
+                  version >= 3 && version <= NTP_VERSION &&
+                  (packet->li_vn_mode >> 6) != 3 /* Server unsynchronized */ &&
+                  packet->stratum > 0 && packet->stratum < NTP_STRATUM_MAX &&
+                  l->source.sin_family != 0;
+    
+    /* Anyone on the segment can send a broadcast: take it only with a
+       valid MAC under our key, or without a key from the configured server */
+    if (usable && key_id != 0) {
+        uint32_t signed_by;
+        size_t data_length;
+        pthread_mutex_lock(&c->lock);
+        const ntp_keyring_t *keys = c->keys;
+        pthread_mutex_unlock(&c->lock);
+        usable = ntp_auth_verify(keys, packet, length, &signed_by, &data_length) && signed_by == key_id &&
+                 data_length == sizeof(*packet);
+    } else if (usable) {
+        usable = from->sin_addr.s_addr == l->source.sin_addr.s_addr && from->sin_port == l->source.sin_port;
+    }
+    
+    /* Each broadcast must be newer than the last: a replayed one, signed
+       or not, would step the clock back by its age */
+    int64_t t3 = ntp_timestamp_to_ns(ntohl(packet->tx_timestamp_sec), ntohl(packet->tx_timestamp_frac));
+    usable = usable && t3 > l->last_t3_ns;
+    
+    pthread_mutex_lock(&c->lock);
+    l->stats.received++;
+    if (!usable) {
+        l->stats.rejected++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (!usable) {
+        return;
+    }
+    
+    response_to_host(packet);
+    l->last_t3_ns = t3;
+    
+    bool due = l->calibrated_ns == 0 ||
+               (l->config.calibrate_interval > 0 &&
+                received_ns - l->calibrated_ns >= (int64_t)l->config.calibrate_interval * NS_PER_SEC);
+    if (due) {
+        if (calibrate_broadcast(c, t3, received_ns)) {
+            return;  /* Its exchange was this sync */
+        }
+        if (l->one_way_ns < 0) {
+            return;  /* Nothing to go on yet */
+        }
+    }
+    
+    /* The time the server sent, plus the time it took to get here */
+    ntp_sample_t sample;
+    sample.offset_ns = t3 + l->one_way_ns - received_ns;
+    sample.delay_ns = l->round_trip_ns;
+    sample.root_distance_ns = l->round_trip_ns / 2 +
+                              ntp_short_to_ns(packet->root_delay) / 2 +
+                              ntp_short_to_ns(packet->root_dispersion);
+    sample.sent_ns = received_ns - l->one_way_ns;
+    sample.received_ns = received_ns;
+    sample.server_time_ns = t3;
+    sample.stratum = packet->stratum;
+    
+    /* The statistics files log the broadcast interval as the poll */
+    int64_t interval_ns = l->last_applied_ns > 0 ? received_ns - l->last_applied_ns : 0;
+    apply_sample(c, &sample, l->server, (uint32_t)(interval_ns / NS_PER_SEC));
+    
+    pthread_mutex_lock(&c->lock);
+    l->stats.applied++;
+    l->last_applied_ns = received_ns;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * @brief Body of the broadcast listener thread
+ */
+static void *broadcast_listener(void *arg) {
+    ntp_client_t *c = arg;
+    ntp_listener_t *l = &c->listener;
+    union {
+        ntp_packet_t packet;
+        uint8_t bytes[sizeof(ntp_packet_t) + NTP_AUTH_MAX_MAC];
+    } buffer;
+    struct sockaddr_in from;
+    struct sockaddr_in local = { 0 };
+    int64_t received_ns;
+    
+    while (!atomic_load(&l->stopping)) {
+        struct pollfd pfd = { .fd = l->fd, .events = POLLIN };
+        if (poll(&pfd, 1, NTP_BROADCAST_POLL_MS) <= 0 || atomic_load(&l->stopping)) {
+            continue;
+        }
+        ssize_t n = receive_packet(l->fd, &buffer, sizeof(buffer), &from, &received_ns, &local);
+        if (n >= 0) {
+            handle_broadcast(c, &buffer.packet, (size_t)n, &from, received_ns);
+        }
+    }
+    
+    return NULL;
+}
+
+ntp_status_t ntp_client_startBroadcastClient(ntp_client_t *c, const ntp_broadcast_config_t *config) {
+    struct in_addr group = { .s_addr = htonl(INADDR_ANY) };
+    struct in_addr interface_addr = { .s_addr = htonl(INADDR_ANY) };
+    
+    if (config == NULL || config->port == 0) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    if (config->group[0] != '\0' &&
+        (inet_pton(AF_INET, config->group, &group) != 1 || !IN_MULTICAST(ntohl(group.s_addr)))) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    if (config->interface_addr[0] != '\0' && inet_pton(AF_INET, config->interface_addr, &interface_addr) != 1) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    pthread_mutex_lock(&c->background.lock);
+    
+    if (c->listener.running) {
+        pthread_mutex_unlock(&c->background.lock);
+        return NTP_OK;
+    }
+    
+    int fd = open_broadcast_socket(config, &group, &interface_addr);
+    if (fd < 0) {
+        pthread_mutex_unlock(&c->background.lock);
+        return NTP_ERROR_NETWORK;
+    }
+    
+    ntp_listener_t *l = &c->listener;
+    l->fd = fd;
+    l->config = *config;
+    atomic_store(&l->stopping, false);
+    memset(&l->source, 0, sizeof(l->source));
+    l->source_version = 0;
+    l->server[0] = '\0';
+    l->one_way_ns = -1;
+    l->round_trip_ns = 0;
+    l->calibrated_ns = 0;
+    l->last_t3_ns = 0;
+    
+    pthread_mutex_lock(&c->lock);
+    memset(&l->stats, 0, sizeof(l->stats));
+    l->stats.one_way_delay_ns = -1;
+    l->last_applied_ns = 0;
+    pthread_mutex_unlock(&c->lock);
+    
+    if (pthread_create(&l->thread, NULL, broadcast_listener, c) != 0) {
+        close(fd);
+        pthread_mutex_unlock(&c->background.lock);
+        return NTP_ERROR_NOT_INIT;
+    }
+    l->running = true;
+    
+    pthread_mutex_unlock(&c->background.lock);
+    
+    return NTP_OK;
+}
+
+void ntp_client_stopBroadcastClient(ntp_client_t *c) {
+    pthread_mutex_lock(&c->background.lock);
+    
+    /* The listener never takes this lock. Shutting the socket down wakes
+       its poll, even though an unconnected socket reports ENOTCONN. */
+    if (c->listener.running) {
+        atomic_store(&c->listener.stopping, true);
+        shutdown(c->listener.fd, SHUT_RD);
+        pthread_join(c->listener.thread, NULL);
+        close(c->listener.fd);
+        c->listener.running = false;
+    }
+    
+    pthread_mutex_unlock(&c->background.lock);
+}
+
+ntp_status_t ntp_client_getBroadcastStats(ntp_client_t *c, ntp_broadcast_stats_t *stats) {
+    if (stats == NULL) {
+        return NTP_ERROR_INVALID_PARAM;
+    }
+    
+    pthread_mutex_lock(&c->lock);
+    *stats = c->listener.stats;
+    pthread_mutex_unlock(&c->lock);
+    
+    return NTP_OK;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Default instance                                                       */
+/* ---------------------------------------------------------------------- */
+
+ntp_status_t ntp_sync(void) {
+    return ntp_client_sync(&default_client);
+}
+
+ntp_status_t ntp_enableSharing(const char *dir) {
+    return ntp_client_enableSharing(&default_client, dir);
+}
+
+ntp_status_t ntp_setKeys(const ntp_keyring_t *keys) {
+    return ntp_client_setKeys(&default_client, keys);
+}
+
+time_t ntp_getCurrentTime(void) {
+    return ntp_client_getCurrentTime(&default_client);
+}
+
+int64_t ntp_getTimeSinceLastSync(void) {
+    return ntp_client_getTimeSinceLastSync(&default_client);
+}
+
+bool ntp_getServerName(char *buffer, size_t buffer_size) {
+    return ntp_client_getServerName(&default_client, buffer, buffer_size);
+}
+
+ntp_status_t ntp_getSyncInfo(ntp_sync_info_t *info) {
+    return ntp_client_getSyncInfo(&default_client, info);
+}
+
+size_t ntp_getAllanDeviation(ntp_adev_point_t *points, size_t max) {
+    return ntp_client_getAllanDeviation(&default_client, points, max);
+}
+
+bool ntp_hasEverSynced(void) {
+    return ntp_client_hasEverSynced(&default_client);
+}
+
+ntp_status_t ntp_setServer(const char *server_name) {
+    return ntp_client_setServer(&default_client, server_name);
+}
+
+ntp_status_t ntp_setConfig(const ntp_config_t *config) {
+    return ntp_client_setConfig(&default_client, config);
+}
+
+uint64_t ntp_getConfig(ntp_config_t *config) {
+    return ntp_client_getConfig(&default_client, config);
+}
+
+double ntp_getCurrentTimeWithMicros(void) {
+    return ntp_client_getCurrentTimeWithMicros(&default_client);
+}
+
+int64_t ntp_getTimeNs(void) {
+    return ntp_client_getTimeNs(&default_client);
+}
+
+int ntp_getCurrentHundredths(void) {
+    return ntp_client_getCurrentHundredths(&default_client);
+}
+
+ntp_status_t ntp_startBackgroundSync(void) {
+    return ntp_client_startBackgroundSync(&default_client);
+}
+
+void ntp_stopBackgroundSync(void) {
+    ntp_client_stopBackgroundSync(&default_client);
+}
+
+uint64_t ntp_waitForSyncAttempt(uint64_t seen, int64_t timeout_ns) {
+    return ntp_client_waitForSyncAttempt(&default_client, seen, timeout_ns);
+}
+
+ntp_status_t ntp_sleep_until(int64_t deadline_ns) {
+    return ntp_client_sleep_until(&default_client, deadline_ns);
+}
+
+ntp_status_t ntp_applySample(const ntp_sample_t *sample) {
+    return ntp_client_applySample(&default_client, sample);
+}
+
+ntp_status_t ntp_startBroadcastClient(const ntp_broadcast_config_t *config) {
+    return ntp_client_startBroadcastClient(&default_client, config);
+}
+
+void ntp_stopBroadcastClient(void) {
+    ntp_client_stopBroadcastClient(&default_client);
+}
+
+ntp_status_t ntp_getBroadcastStats(ntp_broadcast_stats_t *stats) {
+    return ntp_client_getBroadcastStats(&default_client, stats);
+}
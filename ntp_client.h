@@ -4,6 +4,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <netinet/in.h>
+#include "ntp_adev.h"
+#include "ntp_auth.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * @brief NTP client configuration structure
@@ -14,6 +21,7 @@ typedef struct {
     uint32_t timeout_ms;      /* Timeout for NTP requests in milliseconds */
     uint32_t retry_count;     /* Number of retries for failed requests */
     uint32_t sync_interval;   /* Time between automatic syncs in seconds */
+    uint32_t key_id;          /* Symmetric key to authenticate syncs with (see ntp_setKeys), 0 for none */
 } ntp_config_t;
 
 /**
@@ -25,9 +33,39 @@ typedef enum {
     NTP_ERROR_TIMEOUT,       /* Request timed out */
     NTP_ERROR_SERVER,        /* Server error response */
     NTP_ERROR_INVALID_PARAM, /* Invalid parameter */
-    NTP_ERROR_NOT_INIT       /* Client not initialized */
+    NTP_ERROR_NOT_INIT,      /* Client not initialized */
+    NTP_ERROR_AUTH           /* Response not authenticated, or no key to authenticate with */
 } ntp_status_t;
 
+/**
+ * @brief Snapshot of the synchronization state
+ */
+typedef struct {
+    bool synced;              /* Whether at least one sync has succeeded */
+    int64_t time_ns;          /* NTP-corrected time in nanoseconds since the epoch (system time if never synced) */
+    int64_t offset_ns;        /* NTP time minus system time */
+    int64_t delay_ns;         /* Round-trip delay of the last exchange */
+    int64_t error_bound_ns;   /* Maximum error of time_ns, or -1 if never synced */
+    int64_t sync_age_ns;      /* Time since the last sync, or -1 if never synced */
+    uint64_t sync_count;      /* Number of successful syncs so far */
+    uint8_t stratum;          /* Server stratum at the last sync */
+    bool interleaved;         /* The last sync had the server's actual transmit time (interleaved mode) */
+    char server_name[256];    /* Configured NTP server */
+} ntp_sync_info_t;
+
+/**
+ * @brief One offset measurement from a server
+ */
+typedef struct {
+    int64_t offset_ns;        /* NTP time minus system time */
+    int64_t delay_ns;         /* Round-trip delay */
+    int64_t root_distance_ns; /* Maximum error of the measurement */
+    int64_t sent_ns;          /* System time the request was sent */
+    int64_t received_ns;      /* System time the response arrived */
+    int64_t server_time_ns;   /* Server's transmit time */
+    uint8_t stratum;          /* Server stratum */
+} ntp_sample_t;
+
 /**
  * @brief Initialize the NTP client with the given configuration
  * 
@@ -76,6 +114,31 @@ int64_t ntp_getTimeSinceLastSync(void);
  */
 bool ntp_getServerName(char *buffer, size_t buffer_size);
 
+/**
+ * @brief Get the current time together with offset, delay and error bound
+ *
+ * All fields are read at the same instant, so they are consistent with
+ * each other. The error bound is the root distance reported at the last
+ * sync plus the local clock's worst-case drift since then.
+ *
+ * @param info Structure to fill in
+ * @return ntp_status_t Status code indicating success or error
+ */
+ntp_status_t ntp_getSyncInfo(ntp_sync_info_t *info);
+
+/**
+ * @brief Allan deviation of the offsets measured so far
+ *
+ * Every sync adds its offset to running sums (ntp_adev_online_t), taken
+ * as evenly spaced at the mean interval between syncs. Points run from
+ * that interval to 128 times it; ntp_adev_best_tau() picks the one
+ * where more frequent polling stops paying off.
+ *
+ * @param points Filled in with up to max points, shortest tau first
+ * @return size_t How many points; 0 until there have been three syncs
+ */
+size_t ntp_getAllanDeviation(ntp_adev_point_t *points, size_t max);
+
 /**
  * @brief Check if the NTP client has ever successfully synced
  * 
@@ -91,6 +154,55 @@ bool ntp_hasEverSynced(void);
  */
 ntp_status_t ntp_setServer(const char *server_name);
 
+/**
+ * @brief Replace the whole configuration at runtime
+ *
+ * Configurations are immutable versions swapped in atomically, so readers
+ * never wait for a change. A sync already in progress finishes with the
+ * configuration it started with. The version replaced is freed once no
+ * reader can still hold it.
+ *
+ * @param config New configuration
+ * @return ntp_status_t Status code indicating success or error
+ */
+ntp_status_t ntp_setConfig(const ntp_config_t *config);
+
+/**
+ * @brief Copy out the current configuration without locking
+ *
+ * @param config Filled in with the configuration, unless NULL
+ * @return uint64_t Its version: 1 as initialized, one more for each
+ *         ntp_setServer or ntp_setConfig; 0 if not initialized
+ */
+uint64_t ntp_getConfig(ntp_config_t *config);
+
+/**
+ * @brief Share syncs with other instances on this host
+ *
+ * Instances syncing with the same server elect a leader through a lock on
+ * a shared state page. Only the leader contacts the server; ntp_sync() in
+ * the others waits for the leader's result, and every instance picks up
+ * each new result as soon as it is published. If the leader exits, the
+ * next instance due to sync takes over.
+ *
+ * @param dir Directory for the shared state files, or NULL for the default
+ * @return ntp_status_t Status code indicating success or error
+ */
+ntp_status_t ntp_enableSharing(const char *dir);
+
+/**
+ * @brief Keys to authenticate syncs with
+ *
+ * While config.key_id is set, each request carries a MAC with that key,
+ * and a sync fails with NTP_ERROR_AUTH unless the response carries a valid
+ * one with the same key. Syncs taken from a leader through sharing, and
+ * the non-blocking API below, are not authenticated. The keyring must not
+ * be freed while the client may still use it.
+ *
+ * @param keys Keyring from ntp_keyring_load(), or NULL for none
+ */
+ntp_status_t ntp_setKeys(const ntp_keyring_t *keys);
+
 /**
  * @brief Get the current time with microsecond precision in seconds since the epoch (UTC)
  *
@@ -101,6 +213,17 @@ ntp_status_t ntp_setServer(const char *server_name);
  */
 double ntp_getCurrentTimeWithMicros(void);
 
+/**
+ * @brief Get the current NTP-adjusted time in nanoseconds without locking
+ *
+ * Reads a snapshot of the offset that every sync updates, so concurrent
+ * callers never wait on the client lock or on each other. Before the first
+ * sync, or when the client is not initialized, it returns the system time.
+ *
+ * @return int64_t Nanoseconds since the Unix epoch
+ */
+int64_t ntp_getTimeNs(void);
+
 /**
  * @brief Get the current hundredths of a second (0-99)
  *
@@ -110,5 +233,233 @@ double ntp_getCurrentTimeWithMicros(void);
  */
 int ntp_getCurrentHundredths(void);
 
+/**
+ * @brief Keep the client synced from a background thread
+ *
+ * Syncs immediately, then every sync_interval seconds (or 10 seconds after
+ * a failure). Readers never wait for the network. Called soon after a stop,
+ * it first waits for the stopped thread to finish its sync and exit.
+ *
+ * @return ntp_status_t Status code indicating success or error
+ */
+ntp_status_t ntp_startBackgroundSync(void);
+
+/**
+ * @brief Stop background syncing
+ *
+ * Returns straight away; a sync already in progress finishes on its own.
+ */
+void ntp_stopBackgroundSync(void);
+
+/**
+ * @brief Wait for the background thread to finish another sync attempt
+ *
+ * @param seen Number of attempts the caller has already seen
+ * @param timeout_ns Longest time to wait
+ * @return uint64_t Number of attempts completed so far (equal to seen on timeout)
+ */
+uint64_t ntp_waitForSyncAttempt(uint64_t seen, int64_t timeout_ns);
+
+/**
+ * @brief Sleep until the given NTP-corrected time
+ *
+ * Maps the deadline to CLOCK_MONOTONIC with the current offset and sleeps
+ * with clock_nanosleep(TIMER_ABSTIME). A sync that changes the offset during
+ * the sleep re-arms it: background syncs of this process immediately, a
+ * leader's results within 100 ms. Never returns before the deadline.
+ *
+ * @param deadline_ns NTP time in nanoseconds since the epoch
+ * @return ntp_status_t NTP_OK once the deadline has passed
+ */
+ntp_status_t ntp_sleep_until(int64_t deadline_ns);
+
+/*
+ * Non-blocking requests, for callers that run their own event loop.
+ *
+ * Any number of requests to any servers can share one socket from
+ * ntp_openRequestSocket(). ntp_sendRequest() returns a key that the
+ * server echoes back; once the socket is readable, ntp_receiveResponse()
+ * returns each response with its key and the sample it gives. Timeouts
+ * and retries are up to the caller. ntp_applySample() makes a sample the
+ * client's sync state, as a successful ntp_sync() would.
+ */
+
+/**
+ * @brief Resolve a server's address once, ahead of non-blocking requests
+ *
+ * @return ntp_status_t NTP_ERROR_NETWORK if the name doesn't resolve
+ */
+ntp_status_t ntp_resolveServer(const char *server_name, uint16_t server_port, struct sockaddr_in *addr);
+
+/**
+ * @brief Open a non-blocking UDP socket for requests
+ *
+ * @return int The socket, or -1 on failure
+ */
+int ntp_openRequestSocket(void);
+
+/**
+ * @brief Send one request without waiting for the response
+ *
+ * @param fd Socket from ntp_openRequestSocket
+ * @param addr Server address from ntp_resolveServer
+ * @param key Set to the key its response will carry, unique within the process
+ * @return ntp_status_t NTP_ERROR_NETWORK if it couldn't be sent
+ */
+ntp_status_t ntp_sendRequest(int fd, const struct sockaddr_in *addr, uint64_t *key);
+
+/**
+ * @brief Read the next response waiting on a request socket
+ *
+ * @param fd Socket from ntp_openRequestSocket
+ * @param key Set to the key of the request it answers
+ * @param from Set to the address it came from, which the caller must check
+ *        is the server the request went to
+ * @param sample Set to its measurement when status is NTP_OK
+ * @param status Set to NTP_OK, or NTP_ERROR_SERVER for an unusable response
+ * @return bool false when no response is waiting
+ */
+bool ntp_receiveResponse(int fd, uint64_t *key, struct sockaddr_in *from, ntp_sample_t *sample,
+                         ntp_status_t *status);
+
+/**
+ * @brief Validate a response that arrived some other way and compute its sample
+ *
+ * Applies the same checks a sync does, for example to responses replayed
+ * from a capture.
+ *
+ * @param packet Response as it was on the wire, extension fields allowed
+ * @param length Its length in bytes
+ * @param sent_ns System time the request was sent
+ * @param received_ns System time the response arrived
+ * @param sample Set to its measurement on success
+ * @return ntp_status_t NTP_ERROR_SERVER if the response is unusable
+ */
+ntp_status_t ntp_parseResponse(const void *packet, size_t length, int64_t sent_ns, int64_t received_ns,
+                               ntp_sample_t *sample);
+
+/**
+ * @brief Make a sample the client's sync state and share it if leading
+ *
+ * A sample older than the last sync is ignored.
+ *
+ * @return ntp_status_t NTP_ERROR_NOT_INIT if the client isn't initialized
+ */
+ntp_status_t ntp_applySample(const ntp_sample_t *sample);
+
+/*
+ * Broadcast client.
+ *
+ * Instead of asking a server, a client can listen for the time a server
+ * broadcasts or multicasts (mode 5 packets) and sync from each one, so a
+ * segment of any size puts no queries on the server. A broadcast carries
+ * only the server's transmit time, so the listener first calibrates the
+ * one-way delay with a few unicast exchanges with the configured server,
+ * and again every calibrate_interval seconds. It takes broadcasts only from
+ * the configured server's address and port or, while config.key_id is set,
+ * only those carrying a valid MAC with that key (see ntp_setKeys), from
+ * anywhere; calibrations are then authenticated too. A broadcast whose
+ * transmit time is no later than the last one taken is dropped as a
+ * replay. While broadcasts keep coming, the background sync thread, if
+ * running, doesn't query the configured server.
+ */
+
+#define NTP_MULTICAST_GROUP "224.0.1.1"  /* IANA's NTP multicast group */
+
+/**
+ * @brief What to listen for
+ */
+typedef struct {
+    char group[64];           /* Multicast group to join, "" for broadcasts only */
+    char interface_addr[64];  /* Address of the interface to join it on, "" for any */
+    uint16_t port;            /* Port the server sends to, typically 123 */
+    uint32_t calibrate_interval;  /* Seconds between delay calibrations, 0 to calibrate once */
+} ntp_broadcast_config_t;
+
+/**
+ * @brief What the listener has done since it started
+ */
+typedef struct {
+    uint64_t received;        /* Packets received */
+    uint64_t applied;         /* Broadcasts applied as syncs */
+    uint64_t rejected;        /* Not a usable broadcast, not from the configured server, or no newer than the last */
+    uint64_t calibrations;    /* Delay calibrations, each a burst of unicast exchanges */
+    uint64_t calibration_errors;  /* Calibrations in which every exchange failed */
+    int64_t one_way_delay_ns; /* Calibrated delay from the server, -1 before the first calibration */
+    char server[48];          /* Address of the configured server, "" until a broadcast resolves it */
+} ntp_broadcast_stats_t;
+
+/**
+ * @brief Start listening for broadcasts on a thread of its own
+ *
+ * @return ntp_status_t NTP_ERROR_NETWORK if the port can't be bound or the
+ *         group joined, NTP_ERROR_INVALID_PARAM for a bad config
+ */
+ntp_status_t ntp_startBroadcastClient(const ntp_broadcast_config_t *config);
+
+/**
+ * @brief Stop listening, waiting for the listener thread to exit
+ */
+void ntp_stopBroadcastClient(void);
+
+/**
+ * @brief Counts for the running or last listener
+ */
+ntp_status_t ntp_getBroadcastStats(ntp_broadcast_stats_t *stats);
+
+/*
+ * Client instances.
+ *
+ * The functions above work on one default instance, set up by ntp_init().
+ * A process that talks to many servers at once creates an ntp_client_t for
+ * each. Every instance has its own configuration, sync state, lock, shared
+ * page and background thread. Instances are cache-line aligned, so those
+ * used from different threads never contend. Each ntp_client_X(c, ...)
+ * below behaves like ntp_X(...) above, but on instance c.
+ */
+
+typedef struct ntp_client ntp_client_t;
+
+/**
+ * @brief Create a client instance, initialized as ntp_init would
+ *
+ * @return ntp_client_t* The instance, or NULL on failure
+ */
+ntp_client_t *ntp_client_create(const ntp_config_t *config);
+
+/**
+ * @brief Stop the instance's background sync and broadcast listener, waiting for a sync in
+ *        progress, and free it
+ */
+void ntp_client_destroy(ntp_client_t *c);
+
+ntp_status_t ntp_client_sync(ntp_client_t *c);
+time_t ntp_client_getCurrentTime(ntp_client_t *c);
+int64_t ntp_client_getTimeSinceLastSync(ntp_client_t *c);
+bool ntp_client_getServerName(ntp_client_t *c, char *buffer, size_t buffer_size);
+ntp_status_t ntp_client_getSyncInfo(ntp_client_t *c, ntp_sync_info_t *info);
+size_t ntp_client_getAllanDeviation(ntp_client_t *c, ntp_adev_point_t *points, size_t max);
+bool ntp_client_hasEverSynced(ntp_client_t *c);
+ntp_status_t ntp_client_setServer(ntp_client_t *c, const char *server_name);
+ntp_status_t ntp_client_setConfig(ntp_client_t *c, const ntp_config_t *config);
+uint64_t ntp_client_getConfig(ntp_client_t *c, ntp_config_t *config);
+ntp_status_t ntp_client_enableSharing(ntp_client_t *c, const char *dir);
+ntp_status_t ntp_client_setKeys(ntp_client_t *c, const ntp_keyring_t *keys);
+double ntp_client_getCurrentTimeWithMicros(ntp_client_t *c);
+int64_t ntp_client_getTimeNs(ntp_client_t *c);
+int ntp_client_getCurrentHundredths(ntp_client_t *c);
+ntp_status_t ntp_client_startBackgroundSync(ntp_client_t *c);
+void ntp_client_stopBackgroundSync(ntp_client_t *c);
+uint64_t ntp_client_waitForSyncAttempt(ntp_client_t *c, uint64_t seen, int64_t timeout_ns);
+ntp_status_t ntp_client_sleep_until(ntp_client_t *c, int64_t deadline_ns);
+ntp_status_t ntp_client_applySample(ntp_client_t *c, const ntp_sample_t *sample);
+ntp_status_t ntp_client_startBroadcastClient(ntp_client_t *c, const ntp_broadcast_config_t *config);
+void ntp_client_stopBroadcastClient(ntp_client_t *c);
+ntp_status_t ntp_client_getBroadcastStats(ntp_client_t *c, ntp_broadcast_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* NTP_CLIENT_H */
 
@@ -0,0 +1,85 @@
+#ifndef NTP_CLOCK_HPP
+#define NTP_CLOCK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include "ntp_client.h"
+
+/**
+ * std::chrono clock over the NTP client, for C++ programs.
+ *
+ * ntp::clock meets the Cpp17TrivialClock requirements. now() returns
+ * integer nanoseconds since the Unix epoch from ntp_getTimeNs(), which
+ * reads a lock-free snapshot of the offset. Nothing goes through a double.
+ * The client must be initialized and synced with the C API as usual.
+ * Until the first sync, now() is the system time.
+ *
+ * The epoch is the same as system_clock's, so converting to and from
+ * system_clock is constexpr and only changes the clock type.
+ * std::chrono::clock_cast works through to_sys/from_sys. Where the
+ * standard library has utc_clock, to_utc/from_utc convert through it.
+ */
+
+namespace ntp {
+
+struct clock {
+    using rep = std::int64_t;
+    using period = std::nano;
+    using duration = std::chrono::duration<rep, period>;
+    using time_point = std::chrono::time_point<clock, duration>;
+
+    // Syncs step the offset, in either direction
+    static constexpr bool is_steady = false;
+
+    static time_point now() noexcept
+    {
+        return time_point(duration(ntp_getTimeNs()));
+    }
+
+    template <class Duration>
+    static constexpr std::chrono::time_point<std::chrono::system_clock, Duration>
+    to_sys(const std::chrono::time_point<clock, Duration> &t) noexcept
+    {
+        return std::chrono::time_point<std::chrono::system_clock, Duration>(t.time_since_epoch());
+    }
+
+    template <class Duration>
+    static constexpr std::chrono::time_point<clock, Duration>
+    from_sys(const std::chrono::time_point<std::chrono::system_clock, Duration> &t) noexcept
+    {
+        return std::chrono::time_point<clock, Duration>(t.time_since_epoch());
+    }
+
+    static std::time_t to_time_t(const time_point &t) noexcept
+    {
+        return std::chrono::system_clock::to_time_t(
+            std::chrono::time_point_cast<std::chrono::system_clock::duration>(to_sys(t)));
+    }
+
+    static time_point from_time_t(std::time_t t) noexcept
+    {
+        return time_point(std::chrono::seconds(t));
+    }
+
+#if defined(__cpp_lib_chrono) && __cpp_lib_chrono >= 201907L
+    // Leap seconds come from the library's tzdb, so these aren't constexpr
+    template <class Duration>
+    static std::chrono::utc_time<std::common_type_t<Duration, std::chrono::seconds>>
+    to_utc(const std::chrono::time_point<clock, Duration> &t)
+    {
+        return std::chrono::utc_clock::from_sys(to_sys(t));
+    }
+
+    template <class Duration>
+    static std::chrono::time_point<clock, std::common_type_t<Duration, std::chrono::seconds>>
+    from_utc(const std::chrono::utc_time<Duration> &t)
+    {
+        return from_sys(std::chrono::utc_clock::to_sys(t));
+    }
+#endif
+};
+
+} // namespace ntp
+
+#endif /* NTP_CLOCK_HPP */
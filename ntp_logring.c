@@ -0,0 +1,212 @@
+#include "ntp_logring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#define NS_PER_SEC 1000000000LL
+#define RING_MIN_RECORDS 64
+#define SLOT_HEADER 16                /* Sequence, padded so records stay aligned */
+
+/*
+ * Each slot is a sequence followed by its record. A slot at position pos
+ * is free while its sequence is pos, and filled once it is pos + 1.
+ */
+struct ntp_logring {
+    ntp_logring_config_t config;
+    uint8_t *slots;
+    size_t stride;                /* Bytes per slot */
+    uint64_t mask;
+    _Alignas(64) _Atomic uint64_t enqueue_pos;  /* Next position producers claim */
+    _Alignas(64) uint64_t dequeue_pos;  /* Next position the writer drains; writer only */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          /* CLOCK_MONOTONIC; signalled on stop */
+    bool stopping;
+};
+
+static _Atomic uint64_t *slot_sequence(uint8_t *slot) {
+    return (_Atomic uint64_t *)slot;
+}
+
+static void *writer_thread(void *arg) {
+    ntp_logring_t *ring = arg;
+    uint32_t flush_ms = ring->config.flush_ms;
+
+    pthread_mutex_lock(&ring->lock);
+    while (!ring->stopping) {
+        pthread_mutex_unlock(&ring->lock);
+        ring->config.flush(ring, ring->config.context);
+        pthread_mutex_lock(&ring->lock);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += flush_ms % 1000 * 1000000L;
+        deadline.tv_sec += flush_ms / 1000 + deadline.tv_nsec / NS_PER_SEC;
+        deadline.tv_nsec %= NS_PER_SEC;
+        while (!ring->stopping && pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    /* No producer is left by now */
+    ring->config.flush(ring, ring->config.context);
+    return NULL;
+}
+
+static bool fail_start(ntp_logring_site_t *site, const ntp_logring_config_t *config, ntp_logring_t *ring) {
+    if (ring != NULL) {
+        free(ring->slots);
+        free(ring);
+    }
+    if (config->close != NULL) {
+        config->close(config->context);
+    }
+    pthread_mutex_unlock(&site->lock);
+    return false;
+}
+
+bool ntp_logring_start(ntp_logring_site_t *site, const ntp_logring_config_t *config) {
+    if (config == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&site->lock);
+    if (config->flush == NULL || config->record_size == 0 || atomic_load(&site->ring) != NULL) {
+        return fail_start(site, config, NULL);
+    }
+
+    ntp_logring_t *ring = aligned_alloc(_Alignof(ntp_logring_t), (sizeof(ntp_logring_t) + 63) & ~(size_t)63);
+    if (ring == NULL) {
+        return fail_start(site, config, NULL);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->config = *config;
+
+    size_t slots = RING_MIN_RECORDS;
+    while (slots < config->records) {
+        slots *= 2;
+    }
+    ring->mask = slots - 1;
+    ring->stride = SLOT_HEADER + ((config->record_size + SLOT_HEADER - 1) & ~(size_t)(SLOT_HEADER - 1));
+    ring->slots = aligned_alloc(SLOT_HEADER, slots * ring->stride);
+    if (ring->slots == NULL) {
+        return fail_start(site, config, ring);
+    }
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(slot_sequence(ring->slots + i * ring->stride), i);
+    }
+
+    if (config->open != NULL && !config->open(config->context)) {
+        return fail_start(site, config, ring);
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&ring->lock, NULL);
+
+    atomic_store(&site->logged, 0);
+    atomic_store(&site->dropped, 0);
+
+    if (pthread_create(&ring->thread, NULL, writer_thread, ring) != 0) {
+        pthread_cond_destroy(&ring->cond);
+        pthread_mutex_destroy(&ring->lock);
+        return fail_start(site, config, ring);
+    }
+    atomic_store(&site->ring, ring);
+
+    pthread_mutex_unlock(&site->lock);
+    return true;
+}
+
+void ntp_logring_stop(ntp_logring_site_t *site) {
+    pthread_mutex_lock(&site->lock);
+
+    ntp_logring_t *ring = atomic_exchange(&site->ring, NULL);
+    if (ring != NULL) {
+        /* Producers that saw it finish their record first */
+        while (atomic_load(&site->users) != 0) {
+            sched_yield();
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        ring->stopping = true;
+        pthread_cond_signal(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+        pthread_join(ring->thread, NULL);
+
+        if (ring->config.close != NULL) {
+            ring->config.close(ring->config.context);
+        }
+        pthread_cond_destroy(&ring->cond);
+        pthread_mutex_destroy(&ring->lock);
+        free(ring->slots);
+        free(ring);
+    }
+
+    pthread_mutex_unlock(&site->lock);
+}
+
+bool ntp_logring_active(ntp_logring_site_t *site) {
+    return atomic_load_explicit(&site->ring, memory_order_relaxed) != NULL;
+}
+
+void *ntp_logring_claim(ntp_logring_site_t *site) {
+    atomic_fetch_add(&site->users, 1);
+
+    ntp_logring_t *ring = atomic_load(&site->ring);
+    if (ring == NULL) {
+        atomic_fetch_sub(&site->users, 1);
+        return NULL;
+    }
+
+    uint64_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        uint8_t *slot = ring->slots + (pos & ring->mask) * ring->stride;
+        int64_t diff = (int64_t)(atomic_load_explicit(slot_sequence(slot), memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                return slot + SLOT_HEADER;
+            }
+        } else if (diff < 0) {
+            /* Full: the writer is behind, and waiting for it is not an option */
+            atomic_fetch_add_explicit(&site->dropped, 1, memory_order_relaxed);
+            atomic_fetch_sub(&site->users, 1);
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+void ntp_logring_commit(ntp_logring_site_t *site, void *record) {
+    _Atomic uint64_t *sequence = slot_sequence((uint8_t *)record - SLOT_HEADER);
+
+    /* The slot is ours, so its sequence is still the position claimed */
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1,
+                          memory_order_release);
+    atomic_fetch_add_explicit(&site->logged, 1, memory_order_relaxed);
+
+    atomic_fetch_sub(&site->users, 1);
+}
+
+const void *ntp_logring_peek(ntp_logring_t *ring) {
+    uint8_t *slot = ring->slots + (ring->dequeue_pos & ring->mask) * ring->stride;
+
+    if (atomic_load_explicit(slot_sequence(slot), memory_order_acquire) != ring->dequeue_pos + 1) {
+        return NULL;
+    }
+    return slot + SLOT_HEADER;
+}
+
+void ntp_logring_pop(ntp_logring_t *ring) {
+    uint8_t *slot = ring->slots + (ring->dequeue_pos & ring->mask) * ring->stride;
+
+    atomic_store_explicit(slot_sequence(slot), ring->dequeue_pos + ring->mask + 1, memory_order_release);
+    ring->dequeue_pos++;
+}
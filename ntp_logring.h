@@ -0,0 +1,101 @@
+#ifndef NTP_LOGRING_H
+#define NTP_LOGRING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * The lock-free ring and writer thread behind the packet recorder and the
+ * statistics files.
+ *
+ * Producers claim a fixed-size record, fill it and commit it, never
+ * blocking: the ring is a bounded multi-producer queue after Vyukov, and a
+ * record that finds it full is dropped and counted. A writer thread wakes
+ * every flush_ms and hands the ring to the owner's flush callback, which
+ * drains it with ntp_logring_peek and ntp_logring_pop.
+ *
+ * At most one ring runs per site, a static the owner keeps. Producers
+ * announce themselves on the site before loading its ring, so stopping can
+ * wait them out before freeing it. For C callers only.
+ */
+
+typedef struct ntp_logring ntp_logring_t;
+
+/**
+ * @brief Where the running ring is published, and what it has taken in
+ */
+typedef struct {
+    _Atomic(ntp_logring_t *) ring;
+    _Atomic uint32_t users;       /* Producers that may hold the ring */
+    pthread_mutex_t lock;         /* Serializes start and stop */
+    _Atomic uint64_t logged;      /* Records committed since the last start */
+    _Atomic uint64_t dropped;     /* Records not logged because the ring was full */
+} ntp_logring_site_t;
+
+#define NTP_LOGRING_SITE_INIT { NULL, 0, PTHREAD_MUTEX_INITIALIZER, 0, 0 }
+
+/**
+ * @brief The owner's side of a ring
+ */
+typedef struct {
+    size_t record_size;           /* Bytes per record */
+    uint32_t records;             /* Capacity, rounded up to a power of two, at least 64 */
+    uint32_t flush_ms;            /* How often the writer drains the ring */
+    void *context;                /* Passed to the callbacks */
+    /* Called before the writer starts, once no other ring runs on the
+       site; false fails the start. May be NULL. */
+    bool (*open)(void *context);
+    /* Writer thread: write out what is in the ring */
+    void (*flush)(ntp_logring_t *ring, void *context);
+    /* Called exactly once for each start, to release the context: after
+       the writer has stopped, or when the start fails, whether or not
+       open ran. May be NULL. */
+    void (*close)(void *context);
+} ntp_logring_config_t;
+
+/**
+ * @brief Start a ring and its writer on a site
+ *
+ * @return bool false, with close already called, if one already runs
+ *         there, open fails, or memory or the thread can't be had
+ */
+bool ntp_logring_start(ntp_logring_site_t *site, const ntp_logring_config_t *config);
+
+/**
+ * @brief Stop the site's ring, if any; flush sees everything committed
+ *        before it returns, then close is called
+ */
+void ntp_logring_stop(ntp_logring_site_t *site);
+
+/**
+ * @brief Whether a ring runs on the site; one relaxed atomic load
+ */
+bool ntp_logring_active(ntp_logring_site_t *site);
+
+/**
+ * @brief Claim a record to fill, never blocking
+ *
+ * @return void* The record, to be handed to ntp_logring_commit; NULL if no
+ *         ring runs or it is full (counted as dropped)
+ */
+void *ntp_logring_claim(ntp_logring_site_t *site);
+
+/**
+ * @brief Publish a claimed record to the writer
+ */
+void ntp_logring_commit(ntp_logring_site_t *site, void *record);
+
+/**
+ * @brief The oldest committed record, or NULL if there is none; flush only
+ */
+const void *ntp_logring_peek(ntp_logring_t *ring);
+
+/**
+ * @brief Free the record peek returned; flush only
+ */
+void ntp_logring_pop(ntp_logring_t *ring);
+
+#endif /* NTP_LOGRING_H */
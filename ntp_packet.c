@@ -0,0 +1,214 @@
+#include "ntp_packet.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define NS_PER_SEC 1000000000LL
+#define TIMESTAMPS_OFFSET 16          /* Reference, origin, receive and transmit timestamps */
+#define BLOCK_PACKETS 256             /* 12 KB of packets, parsed in two passes while in L1 */
+
+/**
+ * @brief Convert an NTP timestamp (seconds and 2^-32 fraction) to Unix nanoseconds
+ */
+static int64_t timestamp_to_ns(uint32_t seconds, uint32_t fraction) {
+    return ((int64_t)seconds - (int64_t)NTP_TIMESTAMP_DELTA) * NS_PER_SEC +
+           (int64_t)(((uint64_t)fraction * NS_PER_SEC) >> 32);
+}
+
+/**
+ * @brief Convert an NTP short format value (16.16 fixed point seconds) to nanoseconds
+ */
+static int64_t short_to_ns(uint32_t value) {
+    return (int64_t)(((uint64_t)value * NS_PER_SEC) >> 16);
+}
+
+static void parse_headers(const uint8_t *p, size_t count, ntp_packet_batch_t *out) {
+    for (size_t i = 0; i < count; i++, p += NTP_PACKET_SIZE) {
+        const ntp_packet_t *packet = (const ntp_packet_t *)p;
+        uint32_t root_delay, root_dispersion, ref_id;
+
+        /* Unaligned packets are fine; memcpy compiles to plain loads */
+        memcpy(&root_delay, &packet->root_delay, sizeof(root_delay));
+        memcpy(&root_dispersion, &packet->root_dispersion, sizeof(root_dispersion));
+        memcpy(&ref_id, &packet->ref_id, sizeof(ref_id));
+
+        out->leap[i] = packet->li_vn_mode >> 6;
+        out->version[i] = (packet->li_vn_mode >> 3) & 0x07;
+        out->mode[i] = packet->li_vn_mode & 0x07;
+        out->stratum[i] = packet->stratum;
+        out->poll[i] = (int8_t)packet->poll;
+        out->precision[i] = (int8_t)packet->precision;
+        out->root_delay_ns[i] = short_to_ns(ntohl(root_delay));
+        out->root_dispersion_ns[i] = short_to_ns(ntohl(root_dispersion));
+        out->ref_id[i] = ntohl(ref_id);
+    }
+}
+
+/**
+ * @brief Convert the timestamps of packets [first, count) one at a time
+ */
+static void timestamps_scalar(const uint8_t *packets, size_t first, size_t count, ntp_packet_batch_t *out) {
+    int64_t *fields[4] = { out->ref_ns, out->orig_ns, out->recv_ns, out->tx_ns };
+
+    for (size_t i = first; i < count; i++) {
+        uint32_t words[8];
+        memcpy(words, packets + i * NTP_PACKET_SIZE + TIMESTAMPS_OFFSET, sizeof(words));
+        for (int k = 0; k < 4; k++) {
+            fields[k][i] = timestamp_to_ns(ntohl(words[2 * k]), ntohl(words[2 * k + 1]));
+        }
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* Both kernels reverse each 8-byte timestamp, which turns big-endian
+   seconds and fraction into one little-endian seconds << 32 | fraction.
+   _mm_mul_epu32 multiplies the low 32 bits of each 64-bit lane, so the
+   fraction is multiplied in place and the seconds after a shift; every
+   product fits in 64 bits, and the result is exactly timestamp_to_ns. */
+
+/**
+ * @brief Convert the timestamps of packets four at a time; returns how many were done
+ */
+__attribute__((target("avx2")))
+static size_t timestamps_avx2(const uint8_t *packets, size_t count, ntp_packet_batch_t *out) {
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i ns_per_sec = _mm256_set1_epi64x(NS_PER_SEC);
+    const __m256i delta_ns = _mm256_set1_epi64x((int64_t)NTP_TIMESTAMP_DELTA * NS_PER_SEC);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256i t[4];
+
+        /* t[k]: reference, origin, receive and transmit of packet i + k */
+        for (int k = 0; k < 4; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(packets + (i + k) * NTP_PACKET_SIZE + TIMESTAMPS_OFFSET));
+            v = _mm256_shuffle_epi8(v, swap);
+            __m256i seconds = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), ns_per_sec);
+            __m256i fraction = _mm256_srli_epi64(_mm256_mul_epu32(v, ns_per_sec), 32);
+            t[k] = _mm256_add_epi64(_mm256_sub_epi64(seconds, delta_ns), fraction);
+        }
+
+        /* Transpose to one field of four packets per vector */
+        __m256i ref_recv01 = _mm256_unpacklo_epi64(t[0], t[1]);
+        __m256i orig_tx01 = _mm256_unpackhi_epi64(t[0], t[1]);
+        __m256i ref_recv23 = _mm256_unpacklo_epi64(t[2], t[3]);
+        __m256i orig_tx23 = _mm256_unpackhi_epi64(t[2], t[3]);
+        _mm256_storeu_si256((__m256i *)(out->ref_ns + i), _mm256_permute2x128_si256(ref_recv01, ref_recv23, 0x20));
+        _mm256_storeu_si256((__m256i *)(out->orig_ns + i), _mm256_permute2x128_si256(orig_tx01, orig_tx23, 0x20));
+        _mm256_storeu_si256((__m256i *)(out->recv_ns + i), _mm256_permute2x128_si256(ref_recv01, ref_recv23, 0x31));
+        _mm256_storeu_si256((__m256i *)(out->tx_ns + i), _mm256_permute2x128_si256(orig_tx01, orig_tx23, 0x31));
+    }
+
+    return i;
+}
+
+/**
+ * @brief Convert the timestamps of packets two at a time; returns how many were done
+ */
+__attribute__((target("ssse3")))
+static size_t timestamps_ssse3(const uint8_t *packets, size_t count, ntp_packet_batch_t *out) {
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m128i ns_per_sec = _mm_set1_epi64x(NS_PER_SEC);
+    const __m128i delta_ns = _mm_set1_epi64x((int64_t)NTP_TIMESTAMP_DELTA * NS_PER_SEC);
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128i t[4];
+
+        /* t[2k]: reference and origin, t[2k + 1]: receive and transmit of packet i + k */
+        for (int k = 0; k < 4; k++) {
+            const uint8_t *p = packets + (i + k / 2) * NTP_PACKET_SIZE + TIMESTAMPS_OFFSET + (k % 2) * 16;
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+            __m128i seconds = _mm_mul_epu32(_mm_srli_epi64(v, 32), ns_per_sec);
+            __m128i fraction = _mm_srli_epi64(_mm_mul_epu32(v, ns_per_sec), 32);
+            t[k] = _mm_add_epi64(_mm_sub_epi64(seconds, delta_ns), fraction);
+        }
+
+        _mm_storeu_si128((__m128i *)(out->ref_ns + i), _mm_unpacklo_epi64(t[0], t[2]));
+        _mm_storeu_si128((__m128i *)(out->orig_ns + i), _mm_unpackhi_epi64(t[0], t[2]));
+        _mm_storeu_si128((__m128i *)(out->recv_ns + i), _mm_unpacklo_epi64(t[1], t[3]));
+        _mm_storeu_si128((__m128i *)(out->tx_ns + i), _mm_unpackhi_epi64(t[1], t[3]));
+    }
+
+    return i;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+ntp_packet_isa_t ntp_packet_best_isa(void) {
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return NTP_PACKET_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return NTP_PACKET_SSSE3;
+    }
+#endif
+    return NTP_PACKET_SCALAR;
+}
+
+const char *ntp_packet_isa_name(ntp_packet_isa_t isa) {
+    switch (isa) {
+        case NTP_PACKET_AVX2:
+            return "avx2";
+        case NTP_PACKET_SSSE3:
+            return "ssse3";
+        default:
+            return "scalar";
+    }
+}
+
+ntp_packet_isa_t ntp_packet_parse_batch_isa(ntp_packet_isa_t isa, const void *packets, size_t count,
+                                            ntp_packet_batch_t *out) {
+    const uint8_t *p = packets;
+    ntp_packet_batch_t block = *out;
+
+    if (isa > ntp_packet_best_isa()) {
+        isa = ntp_packet_best_isa();
+    }
+
+    /* A block at a time, so the timestamps are still in cache after the headers */
+    for (size_t first = 0; first < count; first += BLOCK_PACKETS) {
+        size_t n = count - first < BLOCK_PACKETS ? count - first : BLOCK_PACKETS;
+        size_t done = 0;
+
+        block.leap = out->leap + first;
+        block.version = out->version + first;
+        block.mode = out->mode + first;
+        block.stratum = out->stratum + first;
+        block.poll = out->poll + first;
+        block.precision = out->precision + first;
+        block.root_delay_ns = out->root_delay_ns + first;
+        block.root_dispersion_ns = out->root_dispersion_ns + first;
+        block.ref_id = out->ref_id + first;
+        block.ref_ns = out->ref_ns + first;
+        block.orig_ns = out->orig_ns + first;
+        block.recv_ns = out->recv_ns + first;
+        block.tx_ns = out->tx_ns + first;
+
+        parse_headers(p + first * NTP_PACKET_SIZE, n, &block);
+
+#ifdef HAVE_X86_KERNELS
+        if (isa == NTP_PACKET_AVX2) {
+            done = timestamps_avx2(p + first * NTP_PACKET_SIZE, n, &block);
+        } else if (isa == NTP_PACKET_SSSE3) {
+            done = timestamps_ssse3(p + first * NTP_PACKET_SIZE, n, &block);
+        }
+#endif
+
+        /* What doesn't fill a whole vector */
+        timestamps_scalar(p + first * NTP_PACKET_SIZE, done, n, &block);
+    }
+
+    return isa;
+}
+
+void ntp_packet_parse_batch(const void *packets, size_t count, ntp_packet_batch_t *out) {
+    ntp_packet_parse_batch_isa(NTP_PACKET_AVX2, packets, count, out);
+}
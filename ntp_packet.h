@@ -0,0 +1,107 @@
+#ifndef NTP_PACKET_H
+#define NTP_PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NTP packet layout, and batch parsing for captured traffic.
+ *
+ * ntp_packet_parse_batch() decodes arrays of raw 48-byte packets into
+ * structure-of-arrays outputs: the header fields, and the four 32.32
+ * timestamps as int64 nanoseconds since the Unix epoch. Each timestamp is
+ * converted the same way the client converts a response, so results match
+ * per-packet parsing exactly.
+ *
+ * The timestamps are byte-swapped with one shuffle per packet and
+ * converted with 64-bit vector multiplies, four packets at a time with
+ * AVX2 or two with SSSE3. The header fields are single bytes and byte
+ * swaps, which stay scalar. The instruction set is picked once at run time
+ * and falls back to scalar code elsewhere.
+ */
+
+#define NTP_PACKET_SIZE 48
+#define NTP_TIMESTAMP_DELTA 2208988800UL  /* Seconds between 1900 (NTP epoch) and 1970 (Unix epoch) */
+
+/* NTP packet structure */
+typedef struct {
+    uint8_t li_vn_mode;           /* Leap indicator, version and mode */
+    uint8_t stratum;              /* Stratum level */
+    uint8_t poll;                 /* Poll interval */
+    uint8_t precision;            /* Precision */
+    uint32_t root_delay;          /* Root delay */
+    uint32_t root_dispersion;     /* Root dispersion */
+    uint32_t ref_id;              /* Reference ID */
+    uint32_t ref_timestamp_sec;   /* Reference timestamp seconds */
+    uint32_t ref_timestamp_frac;  /* Reference timestamp fraction */
+    uint32_t orig_timestamp_sec;  /* Origin timestamp seconds */
+    uint32_t orig_timestamp_frac; /* Origin timestamp fraction */
+    uint32_t recv_timestamp_sec;  /* Receive timestamp seconds */
+    uint32_t recv_timestamp_frac; /* Receive timestamp fraction */
+    uint32_t tx_timestamp_sec;    /* Transmit timestamp seconds */
+    uint32_t tx_timestamp_frac;   /* Transmit timestamp fraction */
+} ntp_packet_t;
+
+typedef enum {
+    NTP_PACKET_SCALAR,
+    NTP_PACKET_SSSE3,
+    NTP_PACKET_AVX2
+} ntp_packet_isa_t;
+
+/**
+ * @brief Parsed fields, one array per field, each with room for the batch
+ */
+typedef struct {
+    uint8_t *leap;                /* Leap indicator */
+    uint8_t *version;             /* Version number */
+    uint8_t *mode;                /* Association mode */
+    uint8_t *stratum;             /* Stratum level */
+    int8_t *poll;                 /* log2 of the poll interval in seconds */
+    int8_t *precision;            /* log2 of the clock precision in seconds */
+    int64_t *root_delay_ns;       /* Root delay */
+    int64_t *root_dispersion_ns;  /* Root dispersion */
+    uint32_t *ref_id;             /* Reference ID, host byte order */
+    int64_t *ref_ns;              /* Reference timestamp */
+    int64_t *orig_ns;             /* Origin timestamp */
+    int64_t *recv_ns;             /* Receive timestamp */
+    int64_t *tx_ns;               /* Transmit timestamp */
+} ntp_packet_batch_t;
+
+/**
+ * @brief Parse packets with the best instruction set this CPU has
+ *
+ * @param packets count packets of NTP_PACKET_SIZE bytes each, back to back,
+ *        as they arrive on the wire; no alignment needed
+ * @param count Number of packets
+ * @param out Arrays to fill in, each with room for count entries
+ */
+void ntp_packet_parse_batch(const void *packets, size_t count, ntp_packet_batch_t *out);
+
+/**
+ * @brief Parse packets with a given instruction set, for comparing them
+ *
+ * @return ntp_packet_isa_t The instruction set used: isa, or a lesser one
+ *         if this CPU doesn't have it
+ */
+ntp_packet_isa_t ntp_packet_parse_batch_isa(ntp_packet_isa_t isa, const void *packets, size_t count,
+                                            ntp_packet_batch_t *out);
+
+/**
+ * @brief The best instruction set this CPU has for batch parsing
+ */
+ntp_packet_isa_t ntp_packet_best_isa(void);
+
+/**
+ * @brief Name of an instruction set ("scalar", "ssse3" or "avx2")
+ */
+const char *ntp_packet_isa_name(ntp_packet_isa_t isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_PACKET_H */
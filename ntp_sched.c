@@ -0,0 +1,464 @@
+#include "ntp_sched.h"
+#include "ntp_client.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define WHEEL_BITS 6                  /* log2(NTP_WHEEL_SLOTS) */
+#define WHEEL_MASK (NTP_WHEEL_SLOTS - 1)
+#define NS_PER_SEC 1000000000LL
+
+struct ntp_sched {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          /* CLOCK_MONOTONIC; signalled for an earlier deadline and on stop */
+    pthread_t thread;
+    bool stopping;
+    bool approaching;             /* The thread is in its final sleep; wake it through wake, not cond */
+    _Atomic uint32_t wake;        /* Bumped to cut the final sleep short (futex) */
+    ntp_wheel_t wheel;
+    int64_t armed_ns;             /* Deadline the thread is waiting for, INT64_MAX if none */
+    int64_t offset_ns;            /* Offset the pending deadlines were last mapped with */
+    bool mapped;                  /* offset_ns has been read */
+    ntp_sched_stats_t stats;
+};
+
+/* ---------------------------------------------------------------------- */
+/* Timing wheel                                                           */
+/* ---------------------------------------------------------------------- */
+
+static uint64_t ns_to_tick(int64_t ns) {
+    return ns <= 0 ? 0 : (uint64_t)ns >> NTP_WHEEL_TICK_SHIFT;
+}
+
+static int64_t tick_to_ns(uint64_t tick) {
+    return tick > (uint64_t)INT64_MAX >> NTP_WHEEL_TICK_SHIFT ? INT64_MAX
+                                                              : (int64_t)(tick << NTP_WHEEL_TICK_SHIFT);
+}
+
+static void list_push(ntp_timer_t **head, ntp_timer_t *t, int slot) {
+    t->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+    t->slot = (int16_t)slot;
+}
+
+static void list_unlink(ntp_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/**
+ * @brief Move a whole list onto the front of another
+ */
+static void list_splice(ntp_timer_t **to, ntp_timer_t **from) {
+    ntp_timer_t *t = *from;
+
+    while (t != NULL) {
+        ntp_timer_t *next = t->next;
+        list_unlink(t);
+        list_push(to, t, -1);
+        t = next;
+    }
+}
+
+/**
+ * @brief Put a timer where it belongs relative to the current tick
+ *
+ * A timer goes on the level of the highest 6-bit group in which its tick
+ * differs from the current one, in the slot given by that group. Until the
+ * current tick reaches that slot, every group above it matches.
+ */
+static void place(ntp_wheel_t *w, ntp_timer_t *t) {
+    if (t->deadline_ns <= w->now_ns) {
+        list_push(&w->expired, t, -1);
+        return;
+    }
+
+    uint64_t tick = ns_to_tick(t->deadline_ns);
+    uint64_t diff = tick ^ w->now_tick;
+    int level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+    if (level >= NTP_WHEEL_LEVELS) {
+        list_push(&w->overflow, t, -1);
+        return;
+    }
+
+    int slot = (int)(tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    list_push(&w->slots[level][slot], t, level * NTP_WHEEL_SLOTS + slot);
+    w->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * @brief Bitmap of count slots starting at first, wrapping around
+ */
+static uint64_t slot_range(int first, uint64_t count) {
+    if (count >= NTP_WHEEL_SLOTS) {
+        return ~0ULL;
+    }
+    uint64_t bits = (1ULL << count) - 1;
+    return first == 0 ? bits : (bits << first) | (bits >> (NTP_WHEEL_SLOTS - first));
+}
+
+/**
+ * @brief Take every timer in the given slots of a level off the wheel
+ */
+static void collect(ntp_wheel_t *w, int level, uint64_t slots, ntp_timer_t **todo) {
+    slots &= w->occupied[level];
+    while (slots != 0) {
+        int slot = __builtin_ctzll(slots);
+        list_splice(todo, &w->slots[level][slot]);
+        w->occupied[level] &= ~(1ULL << slot);
+        slots &= slots - 1;
+    }
+}
+
+void ntp_wheel_init(ntp_wheel_t *w, int64_t now_ns) {
+    memset(w, 0, sizeof(*w));
+    w->now_ns = now_ns;
+    w->now_tick = ns_to_tick(now_ns);
+}
+
+void ntp_wheel_add(ntp_wheel_t *w, ntp_timer_t *t) {
+    place(w, t);
+    w->count++;
+}
+
+bool ntp_wheel_cancel(ntp_wheel_t *w, ntp_timer_t *t) {
+    if (t->pprev == NULL) {
+        return false;
+    }
+
+    int slot = t->slot;
+    list_unlink(t);
+    if (slot >= 0 && w->slots[slot / NTP_WHEEL_SLOTS][slot % NTP_WHEEL_SLOTS] == NULL) {
+        w->occupied[slot / NTP_WHEEL_SLOTS] &= ~(1ULL << (slot % NTP_WHEEL_SLOTS));
+    }
+    w->count--;
+    return true;
+}
+
+void ntp_wheel_advance(ntp_wheel_t *w, int64_t now_ns) {
+    ntp_timer_t *todo = NULL;
+    uint64_t old_tick = w->now_tick;
+    uint64_t new_tick = ns_to_tick(now_ns);
+
+    if (now_ns < w->now_ns) {
+        /* Time stepped back: placements relative to the later time are
+           wrong now, so start over from the earlier one */
+        for (int level = 0; level < NTP_WHEEL_LEVELS; level++) {
+            collect(w, level, ~0ULL, &todo);
+        }
+        list_splice(&todo, &w->overflow);
+    } else {
+        /* Every slot the current tick reached or passed holds timers that
+           are due or belong on a lower level; on the lowest level that
+           includes the slot we were in, whose timers may not have been due */
+        for (int level = 0; level < NTP_WHEEL_LEVELS; level++) {
+            uint64_t from = old_tick >> (level * WHEEL_BITS);
+            uint64_t to = new_tick >> (level * WHEEL_BITS);
+            if (level == 0) {
+                collect(w, 0, slot_range((int)(from & WHEEL_MASK), to - from + 1), &todo);
+            } else if (to != from) {
+                collect(w, level, slot_range((int)((from + 1) & WHEEL_MASK), to - from), &todo);
+            }
+        }
+        if ((new_tick >> (NTP_WHEEL_LEVELS * WHEEL_BITS)) != (old_tick >> (NTP_WHEEL_LEVELS * WHEEL_BITS))) {
+            list_splice(&todo, &w->overflow);
+        }
+    }
+
+    w->now_ns = now_ns;
+    w->now_tick = new_tick;
+    while (todo != NULL) {
+        ntp_timer_t *t = todo;
+        list_unlink(t);
+        place(w, t);
+    }
+}
+
+ntp_timer_t *ntp_wheel_pop(ntp_wheel_t *w) {
+    ntp_timer_t *t = w->expired;
+
+    if (t != NULL) {
+        list_unlink(t);
+        w->count--;
+    }
+    return t;
+}
+
+int64_t ntp_wheel_next(const ntp_wheel_t *w) {
+    int64_t next = INT64_MAX;
+
+    if (w->expired != NULL) {
+        return w->now_ns;
+    }
+
+    /* Lowest level: every timer in a slot shares a tick, so the earliest
+       of the first occupied slot is exact */
+    uint64_t ahead = w->occupied[0] & (~0ULL << (w->now_tick & WHEEL_MASK));
+    if (ahead != 0) {
+        for (const ntp_timer_t *t = w->slots[0][__builtin_ctzll(ahead)]; t != NULL; t = t->next) {
+            if (t->deadline_ns < next) {
+                next = t->deadline_ns;
+            }
+        }
+    }
+
+    /* Higher levels: the start of the first occupied slot, when its timers
+       move down */
+    for (int level = 1; level < NTP_WHEEL_LEVELS; level++) {
+        int shift = level * WHEEL_BITS;
+        uint64_t current = (w->now_tick >> shift) & WHEEL_MASK;
+        ahead = current == WHEEL_MASK ? 0 : w->occupied[level] & (~0ULL << (current + 1));
+        if (ahead != 0) {
+            uint64_t tick = ((w->now_tick >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) |
+                            ((uint64_t)__builtin_ctzll(ahead) << shift);
+            int64_t ns = tick_to_ns(tick);
+            if (ns < next) {
+                next = ns;
+            }
+        }
+    }
+
+    if (w->overflow != NULL) {
+        int shift = NTP_WHEEL_LEVELS * WHEEL_BITS;
+        int64_t ns = tick_to_ns(((w->now_tick >> shift) + 1) << shift);
+        if (ns < next) {
+            next = ns;
+        }
+    }
+
+    return next;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Scheduler thread                                                       */
+/* ---------------------------------------------------------------------- */
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static struct timespec to_timespec(int64_t ns) {
+    struct timespec ts = { .tv_sec = ns / NS_PER_SEC, .tv_nsec = ns % NS_PER_SEC };
+    return ts;
+}
+
+int64_t ntp_sched_next_wake(int64_t mono_now_ns, int64_t target_ns, bool *final) {
+    *final = target_ns - mono_now_ns <= NTP_SCHED_LEAD_NS;
+    if (*final) {
+        return target_ns;
+    }
+    int64_t until = target_ns - NTP_SCHED_LEAD_NS;
+    return until < mono_now_ns + NTP_SCHED_RECHECK_NS ? until : mono_now_ns + NTP_SCHED_RECHECK_NS;
+}
+
+/**
+ * @brief Read the current NTP time and the monotonic time it maps to; lock held
+ */
+static int64_t sample_locked(ntp_sched_t *s, int64_t *mono_ns) {
+    ntp_sync_info_t info;
+    int64_t offset_ns = ntp_getSyncInfo(&info) == NTP_OK ? info.offset_ns : 0;
+
+    *mono_ns = clock_ns(CLOCK_MONOTONIC);
+    if (s->mapped && offset_ns != s->offset_ns && s->wheel.count > 0) {
+        s->stats.remaps++;
+    }
+    s->offset_ns = offset_ns;
+    s->mapped = true;
+    return clock_ns(CLOCK_REALTIME) + offset_ns;
+}
+
+/**
+ * @brief Sleep until an absolute CLOCK_MONOTONIC time, or until *word no
+ *        longer holds seen
+ *
+ * A futex rather than clock_nanosleep, so another thread can cut the sleep
+ * short; the timeout is just as precise.
+ */
+static void futex_sleep(_Atomic uint32_t *word, uint32_t seen, const struct timespec *until) {
+    while (atomic_load_explicit(word, memory_order_acquire) == seen &&
+           syscall(SYS_futex, word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, seen, until, NULL,
+                   FUTEX_BITSET_MATCH_ANY) != 0 &&
+           errno == EINTR) {
+    }
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    atomic_fetch_add_explicit(word, 1, memory_order_release);
+    syscall(SYS_futex, word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief Wake the thread for an earlier deadline or to stop; lock held
+ */
+static void wake_locked(ntp_sched_t *s) {
+    if (s->approaching) {
+        futex_wake(&s->wake);
+    } else {
+        pthread_cond_signal(&s->cond);
+    }
+}
+
+static void record_lateness(ntp_sched_stats_t *stats, int64_t late_ns) {
+    int bucket = 0;
+
+    if (late_ns < 0) {
+        late_ns = 0;
+    }
+    if (late_ns >= 1000) {
+        bucket = 64 - __builtin_clzll((uint64_t)(late_ns / 1000));
+        if (bucket >= NTP_SCHED_HIST_BUCKETS) {
+            bucket = NTP_SCHED_HIST_BUCKETS - 1;
+        }
+    }
+    stats->lateness[bucket]++;
+    if (late_ns > stats->max_lateness_ns) {
+        stats->max_lateness_ns = late_ns;
+    }
+}
+
+static void *sched_thread(void *arg) {
+    ntp_sched_t *s = arg;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->stopping) {
+        int64_t mono_ns;
+        int64_t now_ns = sample_locked(s, &mono_ns);
+
+        ntp_wheel_advance(&s->wheel, now_ns);
+        ntp_timer_t *t;
+        while ((t = ntp_wheel_pop(&s->wheel)) != NULL && !s->stopping) {
+            record_lateness(&s->stats, clock_ns(CLOCK_REALTIME) + s->offset_ns - t->deadline_ns);
+            s->stats.fired++;
+            pthread_mutex_unlock(&s->lock);
+            t->fn(t, t->arg);
+            pthread_mutex_lock(&s->lock);
+        }
+
+        /* Map the next deadline to CLOCK_MONOTONIC with the offset just read */
+        int64_t next = ntp_wheel_next(&s->wheel);
+        s->armed_ns = next;
+        if (next == INT64_MAX) {
+            pthread_cond_wait(&s->cond, &s->lock);
+            continue;
+        }
+
+        int64_t target = mono_ns + (next - now_ns);
+        int64_t mono_now = clock_ns(CLOCK_MONOTONIC);
+        bool final;
+        int64_t until = ntp_sched_next_wake(mono_now, target, &final);
+        if (!final) {
+            /* Far off: wait where an earlier timer can wake us, and look at
+               the offset again now and then */
+            struct timespec ts = to_timespec(until);
+            pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+        } else if (target > mono_now) {
+            /* Close: sleep to the exact instant, unless an earlier timer or
+               a stop wakes us first */
+            struct timespec ts = to_timespec(target);
+            uint32_t seen = atomic_load_explicit(&s->wake, memory_order_relaxed);
+            s->approaching = true;
+            pthread_mutex_unlock(&s->lock);
+            futex_sleep(&s->wake, seen, &ts);
+            pthread_mutex_lock(&s->lock);
+            s->approaching = false;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+ntp_sched_t *ntp_sched_create(void) {
+    ntp_sched_t *s = calloc(1, sizeof(*s));
+    pthread_condattr_t attr;
+
+    if (s == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    s->armed_ns = INT64_MAX;
+
+    int64_t mono_ns;
+    ntp_wheel_init(&s->wheel, sample_locked(s, &mono_ns));
+
+    if (pthread_create(&s->thread, NULL, sched_thread, s) != 0) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void ntp_sched_destroy(ntp_sched_t *s) {
+    if (s == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stopping = true;
+    wake_locked(s);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+void ntp_sched_add(ntp_sched_t *s, ntp_timer_t *timer, int64_t deadline_ns, ntp_timer_fn fn, void *arg) {
+    timer->deadline_ns = deadline_ns;
+    timer->fn = fn;
+    timer->arg = arg;
+
+    pthread_mutex_lock(&s->lock);
+    ntp_wheel_add(&s->wheel, timer);
+    if (deadline_ns < s->armed_ns) {
+        /* Sooner than what the thread is waiting for */
+        s->armed_ns = deadline_ns;
+        wake_locked(s);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+bool ntp_sched_cancel(ntp_sched_t *s, ntp_timer_t *timer) {
+    bool cancelled = false;
+
+    pthread_mutex_lock(&s->lock);
+    if (ntp_wheel_cancel(&s->wheel, timer)) {
+        s->stats.cancelled++;
+        cancelled = true;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return cancelled;
+}
+
+void ntp_sched_getStats(ntp_sched_t *s, ntp_sched_stats_t *stats) {
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    stats->pending = s->wheel.count;
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,174 @@
+#ifndef NTP_SCHED_H
+#define NTP_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Timers that fire at NTP-corrected instants.
+ *
+ * Timers live in a hierarchical timing wheel keyed by NTP time: six levels
+ * of 64 slots, the lowest with a resolution of 2^20 ns (about 1 ms), each
+ * level above 64 times coarser. Adding and cancelling a timer are O(1);
+ * a timer moves down a level at most five times before it fires. Timers
+ * are caller-allocated, so the wheel itself never allocates.
+ *
+ * The scheduler thread maps the earliest deadline to CLOCK_MONOTONIC with
+ * the current offset and sleeps towards it. Because the wheel holds NTP
+ * times, an offset change re-maps every pending deadline at once; the
+ * thread notices one within NTP_SCHED_RECHECK_NS and never fires a timer
+ * before its deadline in NTP time.
+ */
+
+#define NTP_WHEEL_LEVELS 6
+#define NTP_WHEEL_SLOTS 64
+#define NTP_WHEEL_TICK_SHIFT 20           /* 2^20 ns per tick on the lowest level */
+
+#define NTP_SCHED_LEAD_NS 1000000         /* Final approach to a deadline in clock_nanosleep */
+#define NTP_SCHED_RECHECK_NS 100000000    /* Longest wait before looking at the offset again */
+#define NTP_SCHED_HIST_BUCKETS 24         /* Lateness histogram: < 1 us, < 2 us, ... >= 4 s */
+
+typedef struct ntp_timer ntp_timer_t;
+
+/**
+ * @brief Called on the scheduler thread when a timer fires
+ *
+ * The timer is no longer pending and may be added again from here.
+ */
+typedef void (*ntp_timer_fn)(ntp_timer_t *timer, void *arg);
+
+/**
+ * @brief A timer; zero it before first use. Set up by ntp_sched_add and
+ *        private to the wheel while pending.
+ */
+struct ntp_timer {
+    int64_t deadline_ns;          /* NTP time to fire at */
+    ntp_timer_fn fn;              /* Called when it fires */
+    void *arg;                    /* Passed to fn */
+    ntp_timer_t *next;            /* Rest of the list it is on */
+    ntp_timer_t **pprev;          /* Link pointing at it, or NULL when not pending */
+    int16_t slot;                 /* level * NTP_WHEEL_SLOTS + slot, or -1 on another list */
+};
+
+/**
+ * @brief The timing wheel on its own, without a thread
+ */
+typedef struct {
+    ntp_timer_t *slots[NTP_WHEEL_LEVELS][NTP_WHEEL_SLOTS];
+    uint64_t occupied[NTP_WHEEL_LEVELS];  /* Bitmap of non-empty slots per level */
+    ntp_timer_t *overflow;        /* Beyond the top level (over two years out) */
+    ntp_timer_t *expired;         /* Due, waiting for ntp_wheel_pop */
+    int64_t now_ns;               /* Time of the last advance */
+    uint64_t now_tick;
+    size_t count;                 /* Pending timers, expired ones included */
+} ntp_wheel_t;
+
+/**
+ * @brief Set up an empty wheel at the given time
+ */
+void ntp_wheel_init(ntp_wheel_t *w, int64_t now_ns);
+
+/**
+ * @brief Add a timer whose deadline_ns is set; one already due expires at once
+ */
+void ntp_wheel_add(ntp_wheel_t *w, ntp_timer_t *t);
+
+/**
+ * @brief Remove a pending timer
+ *
+ * @return bool false if it wasn't pending
+ */
+bool ntp_wheel_cancel(ntp_wheel_t *w, ntp_timer_t *t);
+
+/**
+ * @brief Move time forward, expiring every timer due by now_ns
+ */
+void ntp_wheel_advance(ntp_wheel_t *w, int64_t now_ns);
+
+/**
+ * @brief Take the next expired timer off the wheel
+ *
+ * @return ntp_timer_t* The timer, or NULL if none has expired
+ */
+ntp_timer_t *ntp_wheel_pop(ntp_wheel_t *w);
+
+/**
+ * @brief When the wheel next needs advancing
+ *
+ * @return int64_t The earliest deadline, or an earlier time at which timers
+ *         move down a level; INT64_MAX when the wheel is empty
+ */
+int64_t ntp_wheel_next(const ntp_wheel_t *w);
+
+/**
+ * @brief Where to sleep to next on the way to a CLOCK_MONOTONIC target
+ *
+ * A deadline in NTP time maps to a monotonic target that moves whenever the
+ * offset does. Far from it, a sleeper stops NTP_SCHED_LEAD_NS short, and
+ * at most NTP_SCHED_RECHECK_NS from now, then maps it again; within
+ * NTP_SCHED_LEAD_NS it sleeps to the target itself.
+ *
+ * @param final Set to true when the time returned is the target
+ * @return int64_t CLOCK_MONOTONIC time to sleep until
+ */
+int64_t ntp_sched_next_wake(int64_t mono_now_ns, int64_t target_ns, bool *final);
+
+/**
+ * @brief Scheduler statistics
+ */
+typedef struct {
+    uint64_t pending;             /* Timers waiting to fire */
+    uint64_t fired;               /* Timers fired so far */
+    uint64_t cancelled;           /* Timers cancelled before firing */
+    uint64_t remaps;              /* Offset changes that moved the pending deadlines */
+    uint64_t lateness[NTP_SCHED_HIST_BUCKETS];  /* Bucket i: lateness below 2^i us */
+    int64_t max_lateness_ns;      /* Worst lateness so far */
+} ntp_sched_stats_t;
+
+typedef struct ntp_sched ntp_sched_t;
+
+/**
+ * @brief Create a scheduler and start its thread
+ *
+ * Deadlines are mapped with the NTP client's offset, so the client should be
+ * initialized first.
+ *
+ * @return ntp_sched_t* The scheduler, or NULL on failure
+ */
+ntp_sched_t *ntp_sched_create(void);
+
+/**
+ * @brief Stop the thread and free the scheduler; pending timers never fire
+ */
+void ntp_sched_destroy(ntp_sched_t *s);
+
+/**
+ * @brief Fire fn(timer, arg) on the scheduler thread at NTP time deadline_ns
+ *
+ * The timer must not be pending already.
+ */
+void ntp_sched_add(ntp_sched_t *s, ntp_timer_t *timer, int64_t deadline_ns, ntp_timer_fn fn, void *arg);
+
+/**
+ * @brief Cancel a pending timer
+ *
+ * @return bool false if it already fired (its callback may still be running)
+ *         or wasn't added
+ */
+bool ntp_sched_cancel(ntp_sched_t *s, ntp_timer_t *timer);
+
+/**
+ * @brief Copy out the statistics, including the lateness histogram
+ */
+void ntp_sched_getStats(ntp_sched_t *s, ntp_sched_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_SCHED_H */
@@ -0,0 +1,408 @@
+#include "ntp_server.h"
+#include "ntp_packet.h"
+#include "ntp_auth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#define NS_PER_SEC 1000000000LL
+
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_VERSION 4
+#define NTP_STRATUM_UNSYNCED 16
+#define NTP_LEAP_UNSYNCED 3
+#define NTP_PRECISION -20             /* About a microsecond */
+#define NTP_SERVER_POLL_MS 200        /* Longest the thread goes without checking whether to stop */
+#define NTP_SERVER_MAX_PACKET 1024    /* Longest request taken in full, extension fields and MAC included */
+
+/**
+ * @brief A response remembered for interleaved mode
+ */
+typedef struct {
+    uint32_t rx_sec;              /* Receive timestamp it carried, host byte order */
+    uint32_t rx_frac;
+    in_addr_t addr;               /* Client it went to */
+    int64_t tx_ns;                /* NTP time it actually left */
+} server_slot_t;
+
+struct ntp_server {
+    ntp_server_config_t config;
+    int fd;
+    uint16_t port;
+    uint32_t tx_key;              /* Key the kernel gives the next response's transmit timestamp */
+    server_slot_t *slots;
+    uint32_t mask;
+    pthread_t thread;
+    _Atomic bool stopping;
+    struct {
+        _Atomic uint64_t requests;
+        _Atomic uint64_t responses;
+        _Atomic uint64_t interleaved;
+        _Atomic uint64_t tx_timestamps;
+        _Atomic uint64_t rejected;
+        _Atomic uint64_t authenticated;
+        _Atomic uint64_t auth_failures;
+    } stats;
+};
+
+static int64_t system_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Unix nanoseconds to an NTP timestamp, host byte order
+ */
+static void ns_to_timestamp(int64_t ns, uint32_t *seconds, uint32_t *fraction) {
+    *seconds = (uint32_t)(ns / NS_PER_SEC + NTP_TIMESTAMP_DELTA);
+    *fraction = (uint32_t)(((uint64_t)(ns % NS_PER_SEC) << 32) / NS_PER_SEC);
+}
+
+/**
+ * @brief Nanoseconds to NTP short format (16.16 seconds), saturating
+ */
+static uint32_t ns_to_short(int64_t ns) {
+    if (ns <= 0) {
+        return 0;
+    }
+    uint64_t value = ((uint64_t)ns << 16) / NS_PER_SEC;
+    return value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+static void clock_info(const ntp_server_t *s, ntp_sync_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    if (s->config.clock != NULL) {
+        ntp_client_getSyncInfo(s->config.clock, info);
+    } else {
+        ntp_getSyncInfo(info);
+    }
+}
+
+/**
+ * @brief Fill in the header of a response from the served clock's state
+ */
+static void fill_header(ntp_packet_t *response, const ntp_packet_t *request, const ntp_sync_info_t *info) {
+    uint8_t version = (request->li_vn_mode >> 3) & 0x07;
+    struct in_addr ref;
+
+    if (!info->synced) {
+        response->li_vn_mode = (NTP_LEAP_UNSYNCED << 6) | (version << 3) | NTP_MODE_SERVER;
+        response->stratum = NTP_STRATUM_UNSYNCED;
+        return;
+    }
+    response->li_vn_mode = (version << 3) | NTP_MODE_SERVER;
+    response->stratum = info->stratum + 1 < NTP_STRATUM_UNSYNCED ? info->stratum + 1 : NTP_STRATUM_UNSYNCED - 1;
+    response->poll = request->poll;
+    response->precision = (uint8_t)NTP_PRECISION;
+    response->root_delay = htonl(ns_to_short(info->delay_ns));
+    response->root_dispersion = htonl(ns_to_short(info->error_bound_ns - info->delay_ns / 2));
+
+    /* The reference ID of a secondary server is its server's IPv4 address */
+    if (inet_pton(AF_INET, info->server_name, &ref) == 1) {
+        response->ref_id = ref.s_addr;
+    }
+    uint32_t sec, frac;
+    ns_to_timestamp(info->time_ns - info->sync_age_ns, &sec, &frac);
+    response->ref_timestamp_sec = htonl(sec);
+    response->ref_timestamp_frac = htonl(frac);
+}
+
+/**
+ * @brief The kernel's transmit timestamp of the response just sent
+ *
+ * @return int64_t System time it left, or 0 if the kernel gave none
+ */
+static int64_t transmit_timestamp(ntp_server_t *s, uint32_t key) {
+    int64_t found = 0;
+
+    for (;;) {
+        union {
+            char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) + 64)];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg = { .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return found;
+        }
+
+        int64_t stamp = 0;
+        bool ours = false;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                stamp = (int64_t)ts.ts[0].tv_sec * NS_PER_SEC + ts.ts[0].tv_nsec;
+            } else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) {
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                ours = err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && err.ee_data == key;
+            }
+        }
+        /* Timestamps of earlier responses that came too late are dropped */
+        if (ours && stamp != 0) {
+            found = stamp;
+        }
+    }
+}
+
+/**
+ * @brief Answer one request
+ *
+ * @param packet The request as received
+ * @param received_ns System time it arrived
+ */
+static void serve_request(ntp_server_t *s, const uint8_t *packet, size_t length,
+                          const struct sockaddr_in *from, int64_t received_ns) {
+    ntp_packet_t header;
+    const ntp_packet_t *request = &header;
+
+    atomic_fetch_add_explicit(&s->stats.requests, 1, memory_order_relaxed);
+    memcpy(&header, packet, length < sizeof(header) ? length : sizeof(header));
+    uint8_t mode = request->li_vn_mode & 0x07;
+    uint8_t version = (request->li_vn_mode >> 3) & 0x07;
+    if (length < sizeof(header) || mode != NTP_MODE_CLIENT || version < 1 || version > NTP_VERSION) {
+        atomic_fetch_add_explicit(&s->stats.rejected, 1, memory_order_relaxed);
+        return;
+    }
+
+    /* Anything after the header must be a MAC we can check */
+    uint32_t key_id = 0;
+    if (length > sizeof(header) && !ntp_auth_verify(s->config.keys, packet, length, &key_id, NULL)) {
+        atomic_fetch_add_explicit(&s->stats.auth_failures, 1, memory_order_relaxed);
+        return;
+    }
+
+    ntp_sync_info_t info;
+    clock_info(s, &info);
+    int64_t offset_ns = info.offset_ns;
+
+    ntp_packet_t response;
+    memset(&response, 0, sizeof(response));
+    fill_header(&response, request, &info);
+
+    uint32_t rx_sec, rx_frac;
+    ns_to_timestamp(received_ns + offset_ns, &rx_sec, &rx_frac);
+    response.recv_timestamp_sec = htonl(rx_sec);
+    response.recv_timestamp_frac = htonl(rx_frac);
+
+    /* Interleaved if the origin is the receive timestamp of a response we
+       remember sending this client */
+    uint32_t org_sec = ntohl(request->orig_timestamp_sec);
+    uint32_t org_frac = ntohl(request->orig_timestamp_frac);
+    const server_slot_t *previous = &s->slots[(org_sec ^ org_frac) & s->mask];
+    bool interleaved = (org_sec | org_frac) != 0 &&
+                       (request->recv_timestamp_sec | request->recv_timestamp_frac) != 0 &&
+                       previous->rx_sec == org_sec && previous->rx_frac == org_frac &&
+                       previous->addr == from->sin_addr.s_addr && previous->tx_ns != 0;
+    uint32_t tx_sec, tx_frac;
+    if (interleaved) {
+        response.orig_timestamp_sec = request->recv_timestamp_sec;
+        response.orig_timestamp_frac = request->recv_timestamp_frac;
+        ns_to_timestamp(previous->tx_ns, &tx_sec, &tx_frac);
+    } else {
+        response.orig_timestamp_sec = request->tx_timestamp_sec;
+        response.orig_timestamp_frac = request->tx_timestamp_frac;
+        ns_to_timestamp(system_time_ns() + offset_ns, &tx_sec, &tx_frac);
+    }
+    response.tx_timestamp_sec = htonl(tx_sec);
+    response.tx_timestamp_frac = htonl(tx_frac);
+
+    uint8_t reply[sizeof(response) + NTP_AUTH_MAX_MAC];
+    size_t reply_length = sizeof(response);
+    memcpy(reply, &response, sizeof(response));
+    if (key_id != 0) {
+        reply_length += ntp_auth_sign(s->config.keys, key_id, reply, sizeof(response), reply + sizeof(response));
+    }
+
+    if (sendto(s->fd, reply, reply_length, 0, (const struct sockaddr *)from, sizeof(*from)) < 0) {
+        return;
+    }
+    int64_t sent_ns = system_time_ns();
+    int64_t kernel_ns = transmit_timestamp(s, s->tx_key++);
+    if (kernel_ns != 0) {
+        sent_ns = kernel_ns;
+        atomic_fetch_add_explicit(&s->stats.tx_timestamps, 1, memory_order_relaxed);
+    }
+
+    /* Remember when it really left, for the client's next request */
+    server_slot_t *slot = &s->slots[(rx_sec ^ rx_frac) & s->mask];
+    slot->rx_sec = rx_sec;
+    slot->rx_frac = rx_frac;
+    slot->addr = from->sin_addr.s_addr;
+    slot->tx_ns = sent_ns + offset_ns;
+
+    atomic_fetch_add_explicit(&s->stats.responses, 1, memory_order_relaxed);
+    if (interleaved) {
+        atomic_fetch_add_explicit(&s->stats.interleaved, 1, memory_order_relaxed);
+    }
+    if (key_id != 0) {
+        atomic_fetch_add_explicit(&s->stats.authenticated, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Receive one request with the kernel's receive timestamp
+ *
+ * @return ssize_t As recvfrom
+ */
+static ssize_t receive_request(ntp_server_t *s, uint8_t *request, struct sockaddr_in *from,
+                               int64_t *received_ns) {
+    struct iovec iov = { request, NTP_SERVER_MAX_PACKET };
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_name = from,
+        .msg_namelen = sizeof(*from),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+
+    ssize_t n = recvmsg(s->fd, &msg, MSG_DONTWAIT);
+    *received_ns = system_time_ns();
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n >= 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            *received_ns = (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+        }
+    }
+    return n;
+}
+
+static void *server_thread(void *arg) {
+    ntp_server_t *s = arg;
+    uint8_t request[NTP_SERVER_MAX_PACKET];
+    struct sockaddr_in from;
+    int64_t received_ns;
+
+    while (!atomic_load(&s->stopping)) {
+        struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+        if (poll(&pfd, 1, NTP_SERVER_POLL_MS) <= 0 || atomic_load(&s->stopping)) {
+            continue;
+        }
+        /* Transmit timestamps that came after their response was remembered */
+        if (pfd.revents & POLLERR) {
+            transmit_timestamp(s, UINT32_MAX);
+        }
+
+        ssize_t n;
+        while (!atomic_load(&s->stopping) && (n = receive_request(s, request, &from, &received_ns)) >= 0) {
+            serve_request(s, request, (size_t)n, &from, received_ns);
+        }
+    }
+
+    return NULL;
+}
+
+ntp_server_t *ntp_server_start(const ntp_server_config_t *config) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int on = 1;
+
+    if (config == NULL) {
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (config->bind_addr[0] != '\0' && inet_pton(AF_INET, config->bind_addr, &addr.sin_addr) != 1) {
+        return NULL;
+    }
+
+    ntp_server_t *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->config = *config;
+    s->config.bind_addr[sizeof(s->config.bind_addr) - 1] = '\0';
+
+    uint32_t slots = 64;
+    while (slots < (config->slots ? config->slots : NTP_SERVER_SLOTS) && slots < (1u << 24)) {
+        slots *= 2;
+    }
+    s->mask = slots - 1;
+    s->slots = calloc(slots, sizeof(*s->slots));
+
+    s->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s->slots == NULL || s->fd < 0) {
+        goto fail;
+    }
+    if (bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(s->fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        goto fail;
+    }
+    s->port = ntohs(addr.sin_port);
+
+    /* Kernel timestamps for requests as they arrive and, where the kernel
+       has them, responses as they leave; without those, the time sendto
+       returns stands in */
+    setsockopt(s->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    setsockopt(s->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+    atomic_init(&s->stopping, false);
+    if (pthread_create(&s->thread, NULL, server_thread, s) != 0) {
+        goto fail;
+    }
+    return s;
+
+fail:
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    free(s->slots);
+    free(s);
+    return NULL;
+}
+
+void ntp_server_stop(ntp_server_t *s) {
+    if (s == NULL) {
+        return;
+    }
+
+    /* Shutting the socket down wakes the thread's poll */
+    atomic_store(&s->stopping, true);
+    shutdown(s->fd, SHUT_RD);
+    pthread_join(s->thread, NULL);
+
+    close(s->fd);
+    free(s->slots);
+    free(s);
+}
+
+uint16_t ntp_server_getPort(const ntp_server_t *s) {
+    return s != NULL ? s->port : 0;
+}
+
+void ntp_server_getStats(const ntp_server_t *s, ntp_server_stats_t *stats) {
+    if (s == NULL || stats == NULL) {
+        return;
+    }
+    stats->requests = atomic_load(&s->stats.requests);
+    stats->responses = atomic_load(&s->stats.responses);
+    stats->interleaved = atomic_load(&s->stats.interleaved);
+    stats->tx_timestamps = atomic_load(&s->stats.tx_timestamps);
+    stats->rejected = atomic_load(&s->stats.rejected);
+    stats->authenticated = atomic_load(&s->stats.authenticated);
+    stats->auth_failures = atomic_load(&s->stats.auth_failures);
+}
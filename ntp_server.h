@@ -0,0 +1,94 @@
+#ifndef NTP_SERVER_H
+#define NTP_SERVER_H
+
+#include <stdint.h>
+#include "ntp_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NTP server mode.
+ *
+ * Serves a client instance's NTP-corrected time to other hosts, at one
+ * stratum below the server it syncs with. Until the instance has synced,
+ * responses say the clock is unsynchronized (leap 3, stratum 16).
+ *
+ * Requests are timestamped by the kernel as they arrive, and responses as
+ * they leave where the kernel gives software transmit timestamps (else the
+ * time sendto returns). A basic-mode response can only carry a transmit
+ * timestamp taken before it is sent, which biases the client's offset by
+ * half the time it takes to send. A client in interleaved mode
+ * (draft-ietf-ntp-interleaved-modes) gets the time its previous response
+ * really left instead. The server remembers the receive timestamp and the
+ * actual transmit time of its last responses; a request whose origin
+ * timestamp is one of those receive timestamps, from the same address, is
+ * answered in interleaved mode: origin set to the request's receive
+ * timestamp, transmit set to that earlier response's transmit time.
+ * ntp_client_sync() asks for interleaved mode whenever its last exchange
+ * with the server is recent.
+ *
+ * A request that ends in a MAC is answered only if the MAC is valid with
+ * one of the server's keys, and the response is signed with the same key
+ * (see ntp_auth.h).
+ * The response is signed after its transmit timestamp is taken, so the
+ * MAC adds to the time it takes to send; interleaved mode takes that out
+ * too. Requests without a MAC are answered unauthenticated.
+ *
+ * One thread answers every request.
+ */
+
+#define NTP_SERVER_SLOTS 4096         /* Responses remembered for interleaved mode by default */
+
+/**
+ * @brief Where to serve, and whose time
+ */
+typedef struct {
+    char bind_addr[64];           /* Address to listen on, "" for any */
+    uint16_t port;                /* Port to listen on, typically 123; 0 for any free one */
+    ntp_client_t *clock;          /* Instance whose time is served; NULL for the default one */
+    uint32_t slots;               /* Responses remembered, rounded up to a power of two; 0 for the default */
+    const ntp_keyring_t *keys;    /* Keys requests may be signed with; NULL for none. Must outlive the server */
+} ntp_server_config_t;
+
+/**
+ * @brief What the server has done since it started
+ */
+typedef struct {
+    uint64_t requests;            /* Packets received */
+    uint64_t responses;           /* Responses sent */
+    uint64_t interleaved;         /* Responses in interleaved mode */
+    uint64_t tx_timestamps;       /* Responses the kernel timestamped as they left */
+    uint64_t rejected;            /* Packets that weren't client requests */
+    uint64_t authenticated;       /* Responses signed */
+    uint64_t auth_failures;       /* Requests dropped for a MAC that isn't valid with our keys */
+} ntp_server_stats_t;
+
+typedef struct ntp_server ntp_server_t;
+
+/**
+ * @brief Start serving on a thread of its own
+ *
+ * @return ntp_server_t* The server, or NULL if the address can't be bound
+ *         or memory or the thread can't be had
+ */
+ntp_server_t *ntp_server_start(const ntp_server_config_t *config);
+
+/**
+ * @brief Stop serving, waiting for the thread to exit, and free the server
+ */
+void ntp_server_stop(ntp_server_t *s);
+
+/**
+ * @brief Port the server listens on, for one started on port 0
+ */
+uint16_t ntp_server_getPort(const ntp_server_t *s);
+
+void ntp_server_getStats(const ntp_server_t *s, ntp_server_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_SERVER_H */
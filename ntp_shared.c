@@ -0,0 +1,194 @@
+#include "ntp_shared.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHARED_MAGIC "NTPSHM"
+#define SHARED_VERSION 1
+#define SHARED_DEFAULT_DIR "/dev/shm"    /* When XDG_RUNTIME_DIR isn't set */
+#define SHARED_FALLBACK_DIR "/tmp"
+#define SHARED_MODE 0600
+#define SHARED_READ_SPINS 1000        /* Give up on a read after this many torn attempts */
+
+/* Layout of the state file */
+struct ntp_shared_page {
+    char magic[8];                /* SHARED_MAGIC once something has been published */
+    uint32_t version;             /* SHARED_VERSION */
+    _Atomic uint32_t seq;         /* Odd while the leader is writing */
+    char key[264];                /* Server the page belongs to */
+    ntp_shared_sync_t sync;       /* Latest attempt */
+};
+
+/**
+ * @brief FNV-1a hash of the server key, used to name its state file
+ */
+static uint32_t key_hash(const char *key) {
+    uint32_t h = 2166136261u;
+    for (; *key; key++) {
+        h = (h ^ (uint8_t)*key) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Open our user's state file, creating it if needed
+ *
+ * Only a regular file owned by us and writable by nobody else will do:
+ * anyone who can write the page can set our offset, and anyone who can
+ * truncate it or hold its lock can stop our syncs.
+ */
+static int open_state_file(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, SHARED_MODE);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & 0777) != SHARED_MODE) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    return fd;
+}
+
+bool ntp_shared_open(ntp_shared_t *s, const char *dir, const char *key) {
+    char path[512];
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    if (strlen(key) >= sizeof(s->key)) {
+        return false;
+    }
+    strcpy(s->key, key);
+
+    if (dir == NULL) {
+        dir = getenv("XDG_RUNTIME_DIR");
+    }
+    if (dir == NULL || dir[0] == '\0') {
+        dir = access(SHARED_DEFAULT_DIR, W_OK) == 0 ? SHARED_DEFAULT_DIR : SHARED_FALLBACK_DIR;
+    }
+    /* The user ID in the name keeps other users' pages out of the way */
+    snprintf(path, sizeof(path), "%s/ntp-clock-%u-%08x.state", dir, (unsigned)geteuid(), key_hash(key));
+
+    int fd = open_state_file(path);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Whoever gets here first sizes the file; doing it twice is harmless */
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (st.st_size < (off_t)sizeof(struct ntp_shared_page) &&
+         ftruncate(fd, sizeof(struct ntp_shared_page)) != 0)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sizeof(struct ntp_shared_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    s->fd = fd;
+    s->page = map;
+    return true;
+}
+
+void ntp_shared_close(ntp_shared_t *s) {
+    if (s->fd < 0) {
+        return;
+    }
+    munmap(s->page, sizeof(struct ntp_shared_page));
+    close(s->fd);                 /* Releases the flock */
+    s->fd = -1;
+    s->page = NULL;
+    s->leader = false;
+}
+
+bool ntp_shared_try_lead(ntp_shared_t *s) {
+    if (s->fd < 0) {
+        return false;
+    }
+    if (!s->leader && flock(s->fd, LOCK_EX | LOCK_NB) == 0) {
+        s->leader = true;
+
+        /* A leader that died halfway through publishing left the sequence
+           number odd; step past its half-written update */
+        uint32_t seq = atomic_load_explicit(&s->page->seq, memory_order_relaxed);
+        if (seq & 1) {
+            atomic_store_explicit(&s->page->seq, seq + 1, memory_order_release);
+        }
+    }
+    return s->leader;
+}
+
+void ntp_shared_publish(ntp_shared_t *s, const ntp_shared_sync_t *sync) {
+    struct ntp_shared_page *page = s->page;
+
+    if (!s->leader) {
+        return;
+    }
+
+    uint32_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+    atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(page->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+    page->version = SHARED_VERSION;
+    memcpy(page->key, s->key, sizeof(page->key));
+    page->sync = *sync;
+
+    atomic_store_explicit(&page->seq, seq + 2, memory_order_release);
+    s->seen_seq = seq + 2;
+}
+
+bool ntp_shared_read(ntp_shared_t *s, ntp_shared_sync_t *sync) {
+    struct ntp_shared_page *page = s->page;
+    char key[sizeof(page->key)];
+    char magic[sizeof(page->magic)];
+    uint32_t version;
+
+    if (s->fd < 0) {
+        return false;
+    }
+
+    for (int spins = 0; spins < SHARED_READ_SPINS; spins++) {
+        uint32_t before = atomic_load_explicit(&page->seq, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();        /* The leader is writing; let it finish */
+            continue;
+        }
+
+        memcpy(magic, page->magic, sizeof(magic));
+        version = page->version;
+        memcpy(key, page->key, sizeof(key));
+        *sync = page->sync;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&page->seq, memory_order_relaxed) != before) {
+            continue;             /* Torn by a concurrent update */
+        }
+
+        s->seen_seq = before;
+        return memcmp(magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) == 0 &&
+               version == SHARED_VERSION &&
+               strncmp(key, s->key, sizeof(key)) == 0;
+    }
+    return false;
+}
+
+bool ntp_shared_changed(const ntp_shared_t *s) {
+    return s->fd >= 0 &&
+           atomic_load_explicit(&s->page->seq, memory_order_relaxed) != s->seen_seq;
+}
@@ -0,0 +1,98 @@
+#ifndef NTP_SHARED_H
+#define NTP_SHARED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Sync results shared between one user's ntp-clock instances on a host.
+ *
+ * Every instance syncing with the same server maps the same state page,
+ * which only its user can open; a page anyone else owns or can write is
+ * refused, so other users can neither feed us an offset nor stall our
+ * syncs. The instance holding an exclusive flock on it is the leader: it
+ * alone talks to the server and publishes each result to the page under a
+ * seqlock.
+ * Everyone else reads the page without taking any lock. The kernel drops
+ * the flock when the leader exits or dies, and the next instance that wants
+ * to sync takes over.
+ */
+
+/**
+ * @brief One published sync attempt
+ */
+typedef struct {
+    int32_t status;               /* ntp_status_t of the leader's last attempt */
+    int32_t leader_pid;           /* Process that published it */
+    uint64_t attempts;            /* Sync attempts published so far */
+    uint64_t sync_count;          /* Successful syncs so far */
+    int64_t offset_ns;            /* NTP time minus system time */
+    int64_t delay_ns;             /* Round-trip delay of the last successful exchange */
+    int64_t root_distance_ns;     /* Error bound at the moment of the last successful sync */
+    int64_t last_sync_ns;         /* System time of the last successful sync */
+    uint8_t stratum;              /* Server stratum at the last successful sync */
+} ntp_shared_sync_t;
+
+struct ntp_shared_page;
+
+/**
+ * @brief A process's handle on a shared state page
+ */
+typedef struct {
+    int fd;                       /* State file, or -1 when closed */
+    bool leader;                  /* This process holds the leader lock */
+    struct ntp_shared_page *page; /* Shared mapping of the state file */
+    uint32_t seen_seq;            /* Sequence number of the last successful read */
+    char key[264];                /* Server the page belongs to ("host:port") */
+} ntp_shared_t;
+
+/**
+ * @brief Map the state page for a server, creating it if needed
+ *
+ * @param s Handle to initialize
+ * @param dir Directory holding the state files, or NULL for
+ *            $XDG_RUNTIME_DIR (/dev/shm without it)
+ * @param key Identifies the server, e.g. "pool.ntp.org:123"
+ * @return bool true on success
+ */
+bool ntp_shared_open(ntp_shared_t *s, const char *dir, const char *key);
+
+/**
+ * @brief Unmap the page, giving up the leader lock if held
+ */
+void ntp_shared_close(ntp_shared_t *s);
+
+/**
+ * @brief Become the leader if no live process is
+ *
+ * @return bool true if this process is (now) the leader
+ */
+bool ntp_shared_try_lead(ntp_shared_t *s);
+
+/**
+ * @brief Publish a sync attempt; only the leader may call this
+ */
+void ntp_shared_publish(ntp_shared_t *s, const ntp_shared_sync_t *sync);
+
+/**
+ * @brief Read the latest published attempt without locking
+ *
+ * @return bool false if nothing has been published yet
+ */
+bool ntp_shared_read(ntp_shared_t *s, ntp_shared_sync_t *sync);
+
+/**
+ * @brief Whether something new was published since the last ntp_shared_read
+ */
+bool ntp_shared_changed(const ntp_shared_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_SHARED_H */
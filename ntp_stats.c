@@ -0,0 +1,202 @@
+#include "ntp_stats.h"
+#include "ntp_logring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#define NS_PER_SEC 1000000000LL
+#define SECONDS_PER_DAY 86400
+#define MJD_UNIX_EPOCH 40587          /* Modified Julian Day of 1970-01-01 */
+
+/**
+ * @brief The writer's side of the statistics files
+ */
+typedef struct {
+    ntp_stats_config_t config;
+    FILE *peerstats;              /* Files of the current day; NULL if they can't be opened */
+    FILE *loopstats;
+    int64_t day;                  /* Unix day the files are for, -1 before the first */
+} stats_writer_t;
+
+static ntp_logring_site_t writer = NTP_LOGRING_SITE_INIT;
+
+static struct {
+    _Atomic uint64_t written;
+    _Atomic uint64_t files;
+    _Atomic uint64_t write_errors;
+} counters;
+
+/**
+ * @brief Open name.YYYYMMDD for appending and point the name at it
+ */
+static FILE *open_day_file(const char *dir, const char *name, int64_t day) {
+    char file[32], path[sizeof(((ntp_stats_config_t *)0)->dir) + 48], link[sizeof(path)];
+    time_t t = (time_t)(day * SECONDS_PER_DAY);
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    snprintf(file, sizeof(file), "%s.%04d%02d%02d", name, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    FILE *f = fopen(path, "a");
+    if (f == NULL) {
+        atomic_fetch_add(&counters.write_errors, 1);
+        return NULL;
+    }
+    atomic_fetch_add(&counters.files, 1);
+
+    /* Replace the link in one step, so it always points at a file */
+    snprintf(link, sizeof(link), "%s/.%s.link", dir, name);
+    unlink(link);
+    if (symlink(file, link) == 0) {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        rename(link, path);
+    }
+    return f;
+}
+
+static void close_day_files(stats_writer_t *w) {
+    if (w->peerstats != NULL) {
+        fclose(w->peerstats);
+    }
+    if (w->loopstats != NULL) {
+        fclose(w->loopstats);
+    }
+    w->peerstats = w->loopstats = NULL;
+}
+
+/**
+ * @brief Append one record to both files of its day
+ */
+static void write_record(stats_writer_t *w, const ntp_stats_record_t *r) {
+    int64_t seconds = r->time_ns / NS_PER_SEC;
+    int64_t day = seconds / SECONDS_PER_DAY;
+    double of_day = (double)(r->time_ns - day * SECONDS_PER_DAY * NS_PER_SEC) / NS_PER_SEC;
+
+    if (day != w->day) {
+        close_day_files(w);
+        w->peerstats = open_day_file(w->config.dir, "peerstats", day);
+        w->loopstats = open_day_file(w->config.dir, "loopstats", day);
+        w->day = day;
+    }
+    if (w->peerstats == NULL || w->loopstats == NULL) {
+        atomic_fetch_add(&counters.write_errors, 1);
+        return;
+    }
+
+    long long mjd = (long long)(day + MJD_UNIX_EPOCH);
+    int p = fprintf(w->peerstats, "%lld %.3f %s %04x %.9f %.9f %.9f %.9f\n", mjd, of_day, r->peer, r->status,
+                    r->offset_ns / 1e9, r->delay_ns / 1e9, r->dispersion_ns / 1e9, r->jitter_ns / 1e9);
+    int l = fprintf(w->loopstats, "%lld %.3f %.9f %.3f %.9f %.6f %d\n", mjd, of_day, r->offset_ns / 1e9,
+                    r->frequency_ppm, r->jitter_ns / 1e9, r->wander_ppm, r->poll);
+    if (p < 0 || l < 0) {
+        atomic_fetch_add(&counters.write_errors, 1);
+    } else {
+        atomic_fetch_add(&counters.written, 1);
+    }
+}
+
+/**
+ * @brief Write out everything in the ring; writer thread only
+ */
+static void drain_ring(ntp_logring_t *ring, void *context) {
+    stats_writer_t *w = context;
+    const ntp_stats_record_t *record;
+    uint64_t count = 0;
+
+    /* Files that couldn't be opened are tried again on each drain rather
+       than only once the day changes */
+    if (w->peerstats == NULL || w->loopstats == NULL) {
+        w->day = -1;
+    }
+    while ((record = ntp_logring_peek(ring)) != NULL) {
+        write_record(w, record);
+        ntp_logring_pop(ring);
+        count++;
+    }
+
+    /* One write per file per drain */
+    if (count > 0 &&
+        ((w->peerstats != NULL && fflush(w->peerstats) != 0) ||
+         (w->loopstats != NULL && fflush(w->loopstats) != 0))) {
+        atomic_fetch_add(&counters.write_errors, 1);
+    }
+}
+
+static bool open_writer(void *context) {
+    (void)context;
+    atomic_store(&counters.written, 0);
+    atomic_store(&counters.files, 0);
+    atomic_store(&counters.write_errors, 0);
+    return true;
+}
+
+static void free_writer(void *context) {
+    stats_writer_t *w = context;
+
+    close_day_files(w);
+    free(w);
+}
+
+bool ntp_stats_start(const ntp_stats_config_t *config) {
+    struct stat st;
+
+    if (config == NULL || stat(config->dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+
+    stats_writer_t *w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return false;
+    }
+    w->config = *config;
+    w->config.dir[sizeof(w->config.dir) - 1] = '\0';
+    w->day = -1;
+
+    ntp_logring_config_t ring = {
+        .record_size = sizeof(ntp_stats_record_t),
+        .records = config->ring_records ? config->ring_records : NTP_STATS_RING_RECORDS,
+        .flush_ms = NTP_STATS_FLUSH_MS,
+        .context = w,
+        .open = open_writer,
+        .flush = drain_ring,
+        .close = free_writer
+    };
+    return ntp_logring_start(&writer, &ring);
+}
+
+void ntp_stats_stop(void) {
+    ntp_logring_stop(&writer);
+}
+
+bool ntp_stats_active(void) {
+    return ntp_logring_active(&writer);
+}
+
+void ntp_stats_log(const ntp_stats_record_t *record) {
+    if (record == NULL) {
+        return;
+    }
+    ntp_stats_record_t *slot = ntp_logring_claim(&writer);
+    if (slot == NULL) {
+        return;
+    }
+    *slot = *record;
+    slot->peer[sizeof(slot->peer) - 1] = '\0';
+    ntp_logring_commit(&writer, slot);
+}
+
+void ntp_stats_getCounters(ntp_stats_counters_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    c->logged = atomic_load(&writer.logged);
+    c->dropped = atomic_load(&writer.dropped);
+    c->written = atomic_load(&counters.written);
+    c->files = atomic_load(&counters.files);
+    c->write_errors = atomic_load(&counters.write_errors);
+}
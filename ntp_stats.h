@@ -0,0 +1,101 @@
+#ifndef NTP_STATS_H
+#define NTP_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ntpd-style statistics files.
+ *
+ * Once ntp_stats_start() has been called, every sync of every client
+ * instance adds a line to peerstats and one to loopstats in the statistics
+ * directory, in the formats ntpd writes, so tools that read ntpd's files
+ * read these too:
+ *
+ *   peerstats: MJD seconds address status offset delay dispersion jitter
+ *   loopstats: MJD seconds offset frequency jitter wander poll
+ *
+ * Times are in seconds, frequency and wander in parts per million. The
+ * files are peerstats.YYYYMMDD and loopstats.YYYYMMDD, one per UTC day by
+ * the time of the sync, with peerstats and loopstats linked to the newest.
+ *
+ * A sync only pushes its record onto a lock-free ring. A background thread
+ * formats and appends the records every NTP_STATS_FLUSH_MS. If the ring is
+ * full, the record is dropped and counted rather than waited for.
+ */
+
+#define NTP_STATS_FLUSH_MS 1000           /* How often the writer drains the ring */
+#define NTP_STATS_RING_RECORDS 1024       /* Default ring size */
+
+/**
+ * @brief Where to write
+ */
+typedef struct {
+    char dir[256];                /* Statistics directory; must exist */
+    uint32_t ring_records;        /* Ring capacity, rounded up to a power of two; 0 for the default */
+} ntp_stats_config_t;
+
+/**
+ * @brief One sync, as both files log it
+ */
+typedef struct {
+    int64_t time_ns;              /* When, Unix nanoseconds (NTP time) */
+    char peer[48];                /* Server address */
+    uint16_t status;              /* ntpd peer status word */
+    int64_t offset_ns;
+    int64_t delay_ns;
+    int64_t dispersion_ns;
+    int64_t jitter_ns;            /* RMS of the differences between successive offsets */
+    double frequency_ppm;         /* Rate the offset changes at */
+    double wander_ppm;            /* RMS of the changes in frequency */
+    int8_t poll;                  /* log2 of the sync interval in seconds */
+} ntp_stats_record_t;
+
+/**
+ * @brief What the writer has done since it started
+ */
+typedef struct {
+    uint64_t logged;              /* Records put in the ring */
+    uint64_t dropped;             /* Records not logged because the ring was full */
+    uint64_t written;             /* Records appended to both files */
+    uint64_t files;               /* Daily files opened */
+    uint64_t write_errors;        /* Failed opens and writes; their records are lost */
+} ntp_stats_counters_t;
+
+/**
+ * @brief Start logging syncs, process-wide
+ *
+ * @return bool false if the directory isn't there, memory or the thread
+ *         can't be had, or the writer is already running
+ */
+bool ntp_stats_start(const ntp_stats_config_t *config);
+
+/**
+ * @brief Stop logging; everything logged so far is written out first
+ */
+void ntp_stats_stop(void);
+
+/**
+ * @brief Whether the writer is running; one relaxed atomic load
+ */
+bool ntp_stats_active(void);
+
+/**
+ * @brief Log one sync, if the writer is running; never blocks
+ */
+void ntp_stats_log(const ntp_stats_record_t *record);
+
+/**
+ * @brief Counts for the running or last writer
+ */
+void ntp_stats_getCounters(ntp_stats_counters_t *counters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NTP_STATS_H */
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "output_queue.h"
+
+// Extra room left when picking a frame rate for a congested link
+#define OQ_HEADROOM 1.25
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Pick the frame interval the link can sustain
+ */
+static void update_interval(output_queue_t *q)
+{
+    if (q->bytes_per_sec <= 0) {
+        q->interval_ms = OQ_MIN_INTERVAL_MS;
+        return;
+    }
+
+    double needed_ms = q->frame_bytes * OQ_HEADROOM * 1000.0 / q->bytes_per_sec;
+
+    // Round up to whole tenths so updates stay aligned with the display
+    int interval = ((int)needed_ms / OQ_MIN_INTERVAL_MS + 1) * OQ_MIN_INTERVAL_MS;
+    if (interval < OQ_MIN_INTERVAL_MS) interval = OQ_MIN_INTERVAL_MS;
+    if (interval > OQ_MAX_INTERVAL_MS) interval = OQ_MAX_INTERVAL_MS;
+    q->interval_ms = interval;
+}
+
+/**
+ * Account for a frame that has been completely written
+ */
+static void frame_done(output_queue_t *q)
+{
+    uint64_t latency = monotonic_ns() - q->submitted_ns;
+    if (latency > q->max_latency_ns) q->max_latency_ns = latency;
+    q->frames_sent++;
+
+    if (q->congested && latency > 0) {
+        double rate = q->pending.len * 1e9 / latency;
+        q->bytes_per_sec = q->bytes_per_sec > 0 ? 0.7 * q->bytes_per_sec + 0.3 * rate : rate;
+    } else if (q->bytes_per_sec > 0) {
+        // The link kept up - probe for more throughput
+        q->bytes_per_sec *= OQ_HEADROOM;
+        if (q->frame_bytes * OQ_HEADROOM * 1000.0 / q->bytes_per_sec < OQ_MIN_INTERVAL_MS) {
+            q->bytes_per_sec = 0;
+        }
+    }
+    update_interval(q);
+
+    rb_reset(&q->pending);
+    q->offset = 0;
+    q->congested = false;
+}
+
+/**
+ * Put the output descriptor into non-blocking mode
+ */
+bool oq_init(output_queue_t *q, int fd)
+{
+    memset(q, 0, sizeof(*q));
+    q->fd = fd;
+    q->wake_fd = -1;
+    q->interval_ms = OQ_MIN_INTERVAL_MS;
+
+    q->saved_flags = fcntl(fd, F_GETFL);
+    if (q->saved_flags < 0) return false;
+    return fcntl(fd, F_SETFL, q->saved_flags | O_NONBLOCK) == 0;
+}
+
+/**
+ * Restore the descriptor's original flags and release the queue
+ */
+void oq_close(output_queue_t *q)
+{
+    if (q->fd < 0) return;
+    fcntl(q->fd, F_SETFL, q->saved_flags);
+    free(q->pending.data);
+    memset(&q->pending, 0, sizeof(q->pending));
+    q->fd = -1;
+}
+
+/**
+ * Temporarily switch the descriptor back to blocking mode, e.g. while
+ * printing with stdio
+ */
+void oq_set_blocking(output_queue_t *q, bool blocking)
+{
+    if (q->fd < 0) return;
+    fcntl(q->fd, F_SETFL, blocking ? (q->saved_flags & ~O_NONBLOCK) : (q->saved_flags | O_NONBLOCK));
+}
+
+/**
+ * Write as much of the pending frame as the link accepts without blocking
+ *
+ * @return true once nothing is left to write
+ */
+bool oq_drain(output_queue_t *q)
+{
+    while (q->offset < q->pending.len) {
+        ssize_t n = write(q->fd, q->pending.data + q->offset, q->pending.len - q->offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                q->congested = true;
+                return false;
+            }
+            // The terminal went away - there is nobody left to show the frame to
+            rb_reset(&q->pending);
+            q->offset = 0;
+            q->congested = false;
+            return true;
+        }
+        q->offset += n;
+        q->bytes_written += n;
+    }
+
+    if (q->pending.len > 0) frame_done(q);
+    return true;
+}
+
+/**
+ * Check whether a new frame can be queued; if not, the caller should skip
+ * rendering this tick
+ */
+bool oq_ready(output_queue_t *q)
+{
+    if (oq_drain(q)) return true;
+    q->frames_skipped++;
+    return false;
+}
+
+/**
+ * Queue a rendered frame and start writing it
+ *
+ * The frame buffer is swapped with the queue's spare buffer, so no bytes are
+ * copied; the caller gets back an empty buffer to render the next frame into.
+ */
+void oq_submit(output_queue_t *q, render_buffer_t *frame)
+{
+    if (frame->len == 0) return;
+
+    render_buffer_t spare = q->pending;
+    q->pending = *frame;
+    *frame = spare;
+    rb_reset(frame);
+
+    q->offset = 0;
+    q->congested = false;
+    q->submitted_ns = monotonic_ns();
+    q->frame_bytes = q->frame_bytes > 0 ? 0.8 * q->frame_bytes + 0.2 * q->pending.len
+                                        : q->pending.len;
+    oq_drain(q);
+}
+
+/**
+ * Wait until the pending frame has been completely written
+ */
+void oq_flush(output_queue_t *q)
+{
+    while (!oq_drain(q)) {
+        struct pollfd pfd = { q->fd, POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+    }
+}
+
+/**
+ * Sleep for up to timeout_ms, writing more of the pending frame whenever the
+ * link can take it. Returns early, with q->woken set, if wake_fd becomes
+ * readable.
+ *
+ * @return Milliseconds actually waited
+ */
+int oq_wait(output_queue_t *q, int timeout_ms)
+{
+    uint64_t start = monotonic_ns();
+    struct pollfd pfd[2];
+    nfds_t count = 0;
+    bool draining = q->offset < q->pending.len;
+
+    if (q->wake_fd >= 0) {
+        pfd[count++] = (struct pollfd){ q->wake_fd, POLLIN, 0 };
+    }
+    if (draining) {
+        pfd[count++] = (struct pollfd){ q->fd, POLLOUT, 0 };
+    }
+
+    if (poll(count > 0 ? pfd : NULL, count, timeout_ms) > 0) {
+        if (q->wake_fd >= 0 && (pfd[0].revents & (POLLIN | POLLHUP))) q->woken = true;
+        if (draining && pfd[count - 1].revents) oq_drain(q);
+    }
+    return (int)((monotonic_ns() - start) / 1000000);
+}
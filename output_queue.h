@@ -0,0 +1,54 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "clock_render.h"
+
+/**
+ * Non-blocking frame output for slow links (SSH, serial consoles).
+ *
+ * At most one frame is ever queued. While it is still draining the caller
+ * skips rendering, so by the time the link catches up the next frame is
+ * built from the current time and stale intermediate frames are never
+ * produced at all. The frame rate adapts to the throughput observed while
+ * the link was congested.
+ */
+
+#define OQ_MIN_INTERVAL_MS 100      // Fastest frame rate (one frame per tenth)
+#define OQ_MAX_INTERVAL_MS 1000     // Slowest frame rate (one frame per second)
+
+typedef struct {
+    int fd;                     // Output file descriptor
+    int saved_flags;            // fcntl flags to restore on shutdown
+    render_buffer_t pending;    // Frame currently being drained
+    size_t offset;              // Bytes of the pending frame already written
+    bool congested;             // The pending frame hit EAGAIN at least once
+    uint64_t submitted_ns;      // When the pending frame was queued
+
+    double bytes_per_sec;       // Throughput seen on congested frames (0 = unconstrained)
+    double frame_bytes;         // Average frame size
+    int interval_ms;            // Current frame interval
+
+    int wake_fd;                // Input that ends a wait early, or -1
+    bool woken;                 // wake_fd became readable during a wait
+
+    // Statistics
+    uint64_t frames_sent;       // Frames fully written
+    uint64_t frames_skipped;    // Ticks skipped because the link was busy
+    uint64_t bytes_written;     // Total bytes written
+    uint64_t max_latency_ns;    // Longest time from queueing to fully written
+} output_queue_t;
+
+bool oq_init(output_queue_t *q, int fd);
+void oq_close(output_queue_t *q);
+void oq_set_blocking(output_queue_t *q, bool blocking);
+
+bool oq_drain(output_queue_t *q);
+bool oq_ready(output_queue_t *q);
+void oq_submit(output_queue_t *q, render_buffer_t *frame);
+void oq_flush(output_queue_t *q);
+int oq_wait(output_queue_t *q, int timeout_ms);
+
+#endif /* OUTPUT_QUEUE_H */
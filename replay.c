@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "ntp_capture.h"
+#include "ntp_client.h"
+
+/**
+ * ntp-replay - replay NTP exchanges from packet captures through the client.
+ *
+ * Every request/response pair in the captures goes through the checks a
+ * live sync applies (ntp_parseResponse) and into a client instance for its
+ * server (ntp_client_applySample), with the capture times standing in for
+ * the system times of sending and receiving. So a capture taken on the
+ * client host replays the offsets and delays the client saw.
+ *
+ * Usage: ntp-replay [--samples] [--port=N] capture...
+ */
+
+#define READ_BATCH 1024
+#define MATCHER_PENDING 65536
+
+typedef struct {
+    uint8_t family;
+    uint8_t addr[16];
+    uint16_t port;
+    char name[INET6_ADDRSTRLEN];
+    ntp_client_t *client;
+    uint64_t exchanges;
+    uint64_t rejected;            /* Responses the client's checks refuse */
+    int64_t offset_min_ns;
+    int64_t offset_max_ns;
+    double offset_sum_ns;
+    double delay_sum_ns;
+} replay_server_t;
+
+/* Servers, in an open-addressed table */
+static replay_server_t *servers;
+static size_t server_slots;
+static size_t server_count;
+
+static bool print_samples = false;
+static uint16_t ntp_port = 123;
+
+static size_t server_hash(uint8_t family, const uint8_t *addr, uint16_t port)
+{
+    uint64_t a, b;
+    memcpy(&a, addr, sizeof(a));
+    memcpy(&b, addr + 8, sizeof(b));
+    uint64_t h = (a ^ (b << 1) ^ ((uint64_t)port << 48) ^ family) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static replay_server_t *find_slot(replay_server_t *table, size_t slots, uint8_t family,
+                                  const uint8_t *addr, uint16_t port)
+{
+    size_t i = server_hash(family, addr, port) & (slots - 1);
+    while (table[i].client != NULL &&
+           (table[i].family != family || table[i].port != port || memcmp(table[i].addr, addr, 16) != 0))
+    {
+        i = (i + 1) & (slots - 1);
+    }
+    return &table[i];
+}
+
+static bool grow_servers(void)
+{
+    size_t slots = server_slots ? server_slots * 2 : 64;
+    replay_server_t *table = calloc(slots, sizeof(*table));
+    if (table == NULL) return false;
+
+    for (size_t i = 0; i < server_slots; i++)
+    {
+        if (servers[i].client != NULL)
+        {
+            *find_slot(table, slots, servers[i].family, servers[i].addr, servers[i].port) = servers[i];
+        }
+    }
+    free(servers);
+    servers = table;
+    server_slots = slots;
+    return true;
+}
+
+// The server a request went to, with a client instance of its own
+static replay_server_t *find_server(const ntp_capture_packet_t *request)
+{
+    if (server_count * 2 >= server_slots && !grow_servers()) return NULL;
+
+    replay_server_t *s = find_slot(servers, server_slots, request->family, request->dst, request->dst_port);
+    if (s->client != NULL) return s;
+
+    memset(s, 0, sizeof(*s));
+    s->family = request->family;
+    memcpy(s->addr, request->dst, sizeof(s->addr));
+    s->port = request->dst_port;
+    inet_ntop(s->family == 4 ? AF_INET : AF_INET6, s->addr, s->name, sizeof(s->name));
+    s->offset_min_ns = INT64_MAX;
+    s->offset_max_ns = INT64_MIN;
+
+    ntp_config_t config;
+    memset(&config, 0, sizeof(config));
+    snprintf(config.server_name, sizeof(config.server_name), "%s", s->name);
+    config.server_port = s->port;
+    config.timeout_ms = 1000;
+    config.retry_count = 1;
+    config.sync_interval = 3600;
+    s->client = ntp_client_create(&config);
+    if (s->client == NULL) return NULL;
+
+    server_count++;
+    return s;
+}
+
+static void replay_exchange(const ntp_exchange_t *exchange)
+{
+    replay_server_t *s = find_server(&exchange->request);
+    if (s == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    ntp_sample_t sample;
+    ntp_status_t status = ntp_parseResponse(exchange->response.payload, exchange->response.length,
+                                            exchange->request.time_ns, exchange->response.time_ns, &sample);
+    s->exchanges++;
+    if (status != NTP_OK)
+    {
+        s->rejected++;
+    }
+    else
+    {
+        ntp_client_applySample(s->client, &sample);
+        if (sample.offset_ns < s->offset_min_ns) s->offset_min_ns = sample.offset_ns;
+        if (sample.offset_ns > s->offset_max_ns) s->offset_max_ns = sample.offset_ns;
+        s->offset_sum_ns += sample.offset_ns;
+        s->delay_sum_ns += sample.delay_ns;
+    }
+
+    if (print_samples)
+    {
+        if (status == NTP_OK)
+        {
+            printf("%lld.%09lld,%s,%u,ok,%lld,%lld,%lld,%u\n",
+                   (long long)(exchange->request.time_ns / 1000000000), (long long)(exchange->request.time_ns % 1000000000),
+                   s->name, s->port, (long long)sample.offset_ns, (long long)sample.delay_ns,
+                   (long long)sample.root_distance_ns, sample.stratum);
+        }
+        else
+        {
+            printf("%lld.%09lld,%s,%u,rejected,,,,\n",
+                   (long long)(exchange->request.time_ns / 1000000000), (long long)(exchange->request.time_ns % 1000000000),
+                   s->name, s->port);
+        }
+    }
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_servers(const void *a, const void *b)
+{
+    const replay_server_t *x = *(replay_server_t *const *)a;
+    const replay_server_t *y = *(replay_server_t *const *)b;
+    return x->exchanges < y->exchanges ? 1 : x->exchanges > y->exchanges ? -1 : strcmp(x->name, y->name);
+}
+
+static void print_summary(FILE *out)
+{
+    replay_server_t **sorted = malloc((server_count + 1) * sizeof(*sorted));
+    size_t n = 0;
+    for (size_t i = 0; i < server_slots; i++)
+    {
+        if (servers[i].client != NULL) sorted[n++] = &servers[i];
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_servers);
+
+    fprintf(out, "%-40s %10s %8s %11s %11s %11s %11s %10s\n", "server", "exchanges", "rejected",
+            "offset ms", "mean", "min", "max", "delay ms");
+    for (size_t i = 0; i < n; i++)
+    {
+        const replay_server_t *s = sorted[i];
+        char name[INET6_ADDRSTRLEN + 8];
+        snprintf(name, sizeof(name), s->family == 6 ? "[%s]:%u" : "%s:%u", s->name, s->port);
+
+        ntp_sync_info_t info;
+        ntp_client_getSyncInfo(s->client, &info);
+        uint64_t used = s->exchanges - s->rejected;
+        if (used == 0)
+        {
+            fprintf(out, "%-40s %10llu %8llu %11s\n", name, (unsigned long long)s->exchanges,
+                    (unsigned long long)s->rejected, "-");
+            continue;
+        }
+        fprintf(out, "%-40s %10llu %8llu %11.3f %11.3f %11.3f %11.3f %10.3f\n", name,
+                (unsigned long long)s->exchanges, (unsigned long long)s->rejected, info.offset_ns / 1e6,
+                s->offset_sum_ns / used / 1e6, s->offset_min_ns / 1e6, s->offset_max_ns / 1e6,
+                s->delay_sum_ns / used / 1e6);
+    }
+    free(sorted);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] capture...\n\n", prog);
+    fprintf(stderr, "Replays the NTP exchanges in pcap or pcapng captures through the client.\n\n");
+    fprintf(stderr, "      --samples  Print every exchange as CSV: time,server,port,status,offset_ns,\n");
+    fprintf(stderr, "                 delay_ns,root_distance_ns,stratum\n");
+    fprintf(stderr, "      --port=N   Servers' UDP port, if not 123\n");
+    fprintf(stderr, "  -h, --help     Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "samples", no_argument, NULL, 's' },
+        { "port", required_argument, NULL, 'p' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            print_samples = true;
+            break;
+        case 'p':
+        {
+            int port = atoi(optarg);
+            if (port < 1 || port > 65535)
+            {
+                fprintf(stderr, "Invalid port: %s\n", optarg);
+                return 2;
+            }
+            ntp_port = (uint16_t)port;
+            break;
+        }
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ntp_matcher_t *matcher = ntp_matcher_create(MATCHER_PENDING);
+    if (matcher == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    static ntp_capture_packet_t packets[READ_BATCH];
+    uint64_t frames = 0, ntp_packets = 0, exchanges = 0, skipped = 0;
+    double start = monotonic_seconds();
+    for (int f = optind; f < argc; f++)
+    {
+        ntp_capture_t *cap = ntp_capture_open(argv[f]);
+        if (cap == NULL)
+        {
+            fprintf(stderr, "Cannot read %s: %s\n", argv[f],
+                    errno == EINVAL ? "not a pcap or pcapng file" : strerror(errno));
+            return 1;
+        }
+        ntp_capture_set_port(cap, ntp_port);
+
+        size_t n;
+        while ((n = ntp_capture_read(cap, packets, READ_BATCH)) > 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                ntp_exchange_t exchange;
+                if (ntp_matcher_add(matcher, &packets[i], &exchange))
+                {
+                    replay_exchange(&exchange);
+                    exchanges++;
+                }
+            }
+        }
+
+        const ntp_capture_stats_t *stats = ntp_capture_stats(cap);
+        if (stats->truncated) fprintf(stderr, "%s: ends in the middle of a packet\n", argv[f]);
+        frames += stats->frames;
+        ntp_packets += stats->ntp_packets;
+        skipped += stats->skipped;
+        ntp_capture_close(cap);
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    // With --samples, stdout is the CSV; keep the summary apart
+    FILE *out = print_samples ? stderr : stdout;
+    print_summary(out);
+    fprintf(out, "\n%llu frames, %llu NTP packets, %llu exchanges, %llu skipped in %.3f s (%.2f Mframes/s)\n",
+            (unsigned long long)frames, (unsigned long long)ntp_packets, (unsigned long long)exchanges,
+            (unsigned long long)skipped, elapsed, elapsed > 0 ? frames / elapsed / 1e6 : 0);
+
+    for (size_t i = 0; i < server_slots; i++)
+    {
+        if (servers[i].client != NULL) ntp_client_destroy(servers[i].client);
+    }
+    free(servers);
+    ntp_matcher_destroy(matcher);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "term_caps.h"
+
+#define CACHE_MAX_LINES 64
+
+// Terminals known to support synchronized output, by TERM prefix or TERM_PROGRAM
+static const char *sync_terms[] = { "xterm-kitty", "xterm-ghostty", "foot", "alacritty", "contour", "wezterm" };
+static const char *sync_programs[] = { "WezTerm", "iTerm.app", "vscode", "ghostty" };
+
+// Terminals known not to, by TERM prefix
+static const char *no_sync_terms[] = { "linux", "vt", "screen", "cons" };
+
+static bool has_prefix(const char *s, const char *prefix)
+{
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Cache file: $XDG_CACHE_HOME/ntp-clock/terminals, or ~/.cache/ntp-clock/terminals
+ */
+void term_caps_cache_path(char *buf, size_t size)
+{
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (cache != NULL && cache[0] != '\0') {
+        snprintf(buf, size, "%s/ntp-clock/terminals", cache);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(buf, size, "%s/.cache/ntp-clock/terminals", home);
+    } else {
+        buf[0] = '\0';
+    }
+}
+
+/**
+ * Look the terminal up in the cache; each line is "<sync_output> <key>"
+ */
+static bool cache_lookup(term_caps_t *caps)
+{
+    char path[512], line[256];
+    term_caps_cache_path(path, sizeof(path));
+    if (path[0] == '\0') return false;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return false;
+
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if ((line[0] == '0' || line[0] == '1') && line[1] == ' ' && strcmp(line + 2, caps->key) == 0) {
+            caps->sync_output = line[0] == '1' ? CAP_YES : CAP_NO;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/**
+ * Work out the capabilities from the cache and the environment alone
+ */
+void term_caps_detect(term_caps_t *caps)
+{
+    const char *term = getenv("TERM");
+    const char *program = getenv("TERM_PROGRAM");
+
+    memset(caps, 0, sizeof(*caps));
+    caps->sync_output = CAP_UNKNOWN;
+    caps->ansi = term != NULL && term[0] != '\0' && strcmp(term, "dumb") != 0;
+    snprintf(caps->key, sizeof(caps->key), "%s|%s", term ? term : "", program ? program : "");
+
+    if (!caps->ansi) {
+        caps->sync_output = CAP_NO;
+        return;
+    }
+
+    if (cache_lookup(caps)) {
+        caps->from_cache = true;
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(sync_terms) / sizeof(sync_terms[0]); i++) {
+        if (has_prefix(term, sync_terms[i])) caps->sync_output = CAP_YES;
+    }
+    for (size_t i = 0; program != NULL && i < sizeof(sync_programs) / sizeof(sync_programs[0]); i++) {
+        if (strcmp(program, sync_programs[i]) == 0) caps->sync_output = CAP_YES;
+    }
+    for (size_t i = 0; i < sizeof(no_sync_terms) / sizeof(no_sync_terms[0]); i++) {
+        if (has_prefix(term, no_sync_terms[i])) caps->sync_output = CAP_NO;
+    }
+}
+
+/**
+ * Whether something is still worth asking the terminal
+ */
+bool term_caps_pending(const term_caps_t *caps)
+{
+    return caps->ansi && caps->sync_output == CAP_UNKNOWN;
+}
+
+static term_event_t finish_csi(term_caps_t *caps, char final)
+{
+    const char *seq = caps->seq;
+
+    if (caps->seq_len == 0 && (final == 'I' || final == 'O')) {
+        return final == 'I' ? TERM_EVENT_FOCUS_IN : TERM_EVENT_FOCUS_OUT;
+    }
+
+    if (final == 'y' && has_prefix(seq, "?2026;") && seq[caps->seq_len - 1] == '$') {
+        // DECRPM: 1 = set, 2 = reset, 3 = permanently set (all usable)
+        int value = atoi(seq + 6);
+        caps->sync_output = (value >= 1 && value <= 3) ? CAP_YES : CAP_NO;
+        return TERM_EVENT_NONE;
+    }
+
+    if (final == 'c' && seq[0] == '?') {
+        // Device attributes are answered last; whatever wasn't reported by
+        // now isn't supported
+        if (caps->sync_output == CAP_UNKNOWN) caps->sync_output = CAP_NO;
+        return TERM_EVENT_CAPS_DONE;
+    }
+
+    return TERM_EVENT_NONE;
+}
+
+/**
+ * Feed one byte read from the terminal
+ *
+ * @return What the byte completed, if anything
+ */
+term_event_t term_caps_input(term_caps_t *caps, char c)
+{
+    switch (caps->state) {
+    case 1:
+        if (c == '[') {
+            caps->state = 2;
+            caps->seq_len = 0;
+        } else {
+            caps->state = (c == '\x1b') ? 1 : 0;
+        }
+        return TERM_EVENT_NONE;
+    case 2:
+        if (c >= 0x20 && c <= 0x3f) {
+            // Parameter and intermediate bytes
+            if (caps->seq_len < sizeof(caps->seq) - 1) caps->seq[caps->seq_len++] = c;
+            return TERM_EVENT_NONE;
+        }
+        caps->seq[caps->seq_len] = '\0';
+        caps->state = (c == '\x1b') ? 1 : 0;
+        return finish_csi(caps, c);
+    default:
+        if (c == '\x1b') caps->state = 1;
+        return TERM_EVENT_NONE;
+    }
+}
+
+static void make_parent_dirs(const char *path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0700);
+            *p = '/';
+        }
+    }
+}
+
+/**
+ * Remember the detected capabilities for this terminal
+ *
+ * @return false if the cache couldn't be written
+ */
+bool term_caps_save(const term_caps_t *caps)
+{
+    char path[512], tmp[520];
+    char lines[CACHE_MAX_LINES][256];
+    int count = 0;
+
+    if (caps->sync_output == CAP_UNKNOWN) return false;
+    term_caps_cache_path(path, sizeof(path));
+    if (path[0] == '\0') return false;
+
+    // Keep the other terminals' entries
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        while (count < CACHE_MAX_LINES - 1 && fgets(lines[count], sizeof(lines[count]), f) != NULL) {
+            lines[count][strcspn(lines[count], "\n")] = '\0';
+            if (strlen(lines[count]) > 2 && strcmp(lines[count] + 2, caps->key) != 0) count++;
+        }
+        fclose(f);
+    }
+    snprintf(lines[count++], sizeof(lines[0]), "%d %s", caps->sync_output == CAP_YES, caps->key);
+
+    // Replace the file in one go so a concurrent reader never sees half of it
+    make_parent_dirs(path);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    f = fopen(tmp, "w");
+    if (f == NULL) return false;
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s\n", lines[i]);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef TERM_CAPS_H
+#define TERM_CAPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Terminal capabilities, worked out without waiting for the terminal.
+ *
+ * Detection uses a per-user cache of earlier answers and what TERM and
+ * TERM_PROGRAM say about the terminal. Anything still unknown is queried
+ * once the clock is already running: the replies arrive on stdin and are
+ * fed to term_caps_input(), and the answers are cached for next time.
+ */
+
+#define TERM_CAPS_QUERY "\x1b[?2026$p\x1b[c"
+
+typedef enum {
+    CAP_UNKNOWN = -1,
+    CAP_NO = 0,
+    CAP_YES = 1
+} cap_state_t;
+
+typedef struct {
+    bool ansi;                  // The terminal understands ANSI escape sequences
+    cap_state_t sync_output;    // DEC mode 2026 (synchronized output)
+    bool from_cache;            // sync_output came from the cache
+    char key[128];              // TERM and TERM_PROGRAM, identifying the terminal in the cache
+
+    // Reply parser state
+    int state;                  // 0 = ground, 1 = after ESC, 2 = in a CSI sequence
+    char seq[32];               // Parameter and intermediate bytes of the current CSI sequence
+    size_t seq_len;
+} term_caps_t;
+
+typedef enum {
+    TERM_EVENT_NONE = 0,
+    TERM_EVENT_FOCUS_IN,
+    TERM_EVENT_FOCUS_OUT,
+    TERM_EVENT_CAPS_DONE        // Every query has been answered
+} term_event_t;
+
+void term_caps_detect(term_caps_t *caps);
+bool term_caps_pending(const term_caps_t *caps);
+term_event_t term_caps_input(term_caps_t *caps, char c);
+bool term_caps_save(const term_caps_t *caps);
+void term_caps_cache_path(char *buf, size_t size);
+
+#endif /* TERM_CAPS_H */
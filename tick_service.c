@@ -0,0 +1,457 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "tick_service.h"
+#include "broadcast.h"
+#include "ntp_client.h"
+
+#define NS_PER_SEC 1000000000LL
+
+static int64_t ntp_now_ns(void)
+{
+    ntp_sync_info_t info;
+    if (ntp_getSyncInfo(&info) == NTP_OK) return info.time_ns;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static long futex(_Atomic uint32_t *word, int op, uint32_t value, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Service                                                                */
+/* ---------------------------------------------------------------------- */
+
+/**
+ * Timer callback: announce the second that just began, then arm the next
+ */
+static void fire_boundary(ntp_timer_t *timer, void *arg)
+{
+    tick_service_t *t = arg;
+    int64_t second = timer->deadline_ns / NS_PER_SEC;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&t->lock);
+    atomic_store(&t->page->second, second);
+    atomic_store(&t->page->fired_ns, ntp_now_ns());
+    atomic_fetch_add(&t->page->seq, 1);
+
+    // One wakeup for every futex subscriber, however many there are
+    futex(&t->page->seq, FUTEX_WAKE, INT_MAX, NULL);
+
+    for (int i = 0; i < t->subscriber_count; i++) {
+        tick_subscriber_t *s = t->subscribers[i];
+        if (s->event_fd >= 0 && write(s->event_fd, &one, sizeof(one)) == sizeof(one)) {
+            t->notifications++;
+        }
+    }
+    t->ticks++;
+    pthread_mutex_unlock(&t->lock);
+
+    // After a stall, skip the boundaries that are already past
+    int64_t next = (second + 1) * NS_PER_SEC;
+    int64_t now = ntp_now_ns();
+    if (next <= now) next = (now / NS_PER_SEC + 1) * NS_PER_SEC;
+    ntp_sched_add(t->sched, timer, next, fire_boundary, t);
+}
+
+bool tick_service_init(tick_service_t *t, int listen_fd)
+{
+    memset(t, 0, sizeof(*t));
+    t->listen_fd = listen_fd;
+    t->page_fd = memfd_create("ntp-clock-ticks", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (t->page_fd < 0) return false;
+
+    if (ftruncate(t->page_fd, sizeof(tick_page_t)) != 0 ||
+        (t->page = mmap(NULL, sizeof(tick_page_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                        t->page_fd, 0)) == MAP_FAILED) {
+        close(t->page_fd);
+        return false;
+    }
+
+    // Subscribers get this fd; once sealed only our mapping can write the
+    // page, and they can neither map it writable nor resize it
+    if (fcntl(t->page_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) != 0) {
+        munmap(t->page, sizeof(tick_page_t));
+        close(t->page_fd);
+        return false;
+    }
+
+    t->sched = ntp_sched_create();
+    if (t->sched == NULL) {
+        munmap(t->page, sizeof(tick_page_t));
+        close(t->page_fd);
+        return false;
+    }
+
+    pthread_mutex_init(&t->lock, NULL);
+    ntp_sched_add(t->sched, &t->timer, (ntp_now_ns() / NS_PER_SEC + 1) * NS_PER_SEC, fire_boundary, t);
+    return true;
+}
+
+bool tick_service_add_subscriber(tick_service_t *t, int fd)
+{
+    tick_subscriber_t *s = calloc(1, sizeof(*s));
+    if (s == NULL) return false;
+
+    pthread_mutex_lock(&t->lock);
+    if (t->subscriber_count == t->subscriber_cap) {
+        int cap = t->subscriber_cap ? t->subscriber_cap * 2 : 16;
+        tick_subscriber_t **grown = realloc(t->subscribers, cap * sizeof(*grown));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&t->lock);
+            free(s);
+            return false;
+        }
+        t->subscribers = grown;
+        t->subscriber_cap = cap;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    s->fd = fd;
+    s->event_fd = -1;
+    t->subscribers[t->subscriber_count++] = s;
+    pthread_mutex_unlock(&t->lock);
+    return true;
+}
+
+static void remove_subscriber(tick_service_t *t, int index)
+{
+    pthread_mutex_lock(&t->lock);
+    tick_subscriber_t *s = t->subscribers[index];
+    t->subscribers[index] = t->subscribers[--t->subscriber_count];
+    pthread_mutex_unlock(&t->lock);
+
+    close(s->fd);
+    if (s->event_fd >= 0) close(s->event_fd);
+    free(s);
+}
+
+void tick_service_free(tick_service_t *t)
+{
+    // Stop the timer before taking the subscribers away from it
+    ntp_sched_destroy(t->sched);
+    while (t->subscriber_count > 0) {
+        remove_subscriber(t, t->subscriber_count - 1);
+    }
+    free(t->subscribers);
+    munmap(t->page, sizeof(tick_page_t));
+    close(t->page_fd);
+    if (t->listen_fd >= 0) close(t->listen_fd);
+    pthread_mutex_destroy(&t->lock);
+    memset(t, 0, sizeof(*t));
+    t->listen_fd = -1;
+}
+
+/**
+ * Hand a subscriber the page, and an eventfd if it wants one
+ */
+static bool answer_hello(tick_service_t *t, tick_subscriber_t *s, const tick_hello_t *hello)
+{
+    int fds[2] = { t->page_fd, -1 };
+    int count = 1;
+
+    if (hello->mode == TICK_MODE_EVENTFD) {
+        int event_fd = eventfd(0, EFD_CLOEXEC);
+        if (event_fd < 0) return false;
+        fds[count++] = event_fd;
+    } else if (hello->mode != TICK_MODE_FUTEX) {
+        return false;
+    }
+
+    char ack = 1;
+    struct iovec iov = { &ack, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control.buf, .msg_controllen = CMSG_SPACE(count * sizeof(int)) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    if (sendmsg(s->fd, &msg, MSG_NOSIGNAL) != 1) {
+        if (count > 1) close(fds[1]);
+        return false;
+    }
+
+    // Start counting ticks only once the subscriber holds the eventfd
+    if (count > 1) {
+        pthread_mutex_lock(&t->lock);
+        s->event_fd = fds[1];
+        pthread_mutex_unlock(&t->lock);
+    }
+    return true;
+}
+
+/**
+ * Read a subscriber's hello; anything after it is ignored
+ *
+ * @return false if the subscriber has gone away
+ */
+static bool read_subscriber(tick_service_t *t, tick_subscriber_t *s)
+{
+    char discard[64];
+
+    for (;;) {
+        bool greeted = s->hello_len == sizeof(s->hello);
+        char *buf = greeted ? discard : s->hello + s->hello_len;
+        size_t want = greeted ? sizeof(discard) : sizeof(s->hello) - s->hello_len;
+
+        ssize_t n = read(s->fd, buf, want);
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (greeted) continue;
+
+        s->hello_len += n;
+        if (s->hello_len < sizeof(s->hello)) continue;
+
+        tick_hello_t hello;
+        memcpy(&hello, s->hello, sizeof(hello));
+        if (memcmp(hello.magic, TICK_HELLO_MAGIC, sizeof(hello.magic)) != 0 ||
+            !answer_hello(t, s, &hello)) {
+            return false;
+        }
+    }
+}
+
+void tick_service_wait(tick_service_t *t, int timeout_ms)
+{
+    int count = t->subscriber_count + 1;
+    struct pollfd stack_fds[64];
+    struct pollfd *fds = count <= 64 ? stack_fds : malloc(count * sizeof(*fds));
+    if (fds == NULL) return;
+
+    fds[0] = (struct pollfd){ t->listen_fd, POLLIN, 0 };
+    for (int i = 0; i < t->subscriber_count; i++) {
+        fds[i + 1] = (struct pollfd){ t->subscribers[i]->fd, POLLIN, 0 };
+    }
+
+    int subscribers = t->subscriber_count;
+    if (poll(fds, count, timeout_ms) > 0) {
+        // Walk backwards so removing a subscriber doesn't disturb the ones left to check
+        for (int i = subscribers - 1; i >= 0; i--) {
+            if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                !read_subscriber(t, t->subscribers[i])) {
+                remove_subscriber(t, i);
+            }
+        }
+
+        if (t->listen_fd >= 0 && (fds[0].revents & POLLIN)) {
+            int fd;
+            while ((fd = accept(t->listen_fd, NULL, NULL)) >= 0) {
+                if (!tick_service_add_subscriber(t, fd)) close(fd);
+            }
+        }
+    }
+
+    if (fds != stack_fds) free(fds);
+}
+
+/**
+ * Default socket path: in $XDG_RUNTIME_DIR if set, otherwise /tmp
+ */
+void tick_default_path(char *buf, size_t size)
+{
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(buf, size, "%s/ntp-clock-ticks.sock", runtime);
+    } else {
+        snprintf(buf, size, "/tmp/ntp-clock-ticks-%u.sock", (unsigned)getuid());
+    }
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * Keep time and tick for subscribers until interrupted
+ *
+ * @param path Socket to listen on
+ * @return Process exit status
+ */
+int tick_serve(const char *path)
+{
+    tick_service_t t;
+
+    int fd = broadcast_listen(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    ntp_startBackgroundSync();
+    if (!tick_service_init(&t, fd)) {
+        fprintf(stderr, "Cannot start the tick service: %s\n", strerror(errno));
+        ntp_stopBackgroundSync();
+        close(fd);
+        unlink(path);
+        return 1;
+    }
+    fprintf(stderr, "Ticking on %s\n", path);
+
+    while (!stop_requested) {
+        tick_service_wait(&t, 1000);
+    }
+
+    tick_service_free(&t);
+    ntp_stopBackgroundSync();
+    unlink(path);
+    return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Subscribers                                                            */
+/* ---------------------------------------------------------------------- */
+
+/**
+ * Register with the tick service at path
+ *
+ * @param mode TICK_MODE_FUTEX or TICK_MODE_EVENTFD
+ * @return false if the service isn't running or refused
+ */
+bool tick_subscribe(tick_subscription_t *s, const char *path, int mode)
+{
+    memset(s, 0, sizeof(*s));
+    s->event_fd = -1;
+    s->mode = mode;
+    s->fd = broadcast_connect(path);
+    if (s->fd < 0) return false;
+
+    tick_hello_t hello;
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, TICK_HELLO_MAGIC, sizeof(hello.magic));
+    hello.mode = mode;
+
+    int fds[2] = { -1, -1 };
+    char ack;
+    struct iovec iov = { &ack, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+
+    if (send(s->fd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello) ||
+        recvmsg(s->fd, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        tick_unsubscribe(s);
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+    }
+    if (fds[0] >= 0) {
+        void *page = mmap(NULL, sizeof(tick_page_t), PROT_READ, MAP_SHARED, fds[0], 0);
+        s->page = page == MAP_FAILED ? NULL : page;
+        close(fds[0]);
+    }
+    s->event_fd = fds[1];
+
+    if (s->page == NULL || (mode == TICK_MODE_EVENTFD) != (s->event_fd >= 0)) {
+        tick_unsubscribe(s);
+        return false;
+    }
+    s->seen = atomic_load(&s->page->seq);
+    return true;
+}
+
+/**
+ * Whether the service is still there, after a wait timed out
+ */
+static bool service_alive(tick_subscription_t *s)
+{
+    struct pollfd pfd = { s->fd, POLLIN, 0 };
+    char c;
+    return poll(&pfd, 1, 0) == 0 || recv(s->fd, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 0;
+}
+
+/**
+ * Wait for the next second boundary
+ *
+ * @param timeout_ms Longest wait, or -1 to wait for ever
+ * @return Boundaries passed since the last call (more than one if some were
+ *         missed), 0 on timeout, -1 if the service has gone away
+ */
+int64_t tick_wait(tick_subscription_t *s, int timeout_ms)
+{
+    if (s->mode == TICK_MODE_EVENTFD) {
+        struct pollfd pfd = { s->event_fd, POLLIN, 0 };
+        uint64_t ticks;
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0) return errno == EINTR ? 0 : -1;
+        if (ready == 0) return service_alive(s) ? 0 : -1;
+        if (read(s->event_fd, &ticks, sizeof(ticks)) != sizeof(ticks)) return -1;
+        s->seen = atomic_load(&s->page->seq);
+        return (int64_t)ticks;
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        uint32_t seq = atomic_load(&s->page->seq);
+        if (seq != s->seen) {
+            int64_t ticks = (uint32_t)(seq - s->seen);
+            s->seen = seq;
+            return ticks;
+        }
+
+        struct timespec timeout, *wait = NULL;
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t left = (int64_t)timeout_ms * 1000000 -
+                           ((now.tv_sec - start.tv_sec) * NS_PER_SEC + (now.tv_nsec - start.tv_nsec));
+            if (left <= 0) return service_alive(s) ? 0 : -1;
+            timeout.tv_sec = left / NS_PER_SEC;
+            timeout.tv_nsec = left % NS_PER_SEC;
+            wait = &timeout;
+        }
+        // Returns straight away if the word moved on after we read it
+        futex(&s->page->seq, FUTEX_WAIT, seq, wait);
+    }
+}
+
+void tick_unsubscribe(tick_subscription_t *s)
+{
+    if (s->page != NULL) munmap(s->page, sizeof(tick_page_t));
+    if (s->event_fd >= 0) close(s->event_fd);
+    if (s->fd >= 0) close(s->fd);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->event_fd = -1;
+}
@@ -0,0 +1,91 @@
+#ifndef TICK_SERVICE_H
+#define TICK_SERVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "ntp_sched.h"
+
+/**
+ * Second-boundary tick service: one `ntp-clock --ticks` process wakes any
+ * number of local subscribers on every NTP second, from a single timer.
+ *
+ * Subscribers register over a Unix socket and get back a shared tick page
+ * and, if they asked for one, an eventfd. On each boundary the server
+ * stores the second in the page, bumps its sequence word and wakes every
+ * futex waiter on it with one FUTEX_WAKE, then adds one to each eventfd.
+ * An eventfd counts ticks the subscriber hasn't read yet, so a slow
+ * subscriber sees how many it missed; a futex subscriber compares sequence
+ * numbers.
+ */
+
+#define TICK_HELLO_MAGIC "NTPT"
+#define TICK_MODE_FUTEX 1               // Wait on the page's sequence word
+#define TICK_MODE_EVENTFD 2             // Wait on an eventfd
+
+/**
+ * Sent by a subscriber when it connects; answered with one byte carrying
+ * the page's fd and, for TICK_MODE_EVENTFD, the eventfd
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];                  // TICK_HELLO_MAGIC
+    uint8_t mode;                   // TICK_MODE_*
+    uint8_t reserved[3];
+} tick_hello_t;
+
+/**
+ * The shared tick page
+ */
+typedef struct {
+    _Atomic uint32_t seq;           // Bumped on every boundary; the futex word
+    uint32_t reserved;
+    _Atomic int64_t second;         // NTP second that began at the last boundary
+    _Atomic int64_t fired_ns;       // NTP time the server fired it
+} tick_page_t;
+
+typedef struct {
+    int fd;                         // Connection; its hangup ends the subscription
+    int event_fd;                   // Eventfd, or -1 for a futex subscriber
+    char hello[sizeof(tick_hello_t)];
+    size_t hello_len;
+} tick_subscriber_t;
+
+typedef struct {
+    int listen_fd;                  // Listening socket, or -1
+    pthread_mutex_t lock;           // Guards the subscribers against the timer
+    tick_subscriber_t **subscribers;
+    int subscriber_count, subscriber_cap;
+    int page_fd;                    // memfd holding the page, sealed against writes but ours
+    tick_page_t *page;
+    ntp_sched_t *sched;             // Fires the boundary timer
+    ntp_timer_t timer;
+
+    // Statistics
+    uint64_t ticks;                 // Boundaries fired
+    uint64_t notifications;         // Eventfd writes
+} tick_service_t;
+
+bool tick_service_init(tick_service_t *t, int listen_fd);
+void tick_service_free(tick_service_t *t);
+bool tick_service_add_subscriber(tick_service_t *t, int fd);
+void tick_service_wait(tick_service_t *t, int timeout_ms);
+void tick_default_path(char *buf, size_t size);
+int tick_serve(const char *path);
+
+/**
+ * A subscriber's end
+ */
+typedef struct {
+    int fd;                         // Connection to the service
+    int mode;                       // TICK_MODE_*
+    int event_fd;                   // Eventfd, or -1
+    tick_page_t *page;              // Shared tick page
+    uint32_t seen;                  // Page sequence number last seen
+} tick_subscription_t;
+
+bool tick_subscribe(tick_subscription_t *s, const char *path, int mode);
+int64_t tick_wait(tick_subscription_t *s, int timeout_ms);
+void tick_unsubscribe(tick_subscription_t *s);
+
+#endif /* TICK_SERVICE_H */
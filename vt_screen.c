@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vt_screen.h"
+
+// Parser states
+enum {
+    VT_GROUND = 0,
+    VT_ESCAPE,
+    VT_CSI
+};
+
+static vt_cell_t blank_cell(const vt_screen_t *s)
+{
+    vt_cell_t c = { ' ', VT_COLOR_DEFAULT, s->bg };
+    return c;
+}
+
+static vt_cell_t *cell_at(vt_screen_t *s, int row, int col)
+{
+    return &s->cells[(size_t)row * s->width + col];
+}
+
+static void clear_cells(vt_screen_t *s, int row, int from_col, int to_col)
+{
+    vt_cell_t blank = blank_cell(s);
+    for (int c = from_col; c < to_col; c++) {
+        *cell_at(s, row, c) = blank;
+    }
+}
+
+/**
+ * Scroll the lines of the scroll region up (n > 0) or down (n < 0)
+ */
+static void scroll_region(vt_screen_t *s, int n)
+{
+    int lines = s->bottom - s->top + 1;
+    size_t row_size = (size_t)s->width * sizeof(vt_cell_t);
+
+    if (n > lines) n = lines;
+    if (n < -lines) n = -lines;
+
+    if (n > 0) {
+        memmove(cell_at(s, s->top, 0), cell_at(s, s->top + n, 0), (lines - n) * row_size);
+        for (int r = s->bottom - n + 1; r <= s->bottom; r++) {
+            clear_cells(s, r, 0, s->width);
+        }
+    } else if (n < 0) {
+        n = -n;
+        memmove(cell_at(s, s->top + n, 0), cell_at(s, s->top, 0), (lines - n) * row_size);
+        for (int r = s->top; r < s->top + n; r++) {
+            clear_cells(s, r, 0, s->width);
+        }
+    }
+}
+
+static void line_feed(vt_screen_t *s)
+{
+    s->wrap_pending = false;
+    if (s->row == s->bottom) {
+        scroll_region(s, 1);
+    } else if (s->row < s->height - 1) {
+        s->row++;
+    }
+}
+
+static void reverse_index(vt_screen_t *s)
+{
+    s->wrap_pending = false;
+    if (s->row == s->top) {
+        scroll_region(s, -1);
+    } else if (s->row > 0) {
+        s->row--;
+    }
+}
+
+static void move_cursor(vt_screen_t *s, int row, int col)
+{
+    if (row < 0) row = 0;
+    if (row >= s->height) row = s->height - 1;
+    if (col < 0) col = 0;
+    if (col >= s->width) col = s->width - 1;
+    s->row = row;
+    s->col = col;
+    s->wrap_pending = false;
+}
+
+static void put_char(vt_screen_t *s, uint32_t ch)
+{
+    if (s->wrap_pending) {
+        s->col = 0;
+        line_feed(s);
+    }
+
+    vt_cell_t *c = cell_at(s, s->row, s->col);
+    c->ch = ch;
+    c->fg = s->fg;
+    c->bg = s->bg;
+
+    if (s->col == s->width - 1) {
+        s->wrap_pending = true;
+    } else {
+        s->col++;
+    }
+}
+
+static int param(const vt_screen_t *s, int index, int def)
+{
+    if (index >= s->nparams || s->params[index] <= 0) return def;
+    return s->params[index];
+}
+
+static void apply_sgr(vt_screen_t *s)
+{
+    if (s->nparams == 0) {
+        s->fg = s->bg = VT_COLOR_DEFAULT;
+        return;
+    }
+    for (int i = 0; i < s->nparams; i++) {
+        int p = s->params[i];
+        if (p == 0) {
+            s->fg = s->bg = VT_COLOR_DEFAULT;
+        } else if (p >= 30 && p <= 37) {
+            s->fg = p - 30;
+        } else if (p == 39) {
+            s->fg = VT_COLOR_DEFAULT;
+        } else if (p >= 40 && p <= 47) {
+            s->bg = p - 40;
+        } else if (p == 49) {
+            s->bg = VT_COLOR_DEFAULT;
+        } else if (p >= 90 && p <= 97) {
+            s->fg = p - 90 + 8;
+        } else if (p >= 100 && p <= 107) {
+            s->bg = p - 100 + 8;
+        }
+        // Other attributes (bold, underline, ...) are not modelled
+    }
+}
+
+static void set_private_mode(vt_screen_t *s, bool enable)
+{
+    for (int i = 0; i < s->nparams; i++) {
+        switch (s->params[i]) {
+        case 25:
+            s->cursor_visible = enable;
+            break;
+        case 2026:
+            if (s->synchronized && !enable) s->presents++;
+            s->synchronized = enable;
+            break;
+        default:
+            // Modes that don't affect the screen contents are ignored
+            break;
+        }
+    }
+}
+
+static void erase_display(vt_screen_t *s, int mode)
+{
+    if (mode == 0) {
+        clear_cells(s, s->row, s->col, s->width);
+        for (int r = s->row + 1; r < s->height; r++) clear_cells(s, r, 0, s->width);
+    } else if (mode == 1) {
+        for (int r = 0; r < s->row; r++) clear_cells(s, r, 0, s->width);
+        clear_cells(s, s->row, 0, s->col + 1);
+    } else {
+        for (int r = 0; r < s->height; r++) clear_cells(s, r, 0, s->width);
+    }
+}
+
+static void erase_line(vt_screen_t *s, int mode)
+{
+    if (mode == 0) {
+        clear_cells(s, s->row, s->col, s->width);
+    } else if (mode == 1) {
+        clear_cells(s, s->row, 0, s->col + 1);
+    } else {
+        clear_cells(s, s->row, 0, s->width);
+    }
+}
+
+static void dispatch_csi(vt_screen_t *s, char final)
+{
+    if (s->private_marker == '?') {
+        if (final == 'h' || final == 'l') {
+            set_private_mode(s, final == 'h');
+        } else {
+            s->unknown++;
+        }
+        return;
+    }
+    if (s->private_marker != 0 || s->intermediate != 0) {
+        s->unknown++;
+        return;
+    }
+
+    switch (final) {
+    case 'H':
+    case 'f':
+        move_cursor(s, param(s, 0, 1) - 1, param(s, 1, 1) - 1);
+        break;
+    case 'A':
+        move_cursor(s, s->row - param(s, 0, 1), s->col);
+        break;
+    case 'B':
+        move_cursor(s, s->row + param(s, 0, 1), s->col);
+        break;
+    case 'C':
+        move_cursor(s, s->row, s->col + param(s, 0, 1));
+        break;
+    case 'D':
+        move_cursor(s, s->row, s->col - param(s, 0, 1));
+        break;
+    case 'G':
+        move_cursor(s, s->row, param(s, 0, 1) - 1);
+        break;
+    case 'd':
+        move_cursor(s, param(s, 0, 1) - 1, s->col);
+        break;
+    case 'J':
+        erase_display(s, s->nparams ? s->params[0] : 0);
+        break;
+    case 'K':
+        erase_line(s, s->nparams ? s->params[0] : 0);
+        break;
+    case 'm':
+        apply_sgr(s);
+        break;
+    case 'r': {
+        int top = param(s, 0, 1) - 1;
+        int bottom = param(s, 1, s->height) - 1;
+        if (bottom >= s->height) bottom = s->height - 1;
+        if (top < bottom) {
+            s->top = top;
+            s->bottom = bottom;
+            move_cursor(s, 0, 0);
+        }
+        break;
+    }
+    case 'S':
+        scroll_region(s, param(s, 0, 1));
+        break;
+    case 'T':
+        scroll_region(s, -param(s, 0, 1));
+        break;
+    case 's':
+        s->saved_row = s->row;
+        s->saved_col = s->col;
+        break;
+    case 'u':
+        move_cursor(s, s->saved_row, s->saved_col);
+        break;
+    default:
+        s->unknown++;
+        break;
+    }
+}
+
+static void feed_byte(vt_screen_t *s, unsigned char b)
+{
+    switch (s->state) {
+    case VT_ESCAPE:
+        s->state = VT_GROUND;
+        switch (b) {
+        case '[':
+            s->state = VT_CSI;
+            s->nparams = 0;
+            s->private_marker = 0;
+            s->intermediate = 0;
+            memset(s->params, 0, sizeof(s->params));
+            break;
+        case '7':
+            s->saved_row = s->row;
+            s->saved_col = s->col;
+            break;
+        case '8':
+            move_cursor(s, s->saved_row, s->saved_col);
+            break;
+        case 'D':
+            line_feed(s);
+            break;
+        case 'E':
+            s->col = 0;
+            line_feed(s);
+            break;
+        case 'M':
+            reverse_index(s);
+            break;
+        case 'c':
+            vt_screen_reset(s);
+            break;
+        default:
+            s->unknown++;
+            break;
+        }
+        return;
+
+    case VT_CSI:
+        if (b >= '0' && b <= '9') {
+            if (s->nparams == 0) s->nparams = 1;
+            int *p = &s->params[s->nparams - 1];
+            if (*p < 100000) *p = *p * 10 + (b - '0');
+        } else if (b == ';') {
+            if (s->nparams == 0) s->nparams = 1;
+            if (s->nparams < VT_MAX_PARAMS) s->nparams++;
+        } else if (b >= '<' && b <= '?') {
+            s->private_marker = b;
+        } else if (b >= 0x20 && b <= 0x2f) {
+            s->intermediate = b;
+        } else if (b >= 0x40 && b <= 0x7e) {
+            s->state = VT_GROUND;
+            dispatch_csi(s, b);
+        } else if (b == 0x1b) {
+            s->state = VT_ESCAPE;
+        }
+        return;
+
+    default:
+        break;
+    }
+
+    // Ground state: continue a UTF-8 sequence if one is in progress
+    if (s->utf8_remaining > 0) {
+        if ((b & 0xc0) == 0x80) {
+            s->utf8_cp = (s->utf8_cp << 6) | (b & 0x3f);
+            if (--s->utf8_remaining == 0) {
+                put_char(s, s->utf8_cp);
+            }
+            return;
+        }
+        // Malformed sequence - drop it and handle this byte normally
+        s->utf8_remaining = 0;
+        put_char(s, 0xfffd);
+    }
+
+    if (b == 0x1b) {
+        s->state = VT_ESCAPE;
+    } else if (b == '\r') {
+        s->col = 0;
+        s->wrap_pending = false;
+    } else if (b == '\n' || b == '\v' || b == '\f') {
+        line_feed(s);
+    } else if (b == '\b') {
+        if (s->col > 0) s->col--;
+        s->wrap_pending = false;
+    } else if (b < 0x20 || b == 0x7f) {
+        // Other control characters have no visible effect
+    } else if (b < 0x80) {
+        put_char(s, b);
+    } else if ((b & 0xe0) == 0xc0) {
+        s->utf8_cp = b & 0x1f;
+        s->utf8_remaining = 1;
+    } else if ((b & 0xf0) == 0xe0) {
+        s->utf8_cp = b & 0x0f;
+        s->utf8_remaining = 2;
+    } else if ((b & 0xf8) == 0xf0) {
+        s->utf8_cp = b & 0x07;
+        s->utf8_remaining = 3;
+    } else {
+        put_char(s, 0xfffd);
+    }
+}
+
+bool vt_screen_init(vt_screen_t *s, int width, int height)
+{
+    memset(s, 0, sizeof(*s));
+    if (width <= 0 || height <= 0) return false;
+
+    s->cells = malloc((size_t)width * height * sizeof(vt_cell_t));
+    if (s->cells == NULL) return false;
+
+    s->width = width;
+    s->height = height;
+    vt_screen_reset(s);
+    return true;
+}
+
+void vt_screen_free(vt_screen_t *s)
+{
+    free(s->cells);
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * Return the screen to its power-on state, keeping the statistics
+ */
+void vt_screen_reset(vt_screen_t *s)
+{
+    s->row = s->col = 0;
+    s->wrap_pending = false;
+    s->fg = s->bg = VT_COLOR_DEFAULT;
+    s->saved_row = s->saved_col = 0;
+    s->top = 0;
+    s->bottom = s->height - 1;
+    s->cursor_visible = true;
+    s->synchronized = false;
+    s->state = VT_GROUND;
+    s->utf8_remaining = 0;
+    for (int r = 0; r < s->height; r++) {
+        clear_cells(s, r, 0, s->width);
+    }
+}
+
+void vt_screen_feed(vt_screen_t *s, const char *data, size_t len)
+{
+    s->bytes += len;
+    for (size_t i = 0; i < len; i++) {
+        feed_byte(s, (unsigned char)data[i]);
+    }
+}
+
+const vt_cell_t *vt_screen_cell(const vt_screen_t *s, int row, int col)
+{
+    if (row < 0 || row >= s->height || col < 0 || col >= s->width) return NULL;
+    return &s->cells[(size_t)row * s->width + col];
+}
+
+/**
+ * Copy the text of one row into buf as UTF-8
+ *
+ * @return Number of bytes written, excluding the terminating NUL
+ */
+size_t vt_screen_row_text(const vt_screen_t *s, int row, char *buf, size_t size)
+{
+    size_t n = 0;
+
+    if (size == 0) return 0;
+    if (row < 0 || row >= s->height) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    for (int c = 0; c < s->width; c++) {
+        uint32_t ch = s->cells[(size_t)row * s->width + c].ch;
+        char enc[4];
+        size_t len;
+
+        if (ch < 0x80) {
+            enc[0] = ch;
+            len = 1;
+        } else if (ch < 0x800) {
+            enc[0] = 0xc0 | (ch >> 6);
+            enc[1] = 0x80 | (ch & 0x3f);
+            len = 2;
+        } else if (ch < 0x10000) {
+            enc[0] = 0xe0 | (ch >> 12);
+            enc[1] = 0x80 | ((ch >> 6) & 0x3f);
+            enc[2] = 0x80 | (ch & 0x3f);
+            len = 3;
+        } else {
+            enc[0] = 0xf0 | (ch >> 18);
+            enc[1] = 0x80 | ((ch >> 12) & 0x3f);
+            enc[2] = 0x80 | ((ch >> 6) & 0x3f);
+            enc[3] = 0x80 | (ch & 0x3f);
+            len = 4;
+        }
+
+        if (n + len >= size) break;
+        memcpy(buf + n, enc, len);
+        n += len;
+    }
+
+    buf[n] = '\0';
+    return n;
+}
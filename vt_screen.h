@@ -0,0 +1,63 @@
+#ifndef VT_SCREEN_H
+#define VT_SCREEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Minimal in-process model of a VT100/xterm screen.
+ *
+ * Understands the subset of escape sequences the clock renderer emits
+ * (cursor positioning and movement, erase, SGR colours, scroll regions and
+ * a handful of DEC private modes), so rendered output can be inspected
+ * without a real terminal.
+ */
+
+#define VT_COLOR_DEFAULT (-1)
+
+typedef struct {
+    uint32_t ch;        // Unicode code point, ' ' for a blank cell
+    int8_t fg;          // Foreground colour index 0-15, or VT_COLOR_DEFAULT
+    int8_t bg;          // Background colour index 0-15, or VT_COLOR_DEFAULT
+} vt_cell_t;
+
+#define VT_MAX_PARAMS 16
+
+typedef struct {
+    int width;                  // Columns
+    int height;                 // Rows
+    vt_cell_t *cells;           // width * height cells, row-major
+
+    int row, col;               // Cursor position, 0-based
+    bool wrap_pending;          // Cursor sits past the last column
+    int8_t fg, bg;              // Current SGR colours
+    int saved_row, saved_col;   // Saved cursor (ESC 7 / CSI s)
+    int top, bottom;            // Scroll region, 0-based inclusive
+    bool cursor_visible;        // DEC mode 25
+    bool synchronized;          // DEC mode 2026: updates held back until reset
+
+    // Escape sequence parser
+    int state;
+    int params[VT_MAX_PARAMS];
+    int nparams;
+    char private_marker;
+    char intermediate;
+    uint32_t utf8_cp;
+    int utf8_remaining;
+
+    // Statistics
+    unsigned long bytes;        // Bytes fed into the model
+    unsigned long unknown;      // Sequences the model did not understand
+    unsigned long presents;     // Synchronized updates completed
+} vt_screen_t;
+
+bool vt_screen_init(vt_screen_t *s, int width, int height);
+void vt_screen_free(vt_screen_t *s);
+void vt_screen_reset(vt_screen_t *s);
+void vt_screen_feed(vt_screen_t *s, const char *data, size_t len);
+
+const vt_cell_t *vt_screen_cell(const vt_screen_t *s, int row, int col);
+size_t vt_screen_row_text(const vt_screen_t *s, int row, char *buf, size_t size);
+
+#endif /* VT_SCREEN_H */